@@ -0,0 +1,83 @@
+#ifndef BUFFERPOOL_HPP_
+#define BUFFERPOOL_HPP_
+
+#include <cstddef>
+#include <array>
+#include <vector>
+
+
+/* BufferPool -- per-thread slab pool of message buffers.
+ * Requests are rounded up to one of the size classes and served from a
+ * thread local free list. Blocks may be released on any thread, they are
+ * simply cached by the releasing thread. Requests larger than the biggest
+ * class go straight to the heap. */
+/* ------------------------------------------------------------------------- */
+class BufferPool
+{
+public:
+    enum { ClassCount = 4 };
+
+    struct Stats
+    {
+        std::size_t     heap_allocations;   // blocks taken from the heap
+        std::size_t     pool_allocations;   // blocks served from a free list
+        std::size_t     releases;           // blocks returned to the pool
+        std::size_t     oversize;           // requests above the largest class
+    };
+
+    static void* allocate( std::size_t size );
+    static void deallocate( void* block, std::size_t size );
+
+    /* statistics of the calling thread */
+    static const Stats& stats();
+    static void reset_stats();
+
+    static std::size_t class_size( std::size_t index )
+        { return s_class_sizes_[index]; }
+
+    ~BufferPool();
+
+private:
+    BufferPool();
+    static BufferPool& local();
+    static std::size_t class_index( std::size_t size );
+
+private:
+    std::array< std::vector<void*>, ClassCount >    free_lists_;
+    Stats                                           stats_;
+
+    static const std::array< std::size_t, ClassCount >  s_class_sizes_;
+    static const std::array< std::size_t, ClassCount >  s_class_limits_;
+};
+/* ------------------------------------------------------------------------- */
+
+
+/* PoolAllocator -- std allocator drawing from the calling thread's pool */
+/* ------------------------------------------------------------------------- */
+template< typename T >
+class PoolAllocator
+{
+public:
+    typedef T   value_type;
+
+    PoolAllocator() = default;
+    template< typename U >
+    PoolAllocator( const PoolAllocator<U>& ) { }
+
+    T* allocate( std::size_t n )
+        { return static_cast<T*>( BufferPool::allocate( n * sizeof(T) ) ); }
+
+    void deallocate( T* p, std::size_t n )
+        { BufferPool::deallocate( p, n * sizeof(T) ); }
+};
+
+template< typename T, typename U >
+bool operator==( const PoolAllocator<T>&, const PoolAllocator<U>& )
+    { return true; }
+
+template< typename T, typename U >
+bool operator!=( const PoolAllocator<T>&, const PoolAllocator<U>& )
+    { return false; }
+/* ------------------------------------------------------------------------- */
+
+#endif /* BUFFERPOOL_HPP_ */
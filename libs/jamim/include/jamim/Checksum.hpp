@@ -0,0 +1,61 @@
+#ifndef CHECKSUM_HPP_
+#define CHECKSUM_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+
+/* CRC32C (Castagnoli) of `bytes` appended to data whose CRC is `crc`;
+ * start with 0. Streams: crc32c( crc32c( 0, a ), b ) is the CRC of a
+ * followed by b. Uses the SSE4.2 crc32 instruction where the CPU has it,
+ * three streams at a time, and a slicing-by-8 table otherwise. */
+std::uint32_t crc32c( std::uint32_t crc, const void* data, std::size_t bytes );
+/* the table implementation, whatever the CPU */
+std::uint32_t crc32c_portable( std::uint32_t crc, const void* data, std::size_t bytes );
+/* true when crc32c() runs on the crc32 instruction */
+bool crc32c_hardware();
+/* CRC of a followed by b from crc_a, and crc_b of the `bytes_b` of b */
+std::uint32_t crc32c_combine( std::uint32_t crc_a, std::uint32_t crc_b
+                            , std::uint64_t bytes_b );
+
+
+/* BlockChecksums -- CRC32C of a byte stream per fixed size block and as a
+ * whole, fed in chunks of any size as the bytes go by. Every byte is
+ * hashed once; the whole stream CRC is combined from the blocks. Only the
+ * block being filled is kept: update() stops at its end, end_block()
+ * hands its CRC out and starts the next one. */
+/* ------------------------------------------------------------------------- */
+class BlockChecksums
+{
+public:
+    explicit BlockChecksums( std::size_t block );
+
+    /* start over; the stream continues data whose CRC is `prefix` */
+    void reset( std::uint32_t prefix = 0 );
+    /* hashes at most block_left() bytes, returns how many */
+    std::size_t update( const void* data, std::size_t bytes );
+    /* the CRC of the current block, complete or short, which is done */
+    std::uint32_t end_block();
+
+    std::size_t block_left() const
+        { return block_ - filled_; }
+    std::size_t block_filled() const
+        { return filled_; }
+    /* the prefix followed by every byte so far */
+    std::uint32_t whole() const;
+    std::uint64_t bytes() const
+        { return bytes_; }
+    std::size_t block() const
+        { return block_; }
+
+private:
+    std::size_t                 block_;
+    std::uint32_t               current_;
+    std::size_t                 filled_;
+    // the prefix and the complete blocks
+    std::uint32_t               completed_;
+    std::uint64_t               bytes_;
+};
+/* ------------------------------------------------------------------------- */
+
+#endif /* CHECKSUM_HPP_ */
@@ -0,0 +1,75 @@
+#ifndef CHUNKSIZER_HPP_
+#define CHUNKSIZER_HPP_
+
+#include <cstddef>
+#include <chrono>
+
+
+/* ChunkLimits -- bounds of the chunk a file transfer moves per read/write.
+ *  period: when the connection's round trip time is unknown, a chunk
+ *          aims to carry this much transfer time */
+/* ------------------------------------------------------------------------- */
+struct ChunkLimits
+{
+    ChunkLimits( std::size_t min = 64 << 10
+               , std::size_t max = 4 << 20
+               , std::size_t initial = 256 << 10
+               , std::chrono::microseconds period = std::chrono::milliseconds( 10 ) )
+        : min( min )
+        , max( max )
+        , initial( initial )
+        , period( period )
+        { }
+
+    std::size_t                 min;
+    std::size_t                 max;
+    std::size_t                 initial;
+    std::chrono::microseconds   period;
+};
+/* ------------------------------------------------------------------------- */
+
+
+/* ChunkSizer -- chunk size that follows the bandwidth-delay product.
+ * Every completed chunk updates a smoothed throughput, the next chunk is
+ * throughput * round trip time, rounded up to whole pages and kept within
+ * the limits. Not thread safe, one transfer direction owns it. */
+/* ------------------------------------------------------------------------- */
+class ChunkSizer
+{
+public:
+    typedef std::chrono::steady_clock   clock;
+
+    explicit ChunkSizer( const ChunkLimits& limits = ChunkLimits() );
+
+    /* start over with the initial chunk */
+    void reset();
+    /* `bytes` moved in `elapsed` */
+    void record( std::size_t bytes, clock::duration elapsed );
+    /* smoothed round trip time of the connection, 0 if unknown */
+    void rtt( std::chrono::microseconds rtt );
+
+    std::size_t chunk() const
+        { return chunk_; }
+    /* bytes per second, 0 before the first record */
+    double throughput() const
+        { return throughput_; }
+    const ChunkLimits& limits() const
+        { return limits_; }
+
+private:
+    void resize();
+
+private:
+    ChunkLimits                 limits_;
+    std::size_t                 chunk_;
+    double                      throughput_;
+    std::chrono::microseconds   rtt_;
+};
+/* ------------------------------------------------------------------------- */
+
+
+/* the kernel's smoothed round trip time of a connected TCP socket, 0 where
+ * it is not available */
+std::chrono::microseconds tcp_rtt( int fd );
+
+#endif /* CHUNKSIZER_HPP_ */
@@ -1,133 +1,345 @@
-/* Client -- synchronous server query */
-#ifndef CLIENT_HPP_
-#define CLIENT_HPP_
-
-#include <iostream>
-#include <fstream>
-#include <unordered_map>
-#include <boost/array.hpp>
-#include <boost/asio.hpp>
-#include <boost/thread.hpp>
-#include <boost/filesystem.hpp>
-#include "Message.hpp"
-
-/* ------------------------------------------------------------------------- */
-
-/* ------------------------------------------------------------------------- */
-
-/* Client */
-/* ------------------------------------------------------------------------- */
-class Client
-{
-public:
-    typedef void (Client::*Handler)( const boost::system::error_code&
-                                   , std::size_t );
-
-    Client( boost::asio::io_service& io_service
-          , boost::asio::ip::tcp::resolver::iterator  endpoint_iterator
-          , boost::asio::io_service& io_file_service
-          , boost::asio::ip::tcp::resolver::iterator file_endpoint_iterator )
-        : io_service_( io_service )
-        , io_file_service_( io_file_service )
-        , io_strand_( io_service )
-        , io_file_strand_( io_service )
-        , socket_( io_service )
-        , file_socket_( io_service )
-        {
-            do_connect( endpoint_iterator );
-            do_file_connect( file_endpoint_iterator );
-        }
-
-    void write( const Message& msg );
-    void start_file( const Message& msg );
-    void close( );
-
-private:
-/* connecting */
-    void do_connect( boost::asio::ip::tcp::resolver::iterator endpoint_iterator );
-    void handle_connect( const boost::system::error_code& ec
-                       , boost::asio::ip::tcp::resolver::iterator /* it */ );
-
-    void do_file_connect( boost::asio::ip::tcp::resolver::iterator endpoint_iterator );
-    void handle_file_connect( const boost::system::error_code& ec
-                        , boost::asio::ip::tcp::resolver::iterator /* it */ );
-
-/* general communication */
-    void do_read_header();
-    void handle_read_header(const boost::system::error_code& ec
-                           , std::size_t /*length*/);
-
-    void do_read_body();
-
-    void handle_chat_message(const boost::system::error_code& ec
-                            , std::size_t /*length*/);
-
-    void handle_empty(const boost::system::error_code& ec
-                     , std::size_t /*length*/);
-    
-    void handle_quit(const boost::system::error_code& ec
-                    , std::size_t /*length*/);
-
-    void handle_unknown(const boost::system::error_code& /*ec*/
-                       , std::size_t /*length*/);
-
-    void do_write();
-    void handle_write(const boost::system::error_code& ec
-                     , std::size_t /*length*/);
-
-    void handle_error( const boost::system::error_code& ec );
-
-/* file transfer */
-    void do_start_file();
-
-    void do_file_send_start();
-    void handle_file_send_start( const boost::system::error_code& ec
-                               , std::size_t /*length*/);
-    
-    void do_file_send();
-    void handle_file_send( const boost::system::error_code& ec
-                         , std::size_t /*length*/);
-
-    void handle_file_read_start( const boost::system::error_code& ec
-                               , std::size_t /*length*/);
-                               
-    void do_file_read();
-    void handle_file_read( const boost::system::error_code& ec
-                         , std::size_t /*length*/);
-
-    void do_file_read_done();
-
-    void handle_file_done( const boost::system::error_code& ec
-                         , std::size_t /*length*/);
-
-    void handle_file_cancel( const boost::system::error_code& ec
-                           , std::size_t /*length*/);
- 
-     void handle_file_cancel_all( const boost::system::error_code& ec
-                                , std::size_t /*length*/);
-
-    void handle_file_send_error();
-    void handle_file_read_error();
-private:
-    boost::asio::io_service&               io_service_;
-    boost::asio::io_service&               io_file_service_;
-    boost::asio::strand                    io_strand_;
-    boost::asio::strand                    io_file_strand_;
-    boost::asio::ip::tcp::socket           socket_;
-    boost::asio::ip::tcp::socket           file_socket_;
-    Message                                read_msg_;
-    Message                                file_msg_;
-    std::ifstream                          send_file_;
-    std::ofstream                          read_file_;
-    std::array<char, 4096>                 send_file_buf_;
-    std::array<char, 4096>                 read_file_buf_;
-    uint32_t                               read_file_size_;
-    std::deque< Message >                  write_msg_queue_;
-    std::deque< boost::filesystem::path >  file_queue_;
-
-    static const std::unordered_map<MessageType, Handler>  s_handler_map_;
-
-}; //Client
-/* ------------------------------------------------------------------------- */
-
-#endif /* CLIENT_HPP_ */
+/* Client -- synchronous server query */
+#ifndef CLIENT_HPP_
+#define CLIENT_HPP_
+
+#include <iostream>
+#include <fstream>
+#include <array>
+#include <deque>
+#include <memory>
+#include <map>
+#include <unordered_map>
+#include <boost/array.hpp>
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+#include <boost/filesystem.hpp>
+#include "Message.hpp"
+#include "FrameReader.hpp"
+#include "WriteBatch.hpp"
+#include "Dispatch.hpp"
+#include "FileSender.hpp"
+#include "FileSink.hpp"
+#include "FileCheckpoint.hpp"
+#include "Checksum.hpp"
+#include "ChunkSizer.hpp"
+
+/* ------------------------------------------------------------------------- */
+
+/* ------------------------------------------------------------------------- */
+
+/* Client */
+/* ------------------------------------------------------------------------- */
+class Client
+{
+public:
+    typedef void (Client::*Handler)( const boost::system::error_code&
+                                   , std::size_t );
+    typedef DispatchTable< Handler >    HandlerTable;
+
+    /* sent files kept to answer FileResend, ranges asked for at a time */
+    enum { SentFilesKept = 16, RepairBatch = 8, RepairRetries = 3 };
+
+    Client( boost::asio::io_service& io_service
+          , boost::asio::ip::tcp::resolver::iterator  endpoint_iterator
+          , boost::asio::io_service& io_file_service
+          , boost::asio::ip::tcp::resolver::iterator file_endpoint_iterator )
+        : io_service_( io_service )
+        , io_file_service_( io_file_service )
+        , io_strand_( io_service )
+        , io_file_strand_( io_file_service )
+        , socket_( io_service )
+        , file_socket_( io_file_service )
+        , send_frame_current_( 0 )
+        , send_frame_next_( false )
+        , send_writing_( false )
+        , sendfile_left_( 0 )
+        , sendfile_chunk_( FileSender::DefaultChunk )
+        , read_file_current_( 0 )
+        , read_header_filled_( 0 )
+        , read_chunk_left_( 0 )
+        , sink_mode_( FileSink::Pwrite )
+        {
+            do_connect( endpoint_iterator );
+            do_file_connect( file_endpoint_iterator );
+        }
+
+    void write( const Message& msg );
+    void start_file( const Message& msg );
+    void close( );
+    void max_frame_size( std::size_t size )
+        { reader_.max_frame_size( size ); }
+    /* bytes handed to sendfile() per writable wait, 0 sends files through
+     * the stream path */
+    void sendfile_chunk( std::size_t bytes )
+        { sendfile_chunk_ = bytes; }
+    /* how received files are written to disk */
+    void file_sink_mode( FileSink::Mode mode )
+        { sink_mode_ = mode; }
+    /* bounds of the chunks the stream paths read and write */
+    void chunk_limits( const ChunkLimits& limits )
+        {
+            send_sizer_ = ChunkSizer( limits );
+            read_sizer_ = ChunkSizer( limits );
+        }
+
+private:
+/* connecting */
+    void do_connect( boost::asio::ip::tcp::resolver::iterator endpoint_iterator );
+    void handle_connect( const boost::system::error_code& ec
+                       , boost::asio::ip::tcp::resolver::iterator /* it */ );
+
+    void do_file_connect( boost::asio::ip::tcp::resolver::iterator endpoint_iterator );
+    void handle_file_connect( const boost::system::error_code& ec
+                        , boost::asio::ip::tcp::resolver::iterator /* it */ );
+
+/* general communication */
+    void do_read();
+    void handle_read( const boost::system::error_code& ec
+                    , std::size_t bytes_transferred );
+
+    void handle_chat_message(const boost::system::error_code& ec
+                            , std::size_t /*length*/);
+
+    void handle_empty(const boost::system::error_code& ec
+                     , std::size_t /*length*/);
+    
+    void handle_quit(const boost::system::error_code& ec
+                    , std::size_t /*length*/);
+
+    void handle_unknown(const boost::system::error_code& /*ec*/
+                       , std::size_t /*length*/);
+
+    void do_write();
+    void handle_write(const boost::system::error_code& ec
+                     , std::size_t /*length*/);
+
+    void handle_error( const boost::system::error_code& ec );
+
+/* file transfer */
+    /* a file this client is sending, from its FileStart until its last
+     * checksum is written; file strand only */
+    struct FileSend
+    {
+        enum Phase { Awaiting, Preamble, Data, Checksum };
+
+        FileSend( uint64_t id, const boost::filesystem::path& path, uint64_t size )
+            : id( id )
+            , path( path )
+            , size( size )
+            , start( 0 )
+            , unread( 0 )
+            , prefix_crc( 0 )
+            , checksums( FileTrailer::BlockLength )
+            , phase( Awaiting )
+            , cancelled( false )
+            , paused( false )
+            , waiting( false )
+            { }
+
+        const uint64_t              id;
+        const boost::filesystem::path  path;
+        // announced in FileStart, exactly this much is sent even if the
+        // file changes meanwhile
+        const uint64_t              size;
+        // the offset the readers resume from, and what is still to be read
+        uint64_t                    start;
+        uint64_t                    unread;
+        // checksums of what is sent, resumed prefix included
+        uint32_t                    prefix_crc;
+        BlockChecksums              checksums;
+        // sendfile() where it works, the stream otherwise
+        FileSender                  sender;
+        std::ifstream               file;
+        Phase                       phase;
+        bool                        cancelled;
+        // the server holds its chunks until its readers catch up; waiting
+        // once it is out of send_ready_ for that
+        bool                        paused;
+        bool                        waiting;
+    };
+    typedef std::shared_ptr< FileSend >     ptr_FileSend;
+
+    /* a chunk on its way to the file socket: the header and the bytes
+     * copied after it, then `sendfile` bytes of the file */
+    struct SendFrame
+    {
+        ptr_FileSend                send;
+        std::vector<char>           data;
+        std::size_t                 sendfile;
+        bool                        last;
+    };
+
+    /* a file this client is receiving; file strand only */
+    struct FileRead
+    {
+        enum Phase { Preamble, Data, BlockCrc, FileCrc };
+
+        FileRead( uint64_t id, uint64_t size )
+            : id( id )
+            , size( size )
+            , received( 0 )
+            , start( 0 )
+            , offer( id )
+            , checksums( FileTrailer::BlockLength )
+            , preamble_filled( 0 )
+            , crc_filled( 0 )
+            , phase( Preamble )
+            { }
+
+        const uint64_t              id;
+        const uint64_t              size;
+        uint64_t                    received;
+        uint64_t                    start;
+        std::string                 path;
+        // what is offered for a resume, and the checkpoint kept meanwhile
+        FileResume                  offer;
+        FileCheckpoint              checkpoint;
+        FileSink                    sink;
+        std::ofstream               file;
+        // checksums of what arrives, each block checked against the
+        // sender's as it completes
+        BlockChecksums              checksums;
+        std::array< uint8_t, FileResume::PreambleLength >  preamble;
+        std::size_t                 preamble_filled;
+        std::array< uint8_t, FileTrailer::CrcLength >  crc;
+        std::size_t                 crc_filled;
+        Phase                       phase;
+    };
+    typedef std::shared_ptr< FileRead >     ptr_FileRead;
+
+    void do_file_send_start( const boost::filesystem::path& path );
+    void handle_file_accept( const boost::system::error_code& ec
+                           , std::size_t /*length*/);
+    void do_file_accept( const FileResume& offer );
+    uint64_t resume_offset( FileSend& send, const FileResume& offer );
+    void handle_file_refuse( const boost::system::error_code& ec
+                           , std::size_t /*length*/);
+    void do_file_refuse( uint64_t transfer_id );
+
+    /* the chunks of all files being sent, in turn */
+    bool prepare_send_frame( SendFrame& frame );
+    void do_file_send();
+    void handle_file_send( const boost::system::error_code& ec
+                         , std::size_t length );
+    void do_file_sendfile();
+    void handle_file_sendfile( const boost::system::error_code& ec );
+    void finish_send_frame();
+    void do_file_send_done( const ptr_FileSend& send );
+
+    void handle_file_resend( const boost::system::error_code& ec
+                           , std::size_t /*length*/);
+    void do_file_resend( const Message& msg );
+
+    void handle_file_read_start( const boost::system::error_code& ec
+                               , std::size_t /*length*/);
+    void do_file_read_start( const ptr_FileRead& read );
+
+    /* the chunks of all files being received */
+    void do_file_read();
+    void handle_file_read( const boost::system::error_code& ec
+                         , std::size_t /*length*/);
+    void read_file_chunk( const ptr_FileRead& read, const char* data
+                        , std::size_t bytes );
+    bool handle_file_read_preamble( FileRead& read );
+
+    bool write_file_chunk( FileRead& read, const char* data, std::size_t bytes );
+    bool rewrite_file_block( FileRead& read, const uint8_t* data, std::size_t bytes
+                           , uint64_t offset );
+    void store_checkpoint( FileRead& read );
+    void handle_file_read_block( const ptr_FileRead& read );
+    void handle_file_read_end( const ptr_FileRead& read );
+    bool close_read_file( FileRead& read );
+    void do_file_read_done( const ptr_FileRead& read );
+
+    void request_repairs( uint64_t transfer_id );
+    void handle_file_repair( const boost::system::error_code& ec
+                           , std::size_t /*length*/);
+    void do_file_repair( const Message& msg );
+    void do_file_repaired( uint64_t transfer_id );
+
+    void handle_file_pause( const boost::system::error_code& ec
+                          , std::size_t /*length*/);
+    void handle_file_continue( const boost::system::error_code& ec
+                             , std::size_t /*length*/);
+    void do_file_pause( uint64_t transfer_id, bool paused );
+
+    void handle_file_done( const boost::system::error_code& ec
+                         , std::size_t /*length*/);
+
+    void handle_file_cancel( const boost::system::error_code& ec
+                           , std::size_t /*length*/);
+    void do_file_cancel( uint64_t transfer_id, const std::string& reason );
+ 
+     void handle_file_cancel_all( const boost::system::error_code& ec
+                                , std::size_t /*length*/);
+
+    void handle_file_send_error( const ptr_FileSend& send );
+    void handle_file_read_error( const ptr_FileRead& read );
+private:
+    boost::asio::io_service&               io_service_;
+    boost::asio::io_service&               io_file_service_;
+    boost::asio::strand                    io_strand_;
+    boost::asio::strand                    io_file_strand_;
+    boost::asio::ip::tcp::socket           socket_;
+    boost::asio::ip::tcp::socket           file_socket_;
+    FrameReader                            reader_;
+    MessageView                            read_msg_;
+    // the files being sent by transfer id, and those with a chunk to send
+    // next, in turn
+    std::unordered_map< uint64_t, ptr_FileSend >  file_sends_;
+    std::deque< uint64_t >                 send_ready_;
+    // one frame is written to the socket while the next is read from disk
+    std::array< SendFrame, 2 >             send_frames_;
+    std::size_t                            send_frame_current_;
+    bool                                   send_frame_next_;
+    bool                                   send_writing_;
+    std::size_t                            sendfile_left_;
+    // what readers can still ask to be sent again
+    struct SentFile
+    {
+        uint64_t                transfer_id;
+        boost::filesystem::path path;
+        uint64_t                size;
+    };
+    std::deque< SentFile >                 sent_files_;
+    std::size_t                            sendfile_chunk_;
+    ChunkSizer                             send_sizer_;
+    ChunkSizer::clock::time_point          send_file_started_;
+    // the files being received by transfer id; the socket fills one buffer
+    // while the chunks in the other go to disk
+    std::unordered_map< uint64_t, ptr_FileRead >  file_reads_;
+    std::array< std::vector<char>, 2 >     read_file_bufs_;
+    std::size_t                            read_file_current_;
+    // the chunk being read, null when it is skipped
+    std::array< uint8_t, FileChunkHeader::Length >  read_header_;
+    std::size_t                            read_header_filled_;
+    ptr_FileRead                           read_chunk_file_;
+    std::size_t                            read_chunk_left_;
+    // files received with corrupted blocks, from the first one found until
+    // all of them are sent again; only the bad blocks' CRCs are kept
+    struct PendingRepair
+    {
+        std::string             path;
+        uint64_t                start;
+        uint64_t                size;
+        // block number and the sender's CRC of it
+        std::deque< std::pair< uint64_t, uint32_t > >  pending;
+        std::map< uint64_t, uint32_t >  requested;
+        std::size_t             repaired;
+        std::size_t             retries;
+        // the whole stream is in, the file closed
+        bool                    finished;
+    };
+    std::unordered_map< uint64_t, PendingRepair >  read_repairs_;
+    FileSink::Mode                         sink_mode_;
+    ChunkSizer                             read_sizer_;
+    ChunkSizer::clock::time_point          read_file_started_;
+    std::deque< Message >                  write_msg_queue_;
+    WriteBatch                             write_batch_;
+
+    static const HandlerTable  s_handler_table_;
+
+}; //Client
+/* ------------------------------------------------------------------------- */
+
+#endif /* CLIENT_HPP_ */
@@ -0,0 +1,58 @@
+#ifndef DISPATCH_HPP_
+#define DISPATCH_HPP_
+
+#include <cstddef>
+#include "Message.hpp"
+
+
+/* DispatchTable -- one handler slot for every possible MessageType byte */
+/* ------------------------------------------------------------------------- */
+template< typename Handler >
+struct DispatchTable
+{
+    enum { Size = 256 };
+
+    constexpr Handler operator[]( MessageType type ) const
+        { return handlers_[type]; }
+
+    Handler     handlers_[Size];
+};
+/* ------------------------------------------------------------------------- */
+
+
+/* Dispatch -- builds a DispatchTable at compile time from a type list of
+ * message kinds:
+ *
+ *  constexpr Table table = Dispatch<Handler>::make_table< &X::handle_unknown
+ *      , Dispatch<Handler>::On< MessageType::ChatMsg, &X::handle_chat >
+ *      , ... >();
+ *
+ * Every type without an entry maps to the default handler. */
+/* ------------------------------------------------------------------------- */
+template< typename Handler >
+struct Dispatch
+{
+    typedef DispatchTable< Handler >    table_type;
+
+    template< MessageType Type, Handler H >
+    struct On
+    {
+        static constexpr MessageType    type = Type;
+        static constexpr Handler        handler = H;
+    };
+
+    template< Handler Default, typename... Kinds >
+    static constexpr table_type make_table()
+        {
+            table_type table{};
+            for( std::size_t i=0; i<table_type::Size; ++i ){
+                table.handlers_[i] = Default;
+            }
+            int expand[] = { 0, ( table.handlers_[Kinds::type] = Kinds::handler, 0 )... };
+            static_cast<void>( expand );
+            return table;
+        }
+};
+/* ------------------------------------------------------------------------- */
+
+#endif /* DISPATCH_HPP_ */
@@ -0,0 +1,62 @@
+#ifndef FILECHECKPOINT_HPP_
+#define FILECHECKPOINT_HPP_
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+
+/* FileCheckpoint -- record kept next to a partially received file: the
+ * transfer it belongs to and how much of it arrived intact. Rewritten in
+ * place as the file grows and removed once it is complete, so a dropped
+ * transfer can be resumed instead of started over. */
+/* ------------------------------------------------------------------------- */
+class FileCheckpoint
+{
+public:
+    struct Record
+    {
+        Record()
+            : transfer_id( 0 )
+            , size( 0 )
+            , received( 0 )
+            , crc( 0 )
+            { }
+
+        std::uint64_t   transfer_id;
+        std::uint64_t   size;
+        std::uint64_t   received;
+        // CRC32C of the `received` bytes
+        std::uint32_t   crc;
+    };
+
+    enum { RecordLength = 32 };
+
+    /* where the record of `file` is kept */
+    static std::string path_of( const std::string& file )
+        { return file + ".jamim-resume"; }
+
+    /* false when `file` has no valid record */
+    static bool load( const std::string& file, Record& record );
+
+    FileCheckpoint() = default;
+    FileCheckpoint( const FileCheckpoint& ) = delete;
+    FileCheckpoint& operator=( const FileCheckpoint& ) = delete;
+
+    /* start the record of `file`, replacing any previous one */
+    bool open( const std::string& file );
+    bool store( const Record& record );
+    /* stop updating, the record stays for a later resume */
+    void close();
+    /* the file is complete, drop the record */
+    void remove();
+    bool is_open() const
+        { return out_.is_open(); }
+
+private:
+    std::ofstream   out_;
+    std::string     path_;
+};
+/* ------------------------------------------------------------------------- */
+
+#endif /* FILECHECKPOINT_HPP_ */
@@ -0,0 +1,62 @@
+#ifndef FILESENDER_HPP_
+#define FILESENDER_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <boost/system/error_code.hpp>
+
+
+/* FileSender -- file sent to a socket with sendfile(), so its bytes never
+ * enter user space. Linux only; elsewhere open() fails and callers keep to
+ * the stream path. The file is mapped as well, for checksums of what is
+ * sent that read the page cache instead of copying it.
+ * send_to() moves at most `bytes` from the current offset and returns how
+ * many it did move. A call that would block sets ec to would_block, a call
+ * past the end of the file sets eof. */
+/* ------------------------------------------------------------------------- */
+class FileSender
+{
+public:
+    /* bytes moved per send_to() by callers that do not choose */
+    enum { DefaultChunk = 1 << 20 };
+
+    FileSender();
+    ~FileSender();
+
+    FileSender( const FileSender& ) = delete;
+    FileSender& operator=( const FileSender& ) = delete;
+
+    /* sends no more than `limit` bytes of the file, and fails if the file
+     * is shorter */
+    bool open( const std::string& path
+             , std::uint64_t limit = std::numeric_limits<std::uint64_t>::max() );
+    void close();
+    bool is_open() const
+        { return fd_ != -1; }
+    /* continue from `offset`, false past the limit */
+    bool seek( std::uint64_t offset );
+
+    std::uint64_t size() const
+        { return size_; }
+    std::uint64_t offset() const
+        { return offset_; }
+    std::uint64_t remaining() const
+        { return size_ - offset_; }
+    /* the `size()` bytes sent, nullptr for an empty file */
+    const char* view() const
+        { return view_; }
+
+    std::size_t send_to( int fd, std::size_t bytes
+                       , boost::system::error_code& ec );
+
+private:
+    int             fd_;
+    const char*     view_;
+    std::uint64_t   size_;
+    std::uint64_t   offset_;
+};
+/* ------------------------------------------------------------------------- */
+
+#endif /* FILESENDER_HPP_ */
@@ -0,0 +1,79 @@
+#ifndef FILESINK_HPP_
+#define FILESINK_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <boost/system/error_code.hpp>
+
+
+/* FileSink -- file of a known size written front to back.
+ * The whole size is allocated when the file is opened, so a large receive
+ * does not fragment the file system.
+ *  Pwrite: pwrite() every chunk at the current offset
+ *  Mmap:   copy the chunks into the file mapped in one piece
+ *  Direct: O_DIRECT writes of whole blocks staged in an aligned buffer,
+ *          bypassing the page cache; the unaligned tail is written on
+ *          close(). Falls back to Pwrite where O_DIRECT is refused
+ * Linux only; elsewhere open() fails and callers keep to a stream. */
+/* ------------------------------------------------------------------------- */
+class FileSink
+{
+public:
+    enum Mode { Pwrite, Mmap, Direct };
+
+    FileSink();
+    ~FileSink();
+
+    FileSink( const FileSink& ) = delete;
+    FileSink& operator=( const FileSink& ) = delete;
+
+    /* creates or truncates `path`; with `keep` its content stays for a
+     * resume, see seek() */
+    bool open( const std::string& path, std::uint64_t size, Mode mode = Pwrite
+             , bool keep = false );
+    /* continue writing at `offset`, before the first write */
+    void seek( std::uint64_t offset, boost::system::error_code& ec );
+    /* flushes what is staged and trims the file to the bytes written */
+    void close( boost::system::error_code& ec );
+    bool is_open() const
+        { return fd_ != -1; }
+
+    /* append `bytes`; more than the announced size sets ec to
+     * message_size */
+    void write( const char* data, std::size_t bytes
+              , boost::system::error_code& ec );
+    /* overwrite `bytes` already written at `offset`, staged or not; past
+     * written() sets ec to message_size */
+    void rewrite( const char* data, std::size_t bytes, std::uint64_t offset
+                , boost::system::error_code& ec );
+
+    Mode mode() const
+        { return mode_; }
+    std::uint64_t size() const
+        { return size_; }
+    /* bytes written so far */
+    std::uint64_t written() const
+        { return written_; }
+
+private:
+    void write_at( const char* data, std::size_t bytes, std::uint64_t offset
+                 , boost::system::error_code& ec );
+    void flush_direct( bool tail, boost::system::error_code& ec );
+    void release();
+
+private:
+    int             fd_;
+    Mode            mode_;
+    std::uint64_t   size_;
+    std::uint64_t   written_;
+    // Mmap
+    char*           map_;
+    // Direct: bytes staged at stage_offset_ in the file
+    char*           stage_;
+    std::size_t     staged_;
+    std::uint64_t   stage_offset_;
+};
+/* ------------------------------------------------------------------------- */
+
+#endif /* FILESINK_HPP_ */
@@ -0,0 +1,59 @@
+#ifndef FRAMEREADER_HPP_
+#define FRAMEREADER_HPP_
+
+#include <cstddef>
+#include <vector>
+#include <boost/asio.hpp>
+#include "Message.hpp"
+
+
+/* FrameReader -- buffered multi-frame reader.
+ * The socket is read with async_read_some into a ring buffer, then every
+ * complete frame present in the buffer is handed out as a MessageView
+ * pointing straight into the ring. A frame is only copied when it wraps
+ * around the end of the buffer. Frames larger than the ring grow it, up to
+ * the configured maximum frame size. */
+/* ------------------------------------------------------------------------- */
+class FrameReader
+{
+public:
+    enum { DefaultCapacity = 1 << 17, DefaultMaxFrameSize = 1 << 24 };
+
+    explicit FrameReader( std::size_t capacity = DefaultCapacity );
+
+    /* contiguous free space to read into */
+    boost::asio::mutable_buffers_1 prepare();
+    void commit( std::size_t bytes_transferred );
+
+    /* Extract the next complete frame. A view stays valid until the
+     * following call to next() or prepare(). A frame above the maximum
+     * size sets ec to message_size, a malformed header to bad_message. */
+    bool next( MessageView& view, boost::system::error_code& ec );
+
+    void max_frame_size( std::size_t size )
+        { max_frame_size_ = size; }
+    std::size_t max_frame_size() const
+        { return max_frame_size_; }
+
+    std::size_t size() const
+        { return tail_ - head_; }
+    std::size_t capacity() const
+        { return buffer_.size(); }
+
+private:
+    uint8_t byte_at( std::size_t offset ) const
+        { return buffer_[(head_ + offset) & mask_]; }
+    void grow( std::size_t frame_length );
+
+private:
+    std::vector<uint8_t>    buffer_;
+    std::size_t             mask_;
+    std::size_t             head_;
+    std::size_t             tail_;
+    std::size_t             initial_capacity_;
+    std::size_t             max_frame_size_;
+    std::vector< uint8_t, PoolAllocator<uint8_t> >  wrapped_frame_;
+};
+/* ------------------------------------------------------------------------- */
+
+#endif /* FRAMEREADER_HPP_ */
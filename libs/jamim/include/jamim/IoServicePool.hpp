@@ -0,0 +1,109 @@
+#ifndef IOSERVICEPOOL_HPP_
+#define IOSERVICEPOOL_HPP_
+
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+
+
+/* IoServicePool -- the server's execution model.
+ *  Shared:  one io_service run by N threads; handlers of a session are
+ *           serialised by its strands.
+ *  PerCore: N io_services with one thread each, the threads are pinned to
+ *           cores. A session lives on a single io_service, picked as the
+ *           one currently serving the fewest sessions.
+ * The pool keeps its io_services running until stop() even when they have
+ * no work. */
+/* ------------------------------------------------------------------------- */
+class IoServicePool
+{
+public:
+    enum Mode { Shared, PerCore };
+
+    /* Counts a session against the io_service it was placed on for as
+     * long as the lease is alive */
+    class Lease
+    {
+    public:
+        Lease()
+            : load_( nullptr )
+            { }
+        explicit Lease( std::atomic<std::size_t>* load )
+            : load_( load )
+            { ++*load_; }
+        Lease( Lease&& other )
+            : load_( other.load_ )
+            { other.load_ = nullptr; }
+        Lease& operator=( Lease&& other )
+            {
+                if( this != &other ){
+                    release();
+                    load_ = other.load_;
+                    other.load_ = nullptr;
+                }
+                return *this;
+            }
+        Lease( const Lease& ) = delete;
+        Lease& operator=( const Lease& ) = delete;
+        ~Lease()
+            { release(); }
+
+    private:
+        void release()
+            {
+                if( load_ ){
+                    --*load_;
+                    load_ = nullptr;
+                }
+            }
+
+    private:
+        std::atomic<std::size_t>*   load_;
+    };
+
+    IoServicePool( Mode mode, std::size_t threads );
+    ~IoServicePool();
+
+    IoServicePool( const IoServicePool& ) = delete;
+    IoServicePool& operator=( const IoServicePool& ) = delete;
+
+    /* the io_service running the acceptors */
+    boost::asio::io_service& acceptor_service()
+        { return *services_.front(); }
+
+    /* the least loaded io_service, and a lease accounting one session on it */
+    boost::asio::io_service& acquire( Lease& lease );
+
+    /* the io_services in turn, for work that is placed once and not
+     * accounted per session, e.g. chat rooms */
+    boost::asio::io_service& next_service()
+        { return *services_[ next_++ % services_.size() ]; }
+
+    void run();
+    void stop();
+    void join();
+
+    Mode mode() const
+        { return mode_; }
+    std::size_t thread_count() const
+        { return thread_count_; }
+    std::size_t size() const
+        { return services_.size(); }
+    std::size_t load( std::size_t index ) const
+        { return loads_[index]; }
+
+private:
+    const Mode                                                  mode_;
+    const std::size_t                                           thread_count_;
+    std::unique_ptr< std::atomic<std::size_t>[] >               loads_;
+    std::atomic<std::size_t>                                    next_;
+    std::vector< std::unique_ptr<boost::asio::io_service> >     services_;
+    std::vector< std::unique_ptr<boost::asio::io_service::work> > work_;
+    boost::thread_group                                         threads_;
+};
+/* ------------------------------------------------------------------------- */
+
+#endif /* IOSERVICEPOOL_HPP_ */
@@ -1,258 +1,584 @@
-#ifndef MESSAGE_HPP_
-#define MESSAGE_HPP_
-
-#include <iostream>
-#include <array>
-#include <vector>
-#include <string>
-#include <utility>
-#include <boost/asio.hpp>
-
-
-int dummy();
-
-
-inline uint16_t make_uint16( uint8_t msb, uint8_t lsb )
-{
-    return ( ( static_cast<uint16_t>( msb ) << 8 )
-             | static_cast<uint16_t>( lsb ) );
-}
-
-inline uint32_t make_uint32( uint8_t b31_24, uint8_t b23_16
-                           , uint8_t b15_8, uint8_t b7_0 )
-{
-    return ( (static_cast<uint16_t>(b31_24) << 24 )
-           | (static_cast<uint16_t>(b23_16) << 16 )
-           | (static_cast<uint16_t>(b15_8)  <<  8 )
-           | (static_cast<uint16_t>(b7_0) ) );
-}
-
-static const std::string QUIT_MSG{ "User has left the room." };
-static const std::string CANCEL_CURRENT_MSG{ "File transfer cancelled by the user." };
-static const std::string CANCEL_ALL_MSG{ "Files transfer cancelled by the user." };
-
-/* ------------------------------------------------------------------------- */
-using boost::uint32_t;
-using boost::uint16_t;
-using boost::uint8_t;
-using boost::int8_t;
-/* ------------------------------------------------------------------------- */
-
-/* ------------------------------------------------------------------------- */
-enum MessageType : uint8_t { EmptyMsg         = 0
-                           , ChatMsg          = 10
-                           , CmdQuit          = 20
-                           , CmdStartFile     = 30
-                           , CmdCancelCurrent = 40
-                           , CmdCancelAll     = 41
-                           , FileStart        = 60
-                           , FileAccept       = 61
-                           , FileRefuse       = 62
-                           , FileCancel       = 63
-                           , FileCancelAll    = 64
-                           , FileDone         = 65
-                           , Unknown          = 255
-                           };
-enum MessageSize : uint16_t { Empty = 0, Default = 4096 };
-/* ------------------------------------------------------------------------- */
-
-/* ------------------------------------------------------------------------- */
-class MessageHeader
-{
-public:
-    enum { type_offset = 0, length_msb_offset = 1, length_lsb_offset = 2 };
-    enum { HeaderLength = 3 };
-
-    typedef std::array<uint8_t,HeaderLength>                    self;
-    typedef std::array<uint8_t,HeaderLength>::iterator          iterator;
-    typedef std::array<uint8_t,HeaderLength>::const_iterator    const_iterator;
-
-
-    MessageHeader( MessageType type = MessageType::ChatMsg
-                 , uint16_t len = MessageSize::Empty )
-        {
-            header_[type_offset] = type;
-            header_[length_msb_offset] = static_cast<uint8_t>(len >> 8);
-            header_[length_lsb_offset] = static_cast<uint8_t>(len);
-        }
-
-    MessageHeader& operator=( std::pair<MessageType,uint16_t> type_len )
-        {
-            using std::swap;
-            MessageHeader temp(type_len.first, type_len.second);
-            swap( header_, temp.header_);
-            return *this;
-        }
-
-    size_t length() const
-        { return HeaderLength; }
-
-    self& data()
-        { return header_; }
-    const self& data() const
-        { return header_; }
-
-    MessageType msg_type() const
-        { return static_cast<MessageType>(header_[type_offset]); }
-
-    void msg_type( MessageType type )
-        { header_[type_offset] = type; }
-
-    uint16_t msg_length() const
-    {
-        return make_uint16( header_[length_msb_offset]
-                          , header_[length_lsb_offset] );
-    }
-
-    void msg_length( uint16_t len )
-    {
-        header_[length_msb_offset] = static_cast<uint8_t>(len >> 8);
-        header_[length_lsb_offset] = static_cast<uint8_t>(len);
-    }
-
-    uint8_t length_msb() const
-        { return header_[length_msb_offset]; }
-    uint8_t length_lsb() const
-        { return header_[length_lsb_offset]; }
-    
-    iterator begin()
-      { return header_.begin(); }
-    iterator end()
-        { return header_.end(); }
-    const_iterator begin() const
-        { return header_.cbegin(); }
-    const_iterator end() const
-        { return header_.cend(); }
-    const_iterator cbegin() const
-        { return header_.cbegin(); }
-    const_iterator cend() const
-        { return header_.cend(); }
-
-
-private:
-    std::array<uint8_t,HeaderLength>    header_;
-};
-/* ------------------------------------------------------------------------- */
-
-
-/* ------------------------------------------------------------------------- */
-class Message
-{
-public:
-    enum { filesize_offset_31=3, filesize_offset_23=4, filesize_offset_15=5,
-           filesize_offset_7=6, FileStartHeaderSize=7};
-
-    explicit Message( const MessageHeader& header )
-        : msg_body_( header.begin(), header.end() )
-        , header_( header )
-        {
-            msg_body_.resize( header.msg_length() + header.length() );
-        }
-
-    explicit Message( MessageHeader&& header )
-        : msg_body_( header.begin(), header.end() )
-        , header_( std::move(header) )
-        {
-            msg_body_.resize( header.msg_length() + header.length() );
-        }
-    
-    Message( MessageType type, const std::string& str );
-
-    Message( MessageType type = MessageType::ChatMsg
-           , uint16_t len = MessageSize::Empty )
-        : Message( MessageHeader(type, len) )
-        { }
-    
-
-    uint16_t header_length() const
-        { 
-            if( msg_type() == FileStart )
-                return FileStartHeaderSize;
-            else
-                return header_.length();
-        }
-
-    uint16_t body_length() const
-        { return header_.msg_length(); }
-
-    void body_length( uint16_t len )
-        { 
-            header_.msg_length( len );
-            msg_body_[MessageHeader::length_msb_offset] = header_.length_msb();
-            msg_body_[MessageHeader::length_lsb_offset] = header_.length_lsb();
-        }
-
-    uint32_t file_size() const
-        {
-            // only valid for FileStart
-            return make_uint32( msg_body_[filesize_offset_31]
-                              , msg_body_[filesize_offset_23]
-                              , msg_body_[filesize_offset_15]
-                              , msg_body_[filesize_offset_7] );
-        }
-
-    uint16_t total_length() const
-        { return msg_body_.size(); }
-
-    MessageType msg_type() const
-        { return header_.msg_type(); }
-
-    void msg_type( MessageType t )
-        { 
-            header_.msg_type( t );
-            msg_body_[MessageHeader::type_offset] = t;
-        }
-
-    uint8_t* msg_body()
-        { return msg_body_.data() + header_length(); }
-
-    const uint8_t* msg_body() const
-        { return msg_body_.data() + header_length(); }
-
-    uint8_t* data()
-        {
-            return msg_body_.data();
-        }
-
-    const uint8_t* data() const
-        {
-            return msg_body_.data();
-        }
-    
-    void sync()
-        {
-            header_ = MessageHeader( static_cast<MessageType>(msg_body_[MessageHeader::type_offset])
-                                  , make_uint16(msg_body_[MessageHeader::length_msb_offset]
-                                               ,msg_body_[MessageHeader::length_lsb_offset]
-                                               ));
-            msg_body_.resize( header_.length() + header_.msg_length() );
-        }
-
-    std::string data_to_string() const
-        { return std::string(msg_body_.cbegin(), msg_body_.cend() ); }
-    std::string body_to_string() const
-        { return std::string( msg_body(), msg_body() + body_length() ); }
-    
-/* friends */
-    friend std::ostream& operator<<( std::ostream& os, const Message& msg );
-    friend Message message_from_string( const std::string& str );
-    friend Message command_from_string( const std::string& str );
-    friend Message make_file_message( uint32_t file_size, const Message& msg );
-    friend Message make_file_message( uint32_t file_size
-                                    , const std::string& str );
-protected:
-    explicit Message( std::vector<uint8_t>&& body );
-private:
-    std::vector<uint8_t>    msg_body_;
-    MessageHeader           header_;
-
-    // static const std::unordered_map<MessageType,std::string> s_type_string_map_;
-};
-/* ------------------------------------------------------------------------- */
-
-Message message_from_string( const std::string& str );
-Message command_from_string( const std::string& str );
-Message make_file_message( uint32_t file_size, const Message& msg );
-Message make_file_message( uint32_t file_size, const std::string& str );
-
-#endif /* MESSAGE_HPP_ */
+#ifndef MESSAGE_HPP_
+#define MESSAGE_HPP_
+
+#include <iostream>
+#include <array>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <utility>
+#include <memory>
+#include <boost/asio.hpp>
+#include <boost/utility/string_view.hpp>
+#include "BufferPool.hpp"
+
+
+int dummy();
+
+
+inline uint16_t make_uint16( uint8_t msb, uint8_t lsb )
+{
+    return ( ( static_cast<uint16_t>( msb ) << 8 )
+             | static_cast<uint16_t>( lsb ) );
+}
+
+inline uint32_t make_uint32( uint8_t b31_24, uint8_t b23_16
+                           , uint8_t b15_8, uint8_t b7_0 )
+{
+    return ( (static_cast<uint32_t>(b31_24) << 24 )
+           | (static_cast<uint32_t>(b23_16) << 16 )
+           | (static_cast<uint32_t>(b15_8)  <<  8 )
+           | (static_cast<uint32_t>(b7_0) ) );
+}
+
+/* big endian, as written by put_uint64 */
+inline uint64_t make_uint64( const uint8_t* bytes )
+{
+    return ( static_cast<uint64_t>( make_uint32( bytes[0], bytes[1], bytes[2], bytes[3] ) ) << 32 )
+           | make_uint32( bytes[4], bytes[5], bytes[6], bytes[7] );
+}
+
+inline void put_uint32( uint8_t* bytes, uint32_t value )
+{
+    for( int i=0; i<4; ++i ){
+        bytes[i] = static_cast<uint8_t>( value >> (24 - 8*i) );
+    }
+}
+
+inline void put_uint64( uint8_t* bytes, uint64_t value )
+{
+    put_uint32( bytes, static_cast<uint32_t>( value >> 32 ) );
+    put_uint32( bytes + 4, static_cast<uint32_t>( value ) );
+}
+
+static const std::string QUIT_MSG{ "User has left the room." };
+static const std::string CANCEL_CURRENT_MSG{ "File transfer cancelled by the user." };
+static const std::string CANCEL_ALL_MSG{ "Files transfer cancelled by the user." };
+
+/* ------------------------------------------------------------------------- */
+using boost::uint64_t;
+using boost::uint32_t;
+using boost::uint16_t;
+using boost::uint8_t;
+using boost::int8_t;
+/* ------------------------------------------------------------------------- */
+
+/* ------------------------------------------------------------------------- */
+enum MessageType : uint8_t { EmptyMsg         = 0
+                           , ChatMsg          = 10
+                           , CmdQuit          = 20
+                           , CmdJoin          = 21
+                           , CmdPart          = 22
+                           , CmdStartFile     = 30
+                           , CmdCancelCurrent = 40
+                           , CmdCancelAll     = 41
+                           , FileStart        = 60
+                           , FileAccept       = 61
+                           , FileRefuse       = 62
+                           , FileCancel       = 63
+                           , FileCancelAll    = 64
+                           , FileDone         = 65
+                           , FileResend       = 66
+                           , FileRepair       = 67
+                           , FilePause        = 68
+                           , FileContinue     = 69
+                           , ExtendedFrame    = 254   // header format marker
+                           , Unknown          = 255
+                           };
+enum MessageSize : uint16_t { Empty = 0, Default = 4096 };
+/* ------------------------------------------------------------------------- */
+
+/* MessageHeader -- frame header in one of two formats:
+ *  compact:  [type][length 16 bit]                  - bodies up to 0xFFFF bytes
+ *  extended: [ExtendedFrame][type][length 32 bit]   - larger bodies
+ * The compact format is the original 3 byte header and is always used when
+ * the body fits, so peers only see the extended one for large frames. */
+/* ------------------------------------------------------------------------- */
+class MessageHeader
+{
+public:
+    enum { type_offset = 0, length_msb_offset = 1, length_lsb_offset = 2 };
+    enum { ext_type_offset = 1, ext_length_offset = 2 };
+    enum { HeaderLength = 3, ExtendedHeaderLength = 6 };
+    enum { MaxCompactLength = 0xFFFF };
+
+    typedef std::array<uint8_t,ExtendedHeaderLength>            self;
+    typedef self::iterator                                      iterator;
+    typedef self::const_iterator                                const_iterator;
+
+
+    MessageHeader( MessageType type = MessageType::ChatMsg
+                 , uint32_t len = MessageSize::Empty )
+        : header_()
+        {
+            encode( type, len );
+        }
+
+    MessageHeader& operator=( std::pair<MessageType,uint32_t> type_len )
+        {
+            encode( type_len.first, type_len.second );
+            return *this;
+        }
+
+    /* Header length of a frame whose first byte is `first_byte` */
+    static std::size_t length_of( uint8_t first_byte )
+        {
+            return ( first_byte == MessageType::ExtendedFrame ) ? ExtendedHeaderLength
+                                                                : HeaderLength;
+        }
+
+    /* An extended header must not carry the ExtendedFrame marker as its
+     * type: parsed, it would read as extended again, past the bytes it
+     * has. `data` must hold length_of( data[0] ) bytes */
+    static bool well_formed( const uint8_t* data )
+        {
+            return data[type_offset] != MessageType::ExtendedFrame
+                || data[ext_type_offset] != MessageType::ExtendedFrame;
+        }
+
+    /* Parse a header; `data` must hold length_of( data[0] ) bytes and be
+     * well_formed() */
+    static MessageHeader from_bytes( const uint8_t* data )
+        {
+            if( data[type_offset] == MessageType::ExtendedFrame ){
+                return MessageHeader( static_cast<MessageType>(data[ext_type_offset])
+                                    , make_uint32( data[ext_length_offset]
+                                                 , data[ext_length_offset+1]
+                                                 , data[ext_length_offset+2]
+                                                 , data[ext_length_offset+3] ) );
+            }
+            return MessageHeader( static_cast<MessageType>(data[type_offset])
+                                , make_uint16( data[length_msb_offset]
+                                             , data[length_lsb_offset] ) );
+        }
+
+    size_t length() const
+        { return length_of( header_[type_offset] ); }
+
+    bool extended() const
+        { return header_[type_offset] == MessageType::ExtendedFrame; }
+
+    self& data()
+        { return header_; }
+    const self& data() const
+        { return header_; }
+
+    MessageType msg_type() const
+        { return static_cast<MessageType>( extended() ? header_[ext_type_offset]
+                                                      : header_[type_offset] ); }
+
+    void msg_type( MessageType type )
+        { encode( type, msg_length() ); }
+
+    uint32_t msg_length() const
+    {
+        if( extended() ){
+            return make_uint32( header_[ext_length_offset], header_[ext_length_offset+1]
+                              , header_[ext_length_offset+2], header_[ext_length_offset+3] );
+        }
+        return make_uint16( header_[length_msb_offset]
+                          , header_[length_lsb_offset] );
+    }
+
+    void msg_length( uint32_t len )
+        { encode( msg_type(), len ); }
+
+    iterator begin()
+      { return header_.begin(); }
+    iterator end()
+        { return header_.begin() + length(); }
+    const_iterator begin() const
+        { return header_.cbegin(); }
+    const_iterator end() const
+        { return header_.cbegin() + length(); }
+    const_iterator cbegin() const
+        { return header_.cbegin(); }
+    const_iterator cend() const
+        { return header_.cbegin() + length(); }
+
+private:
+    void encode( MessageType type, uint32_t len )
+        {
+            if( len <= MaxCompactLength ){
+                header_[type_offset] = type;
+                header_[length_msb_offset] = static_cast<uint8_t>(len >> 8);
+                header_[length_lsb_offset] = static_cast<uint8_t>(len);
+            }
+            else{
+                header_[type_offset] = MessageType::ExtendedFrame;
+                header_[ext_type_offset] = type;
+                for( int i=0; i<4; ++i ){
+                    header_[ext_length_offset+i] = static_cast<uint8_t>(len >> (24 - 8*i));
+                }
+            }
+        }
+
+private:
+    std::array<uint8_t,ExtendedHeaderLength>    header_;
+};
+/* ------------------------------------------------------------------------- */
+
+
+/* MessageView -- non-owning view of one complete frame, as produced by
+ * the FrameReader. Only valid until the reader is refilled. */
+/* ------------------------------------------------------------------------- */
+class MessageView
+{
+public:
+    /* a FileStart header is followed by the file size and transfer id */
+    enum { FileSizeLength = 8, TransferIdLength = 8
+         , FileInfoLength = FileSizeLength + TransferIdLength };
+
+    MessageView()
+        : data_( nullptr )
+        , length_( 0 )
+        { }
+
+    MessageView( const uint8_t* data, std::size_t length )
+        : data_( data )
+        , length_( length )
+        , header_( MessageHeader::from_bytes( data ) )
+        { }
+
+    MessageType msg_type() const
+        { return header_.msg_type(); }
+
+    std::size_t header_length() const
+        {
+            if( msg_type() == FileStart )
+                return header_.length() + FileInfoLength;
+            else
+                return header_.length();
+        }
+
+    uint32_t body_length() const
+        { return header_.msg_length(); }
+
+    uint64_t file_size() const
+        {
+            // only valid for FileStart
+            return make_uint64( data_ + header_.length() );
+        }
+
+    uint64_t transfer_id() const
+        {
+            // only valid for FileStart
+            return make_uint64( data_ + header_.length() + FileSizeLength );
+        }
+
+    std::size_t total_length() const
+        { return length_; }
+
+    const uint8_t* data() const
+        { return data_; }
+
+    const uint8_t* msg_body() const
+        { return data_ + header_length(); }
+
+    std::string body_to_string() const
+        { return std::string( msg_body(), msg_body() + body_length() ); }
+
+    friend std::ostream& operator<<( std::ostream& os, const MessageView& msg );
+
+private:
+    const uint8_t*      data_;
+    std::size_t         length_;
+    MessageHeader       header_;
+};
+/* ------------------------------------------------------------------------- */
+
+
+/* Message -- owning frame. The header is only kept in the frame bytes.
+ * Frames up to InlineCapacity bytes (short chat lines and all control
+ * frames) live inside the object, larger ones spill to a block from the
+ * calling thread's BufferPool. */
+/* ------------------------------------------------------------------------- */
+class Message
+{
+public:
+    enum { FileSizeLength = MessageView::FileSizeLength
+         , TransferIdLength = MessageView::TransferIdLength
+         , FileInfoLength = MessageView::FileInfoLength };
+    enum { InlineCapacity = 120 };
+
+    explicit Message( const MessageHeader& header );
+
+    Message( MessageType type, boost::string_view str );
+
+    explicit Message( const MessageView& view );
+
+    Message( MessageType type = MessageType::ChatMsg
+           , uint32_t len = MessageSize::Empty )
+        : Message( MessageHeader(type, len) )
+        { }
+
+    Message( const Message& other );
+    Message( Message&& other ) noexcept;
+    Message& operator=( const Message& other );
+    Message& operator=( Message&& other ) noexcept;
+    ~Message();
+
+    MessageHeader header() const
+        { return MessageHeader::from_bytes( data() ); }
+
+    std::size_t header_length() const
+        { 
+            if( msg_type() == FileStart )
+                return MessageHeader::length_of( data()[0] ) + FileInfoLength;
+            else
+                return MessageHeader::length_of( data()[0] );
+        }
+
+    uint32_t body_length() const
+        { return header().msg_length(); }
+
+    void body_length( uint32_t len );
+
+    uint64_t file_size() const
+        {
+            // only valid for FileStart
+            return make_uint64( data() + MessageHeader::length_of( data()[0] ) );
+        }
+
+    uint64_t transfer_id() const
+        {
+            // only valid for FileStart
+            return make_uint64( data() + MessageHeader::length_of( data()[0] )
+                                + FileSizeLength );
+        }
+
+    std::size_t total_length() const
+        { return size_; }
+
+    MessageType msg_type() const
+        { 
+            return static_cast<MessageType>( 
+                data()[0] == MessageType::ExtendedFrame ? data()[MessageHeader::ext_type_offset]
+                                                        : data()[MessageHeader::type_offset] );
+        }
+
+    void msg_type( MessageType t );
+
+    uint8_t* msg_body()
+        { return data() + header_length(); }
+
+    const uint8_t* msg_body() const
+        { return data() + header_length(); }
+
+    uint8_t* data()
+        { return is_inline() ? storage_.inline_ : storage_.heap_; }
+
+    const uint8_t* data() const
+        { return is_inline() ? storage_.inline_ : storage_.heap_; }
+    
+    /* Re-read the header from the frame bytes, which must hold a complete
+     * header, and size the frame for the body */
+    void sync()
+        {
+            resize( std::max<std::size_t>( size_, MessageHeader::ExtendedHeaderLength ) );
+            resize( header_length() + body_length() );
+        }
+
+    std::string data_to_string() const
+        { return std::string( data(), data() + size_ ); }
+    std::string body_to_string() const
+        { return std::string( msg_body(), msg_body() + body_length() ); }
+    
+/* friends */
+    friend std::ostream& operator<<( std::ostream& os, const Message& msg );
+
+private:
+    bool is_inline() const
+        { return capacity_ <= InlineCapacity; }
+    /* change the frame size keeping its content, new bytes are zeroed */
+    void resize( std::size_t size );
+    void assign( const uint8_t* data, std::size_t size );
+    void release();
+    void steal( Message& other );
+
+private:
+    union Storage
+    {
+        uint8_t     inline_[InlineCapacity];
+        uint8_t*    heap_;
+    }                       storage_;
+    uint32_t                size_;
+    uint32_t                capacity_;
+};
+static_assert( sizeof(Message) == 128, "Message should stay two cache lines wide" );
+/* ------------------------------------------------------------------------- */
+
+/* Immutable, reference counted frame. Encoded once and shared by every
+ * recipient's write queue, so a broadcast costs one copy of the body
+ * regardless of the room size. */
+/* ------------------------------------------------------------------------- */
+typedef std::shared_ptr< const Message >    ptr_Message;
+
+inline ptr_Message make_shared_message( Message msg )
+{
+    return std::make_shared< const Message >( std::move( msg ) );
+}
+
+inline ptr_Message make_shared_message( const MessageView& view )
+{
+    return std::make_shared< const Message >( view );
+}
+/* ------------------------------------------------------------------------- */
+
+/* Parse a line typed by the user. The line is copied once, straight into
+ * the frame. */
+Message message_from_string( boost::string_view str );
+Message command_from_string( boost::string_view str );
+Message make_file_message( uint64_t file_size, const Message& msg
+                         , uint64_t transfer_id = 0 );
+Message make_file_message( uint64_t file_size, boost::string_view str
+                         , uint64_t transfer_id = 0 );
+
+
+/* FileResume -- where a transfer picks up. A reader answers FileStart with
+ * a FileAccept carrying the prefix it already holds: `offset` bytes of
+ * transfer `transfer_id`, with CRC32C `prefix_crc`. An empty body means
+ * from the start. The server hands the sender the offer all readers agree
+ * on, and the sender opens the file stream with the offset it really
+ * starts from, after checking the prefix against its own file. */
+/* ------------------------------------------------------------------------- */
+struct FileResume
+{
+    enum { BodyLength = 20, PreambleLength = 8 };
+
+    FileResume( uint64_t transfer_id = 0, uint64_t offset = 0
+              , uint32_t prefix_crc = 0 )
+        : transfer_id( transfer_id )
+        , offset( offset )
+        , prefix_crc( prefix_crc )
+        { }
+
+    bool operator==( const FileResume& other ) const
+        {
+            return transfer_id == other.transfer_id && offset == other.offset
+                && prefix_crc == other.prefix_crc;
+        }
+    bool operator!=( const FileResume& other ) const
+        { return !( *this == other ); }
+
+    uint64_t    transfer_id;
+    uint64_t    offset;
+    uint32_t    prefix_crc;
+};
+/* ------------------------------------------------------------------------- */
+
+Message make_file_accept( const FileResume& resume );
+/* the offer of a FileAccept body, from the start when there is none */
+FileResume file_resume( const uint8_t* body, std::size_t length );
+
+
+/* FileRefuse, FileCancel and FileDone name the transfer they are about in
+ * the first 8 bytes of their body, a reason for people may follow. So does
+ * FileAccept, whose FileResume starts with the transfer id. FilePause and
+ * FileContinue go from the server to a sender: the readers of that
+ * transfer fell a window behind, its chunks wait until they catch up while
+ * the sender's other transfers go on. */
+/* ------------------------------------------------------------------------- */
+enum { FileControlLength = 8 };
+
+Message make_file_control( MessageType type, uint64_t transfer_id
+                         , boost::string_view reason = boost::string_view() );
+/* the transfer a control body names, 0 when it is too short to name one */
+uint64_t file_control_id( const uint8_t* body, std::size_t length );
+std::string file_control_reason( const uint8_t* body, std::size_t length );
+/* ------------------------------------------------------------------------- */
+
+
+/* FileChunkHeader -- the file socket carries the streams of all transfers
+ * in flight as chunks: this header, then `length` bytes of the stream of
+ * transfer `transfer_id`, which is its start offset, data and checksums.
+ * Chunks of different transfers interleave; those of one transfer arrive
+ * in order. */
+/* ------------------------------------------------------------------------- */
+struct FileChunkHeader
+{
+    enum { Length = 12 };
+
+    FileChunkHeader( uint64_t transfer_id = 0, uint32_t length = 0 )
+        : transfer_id( transfer_id )
+        , length( length )
+        { }
+
+    uint64_t    transfer_id;
+    uint32_t    length;
+};
+/* ------------------------------------------------------------------------- */
+
+/* `data` holds FileChunkHeader::Length bytes */
+void put_file_chunk_header( uint8_t* data, const FileChunkHeader& header );
+FileChunkHeader file_chunk_header( const uint8_t* data );
+
+
+/* FileTrailer -- the checksums sent in line with the file data on the
+ * file socket: the CRC32C of every BlockLength bytes from the start
+ * offset follows those bytes, the last block short, and the CRC of the
+ * whole file, resumed prefix included, ends the stream. A reader checks
+ * each block as it completes. */
+/* ------------------------------------------------------------------------- */
+struct FileTrailer
+{
+    enum { BlockLength = 1 << 18, CrcLength = 4 };
+
+    static uint64_t blocks( uint64_t bytes )
+        { return ( bytes + BlockLength - 1 ) / BlockLength; }
+    /* the checksums on the wire with `bytes` of file data */
+    static uint64_t length( uint64_t bytes )
+        { return CrcLength * ( blocks( bytes ) + 1 ); }
+};
+/* ------------------------------------------------------------------------- */
+
+
+/* ResendRequest, RepairChunk -- FileResend and FileRepair bodies: ranges
+ * a reader got corrupted, and their bytes sent again. FileResend goes to
+ * the sender of the transfer, the server filling in the reader's id; it
+ * answers with a FileRepair per range, which the server hands to that
+ * reader alone. */
+/* ------------------------------------------------------------------------- */
+struct FileRange
+{
+    FileRange( uint64_t offset = 0, uint32_t length = 0 )
+        : offset( offset )
+        , length( length )
+        { }
+
+    uint64_t    offset;
+    uint32_t    length;
+};
+
+struct ResendRequest
+{
+    /* transfer id, reader id, then the ranges */
+    enum { ReaderOffset = 8, PrefixLength = 16, RangeLength = 12 };
+
+    uint64_t                    transfer_id;
+    uint64_t                    reader;
+    std::vector< FileRange >    ranges;
+};
+
+struct RepairChunk
+{
+    /* transfer id, reader id, offset, then the bytes */
+    enum { ReaderOffset = 8, PrefixLength = 24 };
+
+    uint64_t                    transfer_id;
+    uint64_t                    reader;
+    uint64_t                    offset;
+    const uint8_t*              data;
+    std::size_t                 length;
+};
+/* ------------------------------------------------------------------------- */
+
+Message make_file_resend( uint64_t transfer_id, const std::vector< FileRange >& ranges );
+Message make_file_repair( uint64_t transfer_id, uint64_t reader, uint64_t offset
+                        , const char* data, std::size_t bytes );
+/* the body is not checked, callers check the message length first */
+ResendRequest file_resend( const uint8_t* body, std::size_t length );
+/* `data` points into the body */
+RepairChunk file_repair( const uint8_t* body, std::size_t length );
+
+#endif /* MESSAGE_HPP_ */
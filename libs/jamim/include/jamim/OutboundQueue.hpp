@@ -0,0 +1,424 @@
+#ifndef OUTBOUNDQUEUE_HPP_
+#define OUTBOUNDQUEUE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+#include "Message.hpp"
+
+
+/* QueueLimits -- caps of one outbound queue and what to do with a frame
+ * that does not fit:
+ *  DropOldest: drop queued frames that are not being written yet
+ *  DropNew:    drop the new frame
+ *  Coalesce:   merge the new frame into the last queued one; chat lines are
+ *              joined, file chunks appended. Anything else is dropped
+ *  Disconnect: drop the new frame; a queue that keeps overflowing for longer
+ *              than `grace` asks for its session to be closed
+ * Pinned frames (file control) are queued past the caps and never dropped.
+ * offer() queues frames that must not be lost: it never drops, a frame
+ * that does not fit is refused and the caller deals with it. */
+/* ------------------------------------------------------------------------- */
+struct QueueLimits
+{
+    enum Policy { DropOldest, DropNew, Coalesce, Disconnect, PolicyCount };
+
+    QueueLimits( std::size_t max_messages = 4096
+               , std::size_t max_bytes = 1 << 22
+               , Policy policy = DropOldest
+               , std::chrono::milliseconds grace = std::chrono::seconds( 5 ) )
+        : max_messages( max_messages )
+        , max_bytes( max_bytes )
+        , policy( policy )
+        , grace( grace )
+        { }
+
+    std::size_t                 max_messages;
+    std::size_t                 max_bytes;
+    Policy                      policy;
+    std::chrono::milliseconds   grace;
+};
+/* ------------------------------------------------------------------------- */
+
+
+/* MemoryBudget -- bytes queued by all sessions together, 0 is unlimited.
+ * A broadcast frame is shared, but every queue holding it is charged its
+ * full size. */
+/* ------------------------------------------------------------------------- */
+class MemoryBudget
+{
+public:
+    explicit MemoryBudget( std::size_t limit = 0 )
+        : limit_( limit )
+        , used_( 0 )
+        { }
+
+    MemoryBudget( const MemoryBudget& ) = delete;
+    MemoryBudget& operator=( const MemoryBudget& ) = delete;
+
+    bool reserve( std::size_t bytes )
+        {
+            const std::size_t limit = limit_.load( std::memory_order_relaxed );
+            std::size_t used = used_.load( std::memory_order_relaxed );
+            do{
+                if( limit != 0 && used + bytes > limit ){
+                    return false;
+                }
+            } while( !used_.compare_exchange_weak( used, used + bytes
+                                                 , std::memory_order_relaxed ) );
+            return true;
+        }
+
+    /* charge `bytes` whatever the limit */
+    void charge( std::size_t bytes )
+        { used_.fetch_add( bytes, std::memory_order_relaxed ); }
+
+    void release( std::size_t bytes )
+        { used_.fetch_sub( bytes, std::memory_order_relaxed ); }
+
+    void limit( std::size_t bytes )
+        { limit_ = bytes; }
+    std::size_t limit() const
+        { return limit_; }
+    std::size_t used() const
+        { return used_; }
+
+private:
+    std::atomic<std::size_t>    limit_;
+    std::atomic<std::size_t>    used_;
+};
+/* ------------------------------------------------------------------------- */
+
+
+/* OverflowStats -- what the limits did, shared by all sessions */
+/* ------------------------------------------------------------------------- */
+class OverflowStats
+{
+public:
+    OverflowStats()
+        : coalesced_( 0 )
+        , disconnects_( 0 )
+        {
+            for( auto& count : dropped_ ){
+                count = 0;
+            }
+        }
+
+    OverflowStats( const OverflowStats& ) = delete;
+    OverflowStats& operator=( const OverflowStats& ) = delete;
+
+    void count_dropped( QueueLimits::Policy policy, std::uint64_t frames = 1 )
+        { dropped_[policy].fetch_add( frames, std::memory_order_relaxed ); }
+    void count_coalesced()
+        { coalesced_.fetch_add( 1, std::memory_order_relaxed ); }
+    void count_disconnect()
+        { disconnects_.fetch_add( 1, std::memory_order_relaxed ); }
+
+    /* frames dropped while `policy` was in effect */
+    std::uint64_t dropped( QueueLimits::Policy policy ) const
+        { return dropped_[policy]; }
+    std::uint64_t coalesced() const
+        { return coalesced_; }
+    std::uint64_t disconnects() const
+        { return disconnects_; }
+
+private:
+    std::atomic<std::uint64_t>  dropped_[QueueLimits::PolicyCount];
+    std::atomic<std::uint64_t>  coalesced_;
+    std::atomic<std::uint64_t>  disconnects_;
+};
+/* ------------------------------------------------------------------------- */
+
+
+/* queued size of a frame */
+inline std::size_t frame_bytes( const ptr_Message& msg )
+{
+    return msg->total_length();
+}
+
+inline std::size_t frame_bytes( const std::vector<char>& chunk )
+{
+    return chunk.size();
+}
+
+/* a frame whose loss breaks a file transfer: the offer, the answers and
+ * the pauses */
+inline bool frame_pinned( const ptr_Message& msg )
+{
+    return msg->msg_type() >= MessageType::FileStart
+        && msg->msg_type() <= MessageType::FileContinue;
+}
+
+inline bool frame_pinned( const std::vector<char>& /*chunk*/ )
+{
+    return false;
+}
+
+/* merge `next` into `last`; false when the frames can not be merged */
+inline bool coalesce_frames( ptr_Message& last, const ptr_Message& next )
+{
+    if( last->msg_type() != MessageType::ChatMsg
+     || next->msg_type() != MessageType::ChatMsg ){
+        return false;
+    }
+    std::string body;
+    body.reserve( last->body_length() + 1 + next->body_length() );
+    body.append( reinterpret_cast<const char*>( last->msg_body() ), last->body_length() );
+    body.push_back( '\n' );
+    body.append( reinterpret_cast<const char*>( next->msg_body() ), next->body_length() );
+    last = make_shared_message( Message( MessageType::ChatMsg, body ) );
+    return true;
+}
+
+inline bool coalesce_frames( std::vector<char>& last, const std::vector<char>& next )
+{
+    last.insert( last.end(), next.begin(), next.end() );
+    return true;
+}
+
+
+/* OutboundQueue -- a session's queue of frames waiting to be written,
+ * bounded by QueueLimits and charged against a shared MemoryBudget.
+ * The first `in_flight` frames are being written and are never dropped or
+ * merged. Not thread safe, the owning strand serialises all calls. */
+/* ------------------------------------------------------------------------- */
+template< typename T >
+class OutboundQueue
+{
+public:
+    typedef std::deque< T >                             container_type;
+    typedef typename container_type::iterator           iterator;
+    typedef typename container_type::const_iterator     const_iterator;
+    typedef std::chrono::steady_clock                   clock;
+
+    enum Result { Queued, Dropped, Disconnect };
+
+    OutboundQueue()
+        : budget_( nullptr )
+        , stats_( nullptr )
+        , bytes_( 0 )
+        , overflowing_( false )
+        { }
+
+    OutboundQueue( const OutboundQueue& ) = delete;
+    OutboundQueue& operator=( const OutboundQueue& ) = delete;
+
+    ~OutboundQueue()
+        { clear(); }
+
+    /* call while the queue is empty */
+    void configure( const QueueLimits& limits
+                  , MemoryBudget* budget = nullptr
+                  , OverflowStats* stats = nullptr )
+        {
+            limits_ = limits;
+            budget_ = budget;
+            stats_ = stats;
+        }
+
+    Result push( T value, std::size_t in_flight, clock::time_point now = clock::now() )
+        {
+            const std::size_t size = frame_bytes( value );
+            if( try_reserve( size ) ){
+                admit( std::move( value ), size );
+                return Queued;
+            }
+            if( frame_pinned( value ) ){
+                if( budget_ ){
+                    budget_->charge( size );
+                }
+                admit( std::move( value ), size );
+                return Queued;
+            }
+
+            switch( limits_.policy ){
+            case QueueLimits::DropOldest:
+                // frames go only to make room within this queue's caps; a
+                // budget other sessions used up drops the new frame
+                for( std::size_t next = in_flight
+                   ; next < queue_.size() && !within_caps( size ); ){
+                    if( frame_pinned( queue_[next] ) ){
+                        ++next;
+                        continue;
+                    }
+                    drop( queue_.begin() + next );
+                }
+                if( try_reserve( size ) ){
+                    admit( std::move( value ), size );
+                    return Queued;
+                }
+                break;
+            case QueueLimits::Coalesce:
+                if( queue_.size() > in_flight && merge( queue_.back(), value ) ){
+                    return Queued;
+                }
+                break;
+            case QueueLimits::Disconnect:
+                if( !overflowing_ ){
+                    overflowing_ = true;
+                    overflow_since_ = now;
+                }
+                count_dropped();
+                if( now - overflow_since_ >= limits_.grace ){
+                    if( stats_ ){
+                        stats_->count_disconnect();
+                    }
+                    return Disconnect;
+                }
+                return Dropped;
+            default:
+                break;
+            }
+            count_dropped();
+            return Dropped;
+        }
+
+    /* queue `value` without dropping anything: Coalesce may merge it into
+     * the last frame, Disconnect answers Disconnect at once as waiting out
+     * the grace would mean dropping; otherwise a frame that does not fit
+     * is refused with Dropped */
+    Result offer( T value, std::size_t in_flight )
+        {
+            const std::size_t size = frame_bytes( value );
+            if( try_reserve( size ) ){
+                admit( std::move( value ), size );
+                return Queued;
+            }
+            if( limits_.policy == QueueLimits::Coalesce
+             && queue_.size() > in_flight && merge( queue_.back(), value ) ){
+                return Queued;
+            }
+            count_dropped();
+            if( limits_.policy == QueueLimits::Disconnect ){
+                if( stats_ ){
+                    stats_->count_disconnect();
+                }
+                return Disconnect;
+            }
+            return Dropped;
+        }
+
+    iterator erase( iterator first, iterator last )
+        {
+            for( iterator it = first; it != last; ++it ){
+                release( frame_bytes( *it ) );
+            }
+            return queue_.erase( first, last );
+        }
+
+    /* the last frame was cut `bytes` shorter in place */
+    void shrink_back( std::size_t bytes )
+        { release( bytes ); }
+
+    void pop_front()
+        {
+            release( frame_bytes( queue_.front() ) );
+            queue_.pop_front();
+        }
+
+    void clear()
+        { erase( queue_.begin(), queue_.end() ); }
+
+    T& front()
+        { return queue_.front(); }
+    const T& front() const
+        { return queue_.front(); }
+
+    iterator begin()
+        { return queue_.begin(); }
+    iterator end()
+        { return queue_.end(); }
+    const_iterator begin() const
+        { return queue_.begin(); }
+    const_iterator end() const
+        { return queue_.end(); }
+
+    bool empty() const
+        { return queue_.empty(); }
+    std::size_t size() const
+        { return queue_.size(); }
+    /* bytes currently charged to the budget */
+    std::size_t bytes() const
+        { return bytes_; }
+    const QueueLimits& limits() const
+        { return limits_; }
+
+private:
+    /* an empty queue takes any one frame the budget allows */
+    bool within_caps( std::size_t size ) const
+        {
+            return queue_.size() < limits_.max_messages
+                && ( queue_.empty() || bytes_ + size <= limits_.max_bytes );
+        }
+
+    /* within the caps and the budget */
+    bool try_reserve( std::size_t size )
+        {
+            return within_caps( size ) && ( !budget_ || budget_->reserve( size ) );
+        }
+
+    void admit( T&& value, std::size_t size )
+        {
+            queue_.push_back( std::move( value ) );
+            bytes_ += size;
+            overflowing_ = false;
+        }
+
+    void drop( iterator it )
+        {
+            release( frame_bytes( *it ) );
+            queue_.erase( it );
+            count_dropped();
+        }
+
+    bool merge( T& last, const T& next )
+        {
+            T merged( last );
+            if( !coalesce_frames( merged, next ) ){
+                return false;
+            }
+            const std::size_t before = frame_bytes( last );
+            const std::size_t after = frame_bytes( merged );
+            if( bytes_ - before + after > limits_.max_bytes
+             || ( budget_ && !budget_->reserve( after - before ) ) ){
+                return false;
+            }
+            last = std::move( merged );
+            bytes_ += after - before;
+            if( stats_ ){
+                stats_->count_coalesced();
+            }
+            return true;
+        }
+
+    void release( std::size_t size )
+        {
+            bytes_ -= size;
+            if( budget_ ){
+                budget_->release( size );
+            }
+        }
+
+    void count_dropped()
+        {
+            if( stats_ ){
+                stats_->count_dropped( limits_.policy );
+            }
+        }
+
+private:
+    container_type          queue_;
+    QueueLimits             limits_;
+    MemoryBudget*           budget_;
+    OverflowStats*          stats_;
+    std::size_t             bytes_;
+    bool                    overflowing_;
+    clock::time_point       overflow_since_;
+};
+/* ------------------------------------------------------------------------- */
+
+#endif /* OUTBOUNDQUEUE_HPP_ */
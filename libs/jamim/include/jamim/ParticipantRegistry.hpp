@@ -0,0 +1,79 @@
+#ifndef PARTICIPANTREGISTRY_HPP_
+#define PARTICIPANTREGISTRY_HPP_
+
+#include <memory>
+#include <boost/thread/mutex.hpp>
+#include "ParticipantTable.hpp"
+
+
+/* ParticipantRegistry -- copy-on-write ParticipantTable.
+ * Readers take the current snapshot with std::atomic_load, then iterate or
+ * look it up without any lock; a snapshot never changes once published.
+ * That load is not lock-free: libstdc++ guards shared_ptr atomics with a
+ * mutex picked by hashing the pointer's address, held only while the
+ * reference count is taken, so a fan-out contends for it once per
+ * snapshot, not per participant.
+ * Writers (join/leave) are serialised by a mutex, copy the current snapshot,
+ * modify the copy and publish it atomically. The copy shares all but the
+ * blocks the change touches, so a join or leave costs O(size / BlockSize)
+ * and a constant number of allocations, however large the room. */
+/* ------------------------------------------------------------------------- */
+template< typename T >
+class ParticipantRegistry
+{
+public:
+    typedef ParticipantTable< T >                   container_type;
+    typedef std::shared_ptr< const container_type > snapshot_type;
+
+    ParticipantRegistry()
+        : snapshot_( std::make_shared<const container_type>() )
+        { }
+
+    ParticipantRegistry( const ParticipantRegistry& ) = delete;
+    ParticipantRegistry& operator=( const ParticipantRegistry& ) = delete;
+
+    snapshot_type snapshot() const
+        { return std::atomic_load( &snapshot_ ); }
+
+    std::size_t size() const
+        { return snapshot()->size(); }
+
+    /* false when the id is already present */
+    bool insert( ParticipantId id, const T& value )
+        {
+            boost::mutex::scoped_lock lk( writer_mutex_ );
+            if( snapshot_->contains( id ) ){
+                return false;
+            }
+            auto next = std::make_shared<container_type>( *snapshot_ );
+            next->insert( id, value );
+            publish( std::move( next ) );
+            return true;
+        }
+
+    /* false when the id is not present */
+    bool erase( ParticipantId id )
+        {
+            boost::mutex::scoped_lock lk( writer_mutex_ );
+            if( !snapshot_->contains( id ) ){
+                return false;
+            }
+            auto next = std::make_shared<container_type>( *snapshot_ );
+            next->erase( id );
+            publish( std::move( next ) );
+            return true;
+        }
+
+private:
+    void publish( std::shared_ptr<container_type>&& next )
+        {
+            std::atomic_store( &snapshot_, snapshot_type( std::move( next ) ) );
+        }
+
+private:
+    boost::mutex        writer_mutex_;
+    snapshot_type       snapshot_;
+};
+/* ------------------------------------------------------------------------- */
+
+#endif /* PARTICIPANTREGISTRY_HPP_ */
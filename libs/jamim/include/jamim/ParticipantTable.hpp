@@ -0,0 +1,283 @@
+#ifndef PARTICIPANTTABLE_HPP_
+#define PARTICIPANTTABLE_HPP_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+
+/* Unique for the lifetime of a server; never reused */
+typedef std::uint64_t   ParticipantId;
+
+
+/* ParticipantTable -- sparse set keyed by ParticipantId.
+ * Values are kept packed in slots 0..size()-1, stored in fixed size blocks.
+ * The index is a slot array indexed by the id, split into pages that only
+ * exist while they hold an id, so the ids seen over a server's lifetime cost
+ * nothing once they are gone. Insert, find and erase are O(1); erase moves
+ * the last value into the freed slot, so the order of values is not
+ * preserved.
+ * Copies share their blocks and pages, a write clones the few it touches:
+ * copying a table and changing one entry costs O(size / BlockSize) pointer
+ * copies and no more than four block or page copies. A table must not be
+ * copied while it is being written. */
+/* ------------------------------------------------------------------------- */
+template< typename T >
+class ParticipantTable
+{
+public:
+    enum { BlockSize = 128, PageBits = 9, PageSize = 1 << PageBits };
+
+private:
+    enum : std::uint32_t { Empty = 0xFFFFFFFFu };
+
+    struct Block
+    {
+        std::array< T, BlockSize >              values;
+        std::array< ParticipantId, BlockSize >  ids;
+    };
+
+    struct Page
+    {
+        Page()
+            : used( 0 )
+            { slots.fill( Empty ); }
+
+        std::array< std::uint32_t, PageSize >   slots;
+        std::size_t                             used;
+    };
+
+    typedef std::shared_ptr< Block >                    ptr_Block;
+    typedef std::pair< ParticipantId, std::shared_ptr< Page > >  PageEntry;
+
+public:
+    /* walks the values in slot order */
+    class const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag   iterator_category;
+        typedef T                           value_type;
+        typedef std::ptrdiff_t              difference_type;
+        typedef const T*                    pointer;
+        typedef const T&                    reference;
+
+        const_iterator()
+            : blocks_( nullptr )
+            , slot_( 0 )
+            { }
+
+        reference operator*() const
+            { return (*blocks_)[slot_ / BlockSize]->values[slot_ % BlockSize]; }
+        pointer operator->() const
+            { return &**this; }
+        const_iterator& operator++()
+            { ++slot_; return *this; }
+        const_iterator operator++( int )
+            { const_iterator before( *this ); ++slot_; return before; }
+        bool operator==( const const_iterator& other ) const
+            { return slot_ == other.slot_; }
+        bool operator!=( const const_iterator& other ) const
+            { return slot_ != other.slot_; }
+
+    private:
+        friend class ParticipantTable;
+        const_iterator( const std::vector< ptr_Block >* blocks, std::size_t slot )
+            : blocks_( blocks )
+            , slot_( slot )
+            { }
+
+        const std::vector< ptr_Block >*     blocks_;
+        std::size_t                         slot_;
+    };
+
+    ParticipantTable()
+        : size_( 0 )
+        { }
+
+    /* false when the id is already present */
+    bool insert( ParticipantId id, const T& value )
+        {
+            if( contains( id ) ){
+                return false;
+            }
+            const std::size_t slot = size_;
+            if( slot / BlockSize == blocks_.size() ){
+                blocks_.push_back( std::make_shared< Block >() );
+            }
+            Block& block = own_block( slot / BlockSize );
+            block.values[slot % BlockSize] = value;
+            block.ids[slot % BlockSize] = id;
+            Page& page = own_page( id );
+            page.slots[id % PageSize] = static_cast< std::uint32_t >( slot );
+            ++page.used;
+            ++size_;
+            return true;
+        }
+
+    /* false when the id is not present */
+    bool erase( ParticipantId id )
+        {
+            std::size_t slot = 0;
+            if( !find_slot( id, slot ) ){
+                return false;
+            }
+            const std::size_t last = size_ - 1;
+            if( slot != last ){
+                Block& from = own_block( last / BlockSize );
+                const ParticipantId moved = from.ids[last % BlockSize];
+                T value( std::move( from.values[last % BlockSize] ) );
+                Block& to = own_block( slot / BlockSize );
+                to.values[slot % BlockSize] = std::move( value );
+                to.ids[slot % BlockSize] = moved;
+                own_page( moved ).slots[moved % PageSize]
+                    = static_cast< std::uint32_t >( slot );
+            }
+            if( last % BlockSize == 0 ){
+                blocks_.pop_back();
+            }
+            else{
+                // the value left behind is released now, not on reuse
+                own_block( last / BlockSize ).values[last % BlockSize] = T();
+            }
+            release_slot( id );
+            --size_;
+            return true;
+        }
+
+    /* nullptr when the id is not present */
+    const T* find( ParticipantId id ) const
+        {
+            std::size_t slot = 0;
+            return find_slot( id, slot ) ? &at( slot ) : nullptr;
+        }
+    T* find( ParticipantId id )
+        {
+            std::size_t slot = 0;
+            return find_slot( id, slot ) ? &at( slot ) : nullptr;
+        }
+
+    bool contains( ParticipantId id ) const
+        {
+            std::size_t slot = 0;
+            return find_slot( id, slot );
+        }
+
+    /* the slot the id's value is in, false when it is not present; slots
+     * stay put until the next erase */
+    bool find_slot( ParticipantId id, std::size_t& slot ) const
+        {
+            const Page* page = find_page( id );
+            if( !page || page->slots[id % PageSize] == Empty ){
+                return false;
+            }
+            slot = page->slots[id % PageSize];
+            return true;
+        }
+
+    const T& at( std::size_t slot ) const
+        { return blocks_[slot / BlockSize]->values[slot % BlockSize]; }
+    T& at( std::size_t slot )
+        { return own_block( slot / BlockSize ).values[slot % BlockSize]; }
+    ParticipantId id_at( std::size_t slot ) const
+        { return blocks_[slot / BlockSize]->ids[slot % BlockSize]; }
+
+    void reserve( std::size_t count )
+        { blocks_.reserve( ( count + BlockSize - 1 ) / BlockSize ); }
+
+    std::size_t size() const
+        { return size_; }
+    bool empty() const
+        { return size_ == 0; }
+
+    const_iterator begin() const
+        { return const_iterator( &blocks_, 0 ); }
+    const_iterator end() const
+        { return const_iterator( &blocks_, size_ ); }
+    /* the ids in slot order */
+    std::vector< ParticipantId > ids() const
+        {
+            std::vector< ParticipantId > ids;
+            ids.reserve( size_ );
+            for( std::size_t slot = 0; slot < size_; ++slot ){
+                ids.push_back( id_at( slot ) );
+            }
+            return ids;
+        }
+
+private:
+    /* Another table sharing a block or page may drop it concurrently but
+     * never takes a new reference, that would mean copying this one. The
+     * fence orders its last reads before our writes. */
+    template< typename U >
+    static bool unique( const std::shared_ptr< U >& shared )
+        {
+            if( shared.use_count() != 1 ){
+                return false;
+            }
+            std::atomic_thread_fence( std::memory_order_acquire );
+            return true;
+        }
+
+    Block& own_block( std::size_t index )
+        {
+            ptr_Block& block = blocks_[index];
+            if( !unique( block ) ){
+                block = std::make_shared< Block >( *block );
+            }
+            return *block;
+        }
+
+    static bool page_before( const PageEntry& entry, ParticipantId number )
+        { return entry.first < number; }
+
+    const Page* find_page( ParticipantId id ) const
+        {
+            const ParticipantId number = id >> PageBits;
+            auto it = std::lower_bound( pages_.begin(), pages_.end(), number
+                                      , &ParticipantTable::page_before );
+            return ( it != pages_.end() && it->first == number ) ? it->second.get()
+                                                                 : nullptr;
+        }
+
+    /* the page of `id`, created or cloned as needed */
+    Page& own_page( ParticipantId id )
+        {
+            const ParticipantId number = id >> PageBits;
+            auto it = std::lower_bound( pages_.begin(), pages_.end(), number
+                                      , &ParticipantTable::page_before );
+            if( it == pages_.end() || it->first != number ){
+                it = pages_.insert( it, PageEntry( number, std::make_shared< Page >() ) );
+            }
+            else if( !unique( it->second ) ){
+                it->second = std::make_shared< Page >( *it->second );
+            }
+            return *it->second;
+        }
+
+    void release_slot( ParticipantId id )
+        {
+            Page& page = own_page( id );
+            page.slots[id % PageSize] = Empty;
+            if( --page.used == 0 ){
+                auto it = std::lower_bound( pages_.begin(), pages_.end()
+                                          , id >> PageBits
+                                          , &ParticipantTable::page_before );
+                pages_.erase( it );
+            }
+        }
+
+private:
+    std::vector< ptr_Block >    blocks_;
+    // sorted by page number, id >> PageBits
+    std::vector< PageEntry >    pages_;
+    std::size_t                 size_;
+};
+/* ------------------------------------------------------------------------- */
+
+#endif /* PARTICIPANTTABLE_HPP_ */
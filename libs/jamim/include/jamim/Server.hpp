@@ -1,267 +1,776 @@
-#ifndef SERVER_HPP_
-#define SERVER_HPP_
-
-#include <cstdlib>
-#include <unordered_map>
-#include <deque>
-#include <list>
-#include <set>
-#include <string>
-#include <memory>
-#include <utility>
-#include <iostream>
-#include <boost/asio.hpp>
-#include <boost/lexical_cast.hpp>
-#include <boost/thread.hpp>
-#include "Message.hpp"
-
-
-/* ChatParticipant */
-/* ------------------------------------------------------------------------- */
-class ChatParticipant;
-typedef std::shared_ptr< ChatParticipant >  ptr_ChatParticipant;
-
-class ChatParticipant
-{
-public:
-    ChatParticipant( uint8_t id )
-        : id_( id )
-        { }
-
-    virtual ~ChatParticipant() { }
-    virtual void deliver( const Message& msg ) = 0;
-    // virtual void file_recieve( const FileTransfer& file ) = 0;
-    virtual void file_accepted( const Message& msg
-                              , ptr_ChatParticipant sender ) = 0;
-    virtual void file_refused( const Message& msg
-                             , ptr_ChatParticipant sender ) = 0;
-    virtual void file_deliver( const std::vector<char>& data ) = 0;
-    virtual void file_msg_deliver( const Message& msg
-                                 /* , ptr_ChatParticipant sender */ ) = 0;
-    virtual void file_responses_remaining( std::size_t ) = 0;
-    uint8_t id() { return id_; }
-    std::string string_id() { return std::to_string(id_); }
-
-private:
-    const uint8_t         id_;
-};
-
-typedef std::shared_ptr< ChatParticipant >  ptr_ChatParticipant;
-/* ------------------------------------------------------------------------- */
-
-/* ChatRoom */
-/* ------------------------------------------------------------------------- */
-class ChatRoom
-{
-    friend class ChatSession;
-public:
-    ChatRoom( boost::asio::io_service& io_service
-            , boost::asio::io_service& io_file_service )
-        : io_strand_( io_service )
-        , io_file_strand_( io_service )
-        { }
-
-    void join( ptr_ChatParticipant participant );
-    void leave( ptr_ChatParticipant participant );
-    std::size_t participant_count() const;
-
-    void deliver( const Message& msg );
-    void deliver( const Message& msg, ptr_ChatParticipant sender );
-
-    void file_awaiting( const Message& msg, ptr_ChatParticipant sender );
-    void file_awaiting_complete( ptr_ChatParticipant sender );
-    void file_accept( const Message& msg, ptr_ChatParticipant sender );
-    void file_refuse( const Message& msg, ptr_ChatParticipant sender );
-    void file_cancel( const Message& msg, ptr_ChatParticipant sender );
-    void file_cancel_all( const Message& msg, ptr_ChatParticipant sender );
-    void file_done( const Message& msg, ptr_ChatParticipant sender );
-    std::size_t file_reader_count( ptr_ChatParticipant sender ) const;
-    void file_deliver( const std::vector<char>& data
-                     , ptr_ChatParticipant sender );
-    void file_msg_deliver( const Message& msg, ptr_ChatParticipant sender );
-private:
-    boost::asio::strand                         io_strand_;
-    boost::asio::strand                         io_file_strand_;
-    std::set< ptr_ChatParticipant >             participants_;
-    std::set< ptr_ChatParticipant >             response_awaiters_;
-    std::unordered_map< ptr_ChatParticipant,
-        std::set< ptr_ChatParticipant > >       file_sender_readers_map_;
-};
-/* ------------------------------------------------------------------------- */
-
-
-/* ChatSession */
-class ChatSession
-    : public ChatParticipant
-    , public std::enable_shared_from_this< ChatSession >
-{
-public:
-    typedef void(ChatSession::*Handler)( const boost::system::error_code&
-                                       , std::size_t
-                                       /* , ptr_ChatParticipant */ );
-
-    friend class ChatRoom;
-
-    ChatSession( boost::asio::io_service& io_service
-               , boost::asio::io_service& io_file_service
-               , boost::asio::ip::tcp::socket socket
-               , boost::asio::ip::tcp::socket file_socket
-               , ChatRoom& room
-               , uint8_t id )
-        : ChatParticipant( id )
-        , socket_( std::move(socket) )
-        , file_socket_( std::move(file_socket) )
-        , io_strand_( io_service )
-        , io_file_strand_( io_service )
-        , room_( room )
-        { }
-
-    void start();
-    void deliver( const Message& msg );
-    void file_accepted( const Message& msg, ptr_ChatParticipant sender );
-    void file_refused( const Message& msg, ptr_ChatParticipant sender );
-    void file_responses_remaining( std::size_t count );
-    void file_deliver( const std::vector<char>& data );
-    void file_msg_deliver( const Message& msg
-                         /* , ptr_ChatParticipant sender */ );
-
-private:
-/* general communication */
-    void do_read_header();
-    void handle_read_header( const boost::system::error_code& ec
-                           , std::size_t /*length*/
-                           /* , ptr_ChatParticipant sender */ );
-    void do_read_body();
-    void handle_read_body( const boost::system::error_code& ec
-                         , std::size_t /*length*/
-                         /* , ptr_ChatParticipant sender */ );
-
-    void handle_empty( const boost::system::error_code& ec
-                     , std::size_t /*length*/
-                     /* , ptr_ChatParticipant sender */ );
-
-    void handle_quit( const boost::system::error_code& ec
-                    , std::size_t /*length*/
-                    /* , ptr_ChatParticipant sender */ );
-
-    void handle_unknown( const boost::system::error_code& ec
-                       , std::size_t /*length*/
-                       /* , ptr_ChatParticipant sender */ );
-
-    void do_write();
-    void handle_write( const boost::system::error_code& ec
-                     , std::size_t /*length*/
-                     /* , ptr_ChatParticipant sender */ );
-    
-    void handle_error( const boost::system::error_code& ec );
-
-
-/* file transfer */
-    void handle_file_start( const boost::system::error_code& ec
-                          , std::size_t /*length*/ );
-
-    void handle_file_accept( const boost::system::error_code& ec
-                           , std::size_t /*length*/ );
-
-    void handle_file_refuse( const boost::system::error_code& ec
-                           , std::size_t /*length*/ );
-
-    void handle_file_cancel( const boost::system::error_code& ec
-                              , std::size_t /*length*/ );
-
-    void handle_file_cancel_all( const boost::system::error_code& ec
-                          , std::size_t /*length*/ );
-
-    void handle_file_done( const boost::system::error_code& ec
-                         , std::size_t /*length*/ );
-
-    void do_file_send_start();
-    void handle_file_send_start( const boost::system::error_code& ec
-                               , std::size_t bytes_transferred );
-    void do_file_send();
-    void handle_file_send( const boost::system::error_code& ec
-                         , std::size_t bytes_transferred );
-
-    void do_file_read();
-    void handle_file_read( const boost::system::error_code& ec
-                         , std::size_t bytes_transferred );
-
-    void do_file_cancel();
-
-    void handle_file_error( const boost::system::error_code& ec );
-
-    void close();
-private:
-    boost::asio::ip::tcp::socket        socket_;
-    boost::asio::ip::tcp::socket        file_socket_;
-    boost::asio::strand                 io_strand_;
-    boost::asio::strand                 io_file_strand_;
-    ChatRoom&                           room_;
-    Message                             read_msg_;
-    std::deque<Message>                 write_msg_queue_;
-
-    Message                             file_msg_;
-    std::set< ptr_ChatParticipant >     file_recievers_;
-    std::size_t                         file_responses_remaining_;
-    std::array<char,4096>               file_send_buf_;
-    // std::deque< std::vector<char> >     file_send_queue_;
-    // std::array<char,4096>               file_read_buf_;
-    std::deque< std::vector<char> >     file_read_queue_;
-    bool                                recieving_file_;
-
-    static const std::unordered_map<MessageType, Handler> s_handler_map_;
-};
-/* ------------------------------------------------------------------------- */
-
-
-/* Server */
-/* ------------------------------------------------------------------------- */
-class Server
-{
-public:
-    Server( const boost::asio::ip::tcp::endpoint& endpoint 
-          , const boost::asio::ip::tcp::endpoint& file_endpoint )
-        : acceptor_( io_service_, endpoint )
-        , file_acceptor_( io_service_, file_endpoint )
-        , socket_( io_service_ )
-        , file_socket_( io_service_ )
-        , room_( io_service_, io_file_service_ )
-        {
-            // run();
-            do_file_accept();
-            do_accept();
-        }
-
-    void run()
-        { 
-            // thread_group.create_thread( [this](){ io_service_.run(); } );
-            // thread_group.create_thread( [this](){ io_file_service_.run(); } );
-            thread_group.create_thread( 
-                boost::bind( &boost::asio::io_service::run, &io_service_ ) );
-            thread_group.create_thread(
-                boost::bind( &boost::asio::io_service::run, &io_service_ ) );
-        }
-
-    ~Server()
-        { thread_group.join_all(); }
-
-private:
-    void do_accept();
-    void handle_accept( const boost::system::error_code& ec );
-
-    void do_file_accept();
-    void handle_file_accept( const boost::system::error_code& ec );
-
-private:
-    boost::asio::io_service             io_service_;
-    boost::asio::io_service             io_file_service_;
-    boost::asio::ip::tcp::acceptor      acceptor_;
-    boost::asio::ip::tcp::acceptor      file_acceptor_;
-    boost::asio::ip::tcp::socket        socket_;
-    boost::asio::ip::tcp::socket        file_socket_;
-    boost::thread_group                 thread_group;
-    ChatRoom                            room_;
-};
-/* ------------------------------------------------------------------------- */
-
-#endif /* SERVER_HPP_ */
+#ifndef SERVER_HPP_
+#define SERVER_HPP_
+
+#include <cstdlib>
+#include <atomic>
+#include <array>
+#include <unordered_map>
+#include <deque>
+#include <list>
+#include <string>
+#include <memory>
+#include <utility>
+#include <iostream>
+#include <boost/asio.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+#include "Message.hpp"
+#include "FrameReader.hpp"
+#include "WriteBatch.hpp"
+#include "OutboundQueue.hpp"
+#include "TransferWindow.hpp"
+#include "SplicePipe.hpp"
+#include "ChunkSizer.hpp"
+#include "Dispatch.hpp"
+#include "IoServicePool.hpp"
+#include "ParticipantRegistry.hpp"
+
+
+/* FileCredit -- file bytes a reader holds of a relayed transfer. The
+ * window is credited once the last frame holding them is written out.
+ * Frames are never dropped on their own: a reader whose queue can not
+ * take a frame leaves the transfer and the window first, so the credits
+ * of what is discarded then go nowhere. */
+/* ------------------------------------------------------------------------- */
+class FileCredit
+{
+public:
+    FileCredit( const ptr_TransferWindow& window, ParticipantId reader
+              , std::size_t bytes )
+        : window_( window )
+        , reader_( reader )
+        , bytes_( bytes )
+        { }
+
+    FileCredit( const FileCredit& ) = delete;
+    FileCredit& operator=( const FileCredit& ) = delete;
+
+    ~FileCredit()
+        {
+            if( auto window = window_.lock() ){
+                window->written( reader_, bytes_ );
+            }
+        }
+
+private:
+    std::weak_ptr< TransferWindow >     window_;
+    const ParticipantId                 reader_;
+    const std::size_t                   bytes_;
+};
+
+typedef std::shared_ptr< FileCredit >   ptr_FileCredit;
+/* ------------------------------------------------------------------------- */
+
+
+/* FileFrame -- what a reader's file socket is sent next: a chunk header
+ * and copied bytes, then `spliced` bytes of the reader's pipe */
+/* ------------------------------------------------------------------------- */
+struct FileFrame
+{
+    FileFrame()
+        : spliced( 0 )
+        { }
+
+    std::vector< char >             data;
+    std::size_t                     spliced;
+    std::vector< ptr_FileCredit >   credits;
+};
+
+inline std::size_t frame_bytes( const FileFrame& frame )
+{
+    return frame.data.size() + frame.spliced;
+}
+
+/* copied chunks are appended whole, so the chunk framing holds */
+inline bool coalesce_frames( FileFrame& last, const FileFrame& next )
+{
+    if( last.spliced != 0 || next.spliced != 0 ){
+        return false;
+    }
+    last.data.insert( last.data.end(), next.data.begin(), next.data.end() );
+    last.credits.insert( last.credits.end(), next.credits.begin(), next.credits.end() );
+    return true;
+}
+
+/* how a frame holds the chunks of a transfer: not at all, as its only
+ * chunk, or with other chunks or spliced bytes it can not be parted from */
+enum FrameHolds { FrameOther, FrameOwned, FrameKept };
+
+inline FrameHolds file_frame_holds( const FileFrame& frame, uint64_t transfer_id )
+{
+    bool owned = false;
+    bool other = false;
+    for( std::size_t at = 0; at + FileChunkHeader::Length <= frame.data.size(); ){
+        const FileChunkHeader header( file_chunk_header(
+            reinterpret_cast<const uint8_t*>( frame.data.data() ) + at ) );
+        ( header.transfer_id == transfer_id ? owned : other ) = true;
+        at += FileChunkHeader::Length + header.length;
+    }
+    if( !owned ){
+        return FrameOther;
+    }
+    return ( other || frame.spliced != 0 ) ? FrameKept : FrameOwned;
+}
+/* ------------------------------------------------------------------------- */
+
+
+/* ChatParticipant */
+/* ------------------------------------------------------------------------- */
+class ChatParticipant;
+typedef std::shared_ptr< ChatParticipant >  ptr_ChatParticipant;
+
+class ChatParticipant
+{
+public:
+    ChatParticipant( ParticipantId id )
+        : id_( id )
+        { }
+
+    virtual ~ChatParticipant() { }
+    virtual void deliver( ptr_Message msg ) = 0;
+    // virtual void file_recieve( const FileTransfer& file ) = 0;
+    /* a reader answered the FileStart of one of this participant's
+     * transfers, which the answer names */
+    virtual void file_accepted( const Message& msg
+                              , ptr_ChatParticipant sender ) = 0;
+    virtual void file_refused( const Message& msg
+                             , ptr_ChatParticipant sender ) = 0;
+    /* `frame` is one whole chunk, FileChunkHeader included; `window` is
+     * credited with its file bytes once they are written out. false when
+     * the participant can not take it, it must then leave the transfer */
+    virtual bool file_deliver( const std::vector<char>& frame
+                             , const ptr_TransferWindow& window ) = 0;
+    virtual void file_msg_deliver( ptr_Message msg
+                                 /* , ptr_ChatParticipant sender */ ) = 0;
+    virtual void file_responses_remaining( uint64_t transfer_id, std::size_t ) = 0;
+    /* zero-copy relay: bytes of this participant's pipe a sender may tee
+     * into, 0 when it only takes copied chunks */
+    virtual std::size_t file_splice_capacity() const
+        { return 0; }
+    /* tee up to `bytes` from the front of `source` and write them out as a
+     * chunk of `transfer_id`; returns how many were taken, the rest is
+     * handed over with file_deliver() */
+    virtual std::size_t file_splice( uint64_t /*transfer_id*/, SplicePipe& /*source*/
+                                   , std::size_t /*bytes*/
+                                   , const ptr_TransferWindow& /*window*/ )
+        { return 0; }
+    /* `reader` no longer takes part in the transfer this participant is
+     * sending */
+    virtual void file_reader_left( uint64_t /*transfer_id*/, ParticipantId /*reader*/ )
+        { }
+    /* this participant was dropped from `transfer_id`, the frames of it
+     * not written yet may go */
+    virtual void file_cancelled( uint64_t /*transfer_id*/ )
+        { }
+    ParticipantId id() const { return id_; }
+    std::string string_id() { return std::to_string(id_); }
+
+private:
+    const ParticipantId   id_;
+};
+
+typedef std::shared_ptr< ChatParticipant >  ptr_ChatParticipant;
+/* ------------------------------------------------------------------------- */
+
+
+/* FileReaders -- who takes part in one transfer: the room's participants
+ * when it started, less its sender, and a bit for each that still does.
+ * Answers and drops clear a bit, so the room's snapshot is shared, never
+ * copied; the fan-out reads the bits without a lock. */
+/* ------------------------------------------------------------------------- */
+class FileReaders
+{
+public:
+    typedef ParticipantRegistry< ptr_ChatParticipant >::snapshot_type  Members;
+
+    FileReaders( const Members& members, ParticipantId sender );
+
+    FileReaders( const FileReaders& ) = delete;
+    FileReaders& operator=( const FileReaders& ) = delete;
+
+    bool contains( ParticipantId id ) const
+        { return find( id ) != nullptr; }
+    /* nullptr unless `id` still takes part */
+    const ptr_ChatParticipant* find( ParticipantId id ) const;
+    /* false when `id` did not take part (any more) */
+    bool remove( ParticipantId id );
+
+    std::size_t size() const
+        { return count_.load(); }
+    bool empty() const
+        { return size() == 0; }
+    std::vector< ParticipantId > ids() const;
+
+    template< typename Function >
+    void for_each( Function function ) const
+        {
+            for( std::size_t word = 0; word < words_; ++word ){
+                uint64_t bits = active_[word].load( std::memory_order_relaxed );
+                while( bits != 0 ){
+                    const std::size_t slot = word * 64 + __builtin_ctzll( bits );
+                    bits &= bits - 1;
+                    function( members_->at( slot ) );
+                }
+            }
+        }
+
+private:
+    const Members                                   members_;
+    const std::size_t                               words_;
+    std::unique_ptr< std::atomic< uint64_t >[] >    active_;
+    std::atomic< std::size_t >                      count_;
+};
+/* ------------------------------------------------------------------------- */
+
+
+/* ChatRoom
+ * Sessions running on any io_service of the pool call into the room
+ * concurrently. Fan-out iterates an immutable snapshot of the participants,
+ * join/leave publish a new one; the file transfer bookkeeping is guarded by
+ * file_mutex_, which is never held while calling back into a participant.
+ * Transfers are keyed by their id, any number of them may be relayed at
+ * once, and an id is only used by one transfer of the room at a time; one
+ * whose stream is relayed hands its id over to a new FileStart.
+ * post_deliver() runs the fan-out on the room's own strand, so a room's
+ * messages are always walked on the io_service it was placed on. */
+/* ------------------------------------------------------------------------- */
+class ChatRoom
+    : public std::enable_shared_from_this< ChatRoom >
+{
+    friend class ChatSession;
+public:
+    typedef ParticipantRegistry< ptr_ChatParticipant >  Participants;
+    typedef std::shared_ptr< FileReaders >              ReaderList;
+
+    ChatRoom( boost::asio::io_service& io_service
+            , boost::asio::io_service& io_file_service
+            , std::string name = std::string() )
+        : io_strand_( io_service )
+        , io_file_strand_( io_file_service )
+        , name_( std::move(name) )
+        { }
+
+    const std::string& name() const
+        { return name_; }
+
+    void join( ptr_ChatParticipant participant );
+    void leave( ptr_ChatParticipant participant );
+    std::size_t participant_count() const;
+
+    void deliver( const Message& msg );
+    void deliver( const Message& msg, ptr_ChatParticipant sender );
+    void deliver( ptr_Message msg );
+    void deliver( ptr_Message msg, ptr_ChatParticipant sender );
+    /* deliver() on the room's strand; the room must be owned by a shared_ptr */
+    void post_deliver( ptr_Message msg, ptr_ChatParticipant sender );
+    /* to one participant of the room, if it is still there */
+    void deliver_to( ParticipantId id, ptr_Message msg );
+
+    /* announce sender's FileStart; false when its transfer id is taken */
+    bool file_awaiting( const Message& msg, ptr_ChatParticipant sender );
+    void file_awaiting_complete( uint64_t transfer_id );
+    void file_accept( const Message& msg, ptr_ChatParticipant sender );
+    void file_refuse( const Message& msg, ptr_ChatParticipant sender );
+    void file_cancel( const Message& msg, ptr_ChatParticipant sender );
+    void file_cancel_all( const Message& msg, ptr_ChatParticipant sender );
+    void file_done( const Message& msg, ptr_ChatParticipant sender );
+    /* to the sender of the transfer `reader` asks ranges of again, dropped
+     * unless it is one of the transfer's readers */
+    void file_resend( ptr_Message msg, ParticipantId reader );
+    /* `reader` leaves every transfer it reads, each one's sender hears of
+     * it as of a reader cancelling; `reason` goes with its FileCancels */
+    void file_leave( ptr_ChatParticipant reader
+                   , const std::string& reason
+                       = "[Server] File transfer cancelled, you left the room." );
+    /* the whole stream of the transfer was relayed; it stays to route
+     * resends until its last reader is done with it */
+    void file_finished( uint64_t transfer_id );
+    std::size_t file_reader_count( uint64_t transfer_id ) const;
+    void file_deliver( uint64_t transfer_id, const std::vector<char>& frame
+                     , const ptr_TransferWindow& window = ptr_TransferWindow() );
+    /* zero-copy variant: `bytes` at the front of `source` are teed to every
+     * reader, then dropped from `source`; readers whose pipe is full get
+     * the rest copied */
+    void file_deliver( uint64_t transfer_id, SplicePipe& source, std::size_t bytes
+                     , const ptr_TransferWindow& window );
+    /* smallest splice capacity of the transfer's readers, 0 when any of
+     * them only takes copied chunks */
+    std::size_t file_splice_capacity( uint64_t transfer_id ) const;
+    /* stop relaying the transfer to a reader that fell too far behind or
+     * could not take a chunk, and send it FileCancel */
+    void file_drop_reader( uint64_t transfer_id, ParticipantId reader );
+    void file_msg_deliver( const Message& msg, uint64_t transfer_id );
+    void file_msg_deliver( ptr_Message msg, uint64_t transfer_id );
+private:
+    /* a transfer from its FileStart until its stream is relayed and every
+     * reader is done with it */
+    struct FileTransfer
+    {
+        ptr_ChatParticipant     sender;
+        ReaderList              readers;
+        // readers are still answering the FileStart
+        bool                    awaiting;
+        // the whole stream went out, only repairs are left
+        bool                    relayed;
+    };
+    typedef std::unordered_map< uint64_t, FileTransfer >  FileTransfers;
+
+    ReaderList file_readers( uint64_t transfer_id ) const;
+    /* with file_mutex_ held: a relayed transfer is over once its last
+     * reader is done with it */
+    void file_settle( FileTransfers::iterator it );
+    /* relayed transfers of a participant leaving the room can no longer
+     * be repaired, their readers get FileCancel */
+    void file_sender_left( ParticipantId sender );
+    /* readers that refused a chunk leave the window and the transfer */
+    void file_drop_refused( uint64_t transfer_id
+                          , const std::vector< ParticipantId >& refused
+                          , const ptr_TransferWindow& window );
+
+    boost::asio::strand                         io_strand_;
+    boost::asio::strand                         io_file_strand_;
+    const std::string                           name_;
+    Participants                                participants_;
+    mutable boost::mutex                        file_mutex_;
+    FileTransfers                               file_transfers_;
+};
+
+typedef std::shared_ptr< ChatRoom >  ptr_ChatRoom;
+/* ------------------------------------------------------------------------- */
+
+
+/* RoomRegistry
+ * The server's rooms by name. A room is created by its first join and
+ * dropped when its last participant leaves, except the default room every
+ * session starts in. New rooms are placed on the io_services of the pool
+ * in turn, so many small rooms spread their fan-out over all workers. */
+/* ------------------------------------------------------------------------- */
+class RoomRegistry
+{
+public:
+    static const std::string    DefaultRoom;
+
+    RoomRegistry( IoServicePool& pool, IoServicePool& file_pool )
+        : pool_( pool )
+        , file_pool_( file_pool )
+        { }
+
+    RoomRegistry( const RoomRegistry& ) = delete;
+    RoomRegistry& operator=( const RoomRegistry& ) = delete;
+
+    /* the room called `name`, created if needed, with participant in it */
+    ptr_ChatRoom join( const std::string& name, ptr_ChatParticipant participant );
+    void leave( const ptr_ChatRoom& room, ptr_ChatParticipant participant );
+    ptr_ChatRoom find( const std::string& name ) const;
+    std::size_t size() const;
+
+private:
+    IoServicePool&                                      pool_;
+    IoServicePool&                                      file_pool_;
+    mutable boost::mutex                                mutex_;
+    std::unordered_map< std::string, ptr_ChatRoom >     rooms_;
+};
+/* ------------------------------------------------------------------------- */
+
+
+/* ChatSession */
+class ChatSession
+    : public ChatParticipant
+    , public std::enable_shared_from_this< ChatSession >
+{
+public:
+    typedef void(ChatSession::*Handler)( const boost::system::error_code&
+                                       , std::size_t
+                                       /* , ptr_ChatParticipant */ );
+    typedef DispatchTable< Handler >    HandlerTable;
+
+    /* how file bytes are relayed from a sender to its readers:
+     *  CopyRelay:   read into a buffer, queue a copy for every reader
+     *  SpliceRelay: splice()/tee() socket to socket through kernel pipes,
+     *               where every reader supports it; copies otherwise */
+    enum RelayMode { CopyRelay, SpliceRelay };
+    /* windows of bytes held for a paused send, what it had in flight; a
+     * sender that does not pause has the socket wait on it past that */
+    enum { HeldWindows = 4 };
+
+    friend class ChatRoom;
+
+    ChatSession( boost::asio::io_service& io_service
+               , boost::asio::io_service& io_file_service
+               , boost::asio::ip::tcp::socket socket
+               , boost::asio::ip::tcp::socket file_socket
+               , RoomRegistry& rooms
+               , ParticipantId id
+               , IoServicePool::Lease lease = IoServicePool::Lease() )
+        : ChatParticipant( id )
+        , socket_( std::move(socket) )
+        , file_socket_( std::move(file_socket) )
+        , io_strand_( io_service )
+        , io_file_strand_( io_file_service )
+        , rooms_( rooms )
+        , reading_( true )
+        , file_chunk_left_( 0 )
+        , file_parked_( false )
+        , relay_mode_( CopyRelay )
+        , file_out_writing_( false )
+        , file_out_piped_( 0 )
+        , file_out_left_( 0 )
+        , file_failed_( false )
+        , lease_( std::move(lease) )
+        { }
+
+    void start();
+    void max_frame_size( std::size_t size )
+        { reader_.max_frame_size( size ); }
+    /* caps of the chat and file queues, set before start() */
+    void outbound_limits( const QueueLimits& chat, const QueueLimits& file
+                        , MemoryBudget& budget, OverflowStats& stats )
+        {
+            write_msg_queue_.configure( chat, &budget, &stats );
+            file_read_queue_.configure( file, &budget, &stats );
+        }
+    /* set before start() */
+    void relay_mode( RelayMode mode );
+    /* how far readers of this session's files may fall behind */
+    void flow_limits( const FlowLimits& limits )
+        { flow_limits_ = limits; }
+    /* bounds of the chunks this session's files are relayed in */
+    void chunk_limits( const ChunkLimits& limits )
+        { file_sizer_ = ChunkSizer( limits ); }
+    void deliver( ptr_Message msg );
+    void file_accepted( const Message& msg, ptr_ChatParticipant sender );
+    void file_refused( const Message& msg, ptr_ChatParticipant sender );
+    void file_responses_remaining( uint64_t transfer_id, std::size_t count );
+    bool file_deliver( const std::vector<char>& frame
+                     , const ptr_TransferWindow& window );
+    std::size_t file_splice_capacity() const;
+    std::size_t file_splice( uint64_t transfer_id, SplicePipe& source
+                           , std::size_t bytes
+                           , const ptr_TransferWindow& window );
+    void file_reader_left( uint64_t transfer_id, ParticipantId reader );
+    void file_cancelled( uint64_t transfer_id );
+    void file_msg_deliver( ptr_Message msg
+                         /* , ptr_ChatParticipant sender */ );
+
+private:
+    /* a file this session is sending, from its FileStart until its stream
+     * is relayed; the window and the resume point are guarded by
+     * file_sends_mutex_, the rest belongs to io_file_strand_ */
+    struct FileSend
+    {
+        FileSend( uint64_t id, uint64_t size, const ptr_ChatRoom& room )
+            : id( id )
+            , room( room )
+            , remaining( size )
+            , responses_remaining( 0 )
+            , resume( id )
+            , resume_offered( false )
+            , accepted( false )
+            , started( false )
+            , splicing( false )
+            , splice_chunk( 0 )
+            , held_bytes( 0 )
+            { }
+
+        const uint64_t              id;
+        // the room the FileStart went to, whichever the session is in now
+        const ptr_ChatRoom          room;
+        // file bytes before the preamble, stream bytes left after it
+        std::uint64_t               remaining;
+        std::atomic< std::size_t >  responses_remaining;
+        FileResume                  resume;
+        bool                        resume_offered;
+        bool                        accepted;
+        bool                        started;
+        ptr_TransferWindow          window;
+        bool                        splicing;
+        std::size_t                 splice_chunk;
+        // frames read while the window was closed, relayed in order once
+        // it opens; the sender is paused meanwhile. File strand only
+        std::deque< std::vector<char> >  held;
+        std::size_t                 held_bytes;
+    };
+    typedef std::shared_ptr< FileSend >     ptr_FileSend;
+
+/* general communication */
+    void do_read();
+    void handle_read( const boost::system::error_code& ec
+                    , std::size_t bytes_transferred );
+    void handle_read_body( const boost::system::error_code& ec
+                         , std::size_t /*length*/
+                         /* , ptr_ChatParticipant sender */ );
+
+    void handle_empty( const boost::system::error_code& ec
+                     , std::size_t /*length*/
+                     /* , ptr_ChatParticipant sender */ );
+
+    void handle_quit( const boost::system::error_code& ec
+                    , std::size_t /*length*/
+                    /* , ptr_ChatParticipant sender */ );
+
+    void handle_join( const boost::system::error_code& ec
+                    , std::size_t /*length*/ );
+
+    void handle_part( const boost::system::error_code& ec
+                    , std::size_t /*length*/ );
+
+    void handle_unknown( const boost::system::error_code& ec
+                       , std::size_t /*length*/
+                       /* , ptr_ChatParticipant sender */ );
+
+    /* the room is switched on io_strand_ but read from the file handlers too */
+    ptr_ChatRoom room() const
+        { return std::atomic_load( &room_ ); }
+    void switch_room( const std::string& name );
+    /* transfers do not follow the session into another room: the ones it
+     * sends are cancelled, the ones it reads are left */
+    void leave_room( const ptr_ChatRoom& room );
+
+    void do_write();
+    void handle_write( const boost::system::error_code& ec
+                     , std::size_t /*length*/
+                     /* , ptr_ChatParticipant sender */ );
+    
+    void handle_error( const boost::system::error_code& ec );
+    /* slow consumer: leave the room and drop the connection */
+    void disconnect();
+
+
+/* file transfer */
+    void handle_file_start( const boost::system::error_code& ec
+                          , std::size_t /*length*/ );
+
+    void handle_file_accept( const boost::system::error_code& ec
+                           , std::size_t /*length*/ );
+
+    void handle_file_refuse( const boost::system::error_code& ec
+                           , std::size_t /*length*/ );
+
+    void handle_file_cancel( const boost::system::error_code& ec
+                              , std::size_t /*length*/ );
+
+    void handle_file_cancel_all( const boost::system::error_code& ec
+                          , std::size_t /*length*/ );
+
+    void handle_file_done( const boost::system::error_code& ec
+                         , std::size_t /*length*/ );
+
+    void handle_file_resend( const boost::system::error_code& ec
+                           , std::size_t /*length*/ );
+
+    void handle_file_repair( const boost::system::error_code& ec
+                           , std::size_t /*length*/ );
+
+    ptr_FileSend find_file_send( uint64_t transfer_id );
+    void do_file_send_start( ptr_FileSend send );
+    void do_file_cancel( ptr_FileSend send );
+    /* the sender gave up on the transfer */
+    void do_file_abort( uint64_t transfer_id );
+
+    /* the chunks of all files this session sends, read one at a time */
+    void do_file_chunk();
+    void handle_file_chunk( const boost::system::error_code& ec
+                          , std::size_t bytes_transferred );
+    void handle_file_preamble( const boost::system::error_code& ec
+                             , std::size_t bytes_transferred );
+    void do_file_send();
+    void handle_file_send( const boost::system::error_code& ec
+                         , std::size_t bytes_transferred );
+    void continue_file_send();
+    void finish_file_send( const ptr_FileSend& send );
+
+    /* a send whose window is closed is set aside, the others go on */
+    void do_file_hold();
+    void handle_file_hold( const boost::system::error_code& ec
+                         , std::size_t bytes_transferred );
+    void relay_held( const ptr_FileSend& send );
+
+    /* zero-copy relay */
+    void do_file_splice();
+    void handle_file_splice( const boost::system::error_code& ec );
+
+    /* the frames of the files this session receives */
+    OutboundQueue< FileFrame >::Result push_file_frame( FileFrame frame );
+    void purge_file_frames( uint64_t transfer_id );
+    void do_file_read();
+    void handle_file_read( const boost::system::error_code& ec
+                         , std::size_t bytes_transferred );
+    void do_file_splice_out();
+    void handle_file_splice_out( const boost::system::error_code& ec );
+    void finish_file_frame();
+
+    void handle_file_error( const boost::system::error_code& ec );
+
+    void close();
+private:
+    boost::asio::ip::tcp::socket        socket_;
+    boost::asio::ip::tcp::socket        file_socket_;
+    boost::asio::strand                 io_strand_;
+    boost::asio::strand                 io_file_strand_;
+    RoomRegistry&                       rooms_;
+    ptr_ChatRoom                        room_;
+    FrameReader                         reader_;
+    MessageView                         read_msg_;
+    bool                                reading_;
+    OutboundQueue<ptr_Message>          write_msg_queue_;
+    WriteBatch                          write_batch_;
+
+    // the files this session is sending, by transfer id
+    boost::mutex                        file_sends_mutex_;
+    std::unordered_map< uint64_t, ptr_FileSend >  file_sends_;
+    // the chunk being read from file_socket_, null when it is skipped
+    std::array< uint8_t, FileChunkHeader::Length >  file_chunk_header_;
+    ptr_FileSend                        file_send_current_;
+    std::size_t                         file_chunk_left_;
+    // waiting for the current send's window to open, its held frames full
+    bool                                file_parked_;
+    // chunk header space, then the bytes read
+    std::vector<char>                   file_send_buf_;
+    std::array< uint8_t, FileResume::PreambleLength >  file_preamble_;
+    ChunkSizer                          file_sizer_;
+    ChunkSizer::clock::time_point       file_send_started_;
+    FlowLimits                          flow_limits_;
+    RelayMode                           relay_mode_;
+    // sender side: the socket's bytes, teed to the readers
+    SplicePipe                          file_in_pipe_;
+    // reader side: the frames of every file relayed to this session and
+    // the teed bytes waiting in file_out_pipe_, guarded by file_out_mutex_
+    // as senders push from their own strands
+    boost::mutex                        file_out_mutex_;
+    OutboundQueue< FileFrame >          file_read_queue_;
+    bool                                file_out_writing_;
+    std::size_t                         file_out_piped_;
+    SplicePipe                          file_out_pipe_;
+    // spliced bytes of the frame being written, io_file_strand_ only
+    std::size_t                         file_out_left_;
+    std::atomic< bool >                 file_failed_;
+    IoServicePool::Lease                lease_;
+
+    static const HandlerTable  s_handler_table_;
+};
+/* ------------------------------------------------------------------------- */
+
+
+/* Server */
+/* ------------------------------------------------------------------------- */
+class Server
+{
+public:
+    Server( const boost::asio::ip::tcp::endpoint& endpoint 
+          , const boost::asio::ip::tcp::endpoint& file_endpoint
+          , IoServicePool::Mode mode = IoServicePool::Shared
+          , std::size_t threads = 2
+          , std::size_t file_threads = 1 )
+        : budget_( 0 )
+        , pool_( mode, threads )
+        , file_pool_( IoServicePool::Shared, file_threads )
+        , acceptor_( pool_.acceptor_service(), endpoint )
+        , file_acceptor_( file_pool_.acceptor_service(), file_endpoint )
+        , socket_( pool_.acceptor_service() )
+        , file_socket_( file_pool_.acceptor_service() )
+        , session_service_( &pool_.acceptor_service() )
+        , rooms_( pool_, file_pool_ )
+        , max_frame_size_( FrameReader::DefaultMaxFrameSize )
+        , relay_mode_( ChatSession::CopyRelay )
+        , next_session_id_( 1 )
+        {
+            // run();
+            // a client connects its chat socket first, then its file
+            // socket: handle_accept -> do_file_accept -> handle_file_accept
+            do_accept();
+        }
+
+    /* chat sessions run on pool_, file sockets and relaying on file_pool_,
+     * so bulk transfers do not hold up chat handlers */
+    void run()
+        { 
+            pool_.run();
+            file_pool_.run();
+        }
+
+    void stop()
+        {
+            pool_.stop();
+            file_pool_.stop();
+        }
+
+    ~Server()
+        {
+            pool_.join();
+            file_pool_.join();
+        }
+
+    /* where chat and file sockets are accepted, with the ports bound when
+     * 0 was asked for */
+    boost::asio::ip::tcp::endpoint endpoint() const
+        { return acceptor_.local_endpoint(); }
+    boost::asio::ip::tcp::endpoint file_endpoint() const
+        { return file_acceptor_.local_endpoint(); }
+
+    /* largest frame accepted from a client, applies to new sessions */
+    void max_frame_size( std::size_t size )
+        { max_frame_size_ = size; }
+
+    /* caps of each session's outbound chat and file queues, apply to new
+     * sessions. File chunks are never dropped, one that does not fit
+     * cancels its transfer for that session */
+    void queue_limits( const QueueLimits& limits )
+        { queue_limits_ = limits; }
+    void file_queue_limits( const QueueLimits& limits )
+        { file_queue_limits_ = limits; }
+
+    /* how far the readers of a relayed file may fall behind the sender,
+     * applies to new sessions */
+    void file_flow_limits( const FlowLimits& limits )
+        { flow_limits_ = limits; }
+
+    /* bounds of the chunks files are relayed in, applies to new sessions */
+    void file_chunk_limits( const ChunkLimits& limits )
+        { chunk_limits_ = limits; }
+
+    /* how file bytes are relayed, applies to new sessions */
+    void file_relay( ChatSession::RelayMode mode )
+        { relay_mode_ = mode; }
+
+    /* bytes all sessions may queue together, 0 is unlimited */
+    void memory_budget( std::size_t bytes )
+        { budget_.limit( bytes ); }
+    const MemoryBudget& memory_budget() const
+        { return budget_; }
+
+    const OverflowStats& overflow_stats() const
+        { return overflow_stats_; }
+
+private:
+    void do_accept();
+    void handle_accept( const boost::system::error_code& ec );
+
+    void do_file_accept();
+    void handle_file_accept( const boost::system::error_code& ec );
+
+private:
+    // outlive the pools, which destroy the sessions still queued on them
+    MemoryBudget                        budget_;
+    OverflowStats                       overflow_stats_;
+    IoServicePool                       pool_;
+    IoServicePool                       file_pool_;
+    boost::asio::ip::tcp::acceptor      acceptor_;
+    boost::asio::ip::tcp::acceptor      file_acceptor_;
+    boost::asio::ip::tcp::socket        socket_;
+    boost::asio::ip::tcp::socket        file_socket_;
+    // where the session being accepted will run
+    boost::asio::io_service*            session_service_;
+    IoServicePool::Lease                session_lease_;
+    RoomRegistry                        rooms_;
+    std::size_t                         max_frame_size_;
+    QueueLimits                         queue_limits_;
+    QueueLimits                         file_queue_limits_;
+    FlowLimits                          flow_limits_;
+    ChunkLimits                         chunk_limits_;
+    ChatSession::RelayMode              relay_mode_;
+    // only touched by the accept chain
+    ParticipantId                       next_session_id_;
+};
+/* ------------------------------------------------------------------------- */
+
+#endif /* SERVER_HPP_ */
@@ -0,0 +1,62 @@
+#ifndef SPLICEPIPE_HPP_
+#define SPLICEPIPE_HPP_
+
+#include <cstddef>
+#include <boost/system/error_code.hpp>
+
+
+/* SplicePipe -- kernel pipe that relays file bytes between descriptors
+ * with splice() and tee(), so they never enter user space. Linux only;
+ * elsewhere open() fails and callers keep to the copy path.
+ * Every call moves at most `bytes` and returns how many it did move. A
+ * call that would block sets ec to would_block, end of input sets eof. */
+/* ------------------------------------------------------------------------- */
+class SplicePipe
+{
+public:
+    enum { DefaultCapacity = 1 << 20 };
+
+    SplicePipe();
+    ~SplicePipe();
+
+    SplicePipe( const SplicePipe& ) = delete;
+    SplicePipe& operator=( const SplicePipe& ) = delete;
+
+    /* the kernel may grant less than `capacity`, see capacity() */
+    bool open( std::size_t capacity = DefaultCapacity );
+    void close();
+    bool is_open() const
+        { return read_fd_ != -1; }
+    std::size_t capacity() const
+        { return capacity_; }
+    /* what `capacity` bytes of pipe surely hold of bytes spliced from the
+     * socket `fd`: the kernel counts a slot per buffer, not bytes, and a
+     * buffer may hold no more than a segment */
+    static std::size_t socket_capacity( std::size_t capacity, int fd );
+
+    /* fd -> pipe */
+    std::size_t splice_from( int fd, std::size_t bytes
+                           , boost::system::error_code& ec );
+    /* copy the front of this pipe into `dst`, leaving it here */
+    std::size_t tee_to( SplicePipe& dst, std::size_t bytes
+                      , boost::system::error_code& ec );
+    /* pipe -> fd */
+    std::size_t splice_to( int fd, std::size_t bytes
+                         , boost::system::error_code& ec );
+    /* user memory -> pipe, for the odd few bytes the relay adds itself */
+    std::size_t write( const void* data, std::size_t bytes
+                     , boost::system::error_code& ec );
+    /* pipe -> user memory, for readers that can not take a tee */
+    std::size_t read( void* data, std::size_t bytes
+                    , boost::system::error_code& ec );
+    /* drop the front of the pipe */
+    std::size_t discard( std::size_t bytes, boost::system::error_code& ec );
+
+private:
+    int             read_fd_;
+    int             write_fd_;
+    std::size_t     capacity_;
+};
+/* ------------------------------------------------------------------------- */
+
+#endif /* SPLICEPIPE_HPP_ */
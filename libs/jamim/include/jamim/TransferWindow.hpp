@@ -0,0 +1,103 @@
+#ifndef TRANSFERWINDOW_HPP_
+#define TRANSFERWINDOW_HPP_
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include "ParticipantTable.hpp"
+
+
+/* FlowLimits -- how far the readers of a relayed file may fall behind.
+ *  window:      bytes a reader may have queued and still let the sender go on
+ *  quorum:      readers that must be within the window for the sender to
+ *               read the next chunk, 0 means all of them
+ *  drop_behind: a reader this many bytes behind is cancelled and dropped
+ *               from the transfer. 0 never drops one while every reader
+ *               holds the sender; with a quorum it is DefaultDropWindows
+ *               windows, nothing else would stop a reader left behind */
+/* ------------------------------------------------------------------------- */
+struct FlowLimits
+{
+    enum { DefaultDropWindows = 2 };
+
+    FlowLimits( std::size_t window = 1 << 20
+              , std::size_t quorum = 0
+              , std::size_t drop_behind = 0 )
+        : window( window )
+        , quorum( quorum )
+        , drop_behind( drop_behind )
+        { }
+
+    /* bytes behind that drop a reader, 0 for never */
+    std::size_t drop_limit() const
+        {
+            if( drop_behind != 0 || quorum == 0 ){
+                return drop_behind;
+            }
+            return DefaultDropWindows * window;
+        }
+
+    std::size_t     window;
+    std::size_t     quorum;
+    std::size_t     drop_behind;
+};
+/* ------------------------------------------------------------------------- */
+
+
+/* TransferWindow -- credit accounting of one relayed file.
+ * The sender charges every chunk to all readers before handing it out,
+ * a reader credits the bytes that left its queue. When the window is
+ * closed acquire() parks the sender, and the credit that reopens it calls
+ * `resume` once, outside the lock. Called from the sender's and the
+ * readers' strands. */
+/* ------------------------------------------------------------------------- */
+class TransferWindow
+{
+public:
+    typedef std::function< void() >     Resume;
+
+    TransferWindow( const FlowLimits& limits, Resume resume );
+
+    TransferWindow( const TransferWindow& ) = delete;
+    TransferWindow& operator=( const TransferWindow& ) = delete;
+
+    void add_reader( ParticipantId reader );
+    void remove_reader( ParticipantId reader );
+
+    /* charge `bytes` to every reader; the readers now past drop_limit() are
+     * removed and returned, for the sender to cancel */
+    std::vector< ParticipantId > sent( std::size_t bytes );
+    /* `bytes` left the reader's queue */
+    void written( ParticipantId reader, std::size_t bytes );
+
+    /* true when the sender may read the next chunk, otherwise `resume` is
+     * called once it may */
+    bool acquire();
+
+    std::size_t behind( ParticipantId reader ) const;
+    std::size_t reader_count() const;
+    const FlowLimits& limits() const
+        { return limits_; }
+
+private:
+    bool open() const;
+    void erase_reader( ParticipantId reader );
+    void resume_if_open( boost::mutex::scoped_lock& lk );
+
+private:
+    const FlowLimits                    limits_;
+    const Resume                        resume_;
+    mutable boost::mutex                mutex_;
+    ParticipantTable< std::size_t >     backlog_;
+    // readers less than a window behind, kept as the backlogs change so
+    // acquire() and written() do not walk the readers
+    std::size_t                         within_;
+    bool                                parked_;
+};
+
+typedef std::shared_ptr< TransferWindow >   ptr_TransferWindow;
+/* ------------------------------------------------------------------------- */
+
+#endif /* TRANSFERWINDOW_HPP_ */
@@ -0,0 +1,74 @@
+#ifndef WRITEBATCH_HPP_
+#define WRITEBATCH_HPP_
+
+#include <cstddef>
+#include <vector>
+#include <boost/asio.hpp>
+#include "Message.hpp"
+
+
+inline boost::asio::const_buffer frame_buffer( const Message& msg )
+{
+    return boost::asio::const_buffer( msg.data(), msg.total_length() );
+}
+
+inline boost::asio::const_buffer frame_buffer( const ptr_Message& msg )
+{
+    return frame_buffer( *msg );
+}
+
+
+/* WriteBatch -- gathers the front of an outbound queue into a single
+ * buffer sequence, so a backed-up queue goes out in one gathered write.
+ * A batch is capped by bytes and by buffer count; the first frame is
+ * always taken. */
+/* ------------------------------------------------------------------------- */
+class WriteBatch
+{
+public:
+    enum { MaxBytes = 1 << 18, MaxBuffers = 64 };
+
+    typedef std::vector< boost::asio::const_buffer >    buffers_type;
+
+    WriteBatch()
+        : count_( 0 )
+        { buffers_.reserve( MaxBuffers ); }
+
+    template< typename Queue >
+    const buffers_type& gather( const Queue& queue )
+        {
+            buffers_.clear();
+            std::size_t bytes = 0;
+            for( const auto& msg : queue ){
+                boost::asio::const_buffer buffer = frame_buffer( msg );
+                const std::size_t size = boost::asio::buffer_size( buffer );
+                if( !buffers_.empty()
+                    && ( buffers_.size() == MaxBuffers || bytes + size > MaxBytes ) ){
+                    break;
+                }
+                buffers_.push_back( buffer );
+                bytes += size;
+            }
+            count_ = buffers_.size();
+            return buffers_;
+        }
+
+    /* number of frames in the batch currently being written */
+    std::size_t count() const
+        { return count_; }
+
+    template< typename Queue >
+    void complete( Queue& queue )
+        {
+            queue.erase( queue.begin(), queue.begin() + count_ );
+            buffers_.clear();
+            count_ = 0;
+        }
+
+private:
+    buffers_type    buffers_;
+    std::size_t     count_;
+};
+/* ------------------------------------------------------------------------- */
+
+#endif /* WRITEBATCH_HPP_ */
@@ -0,0 +1,87 @@
+#include "BufferPool.hpp"
+#include <new>
+
+
+const std::array< std::size_t, BufferPool::ClassCount >
+BufferPool::s_class_sizes_{ { 64, 512, 4096, 65536 } };
+
+/* maximum number of cached blocks per class, roughly 4MB per thread */
+const std::array< std::size_t, BufferPool::ClassCount >
+BufferPool::s_class_limits_{ { 4096, 1024, 256, 32 } };
+
+
+BufferPool::BufferPool()
+    : stats_()
+{
+}
+
+BufferPool::~BufferPool()
+{
+    for( auto& free_list : free_lists_ ){
+        for( void* block : free_list ){
+            ::operator delete( block );
+        }
+    }
+}
+
+BufferPool& BufferPool::local()
+{
+    static thread_local BufferPool pool;
+    return pool;
+}
+
+std::size_t BufferPool::class_index( std::size_t size )
+{
+    std::size_t index = 0;
+    while( index < ClassCount && s_class_sizes_[index] < size ){
+        ++index;
+    }
+    return index;
+}
+
+void* BufferPool::allocate( std::size_t size )
+{
+    BufferPool& pool = local();
+    const std::size_t index = class_index( size );
+    if( index == ClassCount ){
+        ++pool.stats_.oversize;
+        ++pool.stats_.heap_allocations;
+        return ::operator new( size );
+    }
+
+    auto& free_list = pool.free_lists_[index];
+    if( !free_list.empty() ){
+        void* block = free_list.back();
+        free_list.pop_back();
+        ++pool.stats_.pool_allocations;
+        return block;
+    }
+    ++pool.stats_.heap_allocations;
+    return ::operator new( s_class_sizes_[index] );
+}
+
+void BufferPool::deallocate( void* block, std::size_t size )
+{
+    if( !block ){
+        return;
+    }
+    BufferPool& pool = local();
+    const std::size_t index = class_index( size );
+    if( index == ClassCount
+        || pool.free_lists_[index].size() >= s_class_limits_[index] ){
+        ::operator delete( block );
+        return;
+    }
+    ++pool.stats_.releases;
+    pool.free_lists_[index].push_back( block );
+}
+
+const BufferPool::Stats& BufferPool::stats()
+{
+    return local().stats_;
+}
+
+void BufferPool::reset_stats()
+{
+    local().stats_ = Stats();
+}
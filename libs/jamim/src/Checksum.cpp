@@ -0,0 +1,245 @@
+#include "Checksum.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#if defined(__x86_64__) && ( defined(__GNUC__) || defined(__clang__) )
+#include <nmmintrin.h>
+#define JAMIM_CRC32C_SSE42
+#endif
+
+
+namespace
+{
+
+/* reflected Castagnoli polynomial */
+const std::uint32_t Polynomial = 0x82F63B78;
+
+typedef std::array< std::array< std::uint32_t, 256 >, 8 >  SliceTable;
+
+/* table[0] is the byte at a time table, table[k] advances it k more
+ * zero bytes */
+SliceTable make_table()
+{
+    SliceTable table;
+    for( std::uint32_t i = 0; i < 256; ++i ){
+        std::uint32_t crc = i;
+        for( int bit = 0; bit < 8; ++bit ){
+            crc = ( crc >> 1 ) ^ ( ( crc & 1 ) ? Polynomial : 0 );
+        }
+        table[0][i] = crc;
+    }
+    for( std::uint32_t i = 0; i < 256; ++i ){
+        for( std::size_t k = 1; k < table.size(); ++k ){
+            const std::uint32_t prev = table[k-1][i];
+            table[k][i] = ( prev >> 8 ) ^ table[0][prev & 0xFF];
+        }
+    }
+    return table;
+}
+
+const SliceTable s_table = make_table();
+
+/* a * b modulo the polynomial, reflected; `a` must not be 0 */
+std::uint32_t multmodp( std::uint32_t a, std::uint32_t b )
+{
+    std::uint32_t m = 1u << 31;
+    std::uint32_t p = 0;
+    for( ;; ){
+        if( a & m ){
+            p ^= b;
+            if( ( a & ( m - 1 ) ) == 0 ){
+                break;
+            }
+        }
+        m >>= 1;
+        b = ( b & 1 ) ? ( b >> 1 ) ^ Polynomial : b >> 1;
+    }
+    return p;
+}
+
+/* x^(2^k) modulo the polynomial */
+std::array< std::uint32_t, 32 > make_x2n_table()
+{
+    std::array< std::uint32_t, 32 > table;
+    std::uint32_t p = 1u << 30;     // x^1
+    table[0] = p;
+    for( std::size_t k = 1; k < table.size(); ++k ){
+        p = multmodp( p, p );
+        table[k] = p;
+    }
+    return table;
+}
+
+const std::array< std::uint32_t, 32 > s_x2n_table = make_x2n_table();
+
+/* x^(8n) modulo the polynomial: appending n zero bytes */
+std::uint32_t x8nmodp( std::uint64_t n )
+{
+    std::uint32_t xp = 1u << 31;    // x^0
+    for( unsigned k = 3; n != 0; n >>= 1, ++k ){
+        if( n & 1 ){
+            xp = multmodp( s_x2n_table[k & 31], xp );
+        }
+    }
+    return xp;
+}
+
+/* raw state, neither inverted on the way in nor out */
+std::uint32_t crc32c_table( std::uint32_t crc, const unsigned char* p
+                          , std::size_t bytes )
+{
+    const SliceTable& t = s_table;
+    for( ; bytes >= 8; bytes -= 8, p += 8 ){
+        crc ^= static_cast<std::uint32_t>( p[0] )
+             | static_cast<std::uint32_t>( p[1] ) << 8
+             | static_cast<std::uint32_t>( p[2] ) << 16
+             | static_cast<std::uint32_t>( p[3] ) << 24;
+        crc = t[7][crc & 0xFF] ^ t[6][( crc >> 8 ) & 0xFF]
+            ^ t[5][( crc >> 16 ) & 0xFF] ^ t[4][crc >> 24]
+            ^ t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+    }
+    while( bytes-- ){
+        crc = t[0][( crc ^ *p++ ) & 0xFF] ^ ( crc >> 8 );
+    }
+    return crc;
+}
+
+#ifdef JAMIM_CRC32C_SSE42
+/* lane lengths of the interleaved loops; the crc32 instruction has a
+ * latency of three and a throughput of one, so three independent lanes
+ * keep it busy, and are then shifted into place */
+const std::size_t LongLane = 8192;
+const std::size_t ShortLane = 256;
+const std::uint32_t s_long_shift = x8nmodp( LongLane );
+const std::uint32_t s_short_shift = x8nmodp( ShortLane );
+
+inline std::uint64_t load64( const unsigned char* p )
+{
+    std::uint64_t word;
+    std::memcpy( &word, p, sizeof(word) );
+    return word;
+}
+
+__attribute__(( target( "sse4.2" ) ))
+std::uint32_t crc32c_sse42( std::uint32_t crc, const unsigned char* p
+                          , std::size_t bytes )
+{
+    std::uint64_t crc0 = crc;
+    while( bytes != 0 && ( reinterpret_cast<std::uintptr_t>( p ) & 7 ) != 0 ){
+        crc0 = _mm_crc32_u8( static_cast<std::uint32_t>( crc0 ), *p++ );
+        --bytes;
+    }
+    const std::size_t lanes[] = { LongLane, ShortLane };
+    const std::uint32_t shifts[] = { s_long_shift, s_short_shift };
+    for( int i = 0; i < 2; ++i ){
+        const std::size_t lane = lanes[i];
+        for( ; bytes >= 3 * lane; bytes -= 3 * lane ){
+            std::uint64_t crc1 = 0;
+            std::uint64_t crc2 = 0;
+            const unsigned char* const end = p + lane;
+            do{
+                crc0 = _mm_crc32_u64( crc0, load64( p ) );
+                crc1 = _mm_crc32_u64( crc1, load64( p + lane ) );
+                crc2 = _mm_crc32_u64( crc2, load64( p + 2 * lane ) );
+                p += 8;
+            } while( p != end );
+            crc0 = multmodp( shifts[i], static_cast<std::uint32_t>( crc0 ) ) ^ crc1;
+            crc0 = multmodp( shifts[i], static_cast<std::uint32_t>( crc0 ) ) ^ crc2;
+            p += 2 * lane;
+        }
+    }
+    for( ; bytes >= 8; bytes -= 8, p += 8 ){
+        crc0 = _mm_crc32_u64( crc0, load64( p ) );
+    }
+    while( bytes-- ){
+        crc0 = _mm_crc32_u8( static_cast<std::uint32_t>( crc0 ), *p++ );
+    }
+    return static_cast<std::uint32_t>( crc0 );
+}
+#endif /* JAMIM_CRC32C_SSE42 */
+
+typedef std::uint32_t (*Crc32cFunction)( std::uint32_t, const unsigned char*
+                                       , std::size_t );
+
+Crc32cFunction select_crc32c()
+{
+    #ifdef JAMIM_CRC32C_SSE42
+    if( __builtin_cpu_supports( "sse4.2" ) ){
+        return crc32c_sse42;
+    }
+    #endif /* JAMIM_CRC32C_SSE42 */
+    return crc32c_table;
+}
+
+const Crc32cFunction s_crc32c = select_crc32c();
+
+} // namespace
+
+
+std::uint32_t crc32c( std::uint32_t crc, const void* data, std::size_t bytes )
+{
+    return ~s_crc32c( ~crc, static_cast<const unsigned char*>( data ), bytes );
+}
+
+std::uint32_t crc32c_portable( std::uint32_t crc, const void* data, std::size_t bytes )
+{
+    return ~crc32c_table( ~crc, static_cast<const unsigned char*>( data ), bytes );
+}
+
+bool crc32c_hardware()
+{
+    return s_crc32c != crc32c_table;
+}
+
+std::uint32_t crc32c_combine( std::uint32_t crc_a, std::uint32_t crc_b
+                            , std::uint64_t bytes_b )
+{
+    return multmodp( x8nmodp( bytes_b ), crc_a ) ^ crc_b;
+}
+
+
+/* BlockChecksums */
+/* ------------------------------------------------------------------------- */
+BlockChecksums::BlockChecksums( std::size_t block )
+    : block_( block )
+    , current_( 0 )
+    , filled_( 0 )
+    , completed_( 0 )
+    , bytes_( 0 )
+{
+}
+
+void BlockChecksums::reset( std::uint32_t prefix )
+{
+    current_ = 0;
+    filled_ = 0;
+    completed_ = prefix;
+    bytes_ = 0;
+}
+
+std::size_t BlockChecksums::update( const void* data, std::size_t bytes )
+{
+    const std::size_t take = std::min( bytes, block_ - filled_ );
+    current_ = crc32c( current_, data, take );
+    filled_ += take;
+    bytes_ += take;
+    return take;
+}
+
+std::uint32_t BlockChecksums::end_block()
+{
+    const std::uint32_t crc = current_;
+    if( filled_ != 0 ){
+        completed_ = crc32c_combine( completed_, current_, filled_ );
+    }
+    current_ = 0;
+    filled_ = 0;
+    return crc;
+}
+
+std::uint32_t BlockChecksums::whole() const
+{
+    return ( filled_ != 0 ) ? crc32c_combine( completed_, current_, filled_ )
+                            : completed_;
+}
+/* ------------------------------------------------------------------------- */
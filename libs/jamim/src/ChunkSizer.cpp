@@ -0,0 +1,76 @@
+#include "ChunkSizer.hpp"
+#include <algorithm>
+#ifdef __linux__
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif /* __linux__ */
+
+
+namespace
+{
+
+const std::size_t PageSize = 4096;
+// weight of the newest sample in the smoothed throughput
+const double SampleWeight = 0.25;
+
+} // namespace
+
+
+ChunkSizer::ChunkSizer( const ChunkLimits& limits )
+    : limits_( limits )
+{
+    reset();
+}
+
+void ChunkSizer::reset()
+{
+    chunk_ = std::max( limits_.min, std::min( limits_.initial, limits_.max ) );
+    throughput_ = 0;
+    rtt_ = std::chrono::microseconds( 0 );
+}
+
+void ChunkSizer::record( std::size_t bytes, clock::duration elapsed )
+{
+    const double seconds = std::chrono::duration<double>( elapsed ).count();
+    if( bytes == 0 || seconds <= 0 ){
+        return;
+    }
+    const double sample = bytes / seconds;
+    throughput_ = ( throughput_ == 0 ) ? sample
+                : throughput_ + SampleWeight * ( sample - throughput_ );
+    resize();
+}
+
+void ChunkSizer::rtt( std::chrono::microseconds rtt )
+{
+    rtt_ = rtt;
+    resize();
+}
+
+void ChunkSizer::resize()
+{
+    if( throughput_ == 0 ){
+        return;
+    }
+    const std::chrono::microseconds delay = ( rtt_.count() > 0 ) ? rtt_ : limits_.period;
+    const double bdp = throughput_ * std::chrono::duration<double>( delay ).count();
+    const double capped = std::min( bdp, static_cast<double>( limits_.max ) );
+    const std::size_t pages = ( static_cast<std::size_t>( capped ) + PageSize - 1 ) / PageSize;
+    chunk_ = std::max( limits_.min, std::min( pages * PageSize, limits_.max ) );
+}
+
+
+std::chrono::microseconds tcp_rtt( int fd )
+{
+    #ifdef __linux__
+    struct tcp_info info;
+    socklen_t length = sizeof( info );
+    if( ::getsockopt( fd, IPPROTO_TCP, TCP_INFO, &info, &length ) == 0 ){
+        return std::chrono::microseconds( info.tcpi_rtt );
+    }
+    #else
+    (void)fd;
+    #endif /* __linux__ */
+    return std::chrono::microseconds( 0 );
+}
@@ -1,4 +1,7 @@
 #include "Client.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <boost/filesystem.hpp>
@@ -7,20 +10,84 @@
 static boost::mutex debug_mutex;
 namespace fs = boost::filesystem;
 
+namespace
+{
+
+/* Identifies this version of the file: FNV-1a over its absolute path,
+ * size and modification time. Never 0, which stands for no id */
+uint64_t transfer_id_of( const fs::path& path, uint64_t size )
+{
+    boost::system::error_code ec;
+    const std::string key = fs::absolute( path ).string()
+                          + '\0' + std::to_string( size )
+                          + '\0' + std::to_string( fs::last_write_time( path, ec ) );
+    uint64_t hash = 14695981039346656037ULL;
+    for( const char c : key ){
+        hash = ( hash ^ static_cast<uint8_t>( c ) ) * 1099511628211ULL;
+    }
+    return hash ? hash : 1;
+}
+
+/* CRC32C of the first `bytes` of `path`, false if it is shorter */
+bool prefix_crc( const std::string& path, uint64_t bytes, uint32_t& crc )
+{
+    std::ifstream file( path, std::ios_base::binary );
+    std::vector<char> buf( static_cast<std::size_t>(
+                               std::min<uint64_t>( bytes, FileSender::DefaultChunk ) ) );
+    crc = 0;
+    while( 0 < bytes ){
+        const std::size_t take = static_cast<std::size_t>(
+                                     std::min<uint64_t>( bytes, buf.size() ) );
+        if( !file.read( buf.data(), take ) ){
+            return false;
+        }
+        crc = crc32c( crc, buf.data(), take );
+        bytes -= take;
+    }
+    return true;
+}
+
+/* The prefix of `path` left by an interrupted transfer `transfer_id`; it
+ * is hashed again, so what did not reach the disk is not offered */
+bool resume_offer( const std::string& path, uint64_t transfer_id, uint64_t size
+                 , FileResume& offer )
+{
+    FileCheckpoint::Record record;
+    uint32_t crc = 0;
+    if( transfer_id == 0
+     || !FileCheckpoint::load( path, record )
+     || record.transfer_id != transfer_id || record.size != size
+     || !prefix_crc( path, record.received, crc ) || crc != record.crc ){
+        return false;
+    }
+    offer = FileResume( transfer_id, record.received, record.crc );
+    return true;
+}
+
+} // namespace
+
 /* Client */
 /* ------------------------------------------------------------------------- */
 
 /* static variables */
-const std::unordered_map<MessageType, Client::Handler>  Client::s_handler_map_{
-      { MessageType::EmptyMsg         , &Client::handle_empty }
-    , { MessageType::ChatMsg          , &Client::handle_chat_message }
-    , { MessageType::CmdQuit          , &Client::handle_quit }
-    , { MessageType::FileCancel       , &Client::handle_file_cancel }
-    , { MessageType::FileCancelAll    , &Client::handle_file_cancel_all }
-    , { MessageType::FileStart        , &Client::handle_file_read_start }
-    , { MessageType::FileDone         , &Client::handle_file_done }
-    , { MessageType::Unknown          , &Client::handle_unknown }
-};
+typedef Dispatch< Client::Handler >  ClientDispatch;
+
+constexpr Client::HandlerTable  Client::s_handler_table_ =
+    ClientDispatch::make_table< &Client::handle_unknown
+    , ClientDispatch::On< MessageType::EmptyMsg      , &Client::handle_empty >
+    , ClientDispatch::On< MessageType::ChatMsg       , &Client::handle_chat_message >
+    , ClientDispatch::On< MessageType::CmdQuit       , &Client::handle_quit >
+    , ClientDispatch::On< MessageType::FileCancel    , &Client::handle_file_cancel >
+    , ClientDispatch::On< MessageType::FileCancelAll , &Client::handle_file_cancel_all >
+    , ClientDispatch::On< MessageType::FileStart     , &Client::handle_file_read_start >
+    , ClientDispatch::On< MessageType::FileAccept    , &Client::handle_file_accept >
+    , ClientDispatch::On< MessageType::FileRefuse    , &Client::handle_file_refuse >
+    , ClientDispatch::On< MessageType::FileDone      , &Client::handle_file_done >
+    , ClientDispatch::On< MessageType::FileResend    , &Client::handle_file_resend >
+    , ClientDispatch::On< MessageType::FileRepair    , &Client::handle_file_repair >
+    , ClientDispatch::On< MessageType::FilePause     , &Client::handle_file_pause >
+    , ClientDispatch::On< MessageType::FileContinue  , &Client::handle_file_continue >
+    >();
 
 /* public */
 void Client::write( const Message& msg )
@@ -60,16 +127,9 @@ void Client::start_file( const Message& msg )
                   << file_size( filepath ) << std::endl;
         #endif /* NDEBUG */
 
-        // do_start_file()
-        io_file_strand_.post(
-            [this,filepath]()
-            {
-                bool write_in_progress = !file_queue_.empty();
-                file_queue_.push_back( filepath );
-                if( !write_in_progress ){
-                    do_file_send_start();
-                }
-            });
+        // files are read on the file io_service
+        io_file_strand_.post( boost::bind( &Client::do_file_send_start, this
+                                         , filepath ) );
     }
     else{
         boost::mutex::scoped_lock lk(debug_mutex);
@@ -86,6 +146,7 @@ void Client::close()
     #endif /* NDEBUG */
 
     io_strand_.post( [this](){ socket_.close(); } );
+    io_file_strand_.post( [this](){ file_socket_.close(); } );
 }
 
 /* private */
@@ -119,7 +180,7 @@ void Client::handle_connect( const boost::system::error_code& ec
 
     if( !ec ){
         std::cout << "[Connected]" << std::endl;
-        do_read_header();
+        do_read();
     }
 }
 
@@ -148,53 +209,54 @@ void Client::handle_file_connect( const boost::system::error_code& ec
     }
     }
     #endif /* NDEBUG */
+
+    if( !ec ){
+        // chunks of files sent to this client may arrive from now on
+        io_file_strand_.post( boost::bind( &Client::do_file_read, this ) );
+    }
 }
 /* ------------------------------------------------------------------------- */
 
 /* general communitaction */
 /* ------------------------------------------------------------------------- */
-void Client::do_read_header()
+void Client::do_read()
 {
-    boost::asio::async_read( socket_
-        , boost::asio::buffer( read_msg_.data(), read_msg_.header_length() )
+    socket_.async_read_some( reader_.prepare()
         , io_strand_.wrap(
-            boost::bind( &Client::handle_read_header, this
+            boost::bind( &Client::handle_read, this
                        , boost::asio::placeholders::error
                        , boost::asio::placeholders::bytes_transferred )
         ));
 }
-void Client::handle_read_header( const boost::system::error_code& ec
-                               , std::size_t /*length*/ )
+
+/* Dispatch every complete frame that arrived with this read */
+void Client::handle_read( const boost::system::error_code& ec
+                        , std::size_t bytes_transferred )
 {
     if( !ec ){
-        read_msg_.sync();
-        do_read_body();
+        reader_.commit( bytes_transferred );
+        boost::system::error_code frame_ec;
+        while( reader_.next( read_msg_, frame_ec ) ){
+            Handler handler = s_handler_table_[ read_msg_.msg_type() ];
+            (this->*handler)( frame_ec, read_msg_.body_length() );
+        }
+        if( frame_ec ){
+            handle_error( frame_ec );
+        }
+        else{
+            do_read();
+        }
     }
     else{
         handle_error( ec );
     }
 }
 
-void Client::do_read_body()
-{
-    auto it = s_handler_map_.find( read_msg_.msg_type() );
-    Handler handler = ( (it!=s_handler_map_.end()) ? it->second 
-                                                   : &Client::handle_unknown );
-    boost::asio::async_read( socket_
-        , boost::asio::buffer( read_msg_.msg_body(), read_msg_.body_length() )
-        , io_strand_.wrap(
-            boost::bind( handler, this
-                       , boost::asio::placeholders::error
-                       , boost::asio::placeholders::bytes_transferred )
-        ));
-}
-
 void Client::handle_chat_message( const boost::system::error_code& ec
                              , std::size_t /*length*/ )
 {
     if( !ec ){
         std::cout << read_msg_ << std::endl;
-        do_read_header();
     }
     else{
         handle_error( ec );
@@ -216,7 +278,6 @@ void Client::handle_quit( const boost::system::error_code& ec
 {
     if( !ec ){
         std::cout << read_msg_ << std::endl;
-        do_read_header();
     }
     else{
         handle_error( ec );
@@ -227,25 +288,23 @@ void Client::handle_unknown(const boost::system::error_code& /*ec*/
                            , std::size_t /*length*/)
 {
     std::cout << "[Unknown message type] " << read_msg_ << std::endl;
-    do_read_header();
 }
 
 void Client::do_write()
 {
     boost::asio::async_write( socket_
-        , boost::asio::buffer( write_msg_queue_.front().data()
-                             , write_msg_queue_.front().total_length())
+        , write_batch_.gather( write_msg_queue_ )
         , io_strand_.wrap(
             boost::bind( &Client::handle_write, this
                        , boost::asio::placeholders::error
-                       , boost::asio::placeholders::iterator )
+                       , boost::asio::placeholders::bytes_transferred )
         ));
 }
 void Client::handle_write( const boost::system::error_code& ec
                          , std::size_t /*length*/ )
 {
     if( !ec ){
-        write_msg_queue_.pop_front();
+        write_batch_.complete( write_msg_queue_ );
         if( !write_msg_queue_.empty() ){
             do_write();
         }
@@ -264,12 +323,9 @@ void Client::handle_error( const boost::system::error_code& ec )
 
 /* file transfer */
 /* ------------------------------------------------------------------------- */
-void Client::do_start_file()
-{
-
-}
-
-void Client::do_file_send_start()
+/* Announce the file; any number of them may be in flight at once, each
+ * under its own transfer id */
+void Client::do_file_send_start( const fs::path& path )
 {
     #ifndef NDEBUG
     { boost::mutex::scoped_lock lk(debug_mutex);
@@ -278,131 +334,436 @@ void Client::do_file_send_start()
     }
     #endif /* NDEBUG */
 
-    write( make_file_message( file_size(file_queue_.front())
-                            , file_queue_.front().string() ) );
-    // wait for the file transfer to be accepted on the receiving end
-    boost::asio::async_read( file_socket_
-        , boost::asio::buffer( file_msg_.data(), file_msg_.header_length() )
-        , io_file_strand_.wrap(
-            boost::bind( &Client::handle_file_send_start, this
-                       , boost::asio::placeholders::error
-                       , boost::asio::placeholders::bytes_transferred )
-        ));
+    boost::system::error_code ec;
+    const uint64_t size = fs::file_size( path, ec );
+    if( ec ){
+        boost::mutex::scoped_lock lk(debug_mutex);
+        std::cout << "[Error: File " << path << " can not be read.]" << std::endl;
+        return;
+    }
+    const uint64_t transfer_id = transfer_id_of( path, size );
+    if( file_sends_.count( transfer_id ) != 0 ){
+        boost::mutex::scoped_lock lk(debug_mutex);
+        std::cout << "[File " << path << " is already being sent.]" << std::endl;
+        return;
+    }
+    file_sends_[transfer_id] = std::make_shared< FileSend >( transfer_id, path, size );
+    // the server answers on the chat socket -> handle_file_accept()
+    write( make_file_message( size, path.string(), transfer_id ) );
 }
 
-void Client::handle_file_send_start( const boost::system::error_code& ec
-                              , std::size_t /*length*/ )
+void Client::handle_file_accept( const boost::system::error_code& ec
+                               , std::size_t /*length*/ )
 {
     if( !ec ){
-        file_msg_.sync();
-        if( MessageType::FileAccept == file_msg_.msg_type() ){
-            do_file_send();
+        // the readers' resume offer, files are read on the file io_service
+        io_file_strand_.post( boost::bind( &Client::do_file_accept, this
+            , file_resume( read_msg_.msg_body(), read_msg_.body_length() ) ) );
+    }
+    else{
+        handle_error( ec );
+    }
+}
+
+/* Tell the readers where the data starts: the offset they offered when
+ * this file still begins with what they hold, 0 otherwise */
+void Client::do_file_accept( const FileResume& offer )
+{
+    auto it = file_sends_.find( offer.transfer_id );
+    if( it == file_sends_.end() || it->second->phase != FileSend::Awaiting ){
+        return;
+    }
+    FileSend& send = *it->second;
+    send.start = resume_offset( send, offer );
+    send.unread = send.size - send.start;
+    send.checksums.reset( send.prefix_crc );
+    if( 0 < sendfile_chunk_
+     && send.sender.open( send.path.string(), send.size )
+     && send.sender.seek( send.start ) ){
+        boost::system::error_code ec;
+        file_socket_.native_non_blocking( true, ec );
+        if( ec ){
+            send.sender.close();
         }
-        else{
-            boost::mutex::scoped_lock lk(debug_mutex);
-            std::cout << "[File transfer refused " << file_queue_.front() 
-                      << "]" << std::endl;
-            file_queue_.pop_front();
-            if( !file_queue_.empty() ){
-                do_file_send_start();
+    }
+    else{
+        send.sender.close();
+    }
+    if( !send.sender.is_open() ){
+        send.file.open( send.path.string(), std::ios_base::binary );
+        send.file.seekg( static_cast<std::streamoff>( send.start ) );
+        if( !send.file ){
+            #ifndef NDEBUG
+            { boost::mutex::scoped_lock lk(debug_mutex);
+                std::cout << "Failed to open the file " << send.path
+                          << std::endl;
             }
+            #endif /* NDEBUG */
+            handle_file_send_error( it->second );
+            return;
+        }
+    }
+    send.phase = FileSend::Preamble;
+    send_ready_.push_back( send.id );
+    if( !send_writing_ ){
+        do_file_send();
+    }
+}
+
+uint64_t Client::resume_offset( FileSend& send, const FileResume& offer )
+{
+    uint32_t crc = 0;
+    if( offer.transfer_id != send.id
+     || offer.offset == 0 || offer.offset > send.size
+     || !prefix_crc( send.path.string(), offer.offset, crc )
+     || crc != offer.prefix_crc ){
+        return 0;
+    }
+    send.prefix_crc = crc;
+    boost::mutex::scoped_lock lk(debug_mutex);
+    std::cout << "[Resuming " << send.path << " at "
+              << offer.offset << " bytes]" << std::endl;
+    return offer.offset;
+}
+
+void Client::handle_file_refuse( const boost::system::error_code& ec
+                               , std::size_t /*length*/ )
+{
+    if( !ec ){
+        const std::string reason( file_control_reason( read_msg_.msg_body()
+                                                     , read_msg_.body_length() ) );
+        if( !reason.empty() ){
+            std::cout << reason << std::endl;
         }
+        io_file_strand_.post( boost::bind( &Client::do_file_refuse, this
+            , file_control_id( read_msg_.msg_body(), read_msg_.body_length() ) ) );
     }
     else{
-        #ifndef NDEBUG
-        {   boost::mutex::scoped_lock lk(debug_mutex);
-            std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
+        handle_error( ec );
+    }
+}
+
+void Client::do_file_refuse( uint64_t transfer_id )
+{
+    auto it = file_sends_.find( transfer_id );
+    if( it == file_sends_.end() ){
+        return;
+    }
+    {   boost::mutex::scoped_lock lk(debug_mutex);
+        std::cout << "[File transfer refused " << it->second->path
+                  << "]" << std::endl;
+    }
+    file_sends_.erase( it );
+}
+
+/* The next chunk of the file whose turn it is: its preamble, a slice of
+ * its data or a checksum. A slice ends at a block boundary, the block's
+ * CRC follows it; the last one carries the whole file's too. Files take
+ * turns chunk by chunk, so a large file does not hold up the others, and
+ * a paused one sits out until the server lets it continue. */
+bool Client::prepare_send_frame( SendFrame& frame )
+{
+    while( !send_ready_.empty() ){
+        const uint64_t transfer_id = send_ready_.front();
+        send_ready_.pop_front();
+        auto it = file_sends_.find( transfer_id );
+        if( it == file_sends_.end() ){
+            continue;
         }
-        #endif /* NDEBUG */
+        const ptr_FileSend& send = it->second;
+        if( send->paused ){
+            send->waiting = true;
+            continue;
+        }
+        frame.send = send;
+        frame.sendfile = 0;
+        frame.last = false;
+        std::size_t length = 0;
+        switch( send->phase ){
+        case FileSend::Preamble:
+            length = FileResume::PreambleLength;
+            frame.data.resize( FileChunkHeader::Length + length );
+            put_uint64( reinterpret_cast<uint8_t*>( &frame.data[FileChunkHeader::Length] )
+                      , send->start );
+            send->phase = ( send->unread != 0 ) ? FileSend::Data : FileSend::Checksum;
+            break;
+        case FileSend::Data:
+            length = static_cast<std::size_t>( std::min<uint64_t>(
+                         std::min<uint64_t>( send_sizer_.chunk(), send->unread )
+                       , send->checksums.block_left() ) );
+            if( send->sender.is_open() ){
+                // the bytes are hashed from the mapping, sendfile() reads
+                // them from the same page cache
+                frame.data.resize( FileChunkHeader::Length );
+                frame.sendfile = length;
+                send->checksums.update( send->sender.view() + ( send->size - send->unread )
+                                      , length );
+            }
+            else{
+                frame.data.resize( FileChunkHeader::Length + length );
+                send->file.read( &frame.data[FileChunkHeader::Length]
+                               , static_cast<std::streamsize>( length ) );
+                if( static_cast<std::size_t>( send->file.gcount() ) != length ){
+                    #ifndef NDEBUG
+                    { boost::mutex::scoped_lock lk(debug_mutex);
+                        std::cout << "[File " << send->path << " error.]"
+                                  << std::endl;
+                    }
+                    #endif /* NDEBUG */
+                    handle_file_send_error( send );
+                    continue;
+                }
+                send->checksums.update( &frame.data[FileChunkHeader::Length], length );
+            }
+            send->unread -= length;
+            if( send->unread == 0 || send->checksums.block_left() == 0 ){
+                send->phase = FileSend::Checksum;
+            }
+            break;
+        case FileSend::Checksum:
+        {
+            frame.data.resize( FileChunkHeader::Length + 2 * FileTrailer::CrcLength );
+            uint8_t* crc = reinterpret_cast<uint8_t*>( &frame.data[FileChunkHeader::Length] );
+            if( send->checksums.block_filled() != 0 ){
+                put_uint32( crc + length, send->checksums.end_block() );
+                length += FileTrailer::CrcLength;
+            }
+            if( send->unread == 0 ){
+                put_uint32( crc + length, send->checksums.whole() );
+                length += FileTrailer::CrcLength;
+                frame.last = true;
+            }
+            else{
+                send->phase = FileSend::Data;
+            }
+            frame.data.resize( FileChunkHeader::Length + length );
+            break;
+        }
+        default:
+            continue;
+        }
+        put_file_chunk_header( reinterpret_cast<uint8_t*>( frame.data.data() )
+                             , FileChunkHeader( send->id
+                                              , static_cast<uint32_t>( length ) ) );
+        if( !frame.last ){
+            send_ready_.push_back( send->id );
+        }
+        return true;
+    }
+    frame.send.reset();
+    return false;
+}
+
+/* Write the frame prepared, and prepare the one after it while the
+ * socket drains */
+void Client::do_file_send()
+{
+    SendFrame& frame = send_frames_[send_frame_current_];
+    if( send_frame_next_ && frame.send->cancelled ){
+        // its transfer broke off meanwhile
+        send_frame_next_ = false;
+    }
+    if( !send_frame_next_ && !prepare_send_frame( frame ) ){
+        send_writing_ = false;
+        return;
+    }
+    send_frame_next_ = false;
+    send_writing_ = true;
+    send_file_started_ = ChunkSizer::clock::now();
+    boost::asio::async_write( file_socket_
+        , boost::asio::buffer( frame.data )
+        , io_file_strand_.wrap(
+            boost::bind( &Client::handle_file_send, this
+                       , boost::asio::placeholders::error
+                       , boost::asio::placeholders::bytes_transferred ) ) );
+    send_frame_next_ = prepare_send_frame( send_frames_[send_frame_current_ ^ 1] );
+}
+
+void Client::handle_file_send( const boost::system::error_code& ec
+                             , std::size_t length )
+{
+    if( ec ){
+        send_writing_ = false;
         handle_error( ec );
+        return;
+    }
+    const SendFrame& frame = send_frames_[send_frame_current_];
+    if( frame.sendfile != 0 ){
+        sendfile_left_ = frame.sendfile;
+        do_file_sendfile();
+        return;
     }
+    send_sizer_.rtt( tcp_rtt( file_socket_.native_handle() ) );
+    send_sizer_.record( length, ChunkSizer::clock::now() - send_file_started_ );
+    finish_send_frame();
 }
 
-void Client::do_file_send( )
+/* Wait until the file socket is writable, then let the kernel copy the
+ * frame's bytes of the file straight into it */
+void Client::do_file_sendfile()
 {
-    // Open file in binary read mode
-    send_file_.open( file_queue_.front().string(), std::ios_base::binary );
+    file_socket_.async_write_some( boost::asio::null_buffers()
+        , io_file_strand_.wrap(
+            boost::bind( &Client::handle_file_sendfile, this
+                       , boost::asio::placeholders::error ) ) );
+}
 
-    if( send_file_ ){
-        send_file_.read( send_file_buf_.data(), send_file_buf_.size() );
-        if( send_file_.gcount() <= 0 ){
-            handle_file_send_error();
+void Client::handle_file_sendfile( const boost::system::error_code& ec )
+{
+    if( ec ){
+        send_writing_ = false;
+        handle_error( ec );
+        return;
+    }
+    const ptr_FileSend send( send_frames_[send_frame_current_].send );
+    boost::system::error_code send_ec;
+    const std::size_t sent = send->sender.send_to( file_socket_.native_handle()
+                                   , std::min( sendfile_chunk_, sendfile_left_ )
+                                   , send_ec );
+    sendfile_left_ -= sent;
+    if( send_ec && send_ec != boost::asio::error::would_block ){
+        #ifndef NDEBUG
+        { boost::mutex::scoped_lock lk(debug_mutex);
+            std::cout << "[File " << send->path << " error: "
+                      << send_ec.message() << "]" << std::endl;
         }
+        #endif /* NDEBUG */
+        // the chunk is announced, it is filled up to keep the stream framed
+        // and the transfer is cancelled
+        handle_file_send_error( send );
+        SendFrame& frame = send_frames_[send_frame_current_];
+        frame.data.assign( sendfile_left_, 0 );
+        frame.sendfile = 0;
+        frame.last = false;
+        sendfile_left_ = 0;
         boost::asio::async_write( file_socket_
-            , boost::asio::buffer( send_file_buf_.data(), send_file_.gcount() )
+            , boost::asio::buffer( frame.data )
             , io_file_strand_.wrap(
                 boost::bind( &Client::handle_file_send, this
                            , boost::asio::placeholders::error
                            , boost::asio::placeholders::bytes_transferred ) ) );
+        return;
     }
-    else{
-        #ifndef NDEBUG
-        { boost::mutex::scoped_lock lk(debug_mutex);
-            std::cout << "Failed to open the file " << file_queue_.front()
-                      << std::endl;
-        }
-        #endif /* NDEBUG */
-        handle_file_send_error();
+    if( 0 < sendfile_left_ ){
+        do_file_sendfile();
+        return;
     }
+    send_sizer_.record( send_frames_[send_frame_current_].sendfile
+                      , ChunkSizer::clock::now() - send_file_started_ );
+    finish_send_frame();
 }
 
-void Client::handle_file_send( const boost::system::error_code& ec
-                              , std::size_t /*length*/ )
+void Client::finish_send_frame()
+{
+    SendFrame& frame = send_frames_[send_frame_current_];
+    if( frame.last && !frame.send->cancelled ){
+        do_file_send_done( frame.send );
+    }
+    frame.send.reset();
+    send_frame_current_ ^= 1;
+    do_file_send();
+}
+
+/* The last checksum is out */
+void Client::do_file_send_done( const ptr_FileSend& send )
+{
+    #ifndef NDEBUG
+    { boost::mutex::scoped_lock lk(debug_mutex);
+        std::cout << "[File " << send->path << " sent.]"
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    // readers still repairing blocks may ask for them after this
+    sent_files_.push_back( SentFile{ send->id, send->path, send->size } );
+    if( sent_files_.size() > SentFilesKept ){
+        sent_files_.pop_front();
+    }
+    send->file.close();
+    send->sender.close();
+    file_sends_.erase( send->id );
+}
+
+void Client::handle_file_resend( const boost::system::error_code& ec
+                               , std::size_t /*length*/ )
 {
     if( !ec ){
-        if( send_file_ ){
-            send_file_.read( send_file_buf_.data(), send_file_buf_.size() );
-            if( send_file_.gcount() <= 0 ){
-                handle_file_send_error();
-            }
-            boost::asio::async_write( file_socket_
-                , boost::asio::buffer( send_file_buf_.data(), send_file_.gcount() )
-                , io_file_strand_.wrap(
-                    boost::bind( &Client::handle_file_send, this
-                               , boost::asio::placeholders::error
-                               , boost::asio::placeholders::bytes_transferred ) ) );
-        }
-        else if( send_file_.eof() ){
-            #ifndef NDEBUG
-            { boost::mutex::scoped_lock lk(debug_mutex);
-                std::cout << "[File " << file_queue_.front() << " EOF reached.]"
-                          << std::endl;
-            }
-            #endif /* NDEBUG */
-            send_file_.close();
-            file_queue_.pop_front();
-            if( !file_queue_.empty() ){
-                do_file_send_start();
-            }
+        if( ResendRequest::PrefixLength <= read_msg_.body_length() ){
+            // files are read on the file io_service
+            io_file_strand_.post( boost::bind( &Client::do_file_resend, this
+                                             , Message( read_msg_ ) ) );
         }
-        else{
-            #ifndef NDEBUG
-            { boost::mutex::scoped_lock lk(debug_mutex);
-                std::cout << "[File " << file_queue_.front() << " error.]";
-            }
-            handle_file_send_error();
-            file_queue_.pop_front();
-            if( !file_queue_.empty() ){
-                do_file_send_start();
-            }
-            #endif /* NDEBUG */
-        }
-    }else{
+    }
+    else{
         handle_error( ec );
     }
 }
 
-void Client::handle_file_send_error()
+/* Send the ranges a reader got corrupted again, if this client is sending
+ * or sent them and the file did not change since */
+void Client::do_file_resend( const Message& msg )
+{
+    const ResendRequest resend( file_resend( msg.msg_body(), msg.body_length() ) );
+    SentFile sending;
+    const SentFile* sent = nullptr;
+    auto send = file_sends_.find( resend.transfer_id );
+    if( send != file_sends_.end() ){
+        sending = SentFile{ send->second->id, send->second->path, send->second->size };
+        sent = &sending;
+    }
+    else{
+        auto it = std::find_if( sent_files_.begin(), sent_files_.end()
+            , [&resend]( const SentFile& file )
+              { return file.transfer_id == resend.transfer_id; } );
+        if( it == sent_files_.end() ){
+            return;
+        }
+        sent = &*it;
+    }
+    boost::system::error_code ec;
+    if( fs::file_size( sent->path, ec ) != sent->size || ec
+     || transfer_id_of( sent->path, sent->size ) != sent->transfer_id ){
+        boost::mutex::scoped_lock lk(debug_mutex);
+        std::cout << "[" << sent->path << " changed, it can not be sent again]"
+                  << std::endl;
+        return;
+    }
+
+    std::ifstream file( sent->path.string(), std::ios_base::binary );
+    std::vector<char> buf;
+    std::size_t ranges = 0;
+    for( const FileRange& range : resend.ranges ){
+        if( range.length > FileTrailer::BlockLength
+         || range.offset > sent->size || range.length > sent->size - range.offset ){
+            continue;
+        }
+        buf.resize( range.length );
+        file.seekg( static_cast<std::streamoff>( range.offset ) );
+        if( !file.read( buf.data(), buf.size() ) ){
+            break;
+        }
+        write( make_file_repair( resend.transfer_id, resend.reader, range.offset
+                               , buf.data(), buf.size() ) );
+        ++ranges;
+    }
+    boost::mutex::scoped_lock lk(debug_mutex);
+    std::cout << "[Sending " << ranges << " corrupted ranges of " << sent->path
+              << " again]" << std::endl;
+}
+
+/* The transfer ends here; its frames not yet written are skipped */
+void Client::handle_file_send_error( const ptr_FileSend& send )
 {
     #ifndef NDEBUG
     { boost::mutex::scoped_lock lk(debug_mutex);
         std::cout << __FUNCTION__ << std::endl;
     }
     #endif /* NDEBUG */
-    /* TODO: signal file cancel */
     write( message_from_string("[File send error]\n") );
-    write( Message( MessageType::FileCancel, MessageSize::Empty ) );
-    send_file_.close();
+    write( make_file_control( MessageType::FileCancel, send->id ) );
+    send->cancelled = true;
+    send->file.close();
+    file_sends_.erase( send->id );
 }
 
 void Client::handle_file_read_start( const boost::system::error_code& ec
@@ -414,10 +775,11 @@ void Client::handle_file_read_start( const boost::system::error_code& ec
     }
     #endif /* NDEBUG */
     if( !ec ){
-        read_file_size_ = read_msg_.file_size();
+        auto read = std::make_shared< FileRead >( read_msg_.transfer_id()
+                                                , read_msg_.file_size() );
         std::cout << "Request to start file transfer: "
                   << read_msg_.body_to_string()
-                  << "(" << (read_file_size_ / 8 )  <<" bytes)."
+                  << "(" << read->size <<" bytes)."
                   << "\nAccept [y\\n]? " << std::endl;
         std::string line;
         std::getline( std::cin, line );
@@ -425,60 +787,87 @@ void Client::handle_file_read_start( const boost::system::error_code& ec
             std::cout << "Enter path to save the file" <<std::endl;
             while( std::cout<<"> " && std::getline( std::cin, line ) ){
                 if( fs::is_regular_file( fs::path(line) ) ){
+                    // the leftover of this very transfer is picked up
+                    if( resume_offer( line, read->id, read->size, read->offer ) ){
+                        std::cout << "Resuming " << line << " at "
+                                  << read->offer.offset << " bytes."
+                                  << std::endl;
+                        break;
+                    }
                     std::cout << line << " exists. Please select a different filename."
                               << std::endl;
                     continue;
                 }
                 break;
             }
-            /* TODO : handle_file_read_start */
-            // file_msg_ = 
-            write( Message( MessageType::FileAccept, MessageSize::Empty ) );
-            // boost::asio::async_write( socket_
-            //     , boost::asio::buffer( file_msg_.data(), file_msg.total_length() )
-            //     , boost::bind( &Client::do_file_read, this ) );
-            read_file_.open( line, std::ios_base::binary );
-            if( read_file_ ){
-                do_file_read();
+            read->path = line;
+            // the kept prefix must survive until the sender confirms it
+            const bool keep = 0 < read->offer.offset;
+            boost::system::error_code seek_ec;
+            if( read->sink.open( line, read->size, sink_mode_, keep ) ){
+                read->sink.seek( read->offer.offset, seek_ec );
+            }
+            if( seek_ec ){
+                read->offer = FileResume( read->id );
+                read->sink.open( line, read->size, sink_mode_ );
+            }
+            if( !read->sink.is_open() ){
+                // the stream is the fallback where the sink is not
+                // available, it always starts over
+                read->offer = FileResume( read->id );
+                read->file.open( line, std::ios_base::binary );
+            }
+            if( read->sink.is_open() || read->file.is_open() ){
+                // the file socket's chunks are sorted out on the file
+                // io_service, which must know the transfer before it
+                // is accepted
+                io_file_strand_.post( boost::bind( &Client::do_file_read_start
+                                                 , this, read ) );
             }
             else{
                 std::cout << "Failed to open to file."
                 << std::endl;
-                handle_file_read_error();
+                write( make_file_control( MessageType::FileRefuse, read->id ) );
             }
-            do_read_header();
         }
         else{
-            // file_msg_ = 
-            write( Message( MessageType::FileRefuse, MessageSize::Empty ) );
-            // boost::asio::async_write( file_socket_
-            //     , boost::asio::buffer( file_msg_.data(), file_msg.total_length() )
-            //     , boost::bind( &Client::do_read_header, this ) );
-            do_read_header();
+            write( make_file_control( MessageType::FileRefuse, read_msg_.transfer_id() ) );
         }
         
     }
     else{
-        // file_msg_ = ;
-        write( Message( MessageType::FileRefuse, MessageSize::Empty ) );
-        // boost::asio::async_write( file_socket_
-        //     , boost::asio::buffer( file_msg_.data(), file_msg_.total_length() )
-        //     , boost::bind( &Client::handle_error, this
-        //                  , boost::asio::placeholders::error ) );
+        write( make_file_control( MessageType::FileRefuse, read_msg_.transfer_id() ) );
         handle_error( ec );
     }
 }
 
+void Client::do_file_read_start( const ptr_FileRead& read )
+{
+    if( file_reads_.count( read->id ) != 0 ){
+        // already being received
+        write( make_file_control( MessageType::FileRefuse, read->id ) );
+        return;
+    }
+    file_reads_[read->id] = read;
+    // repairs of an earlier transfer of the same file are moot
+    read_repairs_.erase( read->id );
+    write( make_file_accept( read->offer ) );
+}
+
+/* The file socket carries the chunks of every file sent to this client */
 void Client::do_file_read()
 {
-    boost::asio::async_read( file_socket_
-        , boost::asio::buffer( read_file_buf_.data(), read_file_buf_.size() )
+    std::vector<char>& buf = read_file_bufs_[read_file_current_];
+    buf.resize( read_sizer_.chunk() );
+    read_file_started_ = ChunkSizer::clock::now();
+    file_socket_.async_read_some( boost::asio::buffer( buf )
         , io_file_strand_.wrap(
             boost::bind( &Client::handle_file_read, this
                        , boost::asio::placeholders::error
                        , boost::asio::placeholders::bytes_transferred ) ) );
 }
 
+/* Hand every slice of the bytes read to the transfer whose chunk it is */
 void Client::handle_file_read( const boost::system::error_code& ec
                              , std::size_t bytes_transferred )
 {
@@ -489,29 +878,266 @@ void Client::handle_file_read( const boost::system::error_code& ec
     }
     #endif /* NDEBUG */
 
-    if( 0 < bytes_transferred ){
-        read_file_.write( read_file_buf_.data(), bytes_transferred );
-        if( read_file_.tellp() < read_file_size_ ){
-            if(!ec){
-            boost::asio::async_read( file_socket_
-                , boost::asio::buffer( read_file_buf_.data(), read_file_buf_.size() )
-                , io_file_strand_.wrap(
-                    boost::bind( &Client::handle_file_read, this
-                               , boost::asio::placeholders::error
-                               , boost::asio::placeholders::bytes_transferred )
-                ));
+    if( ec ){
+        // every transfer in flight breaks off, partial files stay for a
+        // resume
+        while( !file_reads_.empty() ){
+            const ptr_FileRead read( file_reads_.begin()->second );
+            handle_file_read_error( read );
+        }
+        return;
+    }
+    const std::vector<char>& bytes = read_file_bufs_[read_file_current_];
+    read_sizer_.record( bytes_transferred
+                      , ChunkSizer::clock::now() - read_file_started_ );
+    // the socket fills the other buffer while this one goes to disk
+    read_file_current_ ^= 1;
+    do_file_read();
+
+    const char* data = bytes.data();
+    std::size_t left = bytes_transferred;
+    while( 0 < left ){
+        if( read_chunk_left_ == 0 ){
+            const std::size_t take = std::min( left
+                                             , read_header_.size() - read_header_filled_ );
+            std::copy( data, data + take, read_header_.begin() + read_header_filled_ );
+            read_header_filled_ += take;
+            data += take;
+            left -= take;
+            if( read_header_filled_ == read_header_.size() ){
+                const FileChunkHeader header( file_chunk_header( read_header_.data() ) );
+                auto it = file_reads_.find( header.transfer_id );
+                read_chunk_file_ = ( it != file_reads_.end() ) ? it->second
+                                                               : ptr_FileRead();
+                read_chunk_left_ = header.length;
+                read_header_filled_ = 0;
             }
+            continue;
         }
-        else{
-            do_file_read_done();
+        const std::size_t take = std::min<std::size_t>( left, read_chunk_left_ );
+        if( read_chunk_file_ ){
+            read_file_chunk( read_chunk_file_, data, take );
         }
+        data += take;
+        left -= take;
+        read_chunk_left_ -= take;
     }
-    if( ec ){
-        handle_file_read_error();
+}
+
+/* The stream of a transfer: the offset the sender starts from, the data
+ * with the sender's CRC after each block, then the whole file's CRC */
+void Client::read_file_chunk( const ptr_FileRead& read, const char* data
+                            , std::size_t bytes )
+{
+    if( file_reads_.count( read->id ) == 0 ){
+        // the transfer was abandoned, drop what was still in flight
+        return;
+    }
+    while( 0 < bytes ){
+        switch( read->phase ){
+        case FileRead::Preamble:
+        {
+            const std::size_t take = std::min( bytes
+                                             , read->preamble.size() - read->preamble_filled );
+            std::copy( data, data + take, read->preamble.begin() + read->preamble_filled );
+            read->preamble_filled += take;
+            data += take;
+            bytes -= take;
+            if( read->preamble_filled == read->preamble.size()
+             && !handle_file_read_preamble( *read ) ){
+                handle_file_read_error( read );
+                return;
+            }
+            break;
+        }
+        case FileRead::Data:
+        {
+            const std::size_t take = static_cast<std::size_t>( std::min<uint64_t>(
+                std::min<uint64_t>( bytes, read->size - read->received )
+              , read->checksums.block_left() ) );
+            if( !write_file_chunk( *read, data, take ) ){
+                handle_file_read_error( read );
+                return;
+            }
+            read->checksums.update( data, take );
+            read->received += take;
+            store_checkpoint( *read );
+            data += take;
+            bytes -= take;
+            if( read->received == read->size || read->checksums.block_left() == 0 ){
+                read->phase = FileRead::BlockCrc;
+            }
+            break;
+        }
+        case FileRead::BlockCrc:
+        case FileRead::FileCrc:
+        {
+            const std::size_t take = std::min( bytes, read->crc.size() - read->crc_filled );
+            std::memcpy( &read->crc[read->crc_filled], data, take );
+            read->crc_filled += take;
+            data += take;
+            bytes -= take;
+            if( read->crc_filled < read->crc.size() ){
+                break;
+            }
+            read->crc_filled = 0;
+            if( read->phase == FileRead::FileCrc ){
+                handle_file_read_end( read );
+                return;
+            }
+            handle_file_read_block( read );
+            if( file_reads_.count( read->id ) == 0 ){
+                return;
+            }
+            break;
+        }
+        }
     }
 }
 
-void Client::do_file_read_done()
+/* false when the sender starts where this reader can not */
+bool Client::handle_file_read_preamble( FileRead& read )
+{
+    const uint64_t start = make_uint64( read.preamble.data() );
+    boost::system::error_code seek_ec;
+    if( start != read.offer.offset ){
+        // the sender did not take the offer and starts over
+        if( start == 0 && read.sink.is_open() ){
+            read.sink.seek( 0, seek_ec );
+        }
+        else if( start != 0 ){
+            seek_ec = boost::asio::error::invalid_argument;
+        }
+    }
+    if( seek_ec ){
+        return false;
+    }
+    read.received = start;
+    read.start = start;
+    read.checksums.reset( ( start == 0 ) ? 0 : read.offer.prefix_crc );
+    read.checkpoint.open( read.path );
+    store_checkpoint( read );
+    read.phase = ( read.received == read.size ) ? FileRead::FileCrc : FileRead::Data;
+    return true;
+}
+
+bool Client::write_file_chunk( FileRead& read, const char* data, std::size_t bytes )
+{
+    if( read.sink.is_open() ){
+        boost::system::error_code ec;
+        read.sink.write( data, bytes, ec );
+        return !ec;
+    }
+    return static_cast<bool>( read.file.write( data, bytes ) );
+}
+
+/* Over bytes written before, still being received */
+bool Client::rewrite_file_block( FileRead& read, const uint8_t* data, std::size_t bytes
+                               , uint64_t offset )
+{
+    if( read.sink.is_open() ){
+        boost::system::error_code ec;
+        read.sink.rewrite( reinterpret_cast<const char*>( data ), bytes, offset, ec );
+        return !ec;
+    }
+    const std::ofstream::pos_type end( read.file.tellp() );
+    read.file.seekp( static_cast<std::streamoff>( offset ) );
+    read.file.write( reinterpret_cast<const char*>( data )
+                   , static_cast<std::streamsize>( bytes ) );
+    read.file.seekp( end );
+    return static_cast<bool>( read.file );
+}
+
+/* what is on disk so far, for a resume should the transfer break */
+void Client::store_checkpoint( FileRead& read )
+{
+    if( !read.checkpoint.is_open() ){
+        return;
+    }
+    FileCheckpoint::Record record;
+    record.transfer_id = read.id;
+    record.size = read.size;
+    record.received = read.received;
+    record.crc = read.checksums.whole();
+    read.checkpoint.store( record );
+}
+
+/* Compare the block just received with the sender's; a corrupted one is
+ * asked for again right away while the rest of the file keeps coming */
+void Client::handle_file_read_block( const ptr_FileRead& read )
+{
+    const uint32_t expected = make_uint32( read->crc[0], read->crc[1]
+                                         , read->crc[2], read->crc[3] );
+    const uint64_t block = ( read->checksums.bytes() - 1 ) / FileTrailer::BlockLength;
+    const uint32_t crc = read->checksums.end_block();
+    read->phase = ( read->received == read->size ) ? FileRead::FileCrc : FileRead::Data;
+    if( crc == expected ){
+        return;
+    }
+
+    if( read_repairs_.count( read->id ) == 0 ){
+        PendingRepair& repair = read_repairs_[read->id];
+        repair.path = read->path;
+        repair.start = read->start;
+        repair.size = read->size;
+        repair.repaired = 0;
+        repair.retries = 0;
+        repair.finished = false;
+        boost::mutex::scoped_lock lk(debug_mutex);
+        std::cout << "[Corrupted ranges in " << repair.path
+                  << ", asking for them again]" << std::endl;
+    }
+    read_repairs_[read->id].pending.push_back( std::make_pair( block, expected ) );
+    request_repairs( read->id );
+}
+
+/* The whole file's CRC; a file with corrupted blocks is checked block by
+ * block as they are repaired instead, the rest of it is kept */
+void Client::handle_file_read_end( const ptr_FileRead& read )
+{
+    auto it = read_repairs_.find( read->id );
+    if( it == read_repairs_.end() ){
+        if( read->checksums.whole() != make_uint32( read->crc[0], read->crc[1]
+                                                  , read->crc[2], read->crc[3] ) ){
+            { boost::mutex::scoped_lock lk(debug_mutex);
+                std::cout << "[File checksum mismatch]" << std::endl;
+            }
+            handle_file_read_error( read );
+            return;
+        }
+        do_file_read_done( read );
+        return;
+    }
+
+    if( !close_read_file( *read ) ){
+        handle_file_read_error( read );
+        return;
+    }
+    // the checkpoint stays until the file is whole
+    read->checkpoint.close();
+    file_reads_.erase( read->id );
+    PendingRepair& repair = it->second;
+    repair.finished = true;
+    if( repair.requested.empty() && repair.pending.empty() ){
+        do_file_repaired( read->id );
+    }
+}
+
+/* false if what was written did not make it to the file */
+bool Client::close_read_file( FileRead& read )
+{
+    if( read.sink.is_open() ){
+        boost::system::error_code ec;
+        read.sink.close( ec );
+        return !ec;
+    }
+    read.file.close();
+    const bool flushed = !read.file.fail();
+    read.file.clear();
+    return flushed;
+}
+
+void Client::do_file_read_done( const ptr_FileRead& read )
 {
     #ifndef NDEBUG
     { boost::mutex::scoped_lock lk(debug_mutex);
@@ -520,15 +1146,182 @@ void Client::do_file_read_done()
     }
     #endif /* NDEBUG */
 
+    if( !close_read_file( *read ) ){
+        handle_file_read_error( read );
+        return;
+    }
+    read->checkpoint.remove();
+    file_reads_.erase( read->id );
+
     boost::mutex::scoped_lock lk(debug_mutex);
-    std::cout << "[Transfer complete. (bytes expected: " << (read_file_size_/8)
-              << ", got: " << (read_file_.tellp() / 8 ) << "]" <<std::endl;
-    read_file_.flush();
-    read_file_.close();
-    write( Message( MessageType::FileDone, MessageSize::Empty ) );
+    std::cout << "[Transfer of " << read->path
+              << " complete, checksums verified. (bytes expected: "
+              << read->size << ", got: " << read->received << "]"
+              << std::endl;
+    write( make_file_control( MessageType::FileDone, read->id ) );
+}
+
+/* ask for the next few corrupted blocks of `transfer_id` */
+void Client::request_repairs( uint64_t transfer_id )
+{
+    PendingRepair& repair = read_repairs_[transfer_id];
+    std::vector< FileRange > ranges;
+    while( !repair.pending.empty() && repair.requested.size() < RepairBatch ){
+        const uint64_t block = repair.pending.front().first;
+        repair.requested.insert( repair.pending.front() );
+        repair.pending.pop_front();
+        const uint64_t offset = repair.start + block * FileTrailer::BlockLength;
+        ranges.push_back( FileRange( offset, static_cast<uint32_t>(
+            std::min<uint64_t>( FileTrailer::BlockLength, repair.size - offset ) ) ) );
+    }
+    if( !ranges.empty() ){
+        write( make_file_resend( transfer_id, ranges ) );
+    }
+}
+
+void Client::handle_file_repair( const boost::system::error_code& ec
+                               , std::size_t /*length*/ )
+{
+    if( !ec ){
+        if( RepairChunk::PrefixLength <= read_msg_.body_length() ){
+            io_file_strand_.post( boost::bind( &Client::do_file_repair, this
+                                             , Message( read_msg_ ) ) );
+        }
+    }
+    else{
+        handle_error( ec );
+    }
+}
+
+/* Write a block sent again over the corrupted one, once it checks out;
+ * through the file being written while it is still received */
+void Client::do_file_repair( const Message& msg )
+{
+    const RepairChunk block_repair( file_repair( msg.msg_body(), msg.body_length() ) );
+    auto it = read_repairs_.find( block_repair.transfer_id );
+    if( it == read_repairs_.end() || block_repair.offset < it->second.start ){
+        return;
+    }
+    PendingRepair& repair = it->second;
+    const uint64_t block = ( block_repair.offset - repair.start ) / FileTrailer::BlockLength;
+    const uint64_t offset = repair.start + block * FileTrailer::BlockLength;
+    auto requested = repair.requested.find( block );
+    if( requested == repair.requested.end() || offset != block_repair.offset
+     || block_repair.length != std::min<uint64_t>( FileTrailer::BlockLength
+                                                 , repair.size - offset ) ){
+        return;
+    }
+    const uint32_t expected = requested->second;
+    repair.requested.erase( requested );
+
+    auto reading = file_reads_.find( block_repair.transfer_id );
+    bool failed = false;
+    if( crc32c( 0, block_repair.data, block_repair.length ) != expected ){
+        // damaged on the way again
+        repair.pending.push_back( std::make_pair( block, expected ) );
+        failed = ++repair.retries > RepairRetries;
+    }
+    else if( reading != file_reads_.end() ){
+        failed = !rewrite_file_block( *reading->second, block_repair.data
+                                    , block_repair.length, offset );
+        ++repair.repaired;
+    }
+    else{
+        std::fstream file( repair.path
+                         , std::ios_base::in | std::ios_base::out | std::ios_base::binary );
+        file.seekp( static_cast<std::streamoff>( offset ) );
+        file.write( reinterpret_cast<const char*>( block_repair.data )
+                  , static_cast<std::streamsize>( block_repair.length ) );
+        file.flush();
+        failed = !file;
+        ++repair.repaired;
+    }
+    if( failed ){
+        {   boost::mutex::scoped_lock lk(debug_mutex);
+            std::cout << "[" << repair.path << " could not be repaired]"
+                      << std::endl;
+        }
+        if( reading != file_reads_.end() ){
+            const ptr_FileRead read( reading->second );
+            handle_file_read_error( read );
+        }
+        else{
+            read_repairs_.erase( it );
+        }
+        return;
+    }
+
+    if( !repair.requested.empty() || !repair.pending.empty() ){
+        request_repairs( block_repair.transfer_id );
+    }
+    else if( repair.finished ){
+        do_file_repaired( block_repair.transfer_id );
+    }
 }
 
-void Client::handle_file_read_error()
+/* The last corrupted block of a file received in full is replaced */
+void Client::do_file_repaired( uint64_t transfer_id )
+{
+    auto it = read_repairs_.find( transfer_id );
+    if( it == read_repairs_.end() ){
+        return;
+    }
+    std::remove( FileCheckpoint::path_of( it->second.path ).c_str() );
+    {   boost::mutex::scoped_lock lk(debug_mutex);
+        std::cout << "[Transfer complete, " << it->second.repaired
+                  << " corrupted ranges sent again and verified.]" << std::endl;
+    }
+    read_repairs_.erase( it );
+    write( make_file_control( MessageType::FileDone, transfer_id ) );
+}
+
+void Client::handle_file_pause( const boost::system::error_code& ec
+                              , std::size_t /*length*/ )
+{
+    if( !ec ){
+        io_file_strand_.post( boost::bind( &Client::do_file_pause, this
+            , file_control_id( read_msg_.msg_body(), read_msg_.body_length() )
+            , true ) );
+    }
+    else{
+        handle_error( ec );
+    }
+}
+
+void Client::handle_file_continue( const boost::system::error_code& ec
+                                 , std::size_t /*length*/ )
+{
+    if( !ec ){
+        io_file_strand_.post( boost::bind( &Client::do_file_pause, this
+            , file_control_id( read_msg_.msg_body(), read_msg_.body_length() )
+            , false ) );
+    }
+    else{
+        handle_error( ec );
+    }
+}
+
+/* The readers of a file being sent fell a window behind, or caught up
+ * again; the other files keep their turns meanwhile */
+void Client::do_file_pause( uint64_t transfer_id, bool paused )
+{
+    auto it = file_sends_.find( transfer_id );
+    if( it == file_sends_.end() ){
+        return;
+    }
+    const ptr_FileSend& send = it->second;
+    send->paused = paused;
+    if( paused || !send->waiting ){
+        return;
+    }
+    send->waiting = false;
+    send_ready_.push_back( send->id );
+    if( !send_writing_ ){
+        do_file_send();
+    }
+}
+
+void Client::handle_file_read_error( const ptr_FileRead& read )
 {
     #ifndef NDEBUG
     { boost::mutex::scoped_lock lk(debug_mutex);
@@ -538,13 +1331,18 @@ void Client::handle_file_read_error()
     #endif /* NDEBUG */
 
     { boost::mutex::scoped_lock lk(debug_mutex);
-        std::cout << "[File read error]" << std::endl;
+        std::cout << "[File read error " << read->path << "]" << std::endl;
     }
-    read_file_.close();
-    read_file_size_ = 0;
+    // the partial file and its checkpoint stay for a resume
+    boost::system::error_code ec;
+    read->sink.close( ec );
+    read->checkpoint.close();
+    read->file.close();
+    read->file.clear();
+    file_reads_.erase( read->id );
+    read_repairs_.erase( read->id );
     write( message_from_string( "[File read error. Transfer cancelled.]" ) );
-    write( Message( MessageType::FileCancel, MessageSize::Empty ) );
-    do_read_header();
+    write( make_file_control( MessageType::FileCancel, read->id ) );
 }
 
 void Client::handle_file_done( const boost::system::error_code& ec
@@ -555,7 +1353,6 @@ void Client::handle_file_done( const boost::system::error_code& ec
         std::cout << __FUNCTION__ << std::endl;
     }
     #endif /* NDEBUG */
-    do_read_header();
 }
 
 void Client::handle_file_cancel( const boost::system::error_code& ec
@@ -569,15 +1366,48 @@ void Client::handle_file_cancel( const boost::system::error_code& ec
     #endif /* NDEBUG */
 
     if( !ec ){
-        /* TODO : implement handle_file_cancel */
-        std::cout << "Current file transfer cancelled." << std::endl;
-        do_read_header();
+        io_file_strand_.post( boost::bind( &Client::do_file_cancel, this
+            , file_control_id( read_msg_.msg_body(), read_msg_.body_length() )
+            , file_control_reason( read_msg_.msg_body(), read_msg_.body_length() ) ) );
     }
     else{
         handle_error( ec );
     }
 }
 
+/* The sender gave up on a file being received, or the server dropped this
+ * reader from it; what arrived so far stays for a resume. The server
+ * cancels a file being sent when it can not be relayed any more. */
+void Client::do_file_cancel( uint64_t transfer_id, const std::string& reason )
+{
+    auto send = file_sends_.find( transfer_id );
+    if( send != file_sends_.end() ){
+        // its frames not yet written are skipped
+        send->second->cancelled = true;
+        send->second->file.close();
+        {   boost::mutex::scoped_lock lk(debug_mutex);
+            std::cout << "File transfer " << send->second->path << " cancelled. "
+                      << reason << std::endl;
+        }
+        file_sends_.erase( send );
+    }
+    auto it = file_reads_.find( transfer_id );
+    if( it == file_reads_.end() ){
+        return;
+    }
+    const ptr_FileRead read( it->second );
+    file_reads_.erase( it );
+    read_repairs_.erase( transfer_id );
+    boost::system::error_code ec;
+    read->sink.close( ec );
+    read->checkpoint.close();
+    read->file.close();
+    read->file.clear();
+    boost::mutex::scoped_lock lk(debug_mutex);
+    std::cout << "File transfer " << read->path << " cancelled. "
+              << reason << std::endl;
+}
+
 void Client::handle_file_cancel_all( const boost::system::error_code& ec
                                 , std::size_t /*length*/ )
 {
@@ -591,7 +1421,6 @@ void Client::handle_file_cancel_all( const boost::system::error_code& ec
     if( !ec ){
         /* TODO : implement handle_file_cancel_all */
         std::cout << "All files cancelled." << std::endl;
-        do_read_header();
     }
     else{
         handle_error( ec );
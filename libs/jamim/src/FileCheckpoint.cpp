@@ -0,0 +1,66 @@
+#include "FileCheckpoint.hpp"
+#include "Message.hpp"
+#include <cstdio>
+
+
+namespace
+{
+
+const char Magic[4] = { 'J', 'M', 'R', '1' };
+
+} // namespace
+
+
+bool FileCheckpoint::load( const std::string& file, Record& record )
+{
+    std::ifstream in( path_of( file ), std::ios_base::binary );
+    uint8_t bytes[RecordLength];
+    if( !in.read( reinterpret_cast<char*>( bytes ), RecordLength )
+     || !std::equal( Magic, Magic + sizeof(Magic), bytes ) ){
+        return false;
+    }
+    record.transfer_id = make_uint64( bytes + 4 );
+    record.size = make_uint64( bytes + 12 );
+    record.received = make_uint64( bytes + 20 );
+    record.crc = make_uint32( bytes[28], bytes[29], bytes[30], bytes[31] );
+    return record.received <= record.size;
+}
+
+bool FileCheckpoint::open( const std::string& file )
+{
+    close();
+    path_ = path_of( file );
+    out_.open( path_, std::ios_base::binary | std::ios_base::trunc );
+    return out_.is_open();
+}
+
+bool FileCheckpoint::store( const Record& record )
+{
+    uint8_t bytes[RecordLength];
+    std::copy( Magic, Magic + sizeof(Magic), bytes );
+    put_uint64( bytes + 4, record.transfer_id );
+    put_uint64( bytes + 12, record.size );
+    put_uint64( bytes + 20, record.received );
+    put_uint32( bytes + 28, record.crc );
+    out_.seekp( 0 );
+    out_.write( reinterpret_cast<const char*>( bytes ), RecordLength );
+    out_.flush();
+    return static_cast<bool>( out_ );
+}
+
+void FileCheckpoint::close()
+{
+    if( out_.is_open() ){
+        out_.close();
+    }
+    out_.clear();
+}
+
+void FileCheckpoint::remove()
+{
+    close();
+    if( !path_.empty() ){
+        std::remove( path_.c_str() );
+        path_.clear();
+    }
+}
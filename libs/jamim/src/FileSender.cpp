@@ -0,0 +1,122 @@
+#include "FileSender.hpp"
+#include <algorithm>
+#include <boost/asio/error.hpp>
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#endif /* __linux__ */
+
+
+FileSender::FileSender()
+    : fd_( -1 )
+    , view_( nullptr )
+    , size_( 0 )
+    , offset_( 0 )
+{
+}
+
+FileSender::~FileSender()
+{
+    close();
+}
+
+bool FileSender::open( const std::string& path, std::uint64_t limit )
+{
+    #ifdef __linux__
+    close();
+    fd_ = ::open( path.c_str(), O_RDONLY | O_CLOEXEC );
+    if( fd_ == -1 ){
+        return false;
+    }
+    struct stat st;
+    if( ::fstat( fd_, &st ) != 0 || !S_ISREG( st.st_mode ) ){
+        close();
+        return false;
+    }
+    const std::uint64_t length = static_cast<std::uint64_t>( st.st_size );
+    if( limit != std::numeric_limits<std::uint64_t>::max() && length < limit ){
+        close();
+        return false;
+    }
+    size_ = std::min( length, limit );
+    // the file is read front to back once
+    ::posix_fadvise( fd_, 0, 0, POSIX_FADV_SEQUENTIAL );
+    if( 0 < size_ ){
+        void* view = ::mmap( nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0 );
+        if( view == MAP_FAILED ){
+            close();
+            return false;
+        }
+        view_ = static_cast<const char*>( view );
+        ::madvise( view, size_, MADV_SEQUENTIAL );
+    }
+    return true;
+    #else
+    (void)path; (void)limit;
+    return false;
+    #endif /* __linux__ */
+}
+
+void FileSender::close()
+{
+    #ifdef __linux__
+    if( view_ ){
+        ::munmap( const_cast<char*>( view_ ), size_ );
+    }
+    if( fd_ != -1 ){
+        ::close( fd_ );
+    }
+    #endif /* __linux__ */
+    fd_ = -1;
+    view_ = nullptr;
+    size_ = offset_ = 0;
+}
+
+bool FileSender::seek( std::uint64_t offset )
+{
+    if( !is_open() || offset > size_ ){
+        return false;
+    }
+    offset_ = offset;
+    return true;
+}
+
+std::size_t FileSender::send_to( int fd, std::size_t bytes
+                               , boost::system::error_code& ec )
+{
+    #ifdef __linux__
+    if( remaining() == 0 ){
+        ec = boost::asio::error::eof;
+        return 0;
+    }
+    if( bytes > remaining() ){
+        bytes = static_cast<std::size_t>( remaining() );
+    }
+    off_t offset = static_cast<off_t>( offset_ );
+    const ssize_t result = ::sendfile( fd, fd_, &offset, bytes );
+    if( result > 0 ){
+        ec = boost::system::error_code();
+        offset_ += static_cast<std::uint64_t>( result );
+        return static_cast<std::size_t>( result );
+    }
+    if( result == 0 ){
+        // the file shrank under us
+        ec = boost::asio::error::eof;
+    }
+    else if( errno == EAGAIN || errno == EWOULDBLOCK ){
+        ec = boost::asio::error::would_block;
+    }
+    else{
+        ec = boost::system::error_code( errno, boost::system::system_category() );
+    }
+    return 0;
+    #else
+    (void)fd; (void)bytes;
+    ec = boost::asio::error::operation_not_supported;
+    return 0;
+    #endif /* __linux__ */
+}
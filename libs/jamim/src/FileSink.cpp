@@ -0,0 +1,309 @@
+#include "FileSink.hpp"
+#include <algorithm>
+#include <boost/asio/error.hpp>
+#ifdef __linux__
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif /* __linux__ */
+
+
+namespace
+{
+
+#ifdef __linux__
+// alignment O_DIRECT asks for on any common device, and the staging size
+const std::size_t BlockSize = 4096;
+const std::size_t StageSize = 1 << 20;
+
+boost::system::error_code last_error()
+{
+    return boost::system::error_code( errno, boost::system::system_category() );
+}
+#endif /* __linux__ */
+
+} // namespace
+
+
+FileSink::FileSink()
+    : fd_( -1 )
+    , mode_( Pwrite )
+    , size_( 0 )
+    , written_( 0 )
+    , map_( nullptr )
+    , stage_( nullptr )
+    , staged_( 0 )
+    , stage_offset_( 0 )
+{
+}
+
+FileSink::~FileSink()
+{
+    boost::system::error_code ec;
+    close( ec );
+}
+
+bool FileSink::open( const std::string& path, std::uint64_t size, Mode mode
+                   , bool keep )
+{
+    #ifdef __linux__
+    boost::system::error_code ec;
+    close( ec );
+
+    int flags = O_RDWR | O_CREAT | O_CLOEXEC | ( keep ? 0 : O_TRUNC );
+    if( mode == Direct ){
+        fd_ = ::open( path.c_str(), flags | O_DIRECT, 0644 );
+        if( fd_ == -1 && errno == EINVAL ){
+            // the file system does not do O_DIRECT
+            mode = Pwrite;
+        }
+    }
+    if( fd_ == -1 ){
+        fd_ = ::open( path.c_str(), flags, 0644 );
+    }
+    if( fd_ == -1 ){
+        return false;
+    }
+    mode_ = mode;
+    size_ = size;
+    written_ = 0;
+
+    // reserve the blocks up front; where fallocate is not supported the
+    // file grows as it is written, only a mapping needs its length set
+    if( 0 < size && ::fallocate( fd_, 0, 0, static_cast<off_t>( size ) ) != 0 ){
+        if( ( errno != EOPNOTSUPP && errno != ENOSYS )
+         || ( mode_ == Mmap && ::ftruncate( fd_, static_cast<off_t>( size ) ) != 0 ) ){
+            release();
+            return false;
+        }
+    }
+
+    if( mode_ == Mmap && 0 < size ){
+        void* map = ::mmap( nullptr, size, PROT_WRITE, MAP_SHARED, fd_, 0 );
+        if( map == MAP_FAILED ){
+            release();
+            return false;
+        }
+        map_ = static_cast<char*>( map );
+        ::madvise( map_, size, MADV_SEQUENTIAL );
+    }
+    if( mode_ == Direct ){
+        void* stage = nullptr;
+        if( ::posix_memalign( &stage, BlockSize, StageSize ) != 0 ){
+            release();
+            return false;
+        }
+        stage_ = static_cast<char*>( stage );
+        staged_ = 0;
+        stage_offset_ = 0;
+    }
+    return true;
+    #else
+    (void)path; (void)size; (void)mode; (void)keep;
+    return false;
+    #endif /* __linux__ */
+}
+
+void FileSink::close( boost::system::error_code& ec )
+{
+    ec = boost::system::error_code();
+    #ifdef __linux__
+    if( fd_ == -1 ){
+        return;
+    }
+    if( mode_ == Direct ){
+        flush_direct( true, ec );
+    }
+    if( map_ ){
+        ::munmap( map_, size_ );
+        map_ = nullptr;
+    }
+    // a short transfer leaves no allocated garbage behind, nor does a kept
+    // file that was longer
+    if( !ec && ::ftruncate( fd_, static_cast<off_t>( written_ ) ) != 0 ){
+        ec = last_error();
+    }
+    #endif /* __linux__ */
+    release();
+}
+
+void FileSink::seek( std::uint64_t offset, boost::system::error_code& ec )
+{
+    #ifdef __linux__
+    if( offset > size_ ){
+        ec = boost::asio::error::invalid_argument;
+        return;
+    }
+    ec = boost::system::error_code();
+    if( mode_ == Direct ){
+        // stage the kept head of the block the offset falls into
+        stage_offset_ = offset - offset % BlockSize;
+        staged_ = static_cast<std::size_t>( offset - stage_offset_ );
+        if( 0 < staged_ ){
+            const ssize_t result = ::pread( fd_, stage_, BlockSize
+                                          , static_cast<off_t>( stage_offset_ ) );
+            if( result < static_cast<ssize_t>( staged_ ) ){
+                ec = ( result < 0 ) ? last_error() : boost::asio::error::eof;
+                return;
+            }
+        }
+    }
+    written_ = offset;
+    #else
+    (void)offset;
+    ec = boost::asio::error::operation_not_supported;
+    #endif /* __linux__ */
+}
+
+void FileSink::write( const char* data, std::size_t bytes
+                    , boost::system::error_code& ec )
+{
+    #ifdef __linux__
+    if( bytes > size_ - written_ ){
+        ec = boost::asio::error::message_size;
+        return;
+    }
+    ec = boost::system::error_code();
+    switch( mode_ ){
+    case Mmap:
+        std::memcpy( map_ + written_, data, bytes );
+        break;
+    case Direct:
+        while( 0 < bytes && !ec ){
+            const std::size_t take = std::min( bytes, StageSize - staged_ );
+            std::memcpy( stage_ + staged_, data, take );
+            staged_ += take;
+            data += take;
+            bytes -= take;
+            written_ += take;
+            if( staged_ == StageSize ){
+                flush_direct( false, ec );
+            }
+        }
+        return;
+    default:
+        write_at( data, bytes, written_, ec );
+        break;
+    }
+    if( !ec ){
+        written_ += bytes;
+    }
+    #else
+    (void)data; (void)bytes;
+    ec = boost::asio::error::operation_not_supported;
+    #endif /* __linux__ */
+}
+
+void FileSink::rewrite( const char* data, std::size_t bytes, std::uint64_t offset
+                      , boost::system::error_code& ec )
+{
+    #ifdef __linux__
+    if( offset > written_ || bytes > written_ - offset ){
+        ec = boost::asio::error::message_size;
+        return;
+    }
+    ec = boost::system::error_code();
+    switch( mode_ ){
+    case Mmap:
+        std::memcpy( map_ + offset, data, bytes );
+        break;
+    case Direct:
+        if( offset + bytes > stage_offset_ ){
+            // the staged part is patched, it goes out with the stage
+            const std::size_t skip = static_cast<std::size_t>(
+                std::max( offset, stage_offset_ ) - offset );
+            std::memcpy( stage_ + ( offset + skip - stage_offset_ ), data + skip
+                       , bytes - skip );
+            bytes = skip;
+        }
+        if( 0 < bytes ){
+            // what is on disk already, unaligned
+            const int flags = ::fcntl( fd_, F_GETFL );
+            ::fcntl( fd_, F_SETFL, flags & ~O_DIRECT );
+            write_at( data, bytes, offset, ec );
+            ::fcntl( fd_, F_SETFL, flags );
+        }
+        break;
+    default:
+        write_at( data, bytes, offset, ec );
+        break;
+    }
+    #else
+    (void)data; (void)bytes; (void)offset;
+    ec = boost::asio::error::operation_not_supported;
+    #endif /* __linux__ */
+}
+
+void FileSink::write_at( const char* data, std::size_t bytes, std::uint64_t offset
+                       , boost::system::error_code& ec )
+{
+    #ifdef __linux__
+    while( 0 < bytes ){
+        const ssize_t result = ::pwrite( fd_, data, bytes, static_cast<off_t>( offset ) );
+        if( result < 0 ){
+            if( errno == EINTR ){
+                continue;
+            }
+            ec = last_error();
+            return;
+        }
+        data += result;
+        bytes -= static_cast<std::size_t>( result );
+        offset += static_cast<std::uint64_t>( result );
+    }
+    #else
+    (void)data; (void)bytes; (void)offset;
+    ec = boost::asio::error::operation_not_supported;
+    #endif /* __linux__ */
+}
+
+/* Write the whole blocks staged; with `tail` the rest too, without
+ * O_DIRECT as it is not block sized */
+void FileSink::flush_direct( bool tail, boost::system::error_code& ec )
+{
+    #ifdef __linux__
+    const std::size_t blocks = staged_ - staged_ % BlockSize;
+    if( 0 < blocks ){
+        write_at( stage_, blocks, stage_offset_, ec );
+        if( ec ){
+            return;
+        }
+        std::memmove( stage_, stage_ + blocks, staged_ - blocks );
+        staged_ -= blocks;
+        stage_offset_ += blocks;
+    }
+    if( tail && 0 < staged_ ){
+        ::fcntl( fd_, F_SETFL, ::fcntl( fd_, F_GETFL ) & ~O_DIRECT );
+        write_at( stage_, staged_, stage_offset_, ec );
+        if( !ec ){
+            stage_offset_ += staged_;
+            staged_ = 0;
+        }
+    }
+    #else
+    (void)tail;
+    ec = boost::asio::error::operation_not_supported;
+    #endif /* __linux__ */
+}
+
+void FileSink::release()
+{
+    #ifdef __linux__
+    if( map_ ){
+        ::munmap( map_, size_ );
+    }
+    std::free( stage_ );
+    if( fd_ != -1 ){
+        ::close( fd_ );
+    }
+    #endif /* __linux__ */
+    fd_ = -1;
+    map_ = nullptr;
+    stage_ = nullptr;
+    staged_ = 0;
+    stage_offset_ = 0;
+    size_ = written_ = 0;
+}
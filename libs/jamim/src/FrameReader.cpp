@@ -0,0 +1,117 @@
+#include "FrameReader.hpp"
+#include <algorithm>
+#include <cstring>
+
+
+namespace
+{
+
+std::size_t round_up_pow2( std::size_t n )
+{
+    std::size_t pow2 = 1;
+    while( pow2 < n ){
+        pow2 <<= 1;
+    }
+    return pow2;
+}
+
+} // namespace
+
+
+FrameReader::FrameReader( std::size_t capacity )
+    : buffer_( round_up_pow2( std::max<std::size_t>( capacity
+                                  , MessageHeader::ExtendedHeaderLength ) ) )
+    , mask_( buffer_.size() - 1 )
+    , head_( 0 )
+    , tail_( 0 )
+    , initial_capacity_( buffer_.size() )
+    , max_frame_size_( DefaultMaxFrameSize )
+{
+}
+
+boost::asio::mutable_buffers_1 FrameReader::prepare()
+{
+    if( head_ == tail_ ){
+        // nothing buffered - restart at the front to avoid wrapping and
+        // give back the memory of an oversized frame
+        head_ = tail_ = 0;
+        if( buffer_.size() > initial_capacity_ ){
+            std::vector<uint8_t>( initial_capacity_ ).swap( buffer_ );
+            mask_ = buffer_.size() - 1;
+        }
+    }
+    const std::size_t free_space = buffer_.size() - size();
+    const std::size_t offset = tail_ & mask_;
+    const std::size_t contiguous = std::min( free_space, buffer_.size() - offset );
+    return boost::asio::buffer( buffer_.data() + offset, contiguous );
+}
+
+void FrameReader::commit( std::size_t bytes_transferred )
+{
+    tail_ += bytes_transferred;
+}
+
+bool FrameReader::next( MessageView& view, boost::system::error_code& ec )
+{
+    ec = boost::system::error_code();
+    if( size() < MessageHeader::HeaderLength ){
+        return false;
+    }
+
+    const std::size_t header_length = MessageHeader::length_of( byte_at( 0 ) );
+    if( size() < header_length ){
+        return false;
+    }
+    uint8_t header_bytes[MessageHeader::ExtendedHeaderLength];
+    for( std::size_t i=0; i<header_length; ++i ){
+        header_bytes[i] = byte_at( i );
+    }
+    if( !MessageHeader::well_formed( header_bytes ) ){
+        ec = boost::system::errc::make_error_code( boost::system::errc::bad_message );
+        return false;
+    }
+    const MessageHeader header = MessageHeader::from_bytes( header_bytes );
+
+    std::size_t frame_length = header.length() + header.msg_length();
+    if( header.msg_type() == MessageType::FileStart ){
+        frame_length += MessageView::FileInfoLength;
+    }
+    if( frame_length > max_frame_size_ ){
+        ec = boost::asio::error::message_size;
+        return false;
+    }
+    if( frame_length > buffer_.size() ){
+        grow( frame_length );
+    }
+    if( size() < frame_length ){
+        return false;
+    }
+
+    const std::size_t offset = head_ & mask_;
+    if( offset + frame_length <= buffer_.size() ){
+        view = MessageView( buffer_.data() + offset, frame_length );
+    }
+    else{
+        const std::size_t first = buffer_.size() - offset;
+        wrapped_frame_.resize( frame_length );
+        std::memcpy( wrapped_frame_.data(), buffer_.data() + offset, first );
+        std::memcpy( wrapped_frame_.data() + first, buffer_.data(), frame_length - first );
+        view = MessageView( wrapped_frame_.data(), frame_length );
+    }
+    head_ += frame_length;
+    return true;
+}
+
+/* Make room for a frame larger than the ring, keeping the buffered bytes */
+void FrameReader::grow( std::size_t frame_length )
+{
+    std::vector<uint8_t> buffer( round_up_pow2( frame_length ) );
+    const std::size_t buffered = size();
+    for( std::size_t i=0; i<buffered; ++i ){
+        buffer[i] = byte_at( i );
+    }
+    buffer_.swap( buffer );
+    mask_ = buffer_.size() - 1;
+    head_ = 0;
+    tail_ = buffered;
+}
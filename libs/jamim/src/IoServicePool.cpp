@@ -0,0 +1,96 @@
+#include "IoServicePool.hpp"
+#include <algorithm>
+#include <boost/bind.hpp>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif /* __linux__ */
+
+
+namespace
+{
+
+void pin_to_core( std::size_t core )
+{
+    #ifdef __linux__
+    const unsigned cores = std::max( 1u, boost::thread::hardware_concurrency() );
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    CPU_SET( core % cores, &set );
+    pthread_setaffinity_np( pthread_self(), sizeof(set), &set );
+    #else
+    (void)core;
+    #endif /* __linux__ */
+}
+
+} // namespace
+
+
+IoServicePool::IoServicePool( Mode mode, std::size_t threads )
+    : mode_( mode )
+    , thread_count_( std::max<std::size_t>( threads, 1 ) )
+    , next_( 0 )
+{
+    const std::size_t count = ( mode_ == PerCore ) ? thread_count_ : 1;
+    loads_.reset( new std::atomic<std::size_t>[count] );
+    for( std::size_t i=0; i<count; ++i ){
+        loads_[i] = 0;
+        services_.emplace_back( new boost::asio::io_service( 
+                                    ( mode_ == PerCore ) ? 1 : thread_count_ ) );
+    }
+}
+
+IoServicePool::~IoServicePool()
+{
+    stop();
+    join();
+}
+
+boost::asio::io_service& IoServicePool::acquire( Lease& lease )
+{
+    std::size_t best = 0;
+    for( std::size_t i=1; i<services_.size(); ++i ){
+        if( loads_[i] < loads_[best] ){
+            best = i;
+        }
+    }
+    lease = Lease( &loads_[best] );
+    return *services_[best];
+}
+
+void IoServicePool::run()
+{
+    for( auto& service : services_ ){
+        work_.emplace_back( new boost::asio::io_service::work( *service ) );
+    }
+    if( mode_ == PerCore ){
+        for( std::size_t i=0; i<services_.size(); ++i ){
+            boost::asio::io_service* service = services_[i].get();
+            threads_.create_thread(
+                [service,i]()
+                {
+                    pin_to_core( i );
+                    service->run();
+                } );
+        }
+    }
+    else{
+        for( std::size_t i=0; i<thread_count_; ++i ){
+            threads_.create_thread(
+                boost::bind( &boost::asio::io_service::run, services_.front().get() ) );
+        }
+    }
+}
+
+void IoServicePool::stop()
+{
+    work_.clear();
+    for( auto& service : services_ ){
+        service->stop();
+    }
+}
+
+void IoServicePool::join()
+{
+    threads_.join_all();
+}
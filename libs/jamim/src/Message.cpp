@@ -1,135 +1,400 @@
-#include "Message.hpp"
-#include <string>
-#include <unordered_map>
-#include <utility>
-#include <iterator>
-
-/* ------------------------------------------------------------------------- */
-namespace
-{
-const char COMMAND_INDICATOR = '-';
-const std::string CMD_QUIT{ "quit" };
-const std::string CMD_START_FILE{ "send" };
-const std::string CMD_CANCEL_CURRENT{ "cancel" };
-const std::string CMD_CANCEL_ALL{ "cancel-all" };
-
-std::unordered_map<std::string, MessageType> CommandMap{
-        { CMD_QUIT              , MessageType::CmdQuit }
-    ,   { CMD_START_FILE        , MessageType::CmdStartFile }
-    ,   { CMD_CANCEL_CURRENT    , MessageType::CmdCancelCurrent }
-    ,   { CMD_CANCEL_ALL        , MessageType::CmdCancelAll }
-    };
-
-inline MessageType command_type( std::string&& str );
-    
-} // namespace
-/* ------------------------------------------------------------------------- */
-
-// const std::unordered_map<MessageType,std::string> Message::s_type_string_map_{
-//     {Message::EmptyMsg         ,}
-//     {Message::ChatMsg          ,}
-//     {Message::CmdQuit          ,}
-//     {Message::CmdStartFile     ,}
-//     {Message::CmdCancelCurrent ,}
-//     {Message::CmdCancelAll     ,}
-//     {Message::Unknown          ,}
-// };
-
-Message message_from_string( const std::string& str )
-{
-     if( str.empty() ){
-        return Message( MessageType::EmptyMsg, MessageSize::Empty );
-     }
-
-     if( str.front() == COMMAND_INDICATOR ){
-         return command_from_string( str );
-     }
-     
-     return Message( MessageType::ChatMsg, str );
-     
-}
-
-Message command_from_string( const std::string& str )
-{
-    std::string::size_type cmd_end = str.find( ' ' ) - 1;    // commands which attach a msg - CmdStartFile
-    if( cmd_end == std::string::npos ){  
-        cmd_end = str.size()-1;           // non-msg commands
-    }
-
-    MessageType cmd_type = command_type( str.substr( 1, cmd_end ) );
-    if( cmd_type == MessageType::CmdStartFile ){
-        return Message( cmd_type, str.substr( cmd_end+2 ) );
-    }
-    else if( cmd_type == MessageType::CmdQuit ){
-        return Message( cmd_type, QUIT_MSG );
-    }
-    else{
-        return Message( cmd_type, MessageSize::Empty );
-    }
-    
-}
-
-Message make_file_message( uint32_t file_size, const Message& msg )
-{
-    return make_file_message( file_size, msg.body_to_string() );
-}
-
-Message make_file_message( uint32_t file_size, const std::string& str )
-{
-    MessageHeader header( MessageType::FileStart, str.size() );
-    std::vector<uint8_t> msgbody(header.begin(), header.end());
-    for( int i=24; i>=0; i-=8 ){
-        msgbody.push_back( static_cast<uint8_t>(file_size >> i) );
-    }
-    std::copy( str.cbegin(), str.cend()
-             , std::back_inserter(msgbody) );
-            
-    return Message( std::move(msgbody) );
-}
-
-
-Message::Message( MessageType type, const std::string& str )
-    : Message( type, str.size() )
-{
-    std::copy( str.cbegin(), str.cend(), (msg_body_.data() + header_.length()) );
-}
-
-Message::Message( std::vector<uint8_t>&& body )
-    : msg_body_( std::move( body ) )
-    , header_( static_cast<MessageType>(msg_body_[MessageHeader::type_offset])
-             , make_uint16(msg_body_[MessageHeader::length_msb_offset]
-                          ,msg_body_[MessageHeader::length_lsb_offset]
-             ))
-{
-}
-
-
-std::ostream& operator<<( std::ostream& os, const Message& msg )
-{
-    return os << ">>> " 
-              << std::string( msg.msg_body(), msg.msg_body()+msg.body_length() );
-}
-
-
-/* ------------------------------------------------------------------------- */
-namespace
-{
-
-inline MessageType command_type( std::string&& str )
-{
-    auto it_cmd = CommandMap.find( str );
-    if( it_cmd != CommandMap.end() ){
-        return it_cmd->second;
-    }
-    else{
-        return MessageType::Unknown;
-    }
-}
-    
-} // namespace
-/* ------------------------------------------------------------------------- */
-
-int dummy()
-{
-    return 42;
-}
+#include "Message.hpp"
+#include <string>
+#include <utility>
+#include <iterator>
+
+/* ------------------------------------------------------------------------- */
+namespace
+{
+const char COMMAND_INDICATOR = '-';
+const char CMD_QUIT[]           = "quit";
+const char CMD_JOIN[]           = "join";
+const char CMD_PART[]           = "part";
+const char CMD_START_FILE[]     = "send";
+const char CMD_CANCEL_CURRENT[] = "cancel";
+const char CMD_CANCEL_ALL[]     = "cancel-all";
+
+inline MessageType command_type( boost::string_view name );
+    
+} // namespace
+/* ------------------------------------------------------------------------- */
+
+// const std::unordered_map<MessageType,std::string> Message::s_type_string_map_{
+//     {Message::EmptyMsg         ,}
+//     {Message::ChatMsg          ,}
+//     {Message::CmdQuit          ,}
+//     {Message::CmdStartFile     ,}
+//     {Message::CmdCancelCurrent ,}
+//     {Message::CmdCancelAll     ,}
+//     {Message::Unknown          ,}
+// };
+
+Message message_from_string( boost::string_view str )
+{
+     if( str.empty() ){
+        return Message( MessageType::EmptyMsg, MessageSize::Empty );
+     }
+
+     if( str.front() == COMMAND_INDICATOR ){
+         return command_from_string( str );
+     }
+     
+     return Message( MessageType::ChatMsg, str );
+     
+}
+
+Message command_from_string( boost::string_view str )
+{
+    // "-name" or "-name argument"; only CmdStartFile and CmdJoin carry
+    // their argument
+    const boost::string_view::size_type name_end = str.find( ' ' );
+    const boost::string_view name = str.substr( 1, name_end - 1 );
+
+    MessageType cmd_type = command_type( name );
+    if( cmd_type == MessageType::CmdStartFile
+     || cmd_type == MessageType::CmdJoin ){
+        return Message( cmd_type, ( name_end == boost::string_view::npos )
+                                  ? boost::string_view()
+                                  : str.substr( name_end+1 ) );
+    }
+    else if( cmd_type == MessageType::CmdQuit ){
+        return Message( cmd_type, QUIT_MSG );
+    }
+    else{
+        return Message( cmd_type, MessageSize::Empty );
+    }
+    
+}
+
+Message make_file_message( uint64_t file_size, const Message& msg
+                         , uint64_t transfer_id )
+{
+    return make_file_message( file_size
+                            , boost::string_view( reinterpret_cast<const char*>( msg.msg_body() )
+                                                , msg.body_length() )
+                            , transfer_id );
+}
+
+Message make_file_message( uint64_t file_size, boost::string_view str
+                         , uint64_t transfer_id )
+{
+    Message msg( MessageType::FileStart, str.size() );
+    uint8_t* info = msg.msg_body() - Message::FileInfoLength;
+    put_uint64( info, file_size );
+    put_uint64( info + Message::FileSizeLength, transfer_id );
+    std::copy( str.cbegin(), str.cend(), msg.msg_body() );
+            
+    return msg;
+}
+
+Message make_file_accept( const FileResume& resume )
+{
+    Message msg( MessageType::FileAccept, FileResume::BodyLength );
+    uint8_t* body = msg.msg_body();
+    put_uint64( body, resume.transfer_id );
+    put_uint64( body + 8, resume.offset );
+    put_uint32( body + 16, resume.prefix_crc );
+    return msg;
+}
+
+FileResume file_resume( const uint8_t* body, std::size_t length )
+{
+    if( length < FileResume::BodyLength ){
+        return FileResume();
+    }
+    return FileResume( make_uint64( body ), make_uint64( body + 8 )
+                     , make_uint32( body[16], body[17], body[18], body[19] ) );
+}
+
+Message make_file_control( MessageType type, uint64_t transfer_id
+                         , boost::string_view reason )
+{
+    Message msg( type, static_cast<uint32_t>( FileControlLength + reason.size() ) );
+    put_uint64( msg.msg_body(), transfer_id );
+    std::copy( reason.cbegin(), reason.cend(), msg.msg_body() + FileControlLength );
+    return msg;
+}
+
+uint64_t file_control_id( const uint8_t* body, std::size_t length )
+{
+    return ( length < FileControlLength ) ? 0 : make_uint64( body );
+}
+
+std::string file_control_reason( const uint8_t* body, std::size_t length )
+{
+    if( length <= FileControlLength ){
+        return std::string();
+    }
+    return std::string( body + FileControlLength, body + length );
+}
+
+void put_file_chunk_header( uint8_t* data, const FileChunkHeader& header )
+{
+    put_uint64( data, header.transfer_id );
+    put_uint32( data + 8, header.length );
+}
+
+FileChunkHeader file_chunk_header( const uint8_t* data )
+{
+    return FileChunkHeader( make_uint64( data )
+                          , make_uint32( data[8], data[9], data[10], data[11] ) );
+}
+
+Message make_file_resend( uint64_t transfer_id, const std::vector< FileRange >& ranges )
+{
+    Message msg( MessageType::FileResend, static_cast<uint32_t>(
+                     ResendRequest::PrefixLength + ResendRequest::RangeLength * ranges.size() ) );
+    uint8_t* body = msg.msg_body();
+    put_uint64( body, transfer_id );
+    put_uint64( body + ResendRequest::ReaderOffset, 0 );
+    body += ResendRequest::PrefixLength;
+    for( const FileRange& range : ranges ){
+        put_uint64( body, range.offset );
+        put_uint32( body + 8, range.length );
+        body += ResendRequest::RangeLength;
+    }
+    return msg;
+}
+
+Message make_file_repair( uint64_t transfer_id, uint64_t reader, uint64_t offset
+                        , const char* data, std::size_t bytes )
+{
+    Message msg( MessageType::FileRepair
+               , static_cast<uint32_t>( RepairChunk::PrefixLength + bytes ) );
+    uint8_t* body = msg.msg_body();
+    put_uint64( body, transfer_id );
+    put_uint64( body + RepairChunk::ReaderOffset, reader );
+    put_uint64( body + 16, offset );
+    std::copy( data, data + bytes, body + RepairChunk::PrefixLength );
+    return msg;
+}
+
+ResendRequest file_resend( const uint8_t* body, std::size_t length )
+{
+    ResendRequest resend;
+    resend.transfer_id = make_uint64( body );
+    resend.reader = make_uint64( body + ResendRequest::ReaderOffset );
+    for( std::size_t at = ResendRequest::PrefixLength
+       ; at + ResendRequest::RangeLength <= length; at += ResendRequest::RangeLength ){
+        const uint8_t* range = body + at;
+        resend.ranges.push_back( FileRange( make_uint64( range )
+            , make_uint32( range[8], range[9], range[10], range[11] ) ) );
+    }
+    return resend;
+}
+
+RepairChunk file_repair( const uint8_t* body, std::size_t length )
+{
+    RepairChunk repair;
+    repair.transfer_id = make_uint64( body );
+    repair.reader = make_uint64( body + RepairChunk::ReaderOffset );
+    repair.offset = make_uint64( body + 16 );
+    repair.data = body + RepairChunk::PrefixLength;
+    repair.length = length - RepairChunk::PrefixLength;
+    return repair;
+}
+
+
+Message::Message( const MessageHeader& header )
+    : size_( 0 )
+    , capacity_( InlineCapacity )
+{
+    std::size_t length = header.length() + header.msg_length();
+    if( header.msg_type() == MessageType::FileStart ){
+        length += FileInfoLength;
+    }
+    resize( length );
+    std::copy( header.begin(), header.end(), data() );
+}
+
+Message::Message( MessageType type, boost::string_view str )
+    : Message( type, str.size() )
+{
+    std::copy( str.cbegin(), str.cend(), msg_body() );
+}
+
+Message::Message( const MessageView& view )
+    : size_( 0 )
+    , capacity_( InlineCapacity )
+{
+    assign( view.data(), view.total_length() );
+}
+
+Message::Message( const Message& other )
+    : size_( 0 )
+    , capacity_( InlineCapacity )
+{
+    assign( other.data(), other.size_ );
+}
+
+Message::Message( Message&& other ) noexcept
+    : size_( 0 )
+    , capacity_( InlineCapacity )
+{
+    steal( other );
+}
+
+Message& Message::operator=( const Message& other )
+{
+    if( this != &other ){
+        assign( other.data(), other.size_ );
+    }
+    return *this;
+}
+
+Message& Message::operator=( Message&& other ) noexcept
+{
+    if( this != &other ){
+        release();
+        steal( other );
+    }
+    return *this;
+}
+
+Message::~Message()
+{
+    release();
+}
+
+void Message::body_length( uint32_t len )
+{
+    MessageHeader header = this->header();
+    const std::size_t old_header = header.length();
+    header.msg_length( len );
+    if( header.length() == old_header ){
+        std::copy( header.begin(), header.end(), data() );
+        resize( header_length() + len );
+    }
+    else{
+        // the header switches between compact and extended format
+        Message frame( header );
+        const std::size_t keep = std::min( size_ - old_header
+                                         , frame.size_ - header.length() );
+        std::copy( data() + old_header, data() + old_header + keep
+                 , frame.data() + header.length() );
+        *this = std::move( frame );
+    }
+}
+
+void Message::msg_type( MessageType t )
+{
+    MessageHeader header = this->header();
+    header.msg_type( t );
+    std::copy( header.begin(), header.end(), data() );
+    resize( header_length() + header.msg_length() );
+}
+
+void Message::resize( std::size_t size )
+{
+    if( size > capacity_ ){
+        uint8_t* block = static_cast<uint8_t*>( BufferPool::allocate( size ) );
+        std::copy( data(), data() + size_, block );
+        const std::size_t old_size = size_;
+        release();
+        size_ = old_size;
+        storage_.heap_ = block;
+        capacity_ = size;
+    }
+    if( size > size_ ){
+        std::fill( data() + size_, data() + size, 0 );
+    }
+    size_ = size;
+}
+
+void Message::assign( const uint8_t* data, std::size_t size )
+{
+    if( size > capacity_ ){
+        release();
+        storage_.heap_ = static_cast<uint8_t*>( BufferPool::allocate( size ) );
+        capacity_ = size;
+    }
+    std::copy( data, data + size, this->data() );
+    size_ = size;
+}
+
+void Message::release()
+{
+    if( !is_inline() ){
+        BufferPool::deallocate( storage_.heap_, capacity_ );
+        capacity_ = InlineCapacity;
+    }
+    size_ = 0;
+}
+
+void Message::steal( Message& other )
+{
+    // this is empty and inline; other is left as an empty inline frame
+    if( other.is_inline() ){
+        std::copy( other.storage_.inline_, other.storage_.inline_ + other.size_
+                 , storage_.inline_ );
+    }
+    else{
+        storage_.heap_ = other.storage_.heap_;
+        capacity_ = other.capacity_;
+        other.capacity_ = InlineCapacity;
+    }
+    size_ = other.size_;
+    other.size_ = MessageHeader::HeaderLength;
+    std::fill( other.storage_.inline_
+             , other.storage_.inline_ + MessageHeader::HeaderLength, 0 );
+}
+
+
+std::ostream& operator<<( std::ostream& os, const Message& msg )
+{
+    return os << ">>> " 
+              << std::string( msg.msg_body(), msg.msg_body()+msg.body_length() );
+}
+
+std::ostream& operator<<( std::ostream& os, const MessageView& msg )
+{
+    return os << ">>> " << msg.body_to_string();
+}
+
+
+/* ------------------------------------------------------------------------- */
+namespace
+{
+
+/* Commands are matched on their length first, so at most four short
+ * compares are made and nothing is allocated. */
+inline MessageType command_type( boost::string_view name )
+{
+    switch( name.size() ){
+    case sizeof(CMD_QUIT) - 1:      // also CMD_START_FILE, CMD_JOIN, CMD_PART
+        if( name == CMD_QUIT ){
+            return MessageType::CmdQuit;
+        }
+        if( name == CMD_START_FILE ){
+            return MessageType::CmdStartFile;
+        }
+        if( name == CMD_JOIN ){
+            return MessageType::CmdJoin;
+        }
+        if( name == CMD_PART ){
+            return MessageType::CmdPart;
+        }
+        break;
+    case sizeof(CMD_CANCEL_CURRENT) - 1:
+        if( name == CMD_CANCEL_CURRENT ){
+            return MessageType::CmdCancelCurrent;
+        }
+        break;
+    case sizeof(CMD_CANCEL_ALL) - 1:
+        if( name == CMD_CANCEL_ALL ){
+            return MessageType::CmdCancelAll;
+        }
+        break;
+    default:
+        break;
+    }
+    return MessageType::Unknown;
+}
+    
+} // namespace
+/* ------------------------------------------------------------------------- */
+
+int dummy()
+{
+    return 42;
+}
@@ -1,922 +1,2153 @@
-#include "Server.hpp"
-#include "Message.hpp"
-#include <boost/bind.hpp>
-#include <functional>
-#include <boost/thread.hpp>
-#include <boost/date_time/posix_time/posix_time.hpp>
-
-
-using boost::mutex;
-static mutex debug_mutex;
-
-
-/* ChatRoom */
-/* ------------------------------------------------------------------------- */
-void ChatRoom::join( ptr_ChatParticipant participant )
-{
-    #ifndef NDEBUG
-    { mutex::scoped_lock lk(debug_mutex);
-        std::cout << __PRETTY_FUNCTION__ << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    participants_.insert( participant );
-}
-
-void ChatRoom::leave( ptr_ChatParticipant participant )
-{
-    #ifndef NDEBUG
-    { mutex::scoped_lock lk(debug_mutex);
-        std::cout << __PRETTY_FUNCTION__ << ", participant: "
-                  << reinterpret_cast<const void*>(participant.get())
-                  << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    participants_.erase( participant );
-}
-
-std::size_t ChatRoom::participant_count() const
-{
-    #ifndef NDEBUG
-    { mutex::scoped_lock lk(debug_mutex);
-        std::cout << __PRETTY_FUNCTION__ << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    return participants_.size();
-}
-
-void ChatRoom::deliver( const Message& msg, ptr_ChatParticipant sender )
-{
-    #ifndef NDEBUG
-    { mutex::scoped_lock lk(debug_mutex);
-        std::cout << __PRETTY_FUNCTION__ << ", sender: "
-                  << reinterpret_cast<const void*>(sender.get())
-                  << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    for( auto it = participants_.begin(); it != participants_.end(); ++it ){
-        if( *it != sender ){
-            (*it)->deliver( msg );
-        }
-    }
-}
-
-void ChatRoom::deliver( const Message& msg )
-{
-    #ifndef NDEBUG
-    { mutex::scoped_lock lk(debug_mutex);
-        std::cout << __PRETTY_FUNCTION__ << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    for( auto participant : participants_ ){
-        participant->deliver( msg );
-    }
-}
-
-void ChatRoom::file_awaiting( const Message& msg, ptr_ChatParticipant sender )
-{
-    #ifndef NDEBUG
-    { mutex::scoped_lock lk(debug_mutex);
-        std::cout << __PRETTY_FUNCTION__ << ", sender: "
-                  << reinterpret_cast<const void*>(sender.get())
-                  << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    response_awaiters_.insert( sender );
-    file_sender_readers_map_.insert( {sender, participants_} );
-    sender->file_responses_remaining( participants_.size() );
-    deliver( msg, sender );
-}
-
-/* Signaled by a ChatParticipant who recieved the expected number of 
- * responses */
-void ChatRoom::file_awaiting_complete( ptr_ChatParticipant sender )
-{
-    #ifndef NDEBUG
-    { mutex::scoped_lock lk(debug_mutex);
-        std::cout << __PRETTY_FUNCTION__ << ", sender: "
-                  << reinterpret_cast<const void*>(sender.get())
-                  << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    response_awaiters_.erase( sender );
-    auto it_awaiter = file_sender_readers_map_.find( sender );
-    if( it_awaiter != file_sender_readers_map_.end() ){
-        if( it_awaiter->second.empty() ){
-            file_sender_readers_map_.erase( sender );
-        }
-    }
-}
-
-std::size_t ChatRoom::file_reader_count( ptr_ChatParticipant sender ) const
-{
-    #ifndef NDEBUG
-    { mutex::scoped_lock lk(debug_mutex);
-        std::cout << __PRETTY_FUNCTION__ << ", sender: "
-                  << reinterpret_cast<const void*>(sender.get())
-                  << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    auto it_awaiter = file_sender_readers_map_.find( sender );
-    if( it_awaiter != file_sender_readers_map_.end() ){
-        return it_awaiter->second.size();
-    }
-    else{
-        return 0;
-    }
-}
-
-/* Sent by a ChatParticipant (sender) accepting a file transfer */
-void ChatRoom::file_accept( const Message& msg, ptr_ChatParticipant sender )
-{
-    #ifndef NDEBUG
-    { mutex::scoped_lock lk(debug_mutex);
-        std::cout << __PRETTY_FUNCTION__ << ", sender: "
-                  << reinterpret_cast<const void*>(sender.get())
-                  << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    for( ptr_ChatParticipant p : response_awaiters_ ){
-        auto it_awaiter = file_sender_readers_map_.find( p );
-        if( it_awaiter != file_sender_readers_map_.end() ){
-            it_awaiter->first->file_accepted( msg, sender );
-        }
-    }
-}
-
-/* Sent by a ChatParticipant (sender) refusing a file transfer */
-void ChatRoom::file_refuse( const Message& msg, ptr_ChatParticipant sender )
-{
-    #ifndef NDEBUG
-    { mutex::scoped_lock lk(debug_mutex);
-        std::cout << __PRETTY_FUNCTION__ << ", sender: "
-                  << reinterpret_cast<const void*>(sender.get())
-                  << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    for( ptr_ChatParticipant p : response_awaiters_ ){
-        auto it_awaiter = file_sender_readers_map_.find( p );
-        if( it_awaiter != file_sender_readers_map_.end() ){
-            it_awaiter->second.erase( sender );
-            it_awaiter->first->file_refused( msg, sender );
-        }
-    }
-}
-
-void ChatRoom::file_cancel( const Message& msg, ptr_ChatParticipant sender )
-{
-    #ifndef NDEBUG
-    { mutex::scoped_lock lk(debug_mutex);
-        std::cout << __PRETTY_FUNCTION__ << ", sender: "
-                  << reinterpret_cast<const void*>(sender.get())
-                  << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    file_msg_deliver( msg, sender );
-    file_sender_readers_map_.erase( sender );
-}
-
-void ChatRoom::file_cancel_all( const Message& msg, ptr_ChatParticipant sender )
-{
-    #ifndef NDEBUG
-    { mutex::scoped_lock lk(debug_mutex);
-        std::cout << __PRETTY_FUNCTION__ << ", sender: "
-                  << reinterpret_cast<const void*>(sender.get())
-                  << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    file_msg_deliver( msg, sender );
-    file_sender_readers_map_.erase( sender );
-}
-
-void ChatRoom::file_done( const Message& msg, ptr_ChatParticipant sender )
-{
-    file_msg_deliver( msg, sender );
-    file_sender_readers_map_.erase( sender );
-}
-
-
-void ChatRoom::file_deliver( const std::vector<char>& data
-                           , ptr_ChatParticipant sender )
-{
-    #ifndef NDEBUG
-    { mutex::scoped_lock lk(debug_mutex);
-        std::cout << __PRETTY_FUNCTION__ << ", sender: "
-                  << reinterpret_cast<const void*>(sender.get())
-                  << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    auto it = file_sender_readers_map_.find( sender );
-    if( it != file_sender_readers_map_.end() ){
-        for( ptr_ChatParticipant reader : it->second ){
-            reader->file_deliver( data );
-        }
-    }
-}
-
-void ChatRoom::file_msg_deliver( const Message& msg
-                               , ptr_ChatParticipant sender )
-{
-    #ifndef NDEBUG
-    { mutex::scoped_lock lk(debug_mutex);
-        std::cout << __PRETTY_FUNCTION__ << ", sender: "
-                  << reinterpret_cast<const void*>(sender.get())
-                  << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    auto it = file_sender_readers_map_.find( sender );
-    if( it != file_sender_readers_map_.end() ){
-        for( ptr_ChatParticipant reader : it->second ){
-            reader->file_msg_deliver( msg );
-        }
-    }
-}
-/* ------------------------------------------------------------------------- */
-
-/* ChatSession */
-/* ------------------------------------------------------------------------- */
-
-/* static variables */
-const std::unordered_map<MessageType, ChatSession::Handler>
-ChatSession::s_handler_map_{
-      { MessageType::EmptyMsg         , &ChatSession::handle_empty }
-    , { MessageType::ChatMsg          , &ChatSession::handle_read_body }
-    , { MessageType::CmdQuit          , &ChatSession::handle_quit }
-    , { MessageType::FileStart        , &ChatSession::handle_file_start }
-    , { MessageType::FileAccept       , &ChatSession::handle_file_accept }
-    , { MessageType::FileRefuse       , &ChatSession::handle_file_refuse }
-    , { MessageType::FileCancel       , &ChatSession::handle_file_cancel }
-    , { MessageType::FileCancelAll    , &ChatSession::handle_file_cancel_all }
-    , { MessageType::FileDone         , &ChatSession::handle_file_done}
-    , { MessageType::Unknown          , &ChatSession::handle_unknown }
-};
-
-
-/* public */
-
-void ChatSession::start()
-{
-    #ifndef NDEBUG
-    { mutex::scoped_lock lk(debug_mutex);
-        std::cout << __PRETTY_FUNCTION__
-                  << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    room_.join( shared_from_this() );
-    do_read_header();
-}
-
-void ChatSession::deliver( const Message& msg )
-{
-    #ifndef NDEBUG
-    { mutex::scoped_lock lk(debug_mutex);
-        std::cout << __PRETTY_FUNCTION__
-                  << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    io_strand_.post(
-        [this,msg]()
-        {
-            bool write_in_progress = !write_msg_queue_.empty();
-            write_msg_queue_.push_back( msg );
-            if( !write_in_progress ){
-                do_write();
-            }
-        }
-    );
-}
-
-/* private */
-
-void ChatSession::do_read_header()
-{
-    #ifndef NDEBUG
-    { mutex::scoped_lock lk(debug_mutex);
-        std::cout << __PRETTY_FUNCTION__
-                  << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    boost::asio::async_read( socket_
-        , boost::asio::buffer( read_msg_.data(), MessageHeader::HeaderLength )
-        , io_strand_.wrap(
-            boost::bind( &ChatSession::handle_read_header, shared_from_this()
-                , boost::asio::placeholders::error
-                , boost::asio::placeholders::bytes_transferred
-                /* , shared_from_this() */ )
-        ));
-}
-
-void ChatSession::handle_read_header( const boost::system::error_code& ec
-                                    , std::size_t /*length*/
-                                    /* , ptr_ChatParticipant sender */ )
-{
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-        std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    if( !ec ){
-        read_msg_.sync();
-        do_read_body();
-    }
-    else{
-        handle_error( ec );
-    }
-}
-
-void ChatSession::do_read_body()
-{
-    #ifndef NDEBUG
-    { mutex::scoped_lock lk(debug_mutex);
-        std::cout << __PRETTY_FUNCTION__
-                  << std::endl;
-    }
-    #endif /* NDEBUG */
-    
-    auto it = s_handler_map_.find( read_msg_.msg_type() );
-    Handler handler = ( (it!=s_handler_map_.end()) ? it->second 
-                                                   : &ChatSession::handle_unknown );
-    boost::asio::async_read( socket_
-        , boost::asio::buffer( read_msg_.msg_body(), read_msg_.body_length() )
-        , io_strand_.wrap(
-            boost::bind( handler, shared_from_this()
-                , boost::asio::placeholders::error
-                , boost::asio::placeholders::bytes_transferred
-                /* , shared_from_this() */ )
-        ));
-}
-
-void ChatSession::handle_read_body( const boost::system::error_code& ec
-                                  , std::size_t /*length*/
-                                  /* , ptr_ChatParticipant sender */ )
-{
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-        std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    if( !ec ){
-        room_.deliver( read_msg_, shared_from_this() );
-        do_read_header();
-    }
-    else{
-        handle_error( ec );
-    }
-}
-
-
-void ChatSession::handle_empty( const boost::system::error_code& ec
-                              , std::size_t /*length*/
-                              /* , ptr_ChatParticipant sender */ )
-{
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-        std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    { mutex::scoped_lock lk(debug_mutex);
-        std::cout << "[Server]: Empty message received" << std::endl;
-    }
-    
-    do_read_header();
-}
-
-void ChatSession::handle_quit( const boost::system::error_code& ec
-                             , std::size_t /*length*/
-                             /* , ptr_ChatParticipant sender */ )
-{
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-        std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    room_.deliver( message_from_string("[Server] User "
-                  + string_id() + " has left the room." ),
-                    shared_from_this() );
-    room_.leave( shared_from_this() );
-}
-
-void ChatSession::handle_unknown( const boost::system::error_code& ec
-                                , std::size_t /*length*/
-                                /* , ptr_ChatParticipant sender */ )
-{
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-        std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    deliver( message_from_string("[Server] Unknown command "
-                      + read_msg_.body_to_string() ) );
-
-    do_read_header();
-}
-
-void ChatSession::do_write()
-{
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-        std::cout << __FUNCTION__ << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    boost::asio::async_write( socket_
-        , boost::asio::buffer( write_msg_queue_.front().data()
-                             , write_msg_queue_.front().total_length() )
-        , io_strand_.wrap(
-            boost::bind( &ChatSession::handle_write, shared_from_this()
-                , boost::asio::placeholders::error
-                , boost::asio::placeholders::bytes_transferred
-                /* , shared_from_this() */ )
-        ));
-}
-
-void ChatSession::handle_write( const boost::system::error_code& ec
-                              , std::size_t /*length*/
-                              /* , ptr_ChatParticipant sender */ )
-{
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-        std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    if( !ec ){
-        write_msg_queue_.pop_front();
-        if( !write_msg_queue_.empty() ){
-            do_write();
-        }
-    }
-    else{
-        handle_error( ec );
-    }
-}
-
-void ChatSession::handle_error( const boost::system::error_code& ec )
-{
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-        std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    // room_.deliver( message_from_string( "[Server] Error occured. Shutting down") );
-    close();
-}
-
-/* file transfer */
-/* ------------------------------------------------------------------------- */
-void ChatSession::handle_file_start( const boost::system::error_code& ec
-                                   , std::size_t /*length*/ )
-{
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-    std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    // file_recievers_.clear();
-    // file_responses_remaining_ = 0;
-    // signal all other participants that a file transfer is about to start
-    room_.file_awaiting( read_msg_, shared_from_this() );
-    do_read_header();
-}
-
-void ChatSession::handle_file_accept( const boost::system::error_code& ec
-                                    , std::size_t /*length*/ )
-{
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-    std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    room_.file_accept( read_msg_, shared_from_this() );
-    do_read_header();
-}
-
-void ChatSession::handle_file_refuse( const boost::system::error_code& ec
-                                    , std::size_t /*length*/ )
-{
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-    std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    room_.file_refuse( read_msg_, shared_from_this() );
-    do_read_header();
-}
-
-void ChatSession::handle_file_cancel( const boost::system::error_code& ec
-                                    , std::size_t /*length*/ )
-{
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-    std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    room_.file_cancel( read_msg_, shared_from_this() );
-    do_read_header();
-}
-
-void ChatSession::handle_file_cancel_all( const boost::system::error_code& ec
-                                        , std::size_t /*length*/ )
-{
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-    std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    room_.file_cancel_all( read_msg_, shared_from_this() );
-    do_read_header();
-}
-
-void ChatSession::handle_file_done( const boost::system::error_code& ec
-                                  , std::size_t /*length*/ )
-{
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-    std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    room_.file_done( read_msg_, shared_from_this() );
-    do_read_header();
-}
-
-/* file sending */
-void ChatSession::do_file_send_start()
-{
-    #ifndef NDEBUG
-    { mutex::scoped_lock lk(debug_mutex);
-        std::cout << __PRETTY_FUNCTION__
-                  << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    // signal the file transfer requestor to start the transfer
-    // start reading data from the file_socket_ -> handle_file_send()
-    file_msg_ = Message( MessageType::FileAccept, MessageSize::Empty );
-    boost::asio::async_write( file_socket_
-        , boost::asio::buffer( file_msg_.data(), file_msg_.total_length() )
-        , io_file_strand_.wrap(
-            boost::bind( &ChatSession::handle_file_send_start, this
-                , boost::asio::placeholders::error
-                , boost::asio::placeholders::bytes_transferred )
-        ));
-}
-
-/* file sending */
-void ChatSession::handle_file_send_start( const boost::system::error_code& ec
-                                  , std::size_t /* bytes_transferred */ )
-{
-    if( !ec ){
-        do_file_send();
-    }
-    else{
-        handle_file_error( ec );
-    }
-}
-
-/* file sending */
-/* Keep reading file chunks as long as they're available */
-void ChatSession::do_file_send()
-{
-    #ifndef NDEBUG
-    { mutex::scoped_lock lk(debug_mutex);
-        std::cout << __PRETTY_FUNCTION__
-                  << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    boost::asio::async_read( file_socket_
-        , boost::asio::buffer( file_send_buf_.data(), file_send_buf_.size() )
-        , io_file_strand_.wrap(
-            boost::bind( &ChatSession::handle_file_send, this
-                , boost::asio::placeholders::error
-                , boost::asio::placeholders::bytes_transferred )
-        ));
-}
-
-/* file sending */
-/* Add file chunks to the queue and start sending them to the
- * recieving participants */
-void ChatSession::handle_file_send( const boost::system::error_code& ec
-                                    , std::size_t bytes_transferred )
-{
-    if( !ec ){
-        room_.file_deliver( std::vector<char>( file_send_buf_.begin()
-                                             , (file_send_buf_.begin() 
-                                               + bytes_transferred) )
-                          , shared_from_this() );
-        do_file_send();
-    }
-    else{
-        handle_file_error( ec );
-    }
-}
-
-/* file sending */
-// void ChatSession::do_file_write()
-// {
-//     #ifndef NDEBUG
-//     {   mutex::scoped_lock lk(debug_mutex);
-//         std::cout << __FUNCTION__ << std::endl;
-//     }
-//     #endif /* NDEBUG */
-
-//     while( !file_send_queue.empty() ){
-//         room_.file_deliver( file_send_queue_.front(), shared_from_this() );
-//         file_send_queue_.pop_front();
-//     }
-
-// }
-
-/* file sending */
-// void ChatSession::handle_file_write( const boost::system::error_code& ec
-//                                    , std::size_t bytes_transferred )
-// {
-//     #ifndef NDEBUG
-//     {   mutex::scoped_lock lk(debug_mutex);
-//         std::cout << __FUNCTION__ << std::endl;
-//     }
-//     #endif /* NDEBUG */
-
-//     if( !ec ){
-//         file_send_queue_.pop_front();
-//         if( !file_send_queue_.empty() ){
-//             do_file_write();
-//         }
-//     }
-//     else{
-//         handle_file_error( ec );
-//     }
-// }
-
-/* file sending */
-// void ChatSession::do_file_deliver( std::vector<char>&& data )
-// {
-    // #ifndef NDEBUG
-    // {   mutex::scoped_lock lk(debug_mutex);
-    //     std::cout << __FUNCTION__ << std::endl;
-    // }
-    // #endif /* NDEBUG */
-
-    // io_strand_.post(
-    //     [this,data]()
-    //     {
-    //         bool write_in_progress = !file_send_queue_.empty();
-    //         file_send_queue_.push_back( std::move(data) );
-    //         if( !write_in_progress ){
-    //             do_file_write();
-    //         }
-    //     }
-    // );
-// }
-
-/* file recieving */
-void ChatSession::file_deliver( const std::vector<char>& data )
-{
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-        std::cout << __FUNCTION__ << std::endl;
-    }
-    #endif /* NDEBUG */
-    
-    io_file_strand_.post(
-        [this,data]()
-        {
-            bool write_in_progress = !file_read_queue_.empty();
-            file_read_queue_.push_back( data );
-            if( !write_in_progress ){
-                do_file_read();
-            }
-        }
-    );
-}
-
-/* file recieving */
-void ChatSession::do_file_read()
-{
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-        std::cout << __FUNCTION__ << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    boost::asio::async_write( file_socket_
-        , boost::asio::buffer( file_read_queue_.front()
-                             , file_read_queue_.front().size() )
-        , io_file_strand_.wrap(
-            boost::bind( &ChatSession::handle_file_read, shared_from_this()
-                , boost::asio::placeholders::error
-                , boost::asio::placeholders::bytes_transferred )
-        ));
-}
-
-/* file recieving */
-void ChatSession::handle_file_read( const boost::system::error_code& ec
-                                  , std::size_t bytes_transferred )
-{
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-        std::cout << __FUNCTION__ << "ec: " << ec
-                  << ", bytes transferred: " << bytes_transferred
-                  << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    if( !ec ){
-        file_read_queue_.pop_front();
-        if( !file_read_queue_.empty() ){
-            do_file_read();
-        }
-    }
-    else{
-        handle_file_error( ec );
-    }
-}
-
-/* Signal recieved from ChatRoom that the *sender* accepted the file transfer */
-void ChatSession::file_accepted( const Message& msg
-                               , ptr_ChatParticipant sender )
-{
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-        std::cout << __FUNCTION__ << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    file_recievers_.insert( sender );
-    --file_responses_remaining_;
-    if( file_responses_remaining_ == 0 ){
-        room_.file_awaiting_complete( shared_from_this() );
-        do_file_send_start();
-    }
-}
-
-/* Signal recieved from ChatRoom that the *sender* refused the file transfer */
-void ChatSession::file_refused( const Message& msg
-                              , ptr_ChatParticipant sender )
-{
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-        std::cout << __FUNCTION__ << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    --file_responses_remaining_;
-    if( file_responses_remaining_ == 0 ){
-        room_.file_awaiting_complete( shared_from_this() );
-        if( room_.file_reader_count( shared_from_this() ) != 0 ){
-            do_file_send_start();
-        }
-        else{
-            do_file_cancel();
-        }
-    }
-}
-
-void ChatSession::file_responses_remaining( std::size_t count )
-{
-    file_responses_remaining_ = count;
-}
-
-void ChatSession::file_msg_deliver( const Message& msg
-                                  /* , ptr_ChatParticipant sender */ )
-{
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-        std::cout << __FUNCTION__ << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    io_file_strand_.post(
-        [this,msg]()
-        {
-            bool write_in_progress = !write_msg_queue_.empty();
-            write_msg_queue_.push_back( msg );
-            if( !write_in_progress ){
-                do_write();
-            }
-        }
-    );
-}
-
-void ChatSession::do_file_cancel()
-{
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-        std::cout << __FUNCTION__ << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    /* TODO : implement do_file_cancel */
-}
-
-void ChatSession::handle_file_error( const boost::system::error_code& ec )
-{
-    room_.deliver( Message( MessageType::ChatMsg
-                          , "[File Transfer Error]" ) );
-    file_read_queue_.clear();
-    file_responses_remaining_ = 0;
-}
-
-/* ------------------------------------------------------------------------- */
-
-void ChatSession::close()
-{
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-        std::cout << __FUNCTION__ << std::endl;
-    }
-    #endif /* NDEBUG */
-    boost::system::error_code ec;
-    socket_.shutdown( boost::asio::ip::tcp::socket::shutdown_both, ec );
-    socket_.close( ec );
-    socket_.cancel( ec );
-}
-/* ------------------------------------------------------------------------- */
-
-/* Server */
-/* ------------------------------------------------------------------------- */
-void Server::do_accept()
-{
-    acceptor_.async_accept( socket_
-        , boost::bind( &Server::handle_accept, this
-            , boost::asio::placeholders::error ) );
-}
-
-void Server::handle_accept( const boost::system::error_code& ec )
-{
-    static uint8_t session_id{0};
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-        std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    if( !ec ){
-        // std::make_shared<ChatSession>( io_service_
-        //                              , std::move( socket_ )
-        //                              , room_, session_id++ )->start();
-
-        do_file_accept();
-    }
-}
-
-void Server::do_file_accept()
-{
-    #ifndef NDEBUG
-    { mutex::scoped_lock lk(debug_mutex);
-        std::cout << __PRETTY_FUNCTION__
-                  << std::endl;
-    }
-    #endif /* NDEBUG */
-
-    file_acceptor_.async_accept( file_socket_
-        , boost::bind( &Server::handle_file_accept, this
-                     , boost::asio::placeholders::error ) );
-}
-void Server::handle_file_accept( const boost::system::error_code& ec )
-{
-    #ifndef NDEBUG
-    {   mutex::scoped_lock lk(debug_mutex);
-        std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
-    }
-    #endif /* NDEBUG */
-    if( !ec ){
-        
-        std::make_shared<ChatSession>( io_service_
-                                     , io_service_
-                                     , std::move( socket_ )
-                                     , std::move( file_socket_ )
-                                     , room_, 1 )->start();
-
-        do_accept();
-    }
-}
-/* ------------------------------------------------------------------------- */
+#include "Server.hpp"
+#include "Message.hpp"
+#include <boost/bind.hpp>
+#include <functional>
+#include <algorithm>
+#include <iterator>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+
+using boost::mutex;
+static mutex debug_mutex;
+
+
+/* FileReaders */
+/* ------------------------------------------------------------------------- */
+FileReaders::FileReaders( const Members& members, ParticipantId sender )
+    : members_( members )
+    , words_( ( members->size() + 63 ) / 64 )
+    , active_( new std::atomic< uint64_t >[ words_ ] )
+    , count_( members->size() )
+{
+    for( std::size_t word = 0; word < words_; ++word ){
+        const std::size_t bits = std::min<std::size_t>( 64, members->size() - word * 64 );
+        active_[word].store( ( bits == 64 ) ? ~uint64_t( 0 )
+                                            : ( uint64_t( 1 ) << bits ) - 1 );
+    }
+    remove( sender );
+}
+
+const ptr_ChatParticipant* FileReaders::find( ParticipantId id ) const
+{
+    std::size_t slot = 0;
+    if( !members_->find_slot( id, slot )
+     || ( ( active_[slot / 64].load() >> ( slot % 64 ) ) & 1 ) == 0 ){
+        return nullptr;
+    }
+    return &members_->at( slot );
+}
+
+bool FileReaders::remove( ParticipantId id )
+{
+    std::size_t slot = 0;
+    if( !members_->find_slot( id, slot ) ){
+        return false;
+    }
+    const uint64_t bit = uint64_t( 1 ) << ( slot % 64 );
+    if( ( active_[slot / 64].fetch_and( ~bit ) & bit ) == 0 ){
+        return false;
+    }
+    --count_;
+    return true;
+}
+
+std::vector< ParticipantId > FileReaders::ids() const
+{
+    std::vector< ParticipantId > ids;
+    ids.reserve( size() );
+    for( std::size_t slot = 0; slot < members_->size(); ++slot ){
+        if( ( active_[slot / 64].load() >> ( slot % 64 ) ) & 1 ){
+            ids.push_back( members_->id_at( slot ) );
+        }
+    }
+    return ids;
+}
+/* ------------------------------------------------------------------------- */
+
+
+/* ChatRoom */
+/* ------------------------------------------------------------------------- */
+void ChatRoom::join( ptr_ChatParticipant participant )
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__ << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    participants_.insert( participant->id(), participant );
+}
+
+void ChatRoom::leave( ptr_ChatParticipant participant )
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__ << ", participant: "
+                  << reinterpret_cast<const void*>(participant.get())
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    participants_.erase( participant->id() );
+    file_sender_left( participant->id() );
+}
+
+std::size_t ChatRoom::participant_count() const
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__ << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    return participants_.size();
+}
+
+void ChatRoom::deliver( const Message& msg, ptr_ChatParticipant sender )
+{
+    deliver( make_shared_message( msg ), sender );
+}
+
+void ChatRoom::deliver( const Message& msg )
+{
+    deliver( make_shared_message( msg ) );
+}
+
+/* The frame is encoded once and every participant's write queue references
+ * the same immutable buffer */
+void ChatRoom::deliver( ptr_Message msg, ptr_ChatParticipant sender )
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__ << ", sender: "
+                  << reinterpret_cast<const void*>(sender.get())
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    const Participants::snapshot_type snapshot( participants_.snapshot() );
+    for( const ptr_ChatParticipant& participant : *snapshot ){
+        if( participant != sender ){
+            participant->deliver( msg );
+        }
+    }
+}
+
+void ChatRoom::deliver( ptr_Message msg )
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__ << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    const Participants::snapshot_type snapshot( participants_.snapshot() );
+    for( const ptr_ChatParticipant& participant : *snapshot ){
+        participant->deliver( msg );
+    }
+}
+
+void ChatRoom::post_deliver( ptr_Message msg, ptr_ChatParticipant sender )
+{
+    auto self( shared_from_this() );
+    io_strand_.post(
+        [self,msg,sender]()
+        {
+            self->deliver( msg, sender );
+        }
+    );
+}
+
+void ChatRoom::deliver_to( ParticipantId id, ptr_Message msg )
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__ << ", id: " << id << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    const Participants::snapshot_type snapshot( participants_.snapshot() );
+    const ptr_ChatParticipant* participant = snapshot->find( id );
+    if( participant ){
+        (*participant)->deliver( msg );
+    }
+}
+
+/* A FileStart opens a transfer with every other participant as a reader,
+ * until they answer */
+bool ChatRoom::file_awaiting( const Message& msg, ptr_ChatParticipant sender )
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__ << ", sender: "
+                  << reinterpret_cast<const void*>(sender.get())
+                  << ", transfer: " << msg.transfer_id()
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    const uint64_t transfer_id = msg.transfer_id();
+    if( transfer_id == 0 ){
+        return false;
+    }
+    auto readers = std::make_shared< FileReaders >( participants_.snapshot()
+                                                  , sender->id() );
+    {   mutex::scoped_lock lk( file_mutex_ );
+        auto it = file_transfers_.find( transfer_id );
+        if( it != file_transfers_.end() && !it->second.relayed ){
+            return false;
+        }
+        file_transfers_[transfer_id] = FileTransfer{ sender, readers, true, false };
+    }
+    sender->file_responses_remaining( transfer_id, readers->size() );
+    deliver( msg, sender );
+    return true;
+}
+
+/* Signaled by a ChatParticipant who recieved the expected number of 
+ * responses */
+void ChatRoom::file_awaiting_complete( uint64_t transfer_id )
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__ << ", transfer: " << transfer_id
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    mutex::scoped_lock lk( file_mutex_ );
+    auto it = file_transfers_.find( transfer_id );
+    if( it != file_transfers_.end() ){
+        it->second.awaiting = false;
+        if( it->second.readers->empty() ){
+            file_transfers_.erase( it );
+        }
+    }
+}
+
+std::size_t ChatRoom::file_reader_count( uint64_t transfer_id ) const
+{
+    const ReaderList readers( file_readers( transfer_id ) );
+    return readers ? readers->size() : 0;
+}
+
+/* Sent by a reader accepting a file transfer, its FileResume names it */
+void ChatRoom::file_accept( const Message& msg, ptr_ChatParticipant sender )
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__ << ", sender: "
+                  << reinterpret_cast<const void*>(sender.get())
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    const uint64_t transfer_id = file_resume( msg.msg_body()
+                                            , msg.body_length() ).transfer_id;
+    // the last answer completes the transfer's sender, which calls back
+    // into the room, so it is notified outside the lock
+    ptr_ChatParticipant awaiter;
+    {   mutex::scoped_lock lk( file_mutex_ );
+        auto it = file_transfers_.find( transfer_id );
+        if( it == file_transfers_.end() || !it->second.awaiting
+         || !it->second.readers->contains( sender->id() ) ){
+            return;
+        }
+        awaiter = it->second.sender;
+    }
+    awaiter->file_accepted( msg, sender );
+}
+
+/* Sent by a reader refusing a file transfer */
+void ChatRoom::file_refuse( const Message& msg, ptr_ChatParticipant sender )
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__ << ", sender: "
+                  << reinterpret_cast<const void*>(sender.get())
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    const uint64_t transfer_id = file_control_id( msg.msg_body()
+                                                , msg.body_length() );
+    ptr_ChatParticipant awaiter;
+    {   mutex::scoped_lock lk( file_mutex_ );
+        auto it = file_transfers_.find( transfer_id );
+        if( it == file_transfers_.end() || !it->second.awaiting
+         || !it->second.readers->remove( sender->id() ) ){
+            return;
+        }
+        awaiter = it->second.sender;
+    }
+    awaiter->file_refused( msg, sender );
+}
+
+/* The sender cancelling ends the transfer for all of its readers, a reader
+ * cancelling only leaves it; before the answers are in that counts as a
+ * refusal */
+void ChatRoom::file_cancel( const Message& msg, ptr_ChatParticipant sender )
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__ << ", sender: "
+                  << reinterpret_cast<const void*>(sender.get())
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    const uint64_t transfer_id = file_control_id( msg.msg_body()
+                                                , msg.body_length() );
+    ReaderList readers;
+    ptr_ChatParticipant awaiter;
+    bool awaiting = false;
+    {   mutex::scoped_lock lk( file_mutex_ );
+        auto it = file_transfers_.find( transfer_id );
+        if( it == file_transfers_.end() ){
+            return;
+        }
+        if( it->second.sender->id() == sender->id() ){
+            readers = it->second.readers;
+            file_transfers_.erase( it );
+        }
+        else if( it->second.readers->remove( sender->id() ) ){
+            awaiter = it->second.sender;
+            awaiting = it->second.awaiting;
+            file_settle( it );
+        }
+    }
+    if( readers ){
+        auto shared_msg = make_shared_message( msg );
+        readers->for_each( [&shared_msg]( const ptr_ChatParticipant& reader )
+            { reader->file_msg_deliver( shared_msg ); } );
+    }
+    else if( awaiter ){
+        awaiter->file_reader_left( transfer_id, sender->id() );
+        if( awaiting ){
+            awaiter->file_refused( msg, sender );
+        }
+    }
+}
+
+/* Every transfer sender is sending ends */
+void ChatRoom::file_cancel_all( const Message& msg, ptr_ChatParticipant sender )
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__ << ", sender: "
+                  << reinterpret_cast<const void*>(sender.get())
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    std::vector< std::pair< uint64_t, ReaderList > > cancelled;
+    {   mutex::scoped_lock lk( file_mutex_ );
+        for( auto it = file_transfers_.begin(); it != file_transfers_.end(); ){
+            if( it->second.sender->id() == sender->id() ){
+                cancelled.emplace_back( it->first, it->second.readers );
+                it = file_transfers_.erase( it );
+            }
+            else{
+                ++it;
+            }
+        }
+    }
+    const std::string reason( reinterpret_cast<const char*>( msg.msg_body() )
+                            , msg.body_length() );
+    for( const auto& transfer : cancelled ){
+        auto cancel = make_shared_message(
+            make_file_control( MessageType::FileCancel, transfer.first, reason ) );
+        transfer.second->for_each( [&cancel]( const ptr_ChatParticipant& reader )
+            { reader->file_msg_deliver( cancel ); } );
+    }
+}
+
+/* A reader has all of the file */
+void ChatRoom::file_done( const Message& msg, ptr_ChatParticipant sender )
+{
+    const uint64_t transfer_id = file_control_id( msg.msg_body()
+                                                , msg.body_length() );
+    ptr_ChatParticipant awaiter;
+    {   mutex::scoped_lock lk( file_mutex_ );
+        auto it = file_transfers_.find( transfer_id );
+        if( it == file_transfers_.end()
+         || !it->second.readers->remove( sender->id() ) ){
+            return;
+        }
+        awaiter = it->second.sender;
+        file_settle( it );
+    }
+    awaiter->file_reader_left( transfer_id, sender->id() );
+}
+
+/* A reader asks for corrupted ranges again; only the transfer's sender
+ * has them */
+void ChatRoom::file_resend( ptr_Message msg, ParticipantId reader )
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__ << ", reader: " << reader
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    const uint64_t transfer_id = file_control_id( msg->msg_body()
+                                                , msg->body_length() );
+    ptr_ChatParticipant sender;
+    {   mutex::scoped_lock lk( file_mutex_ );
+        auto it = file_transfers_.find( transfer_id );
+        if( it == file_transfers_.end()
+         || !it->second.readers->contains( reader ) ){
+            return;
+        }
+        sender = it->second.sender;
+    }
+    sender->deliver( msg );
+}
+
+/* The reader is leaving the room; before the answers are in its leaving
+ * counts as a refusal */
+void ChatRoom::file_leave( ptr_ChatParticipant reader, const std::string& reason )
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__ << ", reader: " << reader->id()
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    struct Left
+    {
+        uint64_t                transfer_id;
+        ptr_ChatParticipant     sender;
+        bool                    awaiting;
+    };
+    std::vector< Left > left;
+    {   mutex::scoped_lock lk( file_mutex_ );
+        for( auto it = file_transfers_.begin(); it != file_transfers_.end(); ){
+            const auto transfer = it++;
+            if( !transfer->second.readers->remove( reader->id() ) ){
+                continue;
+            }
+            left.push_back( Left{ transfer->first, transfer->second.sender
+                                , transfer->second.awaiting } );
+            file_settle( transfer );
+        }
+    }
+    for( const Left& transfer : left ){
+        reader->file_msg_deliver( make_shared_message( make_file_control(
+            MessageType::FileCancel, transfer.transfer_id, reason ) ) );
+        transfer.sender->file_reader_left( transfer.transfer_id, reader->id() );
+        if( transfer.awaiting ){
+            transfer.sender->file_refused(
+                make_file_control( MessageType::FileRefuse, transfer.transfer_id )
+              , reader );
+        }
+    }
+}
+
+void ChatRoom::file_finished( uint64_t transfer_id )
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__ << ", transfer: " << transfer_id
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    mutex::scoped_lock lk( file_mutex_ );
+    auto it = file_transfers_.find( transfer_id );
+    if( it != file_transfers_.end() ){
+        it->second.relayed = true;
+        file_settle( it );
+    }
+}
+
+void ChatRoom::file_settle( FileTransfers::iterator it )
+{
+    if( it->second.relayed && it->second.readers->empty() ){
+        file_transfers_.erase( it );
+    }
+}
+
+void ChatRoom::file_sender_left( ParticipantId sender )
+{
+    std::vector< std::pair< uint64_t, ReaderList > > cancelled;
+    {   mutex::scoped_lock lk( file_mutex_ );
+        for( auto it = file_transfers_.begin(); it != file_transfers_.end(); ){
+            if( it->second.relayed && it->second.sender->id() == sender ){
+                cancelled.emplace_back( it->first, it->second.readers );
+                it = file_transfers_.erase( it );
+            }
+            else{
+                ++it;
+            }
+        }
+    }
+    for( const auto& transfer : cancelled ){
+        auto cancel = make_shared_message( make_file_control(
+            MessageType::FileCancel, transfer.first
+          , "[Server] Sender left the room, the file cannot be repaired." ) );
+        transfer.second->for_each( [&cancel]( const ptr_ChatParticipant& reader )
+            { reader->file_msg_deliver( cancel ); } );
+    }
+}
+
+void ChatRoom::file_deliver( uint64_t transfer_id, const std::vector<char>& frame
+                           , const ptr_TransferWindow& window )
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__ << ", transfer: " << transfer_id
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    std::vector< ParticipantId > refused;
+    const ReaderList readers( file_readers( transfer_id ) );
+    if( readers ){
+        readers->for_each( [&]( const ptr_ChatParticipant& reader )
+            {
+                if( !reader->file_deliver( frame, window ) ){
+                    refused.push_back( reader->id() );
+                }
+            } );
+    }
+    file_drop_refused( transfer_id, refused, window );
+}
+
+void ChatRoom::file_drop_reader( uint64_t transfer_id, ParticipantId reader )
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__ << ", reader: " << reader
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    ptr_ChatParticipant dropped;
+    {   mutex::scoped_lock lk( file_mutex_ );
+        auto it = file_transfers_.find( transfer_id );
+        if( it == file_transfers_.end() ){
+            return;
+        }
+        const ptr_ChatParticipant* current = it->second.readers->find( reader );
+        if( !current ){
+            return;
+        }
+        dropped = *current;
+        it->second.readers->remove( reader );
+        file_settle( it );
+    }
+    dropped->file_cancelled( transfer_id );
+    dropped->file_msg_deliver( make_shared_message(
+        make_file_control( MessageType::FileCancel, transfer_id
+                         , "[Server] File transfer dropped, receiver too slow." ) ) );
+}
+
+void ChatRoom::file_deliver( uint64_t transfer_id, SplicePipe& source
+                           , std::size_t bytes, const ptr_TransferWindow& window )
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__ << ", bytes: " << bytes
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    // readers whose pipe could not take all of it, and how much it took
+    std::vector< std::pair< ptr_ChatParticipant, std::size_t > > short_readers;
+    const ReaderList readers( file_readers( transfer_id ) );
+    if( readers ){
+        readers->for_each( [&]( const ptr_ChatParticipant& reader )
+            {
+                const std::size_t teed = reader->file_splice( transfer_id, source
+                                                            , bytes, window );
+                if( teed < bytes ){
+                    short_readers.emplace_back( reader, teed );
+                }
+            } );
+    }
+
+    boost::system::error_code ec;
+    if( short_readers.empty() ){
+        for( std::size_t left = bytes; left > 0; ){
+            const std::size_t dropped = source.discard( left, ec );
+            if( ec ){
+                break;
+            }
+            left -= dropped;
+        }
+        return;
+    }
+
+    // the bytes are taken out of the pipe once, the short readers get
+    // the rest of them copied
+    std::vector<char> data( bytes );
+    for( std::size_t got = 0; got < bytes; ){
+        const std::size_t read = source.read( &data[got], bytes - got, ec );
+        if( ec ){
+            data.resize( got );
+            break;
+        }
+        got += read;
+    }
+    std::vector< ParticipantId > refused;
+    for( const auto& reader : short_readers ){
+        const std::size_t from = std::min( reader.second, data.size() );
+        std::vector<char> frame( FileChunkHeader::Length + data.size() - from );
+        put_file_chunk_header( reinterpret_cast<uint8_t*>( frame.data() )
+                             , FileChunkHeader( transfer_id
+                                 , static_cast<uint32_t>( data.size() - from ) ) );
+        std::copy( data.begin() + from, data.end()
+                 , frame.begin() + FileChunkHeader::Length );
+        if( !reader.first->file_deliver( frame, window ) ){
+            refused.push_back( reader.first->id() );
+        }
+    }
+    file_drop_refused( transfer_id, refused, window );
+}
+
+/* A reader that could not take a chunk has a gap in its stream from
+ * here on, it is cancelled rather than sent the chunks after it */
+void ChatRoom::file_drop_refused( uint64_t transfer_id
+                                , const std::vector< ParticipantId >& refused
+                                , const ptr_TransferWindow& window )
+{
+    for( ParticipantId reader : refused ){
+        if( window ){
+            window->remove_reader( reader );
+        }
+        file_drop_reader( transfer_id, reader );
+    }
+}
+
+std::size_t ChatRoom::file_splice_capacity( uint64_t transfer_id ) const
+{
+    const ReaderList readers( file_readers( transfer_id ) );
+    if( !readers || readers->empty() ){
+        return 0;
+    }
+    std::size_t capacity = SplicePipe::DefaultCapacity;
+    readers->for_each( [&capacity]( const ptr_ChatParticipant& reader )
+        { capacity = std::min( capacity, reader->file_splice_capacity() ); } );
+    return capacity;
+}
+
+ChatRoom::ReaderList ChatRoom::file_readers( uint64_t transfer_id ) const
+{
+    mutex::scoped_lock lk( file_mutex_ );
+    auto it = file_transfers_.find( transfer_id );
+    if( it != file_transfers_.end() ){
+        return it->second.readers;
+    }
+    return ReaderList();
+}
+
+void ChatRoom::file_msg_deliver( const Message& msg, uint64_t transfer_id )
+{
+    file_msg_deliver( make_shared_message( msg ), transfer_id );
+}
+
+void ChatRoom::file_msg_deliver( ptr_Message msg, uint64_t transfer_id )
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__ << ", transfer: " << transfer_id
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    const ReaderList readers( file_readers( transfer_id ) );
+    if( readers ){
+        readers->for_each( [&msg]( const ptr_ChatParticipant& reader )
+            { reader->file_msg_deliver( msg ); } );
+    }
+}
+/* ------------------------------------------------------------------------- */
+
+/* RoomRegistry */
+/* ------------------------------------------------------------------------- */
+const std::string RoomRegistry::DefaultRoom{ "lobby" };
+
+/* Joins and leaves are serialised with the lookup, so a room that is being
+ * dropped can not be joined at the same time */
+ptr_ChatRoom RoomRegistry::join( const std::string& name
+                               , ptr_ChatParticipant participant )
+{
+    mutex::scoped_lock lk( mutex_ );
+    ptr_ChatRoom& room = rooms_[name];
+    if( !room ){
+        room = std::make_shared<ChatRoom>( pool_.next_service()
+                                         , file_pool_.acceptor_service()
+                                         , name );
+    }
+    room->join( participant );
+    return room;
+}
+
+void RoomRegistry::leave( const ptr_ChatRoom& room
+                        , ptr_ChatParticipant participant )
+{
+    mutex::scoped_lock lk( mutex_ );
+    room->leave( participant );
+    if( room->participant_count() == 0 && room->name() != DefaultRoom ){
+        auto it = rooms_.find( room->name() );
+        if( it != rooms_.end() && it->second == room ){
+            rooms_.erase( it );
+        }
+    }
+}
+
+ptr_ChatRoom RoomRegistry::find( const std::string& name ) const
+{
+    mutex::scoped_lock lk( mutex_ );
+    auto it = rooms_.find( name );
+    if( it != rooms_.end() ){
+        return it->second;
+    }
+    return ptr_ChatRoom();
+}
+
+std::size_t RoomRegistry::size() const
+{
+    mutex::scoped_lock lk( mutex_ );
+    return rooms_.size();
+}
+/* ------------------------------------------------------------------------- */
+
+/* ChatSession */
+/* ------------------------------------------------------------------------- */
+
+/* static variables */
+typedef Dispatch< ChatSession::Handler >     SessionDispatch;
+
+constexpr ChatSession::HandlerTable ChatSession::s_handler_table_ =
+    SessionDispatch::make_table< &ChatSession::handle_unknown
+    , SessionDispatch::On< MessageType::EmptyMsg      , &ChatSession::handle_empty >
+    , SessionDispatch::On< MessageType::ChatMsg       , &ChatSession::handle_read_body >
+    , SessionDispatch::On< MessageType::CmdQuit       , &ChatSession::handle_quit >
+    , SessionDispatch::On< MessageType::CmdJoin       , &ChatSession::handle_join >
+    , SessionDispatch::On< MessageType::CmdPart       , &ChatSession::handle_part >
+    , SessionDispatch::On< MessageType::FileStart     , &ChatSession::handle_file_start >
+    , SessionDispatch::On< MessageType::FileAccept    , &ChatSession::handle_file_accept >
+    , SessionDispatch::On< MessageType::FileRefuse    , &ChatSession::handle_file_refuse >
+    , SessionDispatch::On< MessageType::FileCancel    , &ChatSession::handle_file_cancel >
+    , SessionDispatch::On< MessageType::FileCancelAll , &ChatSession::handle_file_cancel_all >
+    , SessionDispatch::On< MessageType::FileDone      , &ChatSession::handle_file_done >
+    , SessionDispatch::On< MessageType::FileResend    , &ChatSession::handle_file_resend >
+    , SessionDispatch::On< MessageType::FileRepair    , &ChatSession::handle_file_repair >
+    >();
+
+
+/* public */
+
+void ChatSession::start()
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    std::atomic_store( &room_, rooms_.join( RoomRegistry::DefaultRoom
+                                          , shared_from_this() ) );
+    do_read();
+    do_file_chunk();
+}
+
+void ChatSession::deliver( ptr_Message msg )
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    // file control frames are pinned, the queue's policy never drops them;
+    // a room snapshot may be all that holds this session, the handler
+    // keeps it alive
+    auto self( shared_from_this() );
+    io_strand_.post(
+        [this,self,msg]()
+        {
+            bool write_in_progress = !write_msg_queue_.empty();
+            if( write_msg_queue_.push( msg, write_batch_.count() )
+                    == OutboundQueue<ptr_Message>::Disconnect ){
+                disconnect();
+                return;
+            }
+            if( !write_in_progress && !write_msg_queue_.empty() ){
+                do_write();
+            }
+        }
+    );
+}
+
+void ChatSession::relay_mode( RelayMode mode )
+{
+    relay_mode_ = mode;
+    // the reader side pipe is needed as soon as someone sends a file
+    if( relay_mode_ == SpliceRelay ){
+        file_out_pipe_.open();
+    }
+}
+
+/* private */
+
+void ChatSession::do_read()
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    socket_.async_read_some( reader_.prepare()
+        , io_strand_.wrap(
+            boost::bind( &ChatSession::handle_read, shared_from_this()
+                , boost::asio::placeholders::error
+                , boost::asio::placeholders::bytes_transferred )
+        ));
+}
+
+/* Dispatch every complete frame that arrived with this read */
+void ChatSession::handle_read( const boost::system::error_code& ec
+                             , std::size_t bytes_transferred )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+        std::cout << __FUNCTION__ << ", ec: " << ec
+                  << ", bytes transferred: " << bytes_transferred
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    if( !ec ){
+        reader_.commit( bytes_transferred );
+        boost::system::error_code frame_ec;
+        while( reading_ && reader_.next( read_msg_, frame_ec ) ){
+            Handler handler = s_handler_table_[ read_msg_.msg_type() ];
+            (this->*handler)( frame_ec, read_msg_.body_length() );
+        }
+        if( frame_ec ){
+            handle_error( frame_ec );
+        }
+        else if( reading_ ){
+            do_read();
+        }
+    }
+    else{
+        handle_error( ec );
+    }
+}
+
+void ChatSession::handle_read_body( const boost::system::error_code& ec
+                                  , std::size_t /*length*/
+                                  /* , ptr_ChatParticipant sender */ )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+        std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    if( !ec ){
+        room()->post_deliver( make_shared_message( read_msg_ ), shared_from_this() );
+    }
+    else{
+        handle_error( ec );
+    }
+}
+
+
+void ChatSession::handle_empty( const boost::system::error_code& ec
+                              , std::size_t /*length*/
+                              /* , ptr_ChatParticipant sender */ )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+        std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << "[Server]: Empty message received" << std::endl;
+    }
+}
+
+void ChatSession::handle_quit( const boost::system::error_code& ec
+                             , std::size_t /*length*/
+                             /* , ptr_ChatParticipant sender */ )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+        std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    const ptr_ChatRoom room( this->room() );
+    room->post_deliver( make_shared_message( message_from_string("[Server] User "
+                        + string_id() + " has left the room." ) ),
+                        shared_from_this() );
+    leave_room( room );
+    reading_ = false;
+}
+
+void ChatSession::handle_join( const boost::system::error_code& ec
+                             , std::size_t /*length*/ )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+        std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    const std::string name( read_msg_.body_to_string() );
+    if( name.empty() ){
+        deliver( make_shared_message( message_from_string(
+                    "[Server] Usage: -join <room>" ) ) );
+        return;
+    }
+    switch_room( name );
+}
+
+void ChatSession::handle_part( const boost::system::error_code& ec
+                             , std::size_t /*length*/ )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+        std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    switch_room( RoomRegistry::DefaultRoom );
+}
+
+/* Leave the current room and join `name`, announcing both moves */
+void ChatSession::switch_room( const std::string& name )
+{
+    const ptr_ChatRoom current( room() );
+    if( current->name() == name ){
+        deliver( make_shared_message( message_from_string(
+                    "[Server] Already in room " + name ) ) );
+        return;
+    }
+
+    current->post_deliver( make_shared_message( message_from_string("[Server] User "
+                           + string_id() + " has left the room." ) ),
+                           shared_from_this() );
+    leave_room( current );
+
+    const ptr_ChatRoom next( rooms_.join( name, shared_from_this() ) );
+    std::atomic_store( &room_, next );
+    next->post_deliver( make_shared_message( message_from_string("[Server] User "
+                        + string_id() + " has joined the room." ) ),
+                        shared_from_this() );
+    deliver( make_shared_message( message_from_string(
+                "[Server] Joined room " + name ) ) );
+}
+
+void ChatSession::leave_room( const ptr_ChatRoom& room )
+{
+    std::vector< uint64_t > transfer_ids;
+    {   mutex::scoped_lock lk( file_sends_mutex_ );
+        for( const auto& send : file_sends_ ){
+            transfer_ids.push_back( send.first );
+        }
+    }
+    for( uint64_t transfer_id : transfer_ids ){
+        io_file_strand_.post( boost::bind( &ChatSession::do_file_abort
+                                         , shared_from_this(), transfer_id ) );
+        room->file_cancel( make_file_control( MessageType::FileCancel, transfer_id
+                                            , "[Server] Sender left the room." )
+                         , shared_from_this() );
+        deliver( make_shared_message( make_file_control( MessageType::FileCancel
+            , transfer_id, "[Server] File transfer cancelled, you left the room." ) ) );
+    }
+    room->file_leave( shared_from_this() );
+    rooms_.leave( room, shared_from_this() );
+}
+
+void ChatSession::handle_unknown( const boost::system::error_code& ec
+                                , std::size_t /*length*/
+                                /* , ptr_ChatParticipant sender */ )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+        std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    deliver( make_shared_message( message_from_string("[Server] Unknown command "
+                                  + read_msg_.body_to_string() ) ) );
+}
+
+void ChatSession::do_write()
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+        std::cout << __FUNCTION__ << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    boost::asio::async_write( socket_
+        , write_batch_.gather( write_msg_queue_ )
+        , io_strand_.wrap(
+            boost::bind( &ChatSession::handle_write, shared_from_this()
+                , boost::asio::placeholders::error
+                , boost::asio::placeholders::bytes_transferred
+                /* , shared_from_this() */ )
+        ));
+}
+
+void ChatSession::handle_write( const boost::system::error_code& ec
+                              , std::size_t /*length*/
+                              /* , ptr_ChatParticipant sender */ )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+        std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    if( !ec ){
+        write_batch_.complete( write_msg_queue_ );
+        if( !write_msg_queue_.empty() ){
+            do_write();
+        }
+    }
+    else{
+        handle_error( ec );
+    }
+}
+
+void ChatSession::handle_error( const boost::system::error_code& ec )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+        std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    // room_.deliver( message_from_string( "[Server] Error occured. Shutting down") );
+    close();
+}
+
+void ChatSession::disconnect()
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+        std::cout << __FUNCTION__ << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    if( !reading_ ){
+        return;
+    }
+    reading_ = false;
+    leave_room( room() );
+    // the batch being written stays alive until its handler runs
+    write_msg_queue_.erase( write_msg_queue_.begin() + write_batch_.count()
+                          , write_msg_queue_.end() );
+    close();
+}
+
+/* file transfer */
+/* ------------------------------------------------------------------------- */
+/* A FileStart opens one more transfer of this session's, its id must not
+ * be in use in the room */
+void ChatSession::handle_file_start( const boost::system::error_code& ec
+                                   , std::size_t /*length*/ )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+    std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    const uint64_t transfer_id = read_msg_.transfer_id();
+    auto send = std::make_shared< FileSend >( transfer_id, read_msg_.file_size()
+                                            , room() );
+    bool registered = false;
+    {   mutex::scoped_lock lk( file_sends_mutex_ );
+        registered = file_sends_.emplace( transfer_id, send ).second;
+    }
+    // signal all other participants that a file transfer is about to start
+    if( registered && send->room->file_awaiting( Message( read_msg_ ), shared_from_this() ) ){
+        return;
+    }
+    if( registered ){
+        mutex::scoped_lock lk( file_sends_mutex_ );
+        file_sends_.erase( transfer_id );
+    }
+    deliver( make_shared_message( make_file_control( MessageType::FileRefuse
+        , transfer_id, "[Server] File transfer id is already in use." ) ) );
+}
+
+void ChatSession::handle_file_accept( const boost::system::error_code& ec
+                                    , std::size_t /*length*/ )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+    std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    room()->file_accept( Message( read_msg_ ), shared_from_this() );
+}
+
+void ChatSession::handle_file_refuse( const boost::system::error_code& ec
+                                    , std::size_t /*length*/ )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+    std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    room()->file_refuse( Message( read_msg_ ), shared_from_this() );
+}
+
+void ChatSession::handle_file_cancel( const boost::system::error_code& ec
+                                    , std::size_t /*length*/ )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+    std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    // a transfer of our own stops being relayed, what is left of it on the
+    // file socket is skipped
+    const uint64_t transfer_id = file_control_id( read_msg_.msg_body()
+                                                , read_msg_.body_length() );
+    if( const ptr_FileSend send = find_file_send( transfer_id ) ){
+        io_file_strand_.post( boost::bind( &ChatSession::do_file_abort
+                                         , shared_from_this(), transfer_id ) );
+        send->room->file_cancel( Message( read_msg_ ), shared_from_this() );
+        return;
+    }
+    room()->file_cancel( Message( read_msg_ ), shared_from_this() );
+}
+
+void ChatSession::handle_file_cancel_all( const boost::system::error_code& ec
+                                        , std::size_t /*length*/ )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+    std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    std::vector< uint64_t > transfer_ids;
+    {   mutex::scoped_lock lk( file_sends_mutex_ );
+        for( const auto& send : file_sends_ ){
+            transfer_ids.push_back( send.first );
+        }
+    }
+    for( uint64_t transfer_id : transfer_ids ){
+        io_file_strand_.post( boost::bind( &ChatSession::do_file_abort
+                                         , shared_from_this(), transfer_id ) );
+    }
+    room()->file_cancel_all( Message( read_msg_ ), shared_from_this() );
+}
+
+void ChatSession::handle_file_done( const boost::system::error_code& ec
+                                  , std::size_t /*length*/ )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+    std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    room()->file_done( Message( read_msg_ ), shared_from_this() );
+}
+
+/* A reader asks for corrupted ranges again. The transfer's sender
+ * answers, so it goes there with the reader's id filled in */
+void ChatSession::handle_file_resend( const boost::system::error_code& ec
+                                    , std::size_t /*length*/ )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+    std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    if( read_msg_.body_length() < ResendRequest::PrefixLength ){
+        return;
+    }
+    Message msg( read_msg_ );
+    put_uint64( msg.msg_body() + ResendRequest::ReaderOffset, id() );
+    room()->file_resend( make_shared_message( std::move( msg ) ), id() );
+}
+
+/* The ranges sent again go to the reader that asked for them alone */
+void ChatSession::handle_file_repair( const boost::system::error_code& ec
+                                    , std::size_t /*length*/ )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+    std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    if( read_msg_.body_length() < RepairChunk::PrefixLength ){
+        return;
+    }
+    const ParticipantId reader = make_uint64( read_msg_.msg_body()
+                                            + RepairChunk::ReaderOffset );
+    room()->deliver_to( reader, make_shared_message( read_msg_ ) );
+}
+
+ChatSession::ptr_FileSend ChatSession::find_file_send( uint64_t transfer_id )
+{
+    mutex::scoped_lock lk( file_sends_mutex_ );
+    auto it = file_sends_.find( transfer_id );
+    return ( it != file_sends_.end() ) ? it->second : ptr_FileSend();
+}
+
+/* file sending */
+void ChatSession::do_file_send_start( ptr_FileSend send )
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__ << ", transfer: " << send->id
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    if( find_file_send( send->id ) != send ){
+        // cancelled meanwhile
+        return;
+    }
+
+    // the readers are final now, splice only if all of them can take it;
+    // the window is kept within their pipes counted in this socket's
+    // segments, so a tee fits unless other transfers share them
+    FlowLimits limits( flow_limits_ );
+    if( relay_mode_ == SpliceRelay
+     && ( file_in_pipe_.is_open() || file_in_pipe_.open() ) ){
+        const std::size_t capacity = SplicePipe::socket_capacity(
+                  std::min( file_in_pipe_.capacity()
+                          , send->room->file_splice_capacity( send->id ) )
+                , file_socket_.native_handle() );
+        if( capacity >= 2 ){
+            send->splicing = true;
+            send->splice_chunk = capacity / 2;
+            limits.window = std::min( limits.window, capacity / 2 );
+        }
+    }
+
+    // their credit relays the frames held for this send, and resumes the
+    // chunk reader if it is parked on it
+    std::weak_ptr< ChatSession > weak_self( shared_from_this() );
+    std::weak_ptr< FileSend > weak_send( send );
+    auto window = std::make_shared<TransferWindow>( limits
+        , [this,weak_self,weak_send]()
+        {
+            if( auto self = weak_self.lock() ){
+                io_file_strand_.post(
+                    [this,self,weak_send]()
+                    {
+                        const ptr_FileSend held( weak_send.lock() );
+                        if( !held ){
+                            return;
+                        }
+                        relay_held( held );
+                        if( file_parked_ && file_send_current_ == held ){
+                            file_parked_ = false;
+                            continue_file_send();
+                        }
+                    } );
+            }
+        } );
+
+    // signal the file transfer requestor to start the transfer, from where
+    // the readers can resume; it answers with the offset it starts from
+    // -> handle_file_preamble()
+    Message accept;
+    {   mutex::scoped_lock lk( file_sends_mutex_ );
+        // readers leaving from here on are taken off the published window
+        const ChatRoom::ReaderList readers( send->room->file_readers( send->id ) );
+        if( readers ){
+            for( ParticipantId reader : readers->ids() ){
+                window->add_reader( reader );
+            }
+        }
+        send->window = window;
+        accept = make_file_accept( send->resume );
+    }
+    send->accepted = true;
+    deliver( make_shared_message( std::move( accept ) ) );
+}
+
+/* Nobody takes the file */
+void ChatSession::do_file_cancel( ptr_FileSend send )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+        std::cout << __FUNCTION__ << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    {   mutex::scoped_lock lk( file_sends_mutex_ );
+        auto it = file_sends_.find( send->id );
+        if( it == file_sends_.end() || it->second != send ){
+            return;
+        }
+        file_sends_.erase( it );
+    }
+    deliver( make_shared_message(
+        make_file_control( MessageType::FileRefuse, send->id ) ) );
+}
+
+void ChatSession::do_file_abort( uint64_t transfer_id )
+{
+    ptr_FileSend send;
+    {   mutex::scoped_lock lk( file_sends_mutex_ );
+        auto it = file_sends_.find( transfer_id );
+        if( it != file_sends_.end() ){
+            send = it->second;
+            file_sends_.erase( it );
+        }
+    }
+    if( send ){
+        send->held.clear();
+        send->held_bytes = 0;
+    }
+    if( file_send_current_ && file_send_current_->id == transfer_id ){
+        file_send_current_.reset();
+        if( file_parked_ ){
+            file_parked_ = false;
+            continue_file_send();
+        }
+    }
+}
+
+/* file sending */
+/* The file socket carries the chunks of all of this session's transfers,
+ * each introduced by a FileChunkHeader */
+void ChatSession::do_file_chunk()
+{
+    boost::asio::async_read( file_socket_
+        , boost::asio::buffer( file_chunk_header_ )
+        , io_file_strand_.wrap(
+            boost::bind( &ChatSession::handle_file_chunk, shared_from_this()
+                , boost::asio::placeholders::error
+                , boost::asio::placeholders::bytes_transferred )
+        ));
+}
+
+/* file sending */
+void ChatSession::handle_file_chunk( const boost::system::error_code& ec
+                                   , std::size_t /* bytes_transferred */ )
+{
+    if( ec ){
+        handle_file_error( ec );
+        return;
+    }
+    const FileChunkHeader header( file_chunk_header( file_chunk_header_.data() ) );
+    file_send_current_ = find_file_send( header.transfer_id );
+    file_chunk_left_ = header.length;
+    if( file_send_current_ && !file_send_current_->accepted ){
+        // chunks only follow the FileAccept
+        handle_file_error( boost::asio::error::invalid_argument );
+        return;
+    }
+    if( file_send_current_ && !file_send_current_->started ){
+        // the stream opens with the offset the sender starts from, in a
+        // chunk of its own
+        if( file_chunk_left_ != file_preamble_.size() ){
+            handle_file_error( boost::asio::error::invalid_argument );
+            return;
+        }
+        boost::asio::async_read( file_socket_
+            , boost::asio::buffer( file_preamble_ )
+            , io_file_strand_.wrap(
+                boost::bind( &ChatSession::handle_file_preamble, shared_from_this()
+                    , boost::asio::placeholders::error
+                    , boost::asio::placeholders::bytes_transferred )
+            ));
+        return;
+    }
+    if( file_send_current_ && file_chunk_left_ > file_send_current_->remaining ){
+        handle_file_error( boost::asio::error::invalid_argument );
+        return;
+    }
+    continue_file_send();
+}
+
+/* file sending */
+/* The offset, the offer or 0, is relayed as is, so the readers learn it
+ * from the same bytes */
+void ChatSession::handle_file_preamble( const boost::system::error_code& ec
+                                      , std::size_t /* bytes_transferred */ )
+{
+    if( ec ){
+        handle_file_error( ec );
+        return;
+    }
+    const ptr_FileSend send( file_send_current_ );
+    file_chunk_left_ = 0;
+    if( !send ){
+        // cancelled while the preamble was read
+        continue_file_send();
+        return;
+    }
+    const uint64_t start = make_uint64( file_preamble_.data() );
+    uint64_t offered = 0;
+    {   mutex::scoped_lock lk( file_sends_mutex_ );
+        offered = send->resume.offset;
+    }
+    if( start > send->remaining || ( start != 0 && start != offered ) ){
+        handle_file_error( boost::asio::error::invalid_argument );
+        return;
+    }
+    // the data from there on, and its checksums after it
+    send->remaining -= start;
+    send->remaining += FileTrailer::length( send->remaining );
+    send->started = true;
+
+    for( ParticipantId slow : send->window->sent( file_preamble_.size() ) ){
+        send->room->file_drop_reader( send->id, slow );
+    }
+    std::vector<char> frame( FileChunkHeader::Length + file_preamble_.size() );
+    put_file_chunk_header( reinterpret_cast<uint8_t*>( frame.data() )
+                         , FileChunkHeader( send->id, file_preamble_.size() ) );
+    std::copy( file_preamble_.begin(), file_preamble_.end()
+             , frame.begin() + FileChunkHeader::Length );
+    send->room->file_deliver( send->id, frame, send->window );
+    continue_file_send();
+}
+
+/* file sending */
+/* Keep reading the current chunk as long as its bytes are available; the
+ * chunks of a cancelled transfer are read and dropped */
+void ChatSession::do_file_send()
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    const ptr_FileSend& send( file_send_current_ );
+    if( send && send->splicing ){
+        do_file_splice();
+        return;
+    }
+
+    // a chunk never exceeds the window, or it would park the sender alone
+    const std::size_t chunk = send ? std::min( file_sizer_.chunk()
+                                             , send->window->limits().window )
+                                   : file_sizer_.chunk();
+    file_send_buf_.resize( FileChunkHeader::Length
+                         + std::min( chunk, file_chunk_left_ ) );
+    file_send_started_ = ChunkSizer::clock::now();
+    file_socket_.async_read_some(
+          boost::asio::buffer( &file_send_buf_[FileChunkHeader::Length]
+                             , file_send_buf_.size() - FileChunkHeader::Length )
+        , io_file_strand_.wrap(
+            boost::bind( &ChatSession::handle_file_send, shared_from_this()
+                , boost::asio::placeholders::error
+                , boost::asio::placeholders::bytes_transferred )
+        ));
+}
+
+/* file sending */
+/* Hand what was read on to the readers as a chunk of its own */
+void ChatSession::handle_file_send( const boost::system::error_code& ec
+                                  , std::size_t bytes_transferred )
+{
+    if( ec ){
+        handle_file_error( ec );
+        return;
+    }
+    file_chunk_left_ -= bytes_transferred;
+    const ptr_FileSend send( file_send_current_ );
+    if( send ){
+        file_sizer_.record( bytes_transferred
+                          , ChunkSizer::clock::now() - file_send_started_ );
+        send->remaining -= bytes_transferred;
+        // charge the chunk before the readers can credit it
+        for( ParticipantId slow : send->window->sent( bytes_transferred ) ){
+            send->room->file_drop_reader( send->id, slow );
+        }
+        // every reader takes its own copy, the buffer is reused
+        file_send_buf_.resize( FileChunkHeader::Length + bytes_transferred );
+        put_file_chunk_header( reinterpret_cast<uint8_t*>( file_send_buf_.data() )
+                             , FileChunkHeader( send->id
+                                 , static_cast<uint32_t>( bytes_transferred ) ) );
+        send->room->file_deliver( send->id, file_send_buf_, send->window );
+    }
+    continue_file_send();
+}
+
+/* file sending */
+/* The chunk at the head of the socket goes on to the readers if its
+ * window is open. Otherwise it is held for its send alone and the sender
+ * is told to pause that send, so the other sends behind it on the socket
+ * still get through. */
+void ChatSession::continue_file_send()
+{
+    const ptr_FileSend send( file_send_current_ );
+    if( file_chunk_left_ == 0 ){
+        if( send && send->started && send->remaining == 0 && send->held.empty() ){
+            finish_file_send( send );
+        }
+        do_file_chunk();
+    }
+    else if( !send || ( send->held.empty() && send->window->acquire() ) ){
+        do_file_send();
+    }
+    else if( send->held_bytes < HeldWindows * send->window->limits().window ){
+        do_file_hold();
+    }
+    else{
+        // the readers' credit relays the held frames and resumes here
+        file_parked_ = true;
+    }
+}
+
+/* file sending */
+void ChatSession::finish_file_send( const ptr_FileSend& send )
+{
+    {   mutex::scoped_lock lk( file_sends_mutex_ );
+        file_sends_.erase( send->id );
+    }
+    if( file_send_current_ == send ){
+        file_send_current_.reset();
+    }
+    send->room->file_finished( send->id );
+}
+
+/* file sending */
+/* Read the current send's chunk aside while its window is closed */
+void ChatSession::do_file_hold()
+{
+    const ptr_FileSend& send( file_send_current_ );
+    const std::size_t room = HeldWindows * send->window->limits().window
+                           - send->held_bytes;
+    file_send_buf_.resize( FileChunkHeader::Length
+        + std::min( std::min( file_sizer_.chunk(), room ), file_chunk_left_ ) );
+    file_socket_.async_read_some(
+          boost::asio::buffer( &file_send_buf_[FileChunkHeader::Length]
+                             , file_send_buf_.size() - FileChunkHeader::Length )
+        , io_file_strand_.wrap(
+            boost::bind( &ChatSession::handle_file_hold, shared_from_this()
+                , boost::asio::placeholders::error
+                , boost::asio::placeholders::bytes_transferred )
+        ));
+}
+
+void ChatSession::handle_file_hold( const boost::system::error_code& ec
+                                  , std::size_t bytes_transferred )
+{
+    if( ec ){
+        handle_file_error( ec );
+        return;
+    }
+    file_chunk_left_ -= bytes_transferred;
+    const ptr_FileSend send( file_send_current_ );
+    if( send ){
+        send->remaining -= bytes_transferred;
+        file_send_buf_.resize( FileChunkHeader::Length + bytes_transferred );
+        put_file_chunk_header( reinterpret_cast<uint8_t*>( file_send_buf_.data() )
+                             , FileChunkHeader( send->id
+                                 , static_cast<uint32_t>( bytes_transferred ) ) );
+        if( send->held.empty() ){
+            deliver( make_shared_message(
+                make_file_control( MessageType::FilePause, send->id ) ) );
+        }
+        send->held.push_back( std::move( file_send_buf_ ) );
+        send->held_bytes += bytes_transferred;
+        file_send_buf_ = std::vector<char>();
+        // the window may have opened meanwhile, otherwise this parks on it
+        relay_held( send );
+    }
+    continue_file_send();
+}
+
+/* file sending */
+/* Hand the frames held for `send` on while its window is open; the sender
+ * continues once the last of them is out */
+void ChatSession::relay_held( const ptr_FileSend& send )
+{
+    if( send->held.empty() ){
+        return;
+    }
+    while( !send->held.empty() && send->window->acquire() ){
+        const std::vector<char>& frame = send->held.front();
+        const std::size_t bytes = frame.size() - FileChunkHeader::Length;
+        for( ParticipantId slow : send->window->sent( bytes ) ){
+            send->room->file_drop_reader( send->id, slow );
+        }
+        send->room->file_deliver( send->id, frame, send->window );
+        send->held_bytes -= bytes;
+        send->held.pop_front();
+    }
+    if( !send->held.empty() || find_file_send( send->id ) != send ){
+        return;
+    }
+    if( send->started && send->remaining == 0 ){
+        finish_file_send( send );
+    }
+    else{
+        deliver( make_shared_message(
+            make_file_control( MessageType::FileContinue, send->id ) ) );
+    }
+}
+
+
+/* file sending, zero-copy */
+/* Wait until the sender's socket is readable, then splice it straight
+ * into file_in_pipe_ */
+void ChatSession::do_file_splice()
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    boost::system::error_code ec;
+    file_socket_.native_non_blocking( true, ec );
+    file_socket_.async_read_some( boost::asio::null_buffers()
+        , io_file_strand_.wrap(
+            boost::bind( &ChatSession::handle_file_splice, shared_from_this()
+                , boost::asio::placeholders::error )
+        ));
+}
+
+void ChatSession::handle_file_splice( const boost::system::error_code& ec )
+{
+    if( ec ){
+        handle_file_error( ec );
+        return;
+    }
+    const ptr_FileSend send( file_send_current_ );
+    if( !send ){
+        // cancelled while waiting, the rest of the chunk is dropped
+        do_file_send();
+        return;
+    }
+
+    boost::system::error_code splice_ec;
+    const std::size_t bytes = file_in_pipe_.splice_from( file_socket_.native_handle()
+                                    , std::min( file_chunk_left_, send->splice_chunk )
+                                    , splice_ec );
+    if( splice_ec == boost::asio::error::would_block ){
+        do_file_splice();
+        return;
+    }
+    if( splice_ec ){
+        handle_file_error( splice_ec );
+        return;
+    }
+
+    file_chunk_left_ -= bytes;
+    send->remaining -= bytes;
+    for( ParticipantId slow : send->window->sent( bytes ) ){
+        send->room->file_drop_reader( send->id, slow );
+    }
+    send->room->file_deliver( send->id, file_in_pipe_, bytes, send->window );
+    continue_file_send();
+}
+
+/* file recieving */
+/* Called on the sender's strand. A chunk that does not fit is not
+ * dropped, the room cancels the transfer for this session instead */
+bool ChatSession::file_deliver( const std::vector<char>& frame
+                              , const ptr_TransferWindow& window )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+        std::cout << __FUNCTION__ << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    FileFrame file_frame;
+    file_frame.data = frame;
+    if( window && frame.size() > FileChunkHeader::Length ){
+        file_frame.credits.push_back( std::make_shared< FileCredit >( window, id()
+                                    , frame.size() - FileChunkHeader::Length ) );
+    }
+    mutex::scoped_lock lk( file_out_mutex_ );
+    return push_file_frame( std::move( file_frame ) ) == OutboundQueue< FileFrame >::Queued;
+}
+
+/* file recieving, zero-copy */
+std::size_t ChatSession::file_splice_capacity() const
+{
+    return file_out_pipe_.capacity();
+}
+
+/* Called on the sender's strand. The frame is queued and the bytes teed
+ * under one lock, so the pipe holds the spliced frames' bytes in order
+ * whichever senders tee into it. The pipe may take fewer bytes than it has
+ * room for, the frame is cut to what it took and the caller copies the
+ * rest. */
+std::size_t ChatSession::file_splice( uint64_t transfer_id, SplicePipe& source
+                                    , std::size_t bytes
+                                    , const ptr_TransferWindow& window )
+{
+    if( !file_out_pipe_.is_open() || file_failed_ ){
+        return 0;
+    }
+    mutex::scoped_lock lk( file_out_mutex_ );
+    const std::size_t room_left = file_out_pipe_.capacity() - file_out_piped_;
+    const std::size_t bytes_piped = std::min( bytes, room_left );
+    if( bytes_piped == 0 ){
+        return 0;
+    }
+
+    FileFrame frame;
+    frame.data.resize( FileChunkHeader::Length );
+    frame.spliced = bytes_piped;
+    if( push_file_frame( std::move( frame ) ) != OutboundQueue< FileFrame >::Queued ){
+        // the bytes go copied, which cancels the transfer if they do not fit
+        return 0;
+    }
+
+    // the frame is not written before the lock is released
+    boost::system::error_code ec;
+    const std::size_t teed = source.tee_to( file_out_pipe_, bytes_piped, ec );
+    if( teed == 0 ){
+        file_read_queue_.erase( file_read_queue_.end() - 1, file_read_queue_.end() );
+        return 0;
+    }
+    file_out_piped_ += teed;
+    FileFrame& queued = file_read_queue_.begin()[ file_read_queue_.size() - 1 ];
+    put_file_chunk_header( reinterpret_cast<uint8_t*>( queued.data.data() )
+                         , FileChunkHeader( transfer_id, static_cast<uint32_t>( teed ) ) );
+    queued.spliced = teed;
+    file_read_queue_.shrink_back( bytes_piped - teed );
+    // a frame that was not queued must not credit, the copy does
+    if( window ){
+        queued.credits.push_back( std::make_shared< FileCredit >( window, id(), teed ) );
+    }
+    return teed;
+}
+
+/* Queue a frame for file_socket_ and start writing if it is idle, with
+ * file_out_mutex_ held. Queued frames are never dropped, a frame that does
+ * not fit is refused with Dropped; Disconnect when the session is going. */
+OutboundQueue< FileFrame >::Result ChatSession::push_file_frame( FileFrame frame )
+{
+    if( file_failed_ ){
+        // its credits go with it
+        return OutboundQueue< FileFrame >::Disconnect;
+    }
+    const std::size_t in_flight = file_out_writing_ ? 1 : 0;
+    const auto result = file_read_queue_.offer( std::move( frame ), in_flight );
+    if( result == OutboundQueue< FileFrame >::Disconnect ){
+        // stop relaying to this reader, the chat side is closed from its
+        // own strand
+        file_failed_ = true;
+        file_read_queue_.erase( file_read_queue_.begin() + in_flight
+                              , file_read_queue_.end() );
+        io_file_strand_.post( boost::bind( &ChatSession::handle_file_error
+                                         , shared_from_this()
+                                         , boost::asio::error::operation_aborted ) );
+        io_strand_.post( boost::bind( &ChatSession::disconnect
+                                    , shared_from_this() ) );
+        return result;
+    }
+    if( !file_out_writing_ && !file_read_queue_.empty() ){
+        file_out_writing_ = true;
+        io_file_strand_.post( boost::bind( &ChatSession::do_file_read
+                                         , shared_from_this() ) );
+    }
+    return result;
+}
+
+/* Drop the queued frames of a transfer this session leaves, with
+ * file_out_mutex_ held. The frame being written stays, and so do the
+ * frames the transfer shares with another or has spliced bytes in along
+ * with everything of it before them: what reaches the reader remains a
+ * prefix of its stream. */
+void ChatSession::purge_file_frames( uint64_t transfer_id )
+{
+    const std::size_t in_flight = file_out_writing_ ? 1 : 0;
+    std::size_t from = in_flight;
+    for( std::size_t i = file_read_queue_.size(); i > in_flight; --i ){
+        if( file_frame_holds( file_read_queue_.begin()[i-1], transfer_id )
+                == FrameKept ){
+            from = i;
+            break;
+        }
+    }
+    for( auto it = file_read_queue_.begin() + from; it != file_read_queue_.end(); ){
+        if( file_frame_holds( *it, transfer_id ) == FrameOwned ){
+            it = file_read_queue_.erase( it, it + 1 );
+        }
+        else{
+            ++it;
+        }
+    }
+}
+
+/* file recieving */
+/* The front frame stays in place until it is written: its copied bytes
+ * first, then its spliced ones */
+void ChatSession::do_file_read()
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+        std::cout << __FUNCTION__ << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    boost::asio::const_buffer data;
+    {   mutex::scoped_lock lk( file_out_mutex_ );
+        if( file_read_queue_.empty() ){
+            file_out_writing_ = false;
+            return;
+        }
+        const FileFrame& frame = file_read_queue_.front();
+        data = boost::asio::buffer( frame.data );
+        file_out_left_ = frame.spliced;
+    }
+    boost::asio::async_write( file_socket_
+        , boost::asio::buffer( data )
+        , io_file_strand_.wrap(
+            boost::bind( &ChatSession::handle_file_read, shared_from_this()
+                , boost::asio::placeholders::error
+                , boost::asio::placeholders::bytes_transferred )
+        ));
+}
+
+/* file recieving */
+void ChatSession::handle_file_read( const boost::system::error_code& ec
+                                  , std::size_t bytes_transferred )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+        std::cout << __FUNCTION__ << "ec: " << ec
+                  << ", bytes transferred: " << bytes_transferred
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    if( ec ){
+        handle_file_error( ec );
+        return;
+    }
+    if( file_out_left_ != 0 ){
+        do_file_splice_out();
+    }
+    else{
+        finish_file_frame();
+    }
+}
+
+/* file recieving, zero-copy */
+void ChatSession::do_file_splice_out()
+{
+    boost::system::error_code ec;
+    file_socket_.native_non_blocking( true, ec );
+    file_socket_.async_write_some( boost::asio::null_buffers()
+        , io_file_strand_.wrap(
+            boost::bind( &ChatSession::handle_file_splice_out, shared_from_this()
+                , boost::asio::placeholders::error )
+        ));
+}
+
+void ChatSession::handle_file_splice_out( const boost::system::error_code& ec )
+{
+    if( ec ){
+        handle_file_error( ec );
+        return;
+    }
+
+    boost::system::error_code splice_ec;
+    const std::size_t bytes = file_out_pipe_.splice_to( file_socket_.native_handle()
+                                                      , file_out_left_
+                                                      , splice_ec );
+    if( splice_ec && splice_ec != boost::asio::error::would_block ){
+        handle_file_error( splice_ec );
+        return;
+    }
+    file_out_left_ -= bytes;
+    if( bytes != 0 ){
+        mutex::scoped_lock lk( file_out_mutex_ );
+        file_out_piped_ -= bytes;
+    }
+    if( file_out_left_ != 0 ){
+        do_file_splice_out();
+    }
+    else{
+        finish_file_frame();
+    }
+}
+
+/* file recieving */
+/* Popping the frame releases its credits */
+void ChatSession::finish_file_frame()
+{
+    mutex::scoped_lock lk( file_out_mutex_ );
+    if( !file_read_queue_.empty() ){
+        file_read_queue_.pop_front();
+    }
+    if( file_read_queue_.empty() ){
+        file_out_writing_ = false;
+        return;
+    }
+    lk.unlock();
+    do_file_read();
+}
+
+/* Signal recieved from ChatRoom that a reader accepted one of our files */
+void ChatSession::file_accepted( const Message& msg
+                               , ptr_ChatParticipant sender )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+        std::cout << __FUNCTION__ << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    // resume only where every accepting reader holds the same prefix of
+    // this very transfer, otherwise start over
+    const FileResume offer( file_resume( msg.msg_body(), msg.body_length() ) );
+    const ptr_FileSend send( find_file_send( offer.transfer_id ) );
+    if( !send ){
+        return;
+    }
+    {   mutex::scoped_lock lk( file_sends_mutex_ );
+        if( send->resume_offered && offer != send->resume ){
+            send->resume = FileResume( send->id );
+        }
+        else if( !send->resume_offered ){
+            send->resume = offer;
+        }
+        send->resume_offered = true;
+    }
+
+    if( --send->responses_remaining == 0 ){
+        send->room->file_awaiting_complete( send->id );
+        io_file_strand_.post( boost::bind( &ChatSession::do_file_send_start
+                                         , shared_from_this(), send ) );
+    }
+}
+
+/* Signal recieved from ChatRoom that a reader refused one of our files */
+void ChatSession::file_refused( const Message& msg
+                              , ptr_ChatParticipant sender )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+        std::cout << __FUNCTION__ << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    const ptr_FileSend send( find_file_send(
+        file_control_id( msg.msg_body(), msg.body_length() ) ) );
+    if( !send ){
+        return;
+    }
+    if( --send->responses_remaining == 0 ){
+        send->room->file_awaiting_complete( send->id );
+        if( send->room->file_reader_count( send->id ) != 0 ){
+            io_file_strand_.post( boost::bind( &ChatSession::do_file_send_start
+                                             , shared_from_this(), send ) );
+        }
+        else{
+            io_file_strand_.post( boost::bind( &ChatSession::do_file_cancel
+                                             , shared_from_this(), send ) );
+        }
+    }
+}
+
+void ChatSession::file_responses_remaining( uint64_t transfer_id, std::size_t count )
+{
+    const ptr_FileSend send( find_file_send( transfer_id ) );
+    if( !send ){
+        return;
+    }
+    send->responses_remaining = count;
+    if( count == 0 ){
+        // nobody else in the room
+        send->room->file_awaiting_complete( transfer_id );
+        io_file_strand_.post( boost::bind( &ChatSession::do_file_cancel
+                                         , shared_from_this(), send ) );
+    }
+}
+
+/* Called from the reader's strand */
+void ChatSession::file_reader_left( uint64_t transfer_id, ParticipantId reader )
+{
+    mutex::scoped_lock lk( file_sends_mutex_ );
+    auto it = file_sends_.find( transfer_id );
+    if( it != file_sends_.end() && it->second->window ){
+        it->second->window->remove_reader( reader );
+    }
+}
+
+/* Called from the sender's strand */
+void ChatSession::file_cancelled( uint64_t transfer_id )
+{
+    mutex::scoped_lock lk( file_out_mutex_ );
+    purge_file_frames( transfer_id );
+}
+
+/* File control frames share the chat write queue, which is only ever
+ * touched from io_strand_ */
+void ChatSession::file_msg_deliver( ptr_Message msg
+                                  /* , ptr_ChatParticipant sender */ )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+        std::cout << __FUNCTION__ << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    deliver( msg );
+}
+
+/* The file socket is shared by every transfer, so an error on it ends all
+ * of them: ours are cancelled, what is relayed to us is dropped */
+void ChatSession::handle_file_error( const boost::system::error_code& ec )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+        std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    // once, the socket is closed at the end
+    if( !file_socket_.is_open() ){
+        return;
+    }
+    {   mutex::scoped_lock lk( file_out_mutex_ );
+        file_failed_ = true;
+        file_read_queue_.erase( file_read_queue_.begin()
+                                + ( file_out_writing_ ? 1 : 0 )
+                              , file_read_queue_.end() );
+        // the frame being written will not finish, its bytes are credited
+        // now rather than when the session goes
+        if( !file_read_queue_.empty() ){
+            file_read_queue_.front().credits.clear();
+        }
+    }
+    // and no window waits on this reader any more
+    room()->file_leave( shared_from_this(), "[Server] File transfer failed." );
+    std::unordered_map< uint64_t, ptr_FileSend > sends;
+    {   mutex::scoped_lock lk( file_sends_mutex_ );
+        sends.swap( file_sends_ );
+    }
+    file_send_current_.reset();
+    file_parked_ = false;
+    for( const auto& send : sends ){
+        send.second->room->file_cancel( make_file_control( MessageType::FileCancel
+                                          , send.first, "[Server] File transfer failed." )
+                                      , shared_from_this() );
+    }
+    // the peer closing its file socket is no error
+    if( ec != boost::asio::error::eof
+     && ec != boost::asio::error::operation_aborted ){
+        room()->deliver( Message( MessageType::ChatMsg
+                                , "[File Transfer Error]" ) );
+    }
+    boost::system::error_code close_ec;
+    file_socket_.close( close_ec );
+}
+
+/* ------------------------------------------------------------------------- */
+
+void ChatSession::close()
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+        std::cout << __FUNCTION__ << std::endl;
+    }
+    #endif /* NDEBUG */
+    boost::system::error_code ec;
+    socket_.shutdown( boost::asio::ip::tcp::socket::shutdown_both, ec );
+    socket_.close( ec );
+    socket_.cancel( ec );
+    // the file socket's read loop would keep the session alive
+    io_file_strand_.post( boost::bind( &ChatSession::handle_file_error
+                                     , shared_from_this()
+                                     , boost::asio::error::operation_aborted ) );
+}
+/* ------------------------------------------------------------------------- */
+
+/* Server */
+/* ------------------------------------------------------------------------- */
+void Server::do_accept()
+{
+    // place the next session on the least loaded io_service
+    session_service_ = &pool_.acquire( session_lease_ );
+    socket_ = boost::asio::ip::tcp::socket( *session_service_ );
+    acceptor_.async_accept( socket_
+        , boost::bind( &Server::handle_accept, this
+            , boost::asio::placeholders::error ) );
+}
+
+void Server::handle_accept( const boost::system::error_code& ec )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+        std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    if( !ec ){
+        // std::make_shared<ChatSession>( io_service_
+        //                              , std::move( socket_ )
+        //                              , room_, session_id++ )->start();
+
+        do_file_accept();
+    }
+}
+
+void Server::do_file_accept()
+{
+    #ifndef NDEBUG
+    { mutex::scoped_lock lk(debug_mutex);
+        std::cout << __PRETTY_FUNCTION__
+                  << std::endl;
+    }
+    #endif /* NDEBUG */
+
+    file_acceptor_.async_accept( file_socket_
+        , boost::bind( &Server::handle_file_accept, this
+                     , boost::asio::placeholders::error ) );
+}
+void Server::handle_file_accept( const boost::system::error_code& ec )
+{
+    #ifndef NDEBUG
+    {   mutex::scoped_lock lk(debug_mutex);
+        std::cout << __FUNCTION__ << ", ec: " << ec << std::endl;
+    }
+    #endif /* NDEBUG */
+    if( !ec ){
+        
+        auto session = std::make_shared<ChatSession>( *session_service_
+                                                    , file_pool_.acceptor_service()
+                                                    , std::move( socket_ )
+                                                    , std::move( file_socket_ )
+                                                    , rooms_, next_session_id_++
+                                                    , std::move( session_lease_ ) );
+        session->max_frame_size( max_frame_size_ );
+        session->outbound_limits( queue_limits_, file_queue_limits_
+                                , budget_, overflow_stats_ );
+        session->flow_limits( flow_limits_ );
+        session->chunk_limits( chunk_limits_ );
+        session->relay_mode( relay_mode_ );
+        session->start();
+
+        do_accept();
+    }
+}
+/* ------------------------------------------------------------------------- */
@@ -0,0 +1,179 @@
+#include "SplicePipe.hpp"
+#include <boost/asio/error.hpp>
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif /* __linux__ */
+
+
+namespace
+{
+
+#ifdef __linux__
+/* Translate the result of a splice()/tee() call */
+std::size_t moved( ssize_t result, boost::system::error_code& ec )
+{
+    if( result > 0 ){
+        ec = boost::system::error_code();
+        return static_cast<std::size_t>( result );
+    }
+    if( result == 0 ){
+        ec = boost::asio::error::eof;
+    }
+    else if( errno == EAGAIN || errno == EWOULDBLOCK ){
+        ec = boost::asio::error::would_block;
+    }
+    else{
+        ec = boost::system::error_code( errno, boost::system::system_category() );
+    }
+    return 0;
+}
+
+int dev_null()
+{
+    static const int fd = ::open( "/dev/null", O_WRONLY | O_CLOEXEC );
+    return fd;
+}
+#endif /* __linux__ */
+
+} // namespace
+
+
+SplicePipe::SplicePipe()
+    : read_fd_( -1 )
+    , write_fd_( -1 )
+    , capacity_( 0 )
+{
+}
+
+SplicePipe::~SplicePipe()
+{
+    close();
+}
+
+bool SplicePipe::open( std::size_t capacity )
+{
+    #ifdef __linux__
+    close();
+    int fds[2];
+    if( ::pipe2( fds, O_NONBLOCK | O_CLOEXEC ) != 0 ){
+        return false;
+    }
+    read_fd_ = fds[0];
+    write_fd_ = fds[1];
+    // best effort, unprivileged processes are capped by pipe-max-size
+    ::fcntl( write_fd_, F_SETPIPE_SZ, static_cast<int>( capacity ) );
+    const int granted = ::fcntl( write_fd_, F_GETPIPE_SZ );
+    capacity_ = ( granted > 0 ) ? static_cast<std::size_t>( granted ) : 0;
+    return true;
+    #else
+    (void)capacity;
+    return false;
+    #endif /* __linux__ */
+}
+
+std::size_t SplicePipe::socket_capacity( std::size_t capacity, int fd )
+{
+    #ifdef __linux__
+    const long page = ::sysconf( _SC_PAGESIZE );
+    int mss = 0;
+    socklen_t length = sizeof( mss );
+    if( page <= 0 || ::getsockopt( fd, IPPROTO_TCP, TCP_MAXSEG, &mss, &length ) != 0
+     || mss <= 0 || mss >= page ){
+        return capacity;
+    }
+    return capacity / static_cast<std::size_t>( page ) * static_cast<std::size_t>( mss );
+    #else
+    (void)fd;
+    return capacity;
+    #endif /* __linux__ */
+}
+
+void SplicePipe::close()
+{
+    #ifdef __linux__
+    if( read_fd_ != -1 ){
+        ::close( read_fd_ );
+        ::close( write_fd_ );
+    }
+    #endif /* __linux__ */
+    read_fd_ = write_fd_ = -1;
+    capacity_ = 0;
+}
+
+std::size_t SplicePipe::splice_from( int fd, std::size_t bytes
+                                   , boost::system::error_code& ec )
+{
+    #ifdef __linux__
+    return moved( ::splice( fd, nullptr, write_fd_, nullptr, bytes
+                          , SPLICE_F_MOVE | SPLICE_F_NONBLOCK ), ec );
+    #else
+    (void)fd; (void)bytes;
+    ec = boost::asio::error::operation_not_supported;
+    return 0;
+    #endif /* __linux__ */
+}
+
+std::size_t SplicePipe::tee_to( SplicePipe& dst, std::size_t bytes
+                              , boost::system::error_code& ec )
+{
+    #ifdef __linux__
+    return moved( ::tee( read_fd_, dst.write_fd_, bytes, SPLICE_F_NONBLOCK ), ec );
+    #else
+    (void)dst; (void)bytes;
+    ec = boost::asio::error::operation_not_supported;
+    return 0;
+    #endif /* __linux__ */
+}
+
+std::size_t SplicePipe::splice_to( int fd, std::size_t bytes
+                                 , boost::system::error_code& ec )
+{
+    #ifdef __linux__
+    return moved( ::splice( read_fd_, nullptr, fd, nullptr, bytes
+                          , SPLICE_F_MOVE | SPLICE_F_NONBLOCK ), ec );
+    #else
+    (void)fd; (void)bytes;
+    ec = boost::asio::error::operation_not_supported;
+    return 0;
+    #endif /* __linux__ */
+}
+
+std::size_t SplicePipe::write( const void* data, std::size_t bytes
+                             , boost::system::error_code& ec )
+{
+    #ifdef __linux__
+    return moved( ::write( write_fd_, data, bytes ), ec );
+    #else
+    (void)data; (void)bytes;
+    ec = boost::asio::error::operation_not_supported;
+    return 0;
+    #endif /* __linux__ */
+}
+
+std::size_t SplicePipe::read( void* data, std::size_t bytes
+                            , boost::system::error_code& ec )
+{
+    #ifdef __linux__
+    return moved( ::read( read_fd_, data, bytes ), ec );
+    #else
+    (void)data; (void)bytes;
+    ec = boost::asio::error::operation_not_supported;
+    return 0;
+    #endif /* __linux__ */
+}
+
+std::size_t SplicePipe::discard( std::size_t bytes, boost::system::error_code& ec )
+{
+    #ifdef __linux__
+    return splice_to( dev_null(), bytes, ec );
+    #else
+    (void)bytes;
+    ec = boost::asio::error::operation_not_supported;
+    return 0;
+    #endif /* __linux__ */
+}
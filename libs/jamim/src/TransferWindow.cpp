@@ -0,0 +1,116 @@
+#include "TransferWindow.hpp"
+#include <algorithm>
+
+
+TransferWindow::TransferWindow( const FlowLimits& limits, Resume resume )
+    : limits_( limits )
+    , resume_( std::move( resume ) )
+    , within_( 0 )
+    , parked_( false )
+{
+}
+
+void TransferWindow::add_reader( ParticipantId reader )
+{
+    boost::mutex::scoped_lock lk( mutex_ );
+    if( backlog_.insert( reader, 0 ) ){
+        ++within_;
+    }
+}
+
+void TransferWindow::remove_reader( ParticipantId reader )
+{
+    boost::mutex::scoped_lock lk( mutex_ );
+    erase_reader( reader );
+    resume_if_open( lk );
+}
+
+std::vector< ParticipantId > TransferWindow::sent( std::size_t bytes )
+{
+    boost::mutex::scoped_lock lk( mutex_ );
+    const std::size_t drop_limit = limits_.drop_limit();
+    std::vector< ParticipantId > dropped;
+    for( std::size_t i=0; i<backlog_.size(); ++i ){
+        std::size_t& behind = backlog_.at( i );
+        if( behind < limits_.window && behind + bytes >= limits_.window ){
+            --within_;
+        }
+        behind += bytes;
+        if( drop_limit != 0 && behind > drop_limit ){
+            dropped.push_back( backlog_.id_at( i ) );
+        }
+    }
+    for( ParticipantId reader : dropped ){
+        erase_reader( reader );
+    }
+    return dropped;
+}
+
+void TransferWindow::written( ParticipantId reader, std::size_t bytes )
+{
+    boost::mutex::scoped_lock lk( mutex_ );
+    std::size_t* behind = backlog_.find( reader );
+    if( !behind ){
+        return;
+    }
+    const bool was_within = *behind < limits_.window;
+    *behind -= std::min( *behind, bytes );
+    if( !was_within && *behind < limits_.window ){
+        ++within_;
+    }
+    resume_if_open( lk );
+}
+
+bool TransferWindow::acquire()
+{
+    boost::mutex::scoped_lock lk( mutex_ );
+    if( open() ){
+        return true;
+    }
+    parked_ = true;
+    return false;
+}
+
+std::size_t TransferWindow::behind( ParticipantId reader ) const
+{
+    boost::mutex::scoped_lock lk( mutex_ );
+    const std::size_t* behind = backlog_.find( reader );
+    return behind ? *behind : 0;
+}
+
+std::size_t TransferWindow::reader_count() const
+{
+    boost::mutex::scoped_lock lk( mutex_ );
+    return backlog_.size();
+}
+
+/* private */
+
+bool TransferWindow::open() const
+{
+    const std::size_t required = ( limits_.quorum == 0 )
+                                 ? backlog_.size()
+                                 : std::min( limits_.quorum, backlog_.size() );
+    return within_ >= required;
+}
+
+void TransferWindow::erase_reader( ParticipantId reader )
+{
+    const std::size_t* behind = backlog_.find( reader );
+    if( !behind ){
+        return;
+    }
+    if( *behind < limits_.window ){
+        --within_;
+    }
+    backlog_.erase( reader );
+}
+
+void TransferWindow::resume_if_open( boost::mutex::scoped_lock& lk )
+{
+    if( parked_ && open() ){
+        parked_ = false;
+        lk.unlock();
+        resume_();
+    }
+}
@@ -0,0 +1,52 @@
+#include "jamim/BufferPool.hpp"
+#include "jamim/Message.hpp"
+#include <gtest/gtest.h>
+#include <string>
+
+
+namespace
+{
+
+TEST( BufferPoolTest, ReleasedBlocksAreReused ){
+    BufferPool::reset_stats();
+    void* first = BufferPool::allocate( 100 );
+    BufferPool::deallocate( first, 100 );
+    void* second = BufferPool::allocate( 300 );   // same 512 byte class
+    EXPECT_EQ( first, second );
+    BufferPool::deallocate( second, 300 );
+
+    EXPECT_EQ( 2u, BufferPool::stats().heap_allocations
+                 + BufferPool::stats().pool_allocations );
+    EXPECT_LE( 1u, BufferPool::stats().pool_allocations );
+    EXPECT_EQ( 2u, BufferPool::stats().releases );
+}
+
+TEST( BufferPoolTest, OversizeGoesToHeap ){
+    BufferPool::reset_stats();
+    const std::size_t size = BufferPool::class_size( BufferPool::ClassCount-1 ) + 1;
+    void* block = BufferPool::allocate( size );
+    BufferPool::deallocate( block, size );
+
+    EXPECT_EQ( 1u, BufferPool::stats().oversize );
+    EXPECT_EQ( 0u, BufferPool::stats().releases );
+}
+
+TEST( BufferPoolTest, SteadyStateMessagesDoNotAllocate ){
+    const std::string line( 1000, 'x' );
+    for( int i=0; i<16; ++i ){      // warm up
+        Message msg = message_from_string( line );
+        Message copy( msg );
+    }
+
+    BufferPool::reset_stats();
+    for( int i=0; i<1000; ++i ){
+        Message msg = message_from_string( line );
+        Message copy( msg );
+        Message read_msg;
+        read_msg.sync();
+    }
+    EXPECT_EQ( 0u, BufferPool::stats().heap_allocations );
+    EXPECT_LT( 0u, BufferPool::stats().pool_allocations );
+}
+
+} // namespace
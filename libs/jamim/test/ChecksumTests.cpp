@@ -0,0 +1,114 @@
+#include "jamim/Checksum.hpp"
+#include <gtest/gtest.h>
+#include <string>
+
+
+namespace
+{
+
+/* bit at a time, straight from the definition */
+uint32_t reference_crc32c( const std::string& data )
+{
+    uint32_t crc = ~0u;
+    for( unsigned char c : data ){
+        crc ^= c;
+        for( int bit = 0; bit < 8; ++bit ){
+            crc = ( crc >> 1 ) ^ ( ( crc & 1 ) ? 0x82F63B78 : 0 );
+        }
+    }
+    return ~crc;
+}
+
+std::string make_data( std::size_t bytes )
+{
+    std::string data( bytes, '\0' );
+    for( std::size_t i = 0; i < data.size(); ++i ){
+        data[i] = static_cast<char>( i * 31 + ( i >> 9 ) + 7 );
+    }
+    return data;
+}
+
+TEST( crc32c_Test, CheckValue ){
+    EXPECT_EQ( 0xE3069283u, crc32c( 0, "123456789", 9 ) );
+    EXPECT_EQ( 0xE3069283u, crc32c_portable( 0, "123456789", 9 ) );
+    EXPECT_EQ( 0u, crc32c( 0, "", 0 ) );
+}
+
+/* every length and alignment the interleaved lanes and the tails see */
+TEST( crc32c_Test, MatchesTheDefinition ){
+    const std::string data( make_data( 3 * 8192 * 2 + 3 * 256 + 77 ) );
+    const std::size_t lengths[] = { 0, 1, 7, 8, 9, 255, 3 * 256, 3 * 256 + 5
+                                  , 3 * 8192, 3 * 8192 + 3 * 256 + 13
+                                  , data.size() - 3 };
+    for( std::size_t offset = 0; offset < 3; ++offset ){
+        for( std::size_t length : lengths ){
+            const std::string part( data.substr( offset, length ) );
+            const uint32_t expected = reference_crc32c( part );
+            EXPECT_EQ( expected, crc32c( 0, part.data(), part.size() ) )
+                << "offset " << offset << ", length " << length;
+            EXPECT_EQ( expected, crc32c_portable( 0, part.data(), part.size() ) )
+                << "offset " << offset << ", length " << length;
+        }
+    }
+}
+
+TEST( crc32c_Test, ChainsAcrossChunks ){
+    const std::string data( make_data( 100000 ) );
+    const uint32_t whole = crc32c( 0, data.data(), data.size() );
+    uint32_t chained = 0;
+    for( std::size_t at = 0; at < data.size(); at += 4099 ){
+        chained = crc32c( chained, data.data() + at
+                        , std::min<std::size_t>( 4099, data.size() - at ) );
+    }
+    EXPECT_EQ( whole, chained );
+}
+
+TEST( crc32c_Test, CombinesSeparateCrcs ){
+    const std::string data( make_data( 70000 ) );
+    const uint32_t whole = crc32c( 0, data.data(), data.size() );
+    for( std::size_t split : { std::size_t( 0 ), std::size_t( 1 ), std::size_t( 65536 )
+                             , data.size() } ){
+        const uint32_t a = crc32c( 0, data.data(), split );
+        const uint32_t b = crc32c( 0, data.data() + split, data.size() - split );
+        EXPECT_EQ( whole, crc32c_combine( a, b, data.size() - split ) ) << split;
+    }
+}
+
+TEST( BlockChecksumsTest, HashesBlocksAndTheWhole ){
+    const std::string prefix( make_data( 1000 ) );
+    const std::string data( make_data( 10000 ).substr( 3 ) );
+    BlockChecksums checksums( 4096 );
+    checksums.reset( crc32c( 0, prefix.data(), prefix.size() ) );
+    // chunks of 3000 that straddle the blocks, each block ended as it fills
+    std::vector< uint32_t > blocks;
+    std::size_t at = 0;
+    while( at < data.size() ){
+        const std::size_t chunk = std::min<std::size_t>( 3000, data.size() - at );
+        const std::size_t taken = checksums.update( data.data() + at, chunk );
+        EXPECT_EQ( std::min<std::size_t>( chunk, 4096 - at % 4096 ), taken );
+        at += taken;
+        if( checksums.block_left() == 0 ){
+            blocks.push_back( checksums.end_block() );
+        }
+    }
+    EXPECT_EQ( data.size() % 4096, checksums.block_filled() );
+    const std::string all( prefix + data );
+    EXPECT_EQ( crc32c( 0, all.data(), all.size() ), checksums.whole() );
+    blocks.push_back( checksums.end_block() );
+
+    ASSERT_EQ( 3u, blocks.size() );
+    for( std::size_t i = 0; i < blocks.size(); ++i ){
+        const std::string block( data.substr( i * 4096, 4096 ) );
+        EXPECT_EQ( crc32c( 0, block.data(), block.size() ), blocks[i] ) << i;
+    }
+    // ending a block does not change the whole
+    EXPECT_EQ( crc32c( 0, all.data(), all.size() ), checksums.whole() );
+    EXPECT_EQ( 0u, checksums.block_filled() );
+    EXPECT_EQ( data.size(), checksums.bytes() );
+
+    checksums.reset();
+    EXPECT_EQ( 4096u, checksums.block_left() );
+    EXPECT_EQ( 0u, checksums.whole() );
+}
+
+} // namespace
@@ -0,0 +1,57 @@
+#include "jamim/ChunkSizer.hpp"
+#include <gtest/gtest.h>
+
+
+namespace
+{
+
+using std::chrono::milliseconds;
+using std::chrono::microseconds;
+
+TEST( ChunkSizerTest, StartsWithTheInitialChunk ){
+    ChunkSizer sizer( ChunkLimits( 64 << 10, 4 << 20, 256 << 10 ) );
+    EXPECT_EQ( 256u << 10, sizer.chunk() );
+    EXPECT_EQ( 0, sizer.throughput() );
+}
+
+TEST( ChunkSizerTest, FollowsTheBandwidthDelayProduct ){
+    ChunkSizer sizer( ChunkLimits( 4096, 64 << 20, 4096 ) );
+    // 100 MB/s with a 10 ms round trip keeps 1 MB in flight
+    sizer.rtt( milliseconds( 10 ) );
+    sizer.record( 100000000, std::chrono::seconds( 1 ) );
+    EXPECT_EQ( 1003520u, sizer.chunk() );   // 1e6 rounded up to pages
+
+    // without a round trip time the period stands in for it
+    ChunkSizer period( ChunkLimits( 4096, 64 << 20, 4096, milliseconds( 20 ) ) );
+    period.record( 100000000, std::chrono::seconds( 1 ) );
+    EXPECT_EQ( 2002944u, period.chunk() );
+}
+
+TEST( ChunkSizerTest, StaysWithinTheLimits ){
+    ChunkSizer sizer( ChunkLimits( 64 << 10, 4 << 20 ) );
+    sizer.rtt( microseconds( 50 ) );
+    sizer.record( 1000, std::chrono::seconds( 1 ) );
+    EXPECT_EQ( 64u << 10, sizer.chunk() );
+
+    sizer.rtt( std::chrono::seconds( 1 ) );
+    for( int i = 0; i < 16; ++i ){
+        sizer.record( 1 << 30, std::chrono::seconds( 1 ) );
+    }
+    EXPECT_EQ( 4u << 20, sizer.chunk() );
+
+    sizer.reset();
+    EXPECT_EQ( 256u << 10, sizer.chunk() );
+}
+
+TEST( ChunkSizerTest, SmoothsThroughput ){
+    ChunkSizer sizer;
+    sizer.record( 1000, std::chrono::seconds( 1 ) );
+    sizer.record( 5000, std::chrono::seconds( 1 ) );
+    EXPECT_DOUBLE_EQ( 2000, sizer.throughput() );
+    // empty samples are ignored
+    sizer.record( 0, std::chrono::seconds( 1 ) );
+    sizer.record( 1000, ChunkSizer::clock::duration( 0 ) );
+    EXPECT_DOUBLE_EQ( 2000, sizer.throughput() );
+}
+
+} // namespace
@@ -1,12 +1,307 @@
-#include "jamim/Client.hpp"
-#include "gtest/gtest.h"
-
-
-namespace
-{
-
-TEST(ClientTest, Constructor){
-    SUCCEED();
-}
-
-} // namespace
+#include "jamim/Client.hpp"
+#include "jamim/Server.hpp"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace
+{
+
+using boost::asio::ip::tcp;
+
+/* the transfer ids of the first `count` FileStart frames on `socket` */
+std::vector<uint64_t> read_file_starts( tcp::socket& socket, std::size_t count )
+{
+    std::vector<uint8_t> bytes;
+    std::vector<uint64_t> ids;
+    std::size_t at = 0;
+    while( ids.size() < count ){
+        std::array<uint8_t, 4096> buf;
+        const std::size_t got = socket.read_some( boost::asio::buffer( buf ) );
+        bytes.insert( bytes.end(), buf.begin(), buf.begin() + got );
+        while( at < bytes.size()
+            && MessageHeader::length_of( bytes[at] ) <= bytes.size() - at ){
+            const MessageView view( &bytes[at], bytes.size() - at );
+            const std::size_t length = view.header_length() + view.body_length();
+            if( length > bytes.size() - at ){
+                break;
+            }
+            if( view.msg_type() == MessageType::FileStart ){
+                ids.push_back( view.transfer_id() );
+            }
+            at += length;
+        }
+    }
+    return ids;
+}
+
+/* the next whole frame on `socket` */
+std::vector<uint8_t> read_frame( tcp::socket& socket )
+{
+    std::vector<uint8_t> frame( 1 );
+    boost::asio::read( socket, boost::asio::buffer( frame ) );
+    frame.resize( MessageHeader::length_of( frame[0] ) );
+    boost::asio::read( socket, boost::asio::buffer( &frame[1], frame.size() - 1 ) );
+    const MessageHeader header( MessageHeader::from_bytes( frame.data() ) );
+    const std::size_t rest = header.msg_length()
+        + ( header.msg_type() == MessageType::FileStart ? MessageView::FileInfoLength : 0 );
+    frame.resize( frame.size() + rest );
+    boost::asio::read( socket, boost::asio::buffer( &frame[frame.size() - rest], rest ) );
+    return frame;
+}
+
+/* frames on `socket` until one of `type` */
+std::vector<uint8_t> read_frame( tcp::socket& socket, MessageType type )
+{
+    std::vector<uint8_t> frame;
+    do{
+        frame = read_frame( socket );
+    } while( MessageView( frame.data(), frame.size() ).msg_type() != type );
+    return frame;
+}
+
+void write_chunk( tcp::socket& socket, uint64_t transfer_id, const std::string& bytes )
+{
+    std::vector<uint8_t> frame( FileChunkHeader::Length + bytes.size() );
+    put_file_chunk_header( frame.data(), FileChunkHeader( transfer_id, bytes.size() ) );
+    std::copy( bytes.begin(), bytes.end(), frame.begin() + FileChunkHeader::Length );
+    boost::asio::write( socket, boost::asio::buffer( frame ) );
+}
+
+std::string crc_bytes( uint32_t crc )
+{
+    std::string bytes( FileTrailer::CrcLength, '\0' );
+    put_uint32( reinterpret_cast<uint8_t*>( &bytes[0] ), crc );
+    return bytes;
+}
+
+TEST(ClientTest, Constructor){
+    SUCCEED();
+}
+
+/* two files accepted together take turns on the file socket chunk by
+ * chunk, the preamble and checksums included */
+TEST( ClientTest, ConcurrentSendsAlternate ){
+    const std::string paths[] = { "ClientTests.a.tmp", "ClientTests.b.tmp" };
+    const std::size_t size = 1 << 18;
+    for( const std::string& path : paths ){
+        std::ofstream( path, std::ios_base::binary ) << std::string( size, 'x' );
+    }
+
+    boost::asio::io_service io_service, io_file_service, server_service;
+    std::unique_ptr< boost::asio::io_service::work > work(
+        new boost::asio::io_service::work( io_service ) );
+    std::unique_ptr< boost::asio::io_service::work > file_work(
+        new boost::asio::io_service::work( io_file_service ) );
+    const tcp::endpoint loopback( boost::asio::ip::address_v4::loopback(), 0 );
+    tcp::acceptor chat_acceptor( server_service, loopback );
+    tcp::acceptor file_acceptor( server_service, loopback );
+    tcp::resolver resolver( server_service );
+    Client client( io_service
+        , resolver.resolve( tcp::resolver::query( "127.0.0.1"
+            , std::to_string( chat_acceptor.local_endpoint().port() ) ) )
+        , io_file_service
+        , resolver.resolve( tcp::resolver::query( "127.0.0.1"
+            , std::to_string( file_acceptor.local_endpoint().port() ) ) ) );
+    client.sendfile_chunk( 0 );
+    client.chunk_limits( ChunkLimits( 4096, 4096, 4096 ) );
+    boost::thread_group threads;
+    threads.create_thread( [&io_service](){ io_service.run(); } );
+    threads.create_thread( [&io_file_service](){ io_file_service.run(); } );
+
+    tcp::socket chat( server_service ), file( server_service );
+    chat_acceptor.accept( chat );
+    file_acceptor.accept( file );
+    for( const std::string& path : paths ){
+        client.start_file( message_from_string( path ) );
+    }
+    const std::vector<uint64_t> ids( read_file_starts( chat, 2 ) );
+    ASSERT_EQ( 2u, ids.size() );
+    std::vector<uint8_t> accepts;
+    for( uint64_t id : ids ){
+        const Message accept( make_file_accept( FileResume( id ) ) );
+        accepts.insert( accepts.end(), accept.data(), accept.data() + accept.total_length() );
+    }
+    // the file thread waits until both accepts are queued for it, so the
+    // first file does not get ahead. The chat frames are handled in order:
+    // once a FileStart offered after them is refused, the accepts are in
+    std::promise<void> release;
+    std::shared_future<void> released( release.get_future() );
+    io_file_service.post( [released](){ released.wait(); } );
+    uint64_t offered = 1;
+    while( offered == ids[0] || offered == ids[1] ){
+        ++offered;
+    }
+    const Message offer( make_file_message( 1, "offered", offered ) );
+    accepts.insert( accepts.end(), offer.data(), offer.data() + offer.total_length() );
+    std::istringstream answers( "n\n" );
+    std::streambuf* const cin_buf = std::cin.rdbuf( answers.rdbuf() );
+    boost::asio::write( chat, boost::asio::buffer( accepts ) );
+    const std::vector<uint8_t> refused( read_frame( chat, MessageType::FileRefuse ) );
+    std::cin.rdbuf( cin_buf );
+    const MessageView refusal( refused.data(), refused.size() );
+    EXPECT_EQ( offered, file_control_id( refusal.msg_body(), refusal.body_length() ) );
+    release.set_value();
+
+    // every chunk header, until both streams are in
+    const uint64_t stream = FileResume::PreambleLength + size + FileTrailer::length( size );
+    uint64_t left[] = { stream, stream };
+    std::vector<std::size_t> turns;
+    while( left[0] != 0 || left[1] != 0 ){
+        std::array<uint8_t, FileChunkHeader::Length> header_bytes;
+        boost::asio::read( file, boost::asio::buffer( header_bytes ) );
+        const FileChunkHeader header( file_chunk_header( header_bytes.data() ) );
+        const std::size_t turn = ( header.transfer_id == ids[0] ) ? 0 : 1;
+        ASSERT_EQ( ids[turn], header.transfer_id );
+        ASSERT_LE( header.length, left[turn] );
+        std::vector<char> data( header.length );
+        boost::asio::read( file, boost::asio::buffer( data ) );
+        left[turn] -= header.length;
+        turns.push_back( turn );
+    }
+
+    // the first file goes alone until the second is accepted, then they
+    // alternate until one of them is done
+    auto second = std::find( turns.begin(), turns.end(), turns.front() ^ 1 );
+    ASSERT_NE( turns.end(), second );
+    std::size_t alternated = 0;
+    for( auto it = second; it + 1 != turns.end(); ++it ){
+        const std::size_t done = std::count( turns.begin(), it + 1, *it );
+        if( done == std::size_t( std::count( turns.begin(), turns.end(), *it ) ) ){
+            break;
+        }
+        EXPECT_NE( *it, *( it + 1 ) ) << "frame " << ( it - turns.begin() );
+        ++alternated;
+    }
+    EXPECT_LT( 100u, alternated );
+
+    work.reset();
+    file_work.reset();
+    io_service.stop();
+    io_file_service.stop();
+    threads.join_all();
+    for( const std::string& path : paths ){
+        std::remove( path.c_str() );
+    }
+}
+
+/* a block corrupted on the way is asked for again from the transfer's
+ * sender alone, and the reader ends up with the file whole; the sender
+ * and a bystander are played here, the reader is a Client */
+TEST( ClientTest, CorruptedBlockIsRepaired ){
+    const std::string path( "ClientTests.repaired.tmp" );
+    std::remove( path.c_str() );
+    const uint64_t id = 42;
+    std::string original( FileTrailer::BlockLength + 1000, '\0' );
+    for( std::size_t i = 0; i < original.size(); ++i ){
+        original[i] = static_cast<char>( i * 7 );
+    }
+
+    const tcp::endpoint loopback( boost::asio::ip::address_v4::loopback(), 0 );
+    Server server( loopback, loopback );
+    server.run();
+    // each chat socket is paired with the next file socket
+    boost::asio::io_service test_service;
+    tcp::socket sender( test_service ), sender_file( test_service );
+    tcp::socket other( test_service ), other_file( test_service );
+    sender.connect( server.endpoint() );
+    sender_file.connect( server.file_endpoint() );
+    other.connect( server.endpoint() );
+    other_file.connect( server.file_endpoint() );
+
+    // the reader accepts the file and saves it to `path`
+    std::istringstream answers( "y\n" + path + "\n" );
+    std::streambuf* const cin_buf = std::cin.rdbuf( answers.rdbuf() );
+    boost::asio::io_service io_service, io_file_service;
+    std::unique_ptr< boost::asio::io_service::work > work(
+        new boost::asio::io_service::work( io_service ) );
+    std::unique_ptr< boost::asio::io_service::work > file_work(
+        new boost::asio::io_service::work( io_file_service ) );
+    tcp::resolver resolver( test_service );
+    Client client( io_service
+        , resolver.resolve( tcp::resolver::query( "127.0.0.1"
+            , std::to_string( server.endpoint().port() ) ) )
+        , io_file_service
+        , resolver.resolve( tcp::resolver::query( "127.0.0.1"
+            , std::to_string( server.file_endpoint().port() ) ) ) );
+    boost::thread_group threads;
+    threads.create_thread( [&io_service](){ io_service.run(); } );
+    threads.create_thread( [&io_file_service](){ io_file_service.run(); } );
+
+    // everybody is in the room once the sender heard from both others
+    client.write( message_from_string( "reader" ) );
+    const Message hello( message_from_string( "bystander" ) );
+    boost::asio::write( other, boost::asio::buffer( hello.data(), hello.total_length() ) );
+    read_frame( sender, MessageType::ChatMsg );
+    read_frame( sender, MessageType::ChatMsg );
+
+    const Message start( make_file_message( original.size(), "/some/file", id ) );
+    boost::asio::write( sender, boost::asio::buffer( start.data(), start.total_length() ) );
+    read_frame( other, MessageType::FileStart );
+    const Message refuse( make_file_control( MessageType::FileRefuse, id ) );
+    boost::asio::write( other, boost::asio::buffer( refuse.data(), refuse.total_length() ) );
+    read_frame( sender, MessageType::FileAccept );
+
+    // the first block is damaged after its checksum was taken
+    const std::string first( original, 0, FileTrailer::BlockLength );
+    const std::string second( original, FileTrailer::BlockLength );
+    std::string damaged( first );
+    damaged[1000] ^= 0x5a;
+    write_chunk( sender_file, id, std::string( FileResume::PreambleLength, '\0' ) );
+    write_chunk( sender_file, id, damaged + crc_bytes( crc32c( 0, first.data(), first.size() ) ) );
+    write_chunk( sender_file, id, second
+                 + crc_bytes( crc32c( 0, second.data(), second.size() ) )
+                 + crc_bytes( crc32c( 0, original.data(), original.size() ) ) );
+
+    const std::vector<uint8_t> frame( read_frame( sender, MessageType::FileResend ) );
+    const MessageView view( frame.data(), frame.size() );
+    const ResendRequest resend( file_resend( view.msg_body(), view.body_length() ) );
+    EXPECT_EQ( id, resend.transfer_id );
+    ASSERT_EQ( 1u, resend.ranges.size() );
+    EXPECT_EQ( 0u, resend.ranges[0].offset );
+    ASSERT_EQ( uint32_t( FileTrailer::BlockLength ), resend.ranges[0].length );
+    const Message repair( make_file_repair( id, resend.reader, 0
+                                          , first.data(), first.size() ) );
+    boost::asio::write( sender, boost::asio::buffer( repair.data(), repair.total_length() ) );
+
+    std::string received;
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds( 10 );
+    while( received != original && std::chrono::steady_clock::now() < deadline ){
+        std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+        std::ifstream file( path, std::ios_base::binary );
+        received.assign( std::istreambuf_iterator<char>( file )
+                       , std::istreambuf_iterator<char>() );
+    }
+    EXPECT_TRUE( received == original );
+
+    // the bystander never heard of the resend
+    while( other.available() != 0 ){
+        const std::vector<uint8_t> heard( read_frame( other ) );
+        EXPECT_NE( MessageType::FileResend
+                 , MessageView( heard.data(), heard.size() ).msg_type() );
+    }
+
+    client.close();
+    work.reset();
+    file_work.reset();
+    io_service.stop();
+    io_file_service.stop();
+    threads.join_all();
+    std::cin.rdbuf( cin_buf );
+    server.stop();
+    std::remove( path.c_str() );
+    std::remove( FileCheckpoint::path_of( path ).c_str() );
+}
+
+} // namespace
@@ -0,0 +1,97 @@
+#include "jamim/Dispatch.hpp"
+#include <benchmark/benchmark.h>
+#include <unordered_map>
+#include <vector>
+
+
+namespace
+{
+
+/* Stand-in for ChatSession/Client: same handler shape, trivial bodies */
+class Receiver
+{
+public:
+    typedef void (Receiver::*Handler)( std::size_t );
+    typedef DispatchTable< Handler >    HandlerTable;
+
+    void handle_chat( std::size_t length )      { total_ += length; }
+    void handle_file( std::size_t length )      { total_ += 2*length; }
+    void handle_control( std::size_t length )   { total_ += 3*length; }
+    void handle_unknown( std::size_t length )   { total_ -= length; }
+
+    std::size_t total_ = 0;
+};
+
+typedef Dispatch< Receiver::Handler >   ReceiverDispatch;
+
+constexpr Receiver::HandlerTable s_handler_table =
+    ReceiverDispatch::make_table< &Receiver::handle_unknown
+    , ReceiverDispatch::On< MessageType::EmptyMsg      , &Receiver::handle_control >
+    , ReceiverDispatch::On< MessageType::ChatMsg       , &Receiver::handle_chat >
+    , ReceiverDispatch::On< MessageType::CmdQuit       , &Receiver::handle_control >
+    , ReceiverDispatch::On< MessageType::FileStart     , &Receiver::handle_file >
+    , ReceiverDispatch::On< MessageType::FileAccept    , &Receiver::handle_file >
+    , ReceiverDispatch::On< MessageType::FileRefuse    , &Receiver::handle_file >
+    , ReceiverDispatch::On< MessageType::FileCancel    , &Receiver::handle_file >
+    , ReceiverDispatch::On< MessageType::FileCancelAll , &Receiver::handle_file >
+    , ReceiverDispatch::On< MessageType::FileDone      , &Receiver::handle_file >
+    >();
+
+/* the unordered_map previously used by ChatSession/Client */
+const std::unordered_map< MessageType, Receiver::Handler > s_handler_map{
+      { MessageType::EmptyMsg         , &Receiver::handle_control }
+    , { MessageType::ChatMsg          , &Receiver::handle_chat }
+    , { MessageType::CmdQuit          , &Receiver::handle_control }
+    , { MessageType::FileStart        , &Receiver::handle_file }
+    , { MessageType::FileAccept       , &Receiver::handle_file }
+    , { MessageType::FileRefuse       , &Receiver::handle_file }
+    , { MessageType::FileCancel       , &Receiver::handle_file }
+    , { MessageType::FileCancelAll    , &Receiver::handle_file }
+    , { MessageType::FileDone         , &Receiver::handle_file }
+    , { MessageType::Unknown          , &Receiver::handle_unknown }
+};
+
+/* mostly chat with some control and file traffic mixed in */
+const std::vector<MessageType>& traffic()
+{
+    static const std::vector<MessageType> types{
+        ChatMsg, ChatMsg, ChatMsg, ChatMsg, EmptyMsg, ChatMsg, FileStart
+      , ChatMsg, FileAccept, ChatMsg, ChatMsg, Unknown, ChatMsg, FileDone
+      , ChatMsg, CmdQuit };
+    return types;
+}
+
+
+void BM_DispatchHashMap( benchmark::State& state )
+{
+    Receiver receiver;
+    const std::vector<MessageType>& types = traffic();
+    std::size_t i = 0;
+    for( auto _ : state ){
+        const MessageType type = types[i++ % types.size()];
+        auto it = s_handler_map.find( type );
+        Receiver::Handler handler = ( (it!=s_handler_map.end()) ? it->second
+                                                                : &Receiver::handle_unknown );
+        (receiver.*handler)( 1 );
+    }
+    benchmark::DoNotOptimize( receiver.total_ );
+    state.SetItemsProcessed( state.iterations() );
+}
+BENCHMARK( BM_DispatchHashMap );
+
+void BM_DispatchTable( benchmark::State& state )
+{
+    Receiver receiver;
+    const std::vector<MessageType>& types = traffic();
+    std::size_t i = 0;
+    for( auto _ : state ){
+        const MessageType type = types[i++ % types.size()];
+        Receiver::Handler handler = s_handler_table[ type ];
+        (receiver.*handler)( 1 );
+    }
+    benchmark::DoNotOptimize( receiver.total_ );
+    state.SetItemsProcessed( state.iterations() );
+}
+BENCHMARK( BM_DispatchTable );
+
+} // namespace
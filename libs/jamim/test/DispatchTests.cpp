@@ -0,0 +1,46 @@
+#include "jamim/Dispatch.hpp"
+#include <gtest/gtest.h>
+
+
+namespace
+{
+
+class Receiver
+{
+public:
+    typedef int (Receiver::*Handler)() const;
+    typedef DispatchTable< Handler >    HandlerTable;
+
+    int handle_chat() const     { return 1; }
+    int handle_quit() const     { return 2; }
+    int handle_unknown() const  { return -1; }
+};
+
+typedef Dispatch< Receiver::Handler >   ReceiverDispatch;
+
+constexpr Receiver::HandlerTable s_handler_table =
+    ReceiverDispatch::make_table< &Receiver::handle_unknown
+    , ReceiverDispatch::On< MessageType::ChatMsg , &Receiver::handle_chat >
+    , ReceiverDispatch::On< MessageType::CmdQuit , &Receiver::handle_quit >
+    >();
+
+static_assert( s_handler_table[MessageType::ChatMsg] == &Receiver::handle_chat
+             , "table is built at compile time" );
+
+TEST( DispatchTableTest, ListedTypesMapToTheirHandler ){
+    Receiver receiver;
+    EXPECT_EQ( 1, (receiver.*s_handler_table[MessageType::ChatMsg])() );
+    EXPECT_EQ( 2, (receiver.*s_handler_table[MessageType::CmdQuit])() );
+}
+
+TEST( DispatchTableTest, EveryOtherTypeIsUnknown ){
+    Receiver receiver;
+    for( int type = 0; type < Receiver::HandlerTable::Size; ++type ){
+        if( type == MessageType::ChatMsg || type == MessageType::CmdQuit ){
+            continue;
+        }
+        EXPECT_EQ( -1, (receiver.*s_handler_table[static_cast<MessageType>(type)])() );
+    }
+}
+
+} // namespace
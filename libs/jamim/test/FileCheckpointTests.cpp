@@ -0,0 +1,49 @@
+#include "jamim/FileCheckpoint.hpp"
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+
+namespace
+{
+
+const std::string s_file( "FileCheckpointTests.tmp" );
+
+TEST( FileCheckpointTest, StoresTheLatestRecord ){
+    FileCheckpoint checkpoint;
+    ASSERT_TRUE( checkpoint.open( s_file ) );
+    FileCheckpoint::Record record;
+    record.transfer_id = 0x1122334455667788ull;
+    record.size = 5ull << 32;
+    for( std::uint64_t received : { 0ull, 1ull << 20, 3ull << 32 } ){
+        record.received = received;
+        record.crc = static_cast<std::uint32_t>( received >> 7 ) | 1;
+        EXPECT_TRUE( checkpoint.store( record ) );
+    }
+    checkpoint.close();
+
+    FileCheckpoint::Record loaded;
+    ASSERT_TRUE( FileCheckpoint::load( s_file, loaded ) );
+    EXPECT_EQ( record.transfer_id, loaded.transfer_id );
+    EXPECT_EQ( record.size, loaded.size );
+    EXPECT_EQ( record.received, loaded.received );
+    EXPECT_EQ( record.crc, loaded.crc );
+
+    ASSERT_TRUE( checkpoint.open( s_file ) );
+    checkpoint.remove();
+    EXPECT_FALSE( FileCheckpoint::load( s_file, loaded ) );
+}
+
+TEST( FileCheckpointTest, RejectsForeignFiles ){
+    {   std::ofstream out( FileCheckpoint::path_of( s_file ), std::ios_base::binary );
+        out << std::string( FileCheckpoint::RecordLength, 'x' );
+    }
+    FileCheckpoint::Record loaded;
+    EXPECT_FALSE( FileCheckpoint::load( s_file, loaded ) );
+    std::remove( FileCheckpoint::path_of( s_file ).c_str() );
+
+    EXPECT_FALSE( FileCheckpoint::load( "no/such/file", loaded ) );
+}
+
+} // namespace
@@ -0,0 +1,94 @@
+#include "jamim/FileSender.hpp"
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <boost/asio/error.hpp>
+#ifdef __linux__
+#include <sys/socket.h>
+#include <unistd.h>
+#endif /* __linux__ */
+
+
+namespace
+{
+
+#ifdef __linux__
+
+TEST( FileSenderTest, SendsFileInBoundedChunks ){
+    const std::string path( "FileSenderTests.tmp" );
+    const std::string data( 10000, 'x' );
+    { std::ofstream out( path, std::ios_base::binary );
+        out << data;
+    }
+    int sock[2];
+    ASSERT_EQ( 0, ::socketpair( AF_UNIX, SOCK_STREAM, 0, sock ) );
+
+    FileSender sender;
+    ASSERT_TRUE( sender.open( path ) );
+    EXPECT_EQ( data.size(), sender.size() );
+
+    boost::system::error_code ec;
+    EXPECT_EQ( 4096u, sender.send_to( sock[1], 4096, ec ) );
+    EXPECT_FALSE( ec );
+    EXPECT_EQ( 4096u, sender.offset() );
+    while( 0 < sender.remaining() ){
+        ASSERT_LT( 0u, sender.send_to( sock[1], 4096, ec ) );
+    }
+    EXPECT_EQ( 0u, sender.send_to( sock[1], 4096, ec ) );
+    EXPECT_EQ( boost::asio::error::eof, ec );
+
+    std::string received;
+    char buf[4096];
+    while( received.size() < data.size() ){
+        const ssize_t got = ::read( sock[0], buf, sizeof(buf) );
+        ASSERT_LT( 0, got );
+        received.append( buf, got );
+    }
+    EXPECT_EQ( data, received );
+
+    ::close( sock[0] );
+    ::close( sock[1] );
+    std::remove( path.c_str() );
+}
+
+TEST( FileSenderTest, ViewsTheBytesItSends ){
+    const std::string path( "FileSenderTests.tmp" );
+    { std::ofstream out( path, std::ios_base::binary );
+        out << "0123456789";
+    }
+    FileSender sender;
+    ASSERT_TRUE( sender.open( path, 6 ) );
+    ASSERT_NE( nullptr, sender.view() );
+    EXPECT_EQ( "012345", std::string( sender.view(), sender.size() ) );
+    EXPECT_TRUE( sender.seek( 6 ) );
+    EXPECT_FALSE( sender.seek( 7 ) );
+    EXPECT_EQ( 0u, sender.remaining() );
+    sender.close();
+    EXPECT_EQ( nullptr, sender.view() );
+    std::remove( path.c_str() );
+}
+
+TEST( FileSenderTest, SendsNoMoreThanTheLimit ){
+    const std::string path( "FileSenderTests.tmp" );
+    { std::ofstream out( path, std::ios_base::binary );
+        out << std::string( 100, 'x' );
+    }
+    FileSender sender;
+    ASSERT_TRUE( sender.open( path, 60 ) );
+    EXPECT_EQ( 60u, sender.size() );
+    // a file shorter than announced is not sent at all
+    EXPECT_FALSE( sender.open( path, 101 ) );
+    std::remove( path.c_str() );
+}
+
+#endif /* __linux__ */
+
+TEST( FileSenderTest, MissingFileDoesNotOpen ){
+    FileSender sender;
+    EXPECT_FALSE( sender.open( "no/such/file" ) );
+    EXPECT_FALSE( sender.is_open() );
+    EXPECT_EQ( 0u, sender.remaining() );
+}
+
+} // namespace
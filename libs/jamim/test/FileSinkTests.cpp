@@ -0,0 +1,158 @@
+#include "jamim/FileSink.hpp"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <boost/asio/error.hpp>
+
+
+namespace
+{
+
+std::string contents( const std::string& path )
+{
+    std::ifstream in( path, std::ios_base::binary );
+    return std::string( std::istreambuf_iterator<char>( in )
+                      , std::istreambuf_iterator<char>() );
+}
+
+#ifdef __linux__
+
+const FileSink::Mode s_modes[] = { FileSink::Pwrite, FileSink::Mmap, FileSink::Direct };
+
+TEST( FileSinkTest, WritesTheAnnouncedBytes ){
+    const std::string path( "FileSinkTests.tmp" );
+    // not a multiple of any block size, and more than one Direct stage
+    std::string data( ( 1 << 20 ) + 5000, '\0' );
+    for( std::size_t i = 0; i < data.size(); ++i ){
+        data[i] = static_cast<char>( i * 7 );
+    }
+
+    for( FileSink::Mode mode : s_modes ){
+        SCOPED_TRACE( mode );
+        FileSink sink;
+        ASSERT_TRUE( sink.open( path, data.size(), mode ) );
+        boost::system::error_code ec;
+        for( std::size_t at = 0; at < data.size(); at += 65536 ){
+            const std::size_t bytes = std::min<std::size_t>( 65536, data.size() - at );
+            sink.write( data.data() + at, bytes, ec );
+            ASSERT_FALSE( ec );
+        }
+        EXPECT_EQ( data.size(), sink.written() );
+        sink.write( "x", 1, ec );
+        EXPECT_EQ( boost::asio::error::message_size, ec );
+        sink.close( ec );
+        EXPECT_FALSE( ec );
+        EXPECT_FALSE( sink.is_open() );
+
+        EXPECT_EQ( data, contents( path ) );
+    }
+    std::remove( path.c_str() );
+}
+
+TEST( FileSinkTest, RewriteOverwritesWhatWasWritten ){
+    const std::string path( "FileSinkTests.tmp" );
+    // more than a Direct stage, the patch straddles what is staged
+    std::string data( ( 1 << 20 ) + 10000, 'a' );
+    const std::string patch( 8000, 'p' );
+    const std::size_t at = ( 1 << 20 ) - 3000;
+    for( FileSink::Mode mode : s_modes ){
+        SCOPED_TRACE( mode );
+        FileSink sink;
+        ASSERT_TRUE( sink.open( path, data.size(), mode ) );
+        boost::system::error_code ec;
+        sink.write( data.data(), data.size() - 1000, ec );
+        ASSERT_FALSE( ec );
+        sink.rewrite( patch.data(), patch.size(), at, ec );
+        ASSERT_FALSE( ec );
+        sink.rewrite( patch.data(), 2000, data.size() - 2000, ec );
+        EXPECT_EQ( boost::asio::error::message_size, ec );
+        sink.write( data.data(), 1000, ec );
+        ASSERT_FALSE( ec );
+        sink.close( ec );
+        EXPECT_FALSE( ec );
+
+        std::string expected( data );
+        expected.replace( at, patch.size(), patch );
+        EXPECT_EQ( expected, contents( path ) );
+    }
+    std::remove( path.c_str() );
+}
+
+TEST( FileSinkTest, ShortTransferKeepsOnlyWhatArrived ){
+    const std::string path( "FileSinkTests.tmp" );
+    for( FileSink::Mode mode : s_modes ){
+        SCOPED_TRACE( mode );
+        FileSink sink;
+        ASSERT_TRUE( sink.open( path, 1 << 16, mode ) );
+        boost::system::error_code ec;
+        sink.write( "partial", 7, ec );
+        ASSERT_FALSE( ec );
+        sink.close( ec );
+        EXPECT_FALSE( ec );
+
+        EXPECT_EQ( "partial", contents( path ) );
+    }
+    std::remove( path.c_str() );
+}
+
+TEST( FileSinkTest, KeptFileResumesAtTheOffset ){
+    const std::string path( "FileSinkTests.tmp" );
+    // the offset falls inside a block, past the first one
+    const std::string head( 5000, 'h' ), tail( 3000, 't' );
+    for( FileSink::Mode mode : s_modes ){
+        SCOPED_TRACE( mode );
+        FileSink sink;
+        boost::system::error_code ec;
+        ASSERT_TRUE( sink.open( path, head.size() + tail.size(), mode ) );
+        sink.write( head.data(), head.size(), ec );
+        sink.close( ec );
+        ASSERT_FALSE( ec );
+
+        ASSERT_TRUE( sink.open( path, head.size() + tail.size(), mode, true ) );
+        sink.seek( head.size(), ec );
+        ASSERT_FALSE( ec );
+        sink.write( tail.data(), tail.size(), ec );
+        ASSERT_FALSE( ec );
+        sink.close( ec );
+        EXPECT_FALSE( ec );
+
+        EXPECT_EQ( head + tail, contents( path ) );
+    }
+    std::remove( path.c_str() );
+}
+
+TEST( FileSinkTest, SeekPastTheSizeFails ){
+    const std::string path( "FileSinkTests.tmp" );
+    FileSink sink;
+    ASSERT_TRUE( sink.open( path, 16 ) );
+    boost::system::error_code ec;
+    sink.seek( 17, ec );
+    EXPECT_EQ( boost::asio::error::invalid_argument, ec );
+    sink.close( ec );
+    std::remove( path.c_str() );
+}
+
+TEST( FileSinkTest, EmptyFile ){
+    const std::string path( "FileSinkTests.tmp" );
+    FileSink sink;
+    ASSERT_TRUE( sink.open( path, 0, FileSink::Mmap ) );
+    boost::system::error_code ec;
+    sink.close( ec );
+    EXPECT_FALSE( ec );
+    EXPECT_EQ( "", contents( path ) );
+    std::remove( path.c_str() );
+}
+
+#endif /* __linux__ */
+
+TEST( FileSinkTest, MissingDirectoryDoesNotOpen ){
+    FileSink sink;
+    EXPECT_FALSE( sink.open( "no/such/dir/file", 16 ) );
+    EXPECT_FALSE( sink.is_open() );
+    EXPECT_EQ( 0u, sink.written() );
+}
+
+} // namespace
@@ -0,0 +1,147 @@
+#include "jamim/FrameReader.hpp"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+
+namespace
+{
+
+/* copy bytes into the reader the way async_read_some would */
+void feed( FrameReader& reader, const uint8_t* data, std::size_t size )
+{
+    while( size > 0 ){
+        auto buffer = reader.prepare();
+        const std::size_t n = std::min( size, boost::asio::buffer_size( buffer ) );
+        ASSERT_LT( 0u, n );
+        std::copy( data, data + n, boost::asio::buffer_cast<uint8_t*>( buffer ) );
+        reader.commit( n );
+        data += n;
+        size -= n;
+    }
+}
+
+void feed( FrameReader& reader, const Message& msg )
+{
+    feed( reader, msg.data(), msg.total_length() );
+}
+
+TEST( FrameReaderTest, IncompleteFrameIsNotReturned ){
+    FrameReader reader;
+    MessageView view;
+    boost::system::error_code ec;
+    Message msg = message_from_string( "hello" );
+
+    feed( reader, msg.data(), 2 );
+    EXPECT_FALSE( reader.next( view, ec ) );
+    feed( reader, msg.data() + 2, msg.total_length() - 3 );
+    EXPECT_FALSE( reader.next( view, ec ) );
+    feed( reader, msg.data() + msg.total_length() - 1, 1 );
+    ASSERT_TRUE( reader.next( view, ec ) );
+    EXPECT_EQ( MessageType::ChatMsg, view.msg_type() );
+    EXPECT_EQ( "hello", view.body_to_string() );
+    EXPECT_FALSE( reader.next( view, ec ) );
+}
+
+TEST( FrameReaderTest, SeveralFramesFromOneRead ){
+    FrameReader reader;
+    MessageView view;
+    boost::system::error_code ec;
+    feed( reader, message_from_string( "first" ) );
+    feed( reader, message_from_string( "" ) );
+    feed( reader, make_file_message( 1234, "/some/file" ) );
+    feed( reader, message_from_string( "-quit" ) );
+
+    ASSERT_TRUE( reader.next( view, ec ) );
+    EXPECT_EQ( "first", view.body_to_string() );
+    ASSERT_TRUE( reader.next( view, ec ) );
+    EXPECT_EQ( MessageType::EmptyMsg, view.msg_type() );
+    ASSERT_TRUE( reader.next( view, ec ) );
+    EXPECT_EQ( MessageType::FileStart, view.msg_type() );
+    EXPECT_EQ( 1234u, view.file_size() );
+    EXPECT_EQ( "/some/file", view.body_to_string() );
+    ASSERT_TRUE( reader.next( view, ec ) );
+    EXPECT_EQ( MessageType::CmdQuit, view.msg_type() );
+    EXPECT_FALSE( reader.next( view, ec ) );
+}
+
+TEST( FrameReaderTest, FramesWrappingTheBuffer ){
+    FrameReader reader( 64 );
+    MessageView view;
+    boost::system::error_code ec;
+    std::vector<std::string> lines;
+    std::vector<uint8_t> stream;
+    for( int i=0; i<100; ++i ){
+        lines.emplace_back( 10 + i % 40, static_cast<char>('a' + i % 26) );
+        Message msg = message_from_string( lines.back() );
+        stream.insert( stream.end(), msg.data(), msg.data() + msg.total_length() );
+    }
+
+    // small reads keep the ring partially filled, so frames straddle its end
+    std::size_t received = 0;
+    for( std::size_t pos = 0; pos < stream.size(); pos += 7 ){
+        feed( reader, stream.data() + pos, std::min<std::size_t>( 7, stream.size() - pos ) );
+        while( reader.next( view, ec ) ){
+            ASSERT_LT( received, lines.size() );
+            EXPECT_EQ( lines[received], view.body_to_string() );
+            EXPECT_EQ( lines[received], Message( view ).body_to_string() );
+            ++received;
+        }
+    }
+    EXPECT_EQ( lines.size(), received );
+    EXPECT_EQ( 0u, reader.size() );
+}
+
+TEST( FrameReaderTest, ExtendedFrameGrowsTheBuffer ){
+    FrameReader reader( 1024 );
+    MessageView view;
+    boost::system::error_code ec;
+    const std::string line( 200000, 'x' );
+    const Message msg = message_from_string( line );
+    feed( reader, msg.data(), MessageHeader::ExtendedHeaderLength );
+    EXPECT_FALSE( reader.next( view, ec ) );
+    EXPECT_LE( msg.total_length(), reader.capacity() );
+    feed( reader, msg.data() + MessageHeader::ExtendedHeaderLength
+        , msg.total_length() - MessageHeader::ExtendedHeaderLength );
+    feed( reader, message_from_string( "after" ) );
+
+    ASSERT_TRUE( reader.next( view, ec ) );
+    EXPECT_EQ( MessageType::ChatMsg, view.msg_type() );
+    EXPECT_EQ( line.size(), view.body_length() );
+    EXPECT_EQ( line, view.body_to_string() );
+    ASSERT_TRUE( reader.next( view, ec ) );
+    EXPECT_EQ( "after", view.body_to_string() );
+    EXPECT_FALSE( ec );
+}
+
+TEST( FrameReaderTest, FrameAboveMaximumIsAnError ){
+    FrameReader reader;
+    reader.max_frame_size( 1000 );
+    MessageView view;
+    boost::system::error_code ec;
+    feed( reader, message_from_string( std::string( 500, 'x' ) ) );
+    feed( reader, message_from_string( std::string( 5000, 'x' ) ).data()
+        , MessageHeader::HeaderLength );
+
+    ASSERT_TRUE( reader.next( view, ec ) );
+    EXPECT_FALSE( reader.next( view, ec ) );
+    EXPECT_EQ( boost::asio::error::message_size, ec );
+}
+
+/* an extended header naming the extended marker as its type, with a
+ * length that would fit a compact one */
+TEST( FrameReaderTest, NestedExtendedHeaderIsAnError ){
+    FrameReader reader;
+    MessageView view;
+    boost::system::error_code ec;
+    const uint8_t frame[] = { MessageType::ExtendedFrame, MessageType::ExtendedFrame
+                            , 0, 0, 0, 4, 'b', 'o', 'd', 'y' };
+    feed( reader, frame, sizeof( frame ) );
+
+    EXPECT_FALSE( reader.next( view, ec ) );
+    EXPECT_EQ( boost::system::errc::make_error_code( boost::system::errc::bad_message )
+             , ec );
+}
+
+} // namespace
@@ -0,0 +1,59 @@
+#include "jamim/IoServicePool.hpp"
+#include <gtest/gtest.h>
+
+
+namespace
+{
+
+TEST( IoServicePoolTest, SharedModeHasOneService ){
+    IoServicePool pool( IoServicePool::Shared, 4 );
+    EXPECT_EQ( 1u, pool.size() );
+    EXPECT_EQ( 4u, pool.thread_count() );
+
+    IoServicePool::Lease a, b;
+    EXPECT_EQ( &pool.acceptor_service(), &pool.acquire( a ) );
+    EXPECT_EQ( &pool.acceptor_service(), &pool.acquire( b ) );
+    EXPECT_EQ( 2u, pool.load( 0 ) );
+}
+
+TEST( IoServicePoolTest, PerCoreSpreadsByLoad ){
+    IoServicePool pool( IoServicePool::PerCore, 3 );
+    ASSERT_EQ( 3u, pool.size() );
+
+    IoServicePool::Lease leases[4];
+    boost::asio::io_service* first = &pool.acquire( leases[0] );
+    boost::asio::io_service* second = &pool.acquire( leases[1] );
+    boost::asio::io_service* third = &pool.acquire( leases[2] );
+    EXPECT_NE( first, second );
+    EXPECT_NE( second, third );
+    EXPECT_NE( first, third );
+
+    // a released lease makes its service the least loaded one
+    leases[1] = IoServicePool::Lease();
+    EXPECT_EQ( second, &pool.acquire( leases[3] ) );
+    EXPECT_EQ( 1u, pool.load( 0 ) );
+    EXPECT_EQ( 1u, pool.load( 1 ) );
+    EXPECT_EQ( 1u, pool.load( 2 ) );
+}
+
+TEST( IoServicePoolTest, NextServiceRoundRobins ){
+    IoServicePool pool( IoServicePool::PerCore, 2 );
+    boost::asio::io_service* first = &pool.next_service();
+    boost::asio::io_service* second = &pool.next_service();
+    EXPECT_NE( first, second );
+    EXPECT_EQ( first, &pool.next_service() );
+    EXPECT_EQ( 0u, pool.load( 0 ) );
+}
+
+TEST( IoServicePoolTest, RunsHandlersUntilStopped ){
+    IoServicePool pool( IoServicePool::PerCore, 2 );
+    pool.run();
+    boost::promise<void> done;
+    IoServicePool::Lease lease;
+    pool.acquire( lease ).post( [&done](){ done.set_value(); } );
+    done.get_future().get();
+    pool.stop();
+    pool.join();
+}
+
+} // namespace
@@ -0,0 +1,140 @@
+#include "jamim/Message.hpp"
+#include <benchmark/benchmark.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace
+{
+
+/* what a bot typically pipes into the client */
+const std::vector<std::string>& input_lines()
+{
+    static const std::vector<std::string> lines{
+        "good morning everyone"
+      , "-send /home/user/reports/weekly.pdf"
+      , "did anyone see the build results?"
+      , "-cancel"
+      , "-send /tmp/a.log"
+      , "-cancel-all"
+      , "-unknown"
+      , "-quit" };
+    return lines;
+}
+
+/* the substr + unordered_map parser previously used by command_from_string */
+const std::unordered_map<std::string, MessageType> s_command_map{
+        { "quit"        , MessageType::CmdQuit }
+    ,   { "send"        , MessageType::CmdStartFile }
+    ,   { "cancel"      , MessageType::CmdCancelCurrent }
+    ,   { "cancel-all"  , MessageType::CmdCancelAll }
+    };
+
+Message legacy_command_from_string( const std::string& str )
+{
+    std::string::size_type cmd_end = str.find( ' ' ) - 1;
+    if( cmd_end == std::string::npos ){
+        cmd_end = str.size()-1;
+    }
+
+    auto it_cmd = s_command_map.find( str.substr( 1, cmd_end ) );
+    MessageType cmd_type = ( it_cmd != s_command_map.end() ) ? it_cmd->second
+                                                            : MessageType::Unknown;
+    if( cmd_type == MessageType::CmdStartFile ){
+        return Message( cmd_type, str.substr( cmd_end+2 ) );
+    }
+    else if( cmd_type == MessageType::CmdQuit ){
+        return Message( cmd_type, QUIT_MSG );
+    }
+    else{
+        return Message( cmd_type, MessageSize::Empty );
+    }
+}
+
+Message legacy_message_from_string( const std::string& str )
+{
+    if( str.empty() ){
+        return Message( MessageType::EmptyMsg, MessageSize::Empty );
+    }
+    if( str.front() == '-' ){
+        return legacy_command_from_string( str );
+    }
+    return Message( MessageType::ChatMsg, str );
+}
+
+
+void BM_ParseLegacy( benchmark::State& state )
+{
+    const std::vector<std::string>& lines = input_lines();
+    std::size_t i = 0;
+    for( auto _ : state ){
+        Message msg = legacy_message_from_string( lines[i++ % lines.size()] );
+        benchmark::DoNotOptimize( msg.data() );
+    }
+    state.SetItemsProcessed( state.iterations() );
+}
+BENCHMARK( BM_ParseLegacy );
+
+void BM_ParseStringView( benchmark::State& state )
+{
+    const std::vector<std::string>& lines = input_lines();
+    std::size_t i = 0;
+    for( auto _ : state ){
+        Message msg = message_from_string( lines[i++ % lines.size()] );
+        benchmark::DoNotOptimize( msg.data() );
+    }
+    state.SetItemsProcessed( state.iterations() );
+}
+BENCHMARK( BM_ParseStringView );
+
+void BM_ParseCommandOnly( benchmark::State& state )
+{
+    const std::string line{ "-cancel-all" };
+    for( auto _ : state ){
+        Message msg = command_from_string( line );
+        benchmark::DoNotOptimize( msg.data() );
+    }
+    state.SetItemsProcessed( state.iterations() );
+}
+BENCHMARK( BM_ParseCommandOnly );
+
+void BM_MessageConstruct( benchmark::State& state )
+{
+    const std::string line( state.range(0), 'x' );
+    for( auto _ : state ){
+        Message msg( MessageType::ChatMsg, line );
+        benchmark::DoNotOptimize( msg.data() );
+    }
+    state.SetBytesProcessed( state.iterations() * line.size() );
+}
+BENCHMARK( BM_MessageConstruct )->Arg( 16 )->Arg( 100 )->Arg( 1000 )->Arg( 60000 );
+
+/* the read path of Client::handle_file_send_start: header bytes land in
+ * the frame, sync() sizes it for the body */
+void BM_MessageSync( benchmark::State& state )
+{
+    const Message frame = message_from_string( std::string( state.range(0), 'x' ) );
+    for( auto _ : state ){
+        Message msg;
+        std::copy( frame.data(), frame.data() + frame.header_length(), msg.data() );
+        msg.sync();
+        benchmark::DoNotOptimize( msg.data() );
+    }
+    state.SetItemsProcessed( state.iterations() );
+}
+BENCHMARK( BM_MessageSync )->Arg( 16 )->Arg( 1000 );
+
+void BM_MakeFileMessage( benchmark::State& state )
+{
+    const std::string path{ "/home/user/reports/weekly.pdf" };
+    uint32_t size = 0;
+    for( auto _ : state ){
+        Message msg = make_file_message( ++size, path );
+        benchmark::DoNotOptimize( msg.data() );
+    }
+    state.SetItemsProcessed( state.iterations() );
+}
+BENCHMARK( BM_MakeFileMessage );
+
+} // namespace
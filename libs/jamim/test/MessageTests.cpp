@@ -1,281 +1,468 @@
-#include "jamim/Message.hpp"
-#include <gtest/gtest.h>
-#include <algorithm>
-
-
-namespace
-{
-
-class MessageHeaderTest : public ::testing::Test
-{
-public:
-    MessageHeaderTest()
-        : mh1_( MessageType::ChatMsg, MessageSize::Default )
-        { }
-
-    MessageHeader mh1_;
-};
-
-TEST( MessageHeaderConstrucor, DefaultConstructor ){
-    MessageHeader mh1( MessageType::ChatMsg, 0 );
-    EXPECT_EQ( MessageHeader::HeaderLength, mh1.length() );
-    EXPECT_EQ( MessageType::ChatMsg, mh1.msg_type() );
-    EXPECT_EQ( 0, mh1.msg_length() );
-
-    MessageHeader mh2( MessageType::ChatMsg, 1234 );
-    EXPECT_EQ( MessageHeader::HeaderLength, mh2.length() );
-    EXPECT_EQ( MessageType::ChatMsg, mh2.msg_type() );
-    EXPECT_EQ( 1234, mh2.msg_length() );
-
-    MessageHeader mh3( MessageType::CmdStartFile, 9999 );
-    EXPECT_EQ( MessageHeader::HeaderLength, mh3.length() );
-    EXPECT_EQ( MessageType::CmdStartFile, mh3.msg_type() );
-    EXPECT_EQ( 9999, mh3.msg_length() );
-}
-
-TEST_F( MessageHeaderTest, lengthChangesCorrectly ){
-    EXPECT_EQ( MessageHeader::HeaderLength, mh1_.length() );
-    EXPECT_EQ( MessageType::ChatMsg, mh1_.msg_type() );
-    EXPECT_EQ( MessageSize::Default, mh1_.msg_length() );
-
-    mh1_.msg_length( 0 );
-    EXPECT_EQ( MessageHeader::HeaderLength, mh1_.length() );
-    EXPECT_EQ( MessageType::ChatMsg, mh1_.msg_type() );
-    EXPECT_EQ( 0, mh1_.msg_length() );
-
-    mh1_.msg_length( 1 );
-    EXPECT_EQ( MessageHeader::HeaderLength, mh1_.length() );
-    EXPECT_EQ( MessageType::ChatMsg, mh1_.msg_type() );
-    EXPECT_EQ( 1, mh1_.msg_length() );
-
-    mh1_.msg_length( 0xFFFF );
-    EXPECT_EQ( MessageHeader::HeaderLength, mh1_.length() );
-    EXPECT_EQ( MessageType::ChatMsg, mh1_.msg_type() );
-    EXPECT_EQ( 0xFFFF, mh1_.msg_length() );
-}
-
-TEST_F( MessageHeaderTest, typeChangesCorrectly ){
-    EXPECT_EQ( MessageHeader::HeaderLength, mh1_.length() );
-    EXPECT_EQ( MessageSize::Default, mh1_.msg_length() );
-    EXPECT_EQ( MessageType::ChatMsg, mh1_.msg_type() );
-
-    mh1_.msg_type( MessageType::CmdStartFile );
-    EXPECT_EQ( MessageHeader::HeaderLength, mh1_.length() );
-    EXPECT_EQ( MessageSize::Default, mh1_.msg_length() );
-    EXPECT_EQ( MessageType::CmdStartFile, mh1_.msg_type() );
-
-    mh1_.msg_type( MessageType::CmdCancelAll );
-    EXPECT_EQ( MessageHeader::HeaderLength, mh1_.length() );
-    EXPECT_EQ( MessageSize::Default, mh1_.msg_length() );
-    EXPECT_EQ( MessageType::CmdCancelAll, mh1_.msg_type() );
-}
-
-
-class MessageTest : public ::testing::Test
-{
-public:
-    MessageTest()
-        : mh1_( MessageType::ChatMsg, TestMsg.size() )
-        , m1_( mh1_ )
-        , m2_( MessageType::ChatMsg, TestMsg.size() )
-        { }
-    
-    virtual void SetUp()
-    {
-        std::copy( TestMsg.cbegin(), TestMsg.cend(), m1_.msg_body() );
-        std::copy( TestMsg.cbegin(), TestMsg.cend(), m2_.msg_body() );
-    }
-    const std::string TestMsg{ "TEST" };
-    MessageHeader mh1_;
-    Message m1_;
-    Message m2_;
-};
-
-
-TEST_F( MessageTest, Constructors ){
-    EXPECT_EQ( mh1_.msg_length(), m1_.body_length() );
-    EXPECT_EQ( mh1_.msg_length(), m2_.body_length() );
-    EXPECT_EQ( mh1_.msg_type(), m1_.msg_type() );
-    EXPECT_EQ( mh1_.msg_type(), m2_.msg_type() );
-
-    EXPECT_EQ( TestMsg, std::string( m1_.msg_body(), m1_.msg_body() + m1_.body_length() ) );
-    EXPECT_EQ( TestMsg, std::string( m2_.msg_body(), m2_.msg_body() + m2_.body_length() ) );
-}
-
-
-
-TEST_F( MessageTest, MessageBody ){
-    std::vector<boost::uint8_t> TestData( TestMsg.cbegin(), TestMsg.cend() );
-    std::vector<boost::uint8_t> m1_data( m1_.msg_body(), m1_.msg_body() + m1_.body_length() );
-    std::vector<boost::uint8_t> m2_data( m2_.msg_body(), m2_.msg_body() + m2_.body_length() );
-
-    EXPECT_EQ( TestData, m1_data );
-    EXPECT_EQ( TestData, m2_data );
-}
-
-
-TEST( command_from_string_Test, UnknownCommand ){
-    MessageType unknown_msg_type{ MessageType::Unknown };
-    const std::string un1_{"-"};
-    const std::string un2_{"- "};
-    const std::string un3_{"-abc"};
-    const std::string un4_{"-quitabc"};
-    const std::string un5_{"-sendabc/def"};
-
-    EXPECT_EQ( unknown_msg_type, command_from_string(un1_).msg_type() );
-    EXPECT_EQ( unknown_msg_type, command_from_string(un2_).msg_type() );
-    EXPECT_EQ( unknown_msg_type, command_from_string(un3_).msg_type() );
-    EXPECT_EQ( unknown_msg_type, command_from_string(un4_).msg_type() );
-    EXPECT_EQ( unknown_msg_type, command_from_string(un5_).msg_type() );
-}
-
-TEST( command_from_string_Test, quitCommand ){
-    MessageType quit_command{ MessageType::CmdQuit };
-    const std::string quit1_{"-quit"};
-    const std::string quit2_{"-quit "};
-    const std::string quit3_{"-quit ignored/input"};
-
-    Message cmd1_ = command_from_string(quit1_);
-    Message cmd2_ = command_from_string(quit2_);
-    Message cmd3_ = command_from_string(quit3_);
-
-    EXPECT_EQ( quit_command, cmd1_.msg_type() );
-    EXPECT_EQ( quit_command, cmd2_.msg_type() );
-    EXPECT_EQ( quit_command, cmd3_.msg_type() );
-    
-    EXPECT_EQ( QUIT_MSG, std::string( cmd1_.msg_body(), cmd1_.msg_body()
-                                    + cmd1_.body_length() ) );
-    EXPECT_EQ( QUIT_MSG, std::string( cmd2_.msg_body(), cmd2_.msg_body()
-                                    + cmd2_.body_length() ) );
-    EXPECT_EQ( QUIT_MSG, std::string( cmd3_.msg_body(), cmd3_.msg_body()
-                                    + cmd3_.body_length() ) );
-}
-
-TEST( command_from_string_Test, sendCommand ){
-    MessageType send_command{ MessageType::CmdStartFile };
-    const std::string send1_{"-send"};
-    const std::string send2_{"-send "};
-    const std::string send3_{"-send /some/directory/to/file"};
-
-    EXPECT_EQ( send_command, command_from_string(send1_).msg_type() );
-    EXPECT_EQ( send_command, command_from_string(send2_).msg_type() );
-    EXPECT_EQ( send_command, command_from_string(send3_).msg_type() );
-}
-
-TEST( command_from_string_Test, cancelCommand ){
-    MessageType cancel_file_command{ MessageType::CmdCancelCurrent };
-    const std::string cancel1_{"-cancel"};
-    const std::string cancel2_{"-cancel "};
-    const std::string cancel3_{"-cancel ignored/input"};
-
-    EXPECT_EQ( cancel_file_command, command_from_string(cancel1_).msg_type() );
-    EXPECT_EQ( cancel_file_command, command_from_string(cancel2_).msg_type() );
-    EXPECT_EQ( cancel_file_command, command_from_string(cancel3_).msg_type() );
-}
-
-TEST( command_from_string_Test, cancelAllCommand ){
-    MessageType cancel_all_command{ MessageType::CmdCancelAll };
-    const std::string cancelall1_{"-cancel-all"};
-    const std::string cancelall2_{"-cancel-all "};
-    const std::string cancelall3_{"-cancel-all ignored/input"};
-
-    EXPECT_EQ( cancel_all_command, command_from_string(cancelall1_).msg_type() );
-    EXPECT_EQ( cancel_all_command, command_from_string(cancelall2_).msg_type() );
-    EXPECT_EQ( cancel_all_command, command_from_string(cancelall3_).msg_type() );
-}
-
-
-TEST( message_from_string_Test, emptyLineTest ){
-    MessageType empty_msg_type{ MessageType::EmptyMsg };
-    uint16_t expected_msg_size{ 0 };
-    const std::string empty_line{""};
-    
-    Message test_msg = message_from_string(empty_line);
-
-    EXPECT_EQ( empty_msg_type, test_msg.msg_type() );
-    EXPECT_EQ( expected_msg_size, test_msg.body_length() );
-    EXPECT_EQ( MessageHeader::HeaderLength, test_msg.total_length() );
-}
-
-TEST( message_from_string_Test, chatMsgTest ){
-    MessageType chat_msg_type{ MessageType::ChatMsg };
-    const std::string line{"test line"};
-    uint16_t expected_msg_size = static_cast<uint16_t>(line.size());
-
-    Message test_msg = message_from_string( line );
-
-    EXPECT_EQ( chat_msg_type, test_msg.msg_type() );
-    EXPECT_EQ( expected_msg_size, test_msg.body_length() );
-    EXPECT_EQ( line, std::string( test_msg.msg_body(), test_msg.msg_body() 
-                                  + test_msg.body_length()) );
-}
-
-TEST( message_from_string_Test, sendMsgTest ){
-    MessageType send_file_type{ MessageType::CmdStartFile };
-    const std::string file_dir{"/some/file/directory/"};
-    const std::string command{"-send"};
-    const std::string line("-send /some/file/directory/");
-    uint16_t expected_msg_size{ file_dir.size() };
-
-    Message test_msg = message_from_string( line );
-    EXPECT_EQ( send_file_type, test_msg.msg_type() );
-    EXPECT_EQ( expected_msg_size, test_msg.body_length() );
-    EXPECT_EQ( file_dir, std::string( test_msg.msg_body(), test_msg.msg_body() 
-                                      + test_msg.body_length() ) );
-}
-
-TEST( message_from_string_Test, cmdTest ){
-    const std::string cmd_quit{ "-quit" };
-    const std::string cmd_cancel{ "-cancel" };
-    const std::string cmd_cancelall{ "-cancel-all" };
-    uint16_t expected_msg_size( 0 );
-
-    Message msg_quit = message_from_string( cmd_quit );
-    Message msg_cancel = message_from_string( cmd_cancel );
-    Message msg_cancelall = message_from_string( cmd_cancelall );
-
-
-    EXPECT_EQ( MessageType::CmdQuit, msg_quit.msg_type() );
-    EXPECT_EQ( QUIT_MSG.size(), msg_quit.body_length() );
-    
-    EXPECT_EQ( MessageType::CmdCancelCurrent, msg_cancel.msg_type() );
-    EXPECT_EQ( expected_msg_size, msg_cancel.body_length() );
-
-    EXPECT_EQ( MessageType::CmdCancelAll, msg_cancelall.msg_type() );
-    EXPECT_EQ( expected_msg_size, msg_cancelall.body_length() );
-}
-
-TEST( message_from_string_Test, unknownCmdTest ){
-    MessageType unknown_msg_type{ MessageType::Unknown };
-    const std::string un1_{"-"};
-    const std::string un2_{"- "};
-    const std::string un3_{"-abc"};
-    const std::string un4_{"-quitabc"};
-    const std::string un5_{"-sendabc/def"};
-
-    EXPECT_EQ( unknown_msg_type, message_from_string(un1_).msg_type() );
-    EXPECT_EQ( unknown_msg_type, message_from_string(un2_).msg_type() );
-    EXPECT_EQ( unknown_msg_type, message_from_string(un3_).msg_type() );
-    EXPECT_EQ( unknown_msg_type, message_from_string(un4_).msg_type() );
-    EXPECT_EQ( unknown_msg_type, message_from_string(un5_).msg_type() );
-}
-
-
-TEST( make_file_message_Test, ConstructorTest ){
-    uint32_t test_size{12345};
-    const std::string cmd( "-send" );
-    const std::string input_msg_body( "/some/file/dir" );
-    Message input_msg = message_from_string( cmd + " " + input_msg_body );
-    
-    ASSERT_EQ( MessageType::CmdStartFile, input_msg.msg_type() );
-    ASSERT_EQ( input_msg_body, input_msg.body_to_string() );
-    ASSERT_EQ( input_msg_body.size(), input_msg.body_length() );
-
-    Message test_msg = make_file_message( test_size, input_msg );
-    EXPECT_EQ( MessageType::FileStart, test_msg.msg_type() );
-    EXPECT_EQ( input_msg_body, test_msg.body_to_string() );
-    EXPECT_EQ( test_size, test_msg.file_size() );
-}
-
-
-} // namespace
+#include "jamim/Message.hpp"
+#include <gtest/gtest.h>
+#include <algorithm>
+
+
+namespace
+{
+
+class MessageHeaderTest : public ::testing::Test
+{
+public:
+    MessageHeaderTest()
+        : mh1_( MessageType::ChatMsg, MessageSize::Default )
+        { }
+
+    MessageHeader mh1_;
+};
+
+TEST( MessageHeaderConstrucor, DefaultConstructor ){
+    MessageHeader mh1( MessageType::ChatMsg, 0 );
+    EXPECT_EQ( MessageHeader::HeaderLength, mh1.length() );
+    EXPECT_EQ( MessageType::ChatMsg, mh1.msg_type() );
+    EXPECT_EQ( 0, mh1.msg_length() );
+
+    MessageHeader mh2( MessageType::ChatMsg, 1234 );
+    EXPECT_EQ( MessageHeader::HeaderLength, mh2.length() );
+    EXPECT_EQ( MessageType::ChatMsg, mh2.msg_type() );
+    EXPECT_EQ( 1234, mh2.msg_length() );
+
+    MessageHeader mh3( MessageType::CmdStartFile, 9999 );
+    EXPECT_EQ( MessageHeader::HeaderLength, mh3.length() );
+    EXPECT_EQ( MessageType::CmdStartFile, mh3.msg_type() );
+    EXPECT_EQ( 9999, mh3.msg_length() );
+}
+
+TEST_F( MessageHeaderTest, lengthChangesCorrectly ){
+    EXPECT_EQ( MessageHeader::HeaderLength, mh1_.length() );
+    EXPECT_EQ( MessageType::ChatMsg, mh1_.msg_type() );
+    EXPECT_EQ( MessageSize::Default, mh1_.msg_length() );
+
+    mh1_.msg_length( 0 );
+    EXPECT_EQ( MessageHeader::HeaderLength, mh1_.length() );
+    EXPECT_EQ( MessageType::ChatMsg, mh1_.msg_type() );
+    EXPECT_EQ( 0, mh1_.msg_length() );
+
+    mh1_.msg_length( 1 );
+    EXPECT_EQ( MessageHeader::HeaderLength, mh1_.length() );
+    EXPECT_EQ( MessageType::ChatMsg, mh1_.msg_type() );
+    EXPECT_EQ( 1, mh1_.msg_length() );
+
+    mh1_.msg_length( 0xFFFF );
+    EXPECT_EQ( MessageHeader::HeaderLength, mh1_.length() );
+    EXPECT_EQ( MessageType::ChatMsg, mh1_.msg_type() );
+    EXPECT_EQ( 0xFFFF, mh1_.msg_length() );
+}
+
+TEST_F( MessageHeaderTest, typeChangesCorrectly ){
+    EXPECT_EQ( MessageHeader::HeaderLength, mh1_.length() );
+    EXPECT_EQ( MessageSize::Default, mh1_.msg_length() );
+    EXPECT_EQ( MessageType::ChatMsg, mh1_.msg_type() );
+
+    mh1_.msg_type( MessageType::CmdStartFile );
+    EXPECT_EQ( MessageHeader::HeaderLength, mh1_.length() );
+    EXPECT_EQ( MessageSize::Default, mh1_.msg_length() );
+    EXPECT_EQ( MessageType::CmdStartFile, mh1_.msg_type() );
+
+    mh1_.msg_type( MessageType::CmdCancelAll );
+    EXPECT_EQ( MessageHeader::HeaderLength, mh1_.length() );
+    EXPECT_EQ( MessageSize::Default, mh1_.msg_length() );
+    EXPECT_EQ( MessageType::CmdCancelAll, mh1_.msg_type() );
+}
+
+
+TEST( MessageHeaderConstrucor, ExtendedHeader ){
+    MessageHeader mh1( MessageType::ChatMsg, 0x10000 );
+    EXPECT_TRUE( mh1.extended() );
+    EXPECT_EQ( MessageHeader::ExtendedHeaderLength, mh1.length() );
+    EXPECT_EQ( MessageType::ChatMsg, mh1.msg_type() );
+    EXPECT_EQ( 0x10000u, mh1.msg_length() );
+
+    mh1.msg_length( 0xFFFF );
+    EXPECT_FALSE( mh1.extended() );
+    EXPECT_EQ( MessageHeader::HeaderLength, mh1.length() );
+    EXPECT_EQ( 0xFFFFu, mh1.msg_length() );
+
+    MessageHeader mh2( MessageType::FileStart, 0xFFFFFFFF );
+    MessageHeader mh3 = MessageHeader::from_bytes( mh2.data().data() );
+    EXPECT_EQ( MessageType::FileStart, mh3.msg_type() );
+    EXPECT_EQ( 0xFFFFFFFFu, mh3.msg_length() );
+    EXPECT_EQ( MessageHeader::ExtendedHeaderLength
+             , MessageHeader::length_of( mh2.data()[0] ) );
+}
+
+TEST( MessageConstructor, LargeBodyUsesExtendedHeader ){
+    const std::string line( 100000, 'x' );
+    Message msg = message_from_string( line );
+    EXPECT_EQ( MessageType::ChatMsg, msg.msg_type() );
+    EXPECT_EQ( line.size(), msg.body_length() );
+    EXPECT_EQ( MessageHeader::ExtendedHeaderLength, msg.header_length() );
+    EXPECT_EQ( line.size() + MessageHeader::ExtendedHeaderLength, msg.total_length() );
+    EXPECT_EQ( line, msg.body_to_string() );
+    EXPECT_EQ( MessageType::ExtendedFrame, msg.data()[0] );
+}
+
+
+TEST( MessageStorage, SmallFramesStayInline ){
+    BufferPool::reset_stats();
+    Message accept( MessageType::FileAccept, MessageSize::Empty );
+    Message chat = message_from_string( "a short chat line" );
+    Message copy( chat );
+    Message moved( std::move( copy ) );
+    EXPECT_EQ( 0u, BufferPool::stats().heap_allocations );
+    EXPECT_EQ( 0u, BufferPool::stats().pool_allocations );
+
+    EXPECT_EQ( MessageType::FileAccept, accept.msg_type() );
+    EXPECT_EQ( "a short chat line", moved.body_to_string() );
+    EXPECT_EQ( chat.data_to_string(), moved.data_to_string() );
+}
+
+TEST( MessageStorage, LargeFramesSpillAndMove ){
+    const std::string line( 1000, 'x' );
+    Message msg = message_from_string( line );
+    const uint8_t* block = msg.data();
+    Message moved( std::move( msg ) );
+    EXPECT_EQ( block, moved.data() );
+    EXPECT_EQ( line, moved.body_to_string() );
+
+    Message copy;
+    copy = moved;
+    EXPECT_NE( moved.data(), copy.data() );
+    EXPECT_EQ( line, copy.body_to_string() );
+
+    copy.body_length( 4 );
+    EXPECT_EQ( "xxxx", copy.body_to_string() );
+    copy.body_length( 0x10000 );
+    EXPECT_EQ( MessageHeader::ExtendedHeaderLength, copy.header_length() );
+    EXPECT_EQ( "xxxx", std::string( copy.msg_body(), copy.msg_body() + 4 ) );
+    EXPECT_EQ( 0x10000u, copy.body_length() );
+}
+
+
+class MessageTest : public ::testing::Test
+{
+public:
+    MessageTest()
+        : mh1_( MessageType::ChatMsg, TestMsg.size() )
+        , m1_( mh1_ )
+        , m2_( MessageType::ChatMsg, TestMsg.size() )
+        { }
+    
+    virtual void SetUp()
+    {
+        std::copy( TestMsg.cbegin(), TestMsg.cend(), m1_.msg_body() );
+        std::copy( TestMsg.cbegin(), TestMsg.cend(), m2_.msg_body() );
+    }
+    const std::string TestMsg{ "TEST" };
+    MessageHeader mh1_;
+    Message m1_;
+    Message m2_;
+};
+
+
+TEST_F( MessageTest, Constructors ){
+    EXPECT_EQ( mh1_.msg_length(), m1_.body_length() );
+    EXPECT_EQ( mh1_.msg_length(), m2_.body_length() );
+    EXPECT_EQ( mh1_.msg_type(), m1_.msg_type() );
+    EXPECT_EQ( mh1_.msg_type(), m2_.msg_type() );
+
+    EXPECT_EQ( TestMsg, std::string( m1_.msg_body(), m1_.msg_body() + m1_.body_length() ) );
+    EXPECT_EQ( TestMsg, std::string( m2_.msg_body(), m2_.msg_body() + m2_.body_length() ) );
+}
+
+
+
+TEST_F( MessageTest, MessageBody ){
+    std::vector<boost::uint8_t> TestData( TestMsg.cbegin(), TestMsg.cend() );
+    std::vector<boost::uint8_t> m1_data( m1_.msg_body(), m1_.msg_body() + m1_.body_length() );
+    std::vector<boost::uint8_t> m2_data( m2_.msg_body(), m2_.msg_body() + m2_.body_length() );
+
+    EXPECT_EQ( TestData, m1_data );
+    EXPECT_EQ( TestData, m2_data );
+}
+
+
+TEST( command_from_string_Test, UnknownCommand ){
+    MessageType unknown_msg_type{ MessageType::Unknown };
+    const std::string un1_{"-"};
+    const std::string un2_{"- "};
+    const std::string un3_{"-abc"};
+    const std::string un4_{"-quitabc"};
+    const std::string un5_{"-sendabc/def"};
+
+    EXPECT_EQ( unknown_msg_type, command_from_string(un1_).msg_type() );
+    EXPECT_EQ( unknown_msg_type, command_from_string(un2_).msg_type() );
+    EXPECT_EQ( unknown_msg_type, command_from_string(un3_).msg_type() );
+    EXPECT_EQ( unknown_msg_type, command_from_string(un4_).msg_type() );
+    EXPECT_EQ( unknown_msg_type, command_from_string(un5_).msg_type() );
+}
+
+TEST( command_from_string_Test, quitCommand ){
+    MessageType quit_command{ MessageType::CmdQuit };
+    const std::string quit1_{"-quit"};
+    const std::string quit2_{"-quit "};
+    const std::string quit3_{"-quit ignored/input"};
+
+    Message cmd1_ = command_from_string(quit1_);
+    Message cmd2_ = command_from_string(quit2_);
+    Message cmd3_ = command_from_string(quit3_);
+
+    EXPECT_EQ( quit_command, cmd1_.msg_type() );
+    EXPECT_EQ( quit_command, cmd2_.msg_type() );
+    EXPECT_EQ( quit_command, cmd3_.msg_type() );
+    
+    EXPECT_EQ( QUIT_MSG, std::string( cmd1_.msg_body(), cmd1_.msg_body()
+                                    + cmd1_.body_length() ) );
+    EXPECT_EQ( QUIT_MSG, std::string( cmd2_.msg_body(), cmd2_.msg_body()
+                                    + cmd2_.body_length() ) );
+    EXPECT_EQ( QUIT_MSG, std::string( cmd3_.msg_body(), cmd3_.msg_body()
+                                    + cmd3_.body_length() ) );
+}
+
+TEST( command_from_string_Test, sendCommand ){
+    MessageType send_command{ MessageType::CmdStartFile };
+    const std::string send1_{"-send"};
+    const std::string send2_{"-send "};
+    const std::string send3_{"-send /some/directory/to/file"};
+
+    EXPECT_EQ( send_command, command_from_string(send1_).msg_type() );
+    EXPECT_EQ( send_command, command_from_string(send2_).msg_type() );
+    EXPECT_EQ( send_command, command_from_string(send3_).msg_type() );
+
+    EXPECT_EQ( 0u, command_from_string(send1_).body_length() );
+    EXPECT_EQ( 0u, command_from_string(send2_).body_length() );
+    EXPECT_EQ( "/some/directory/to/file", command_from_string(send3_).body_to_string() );
+}
+
+TEST( command_from_string_Test, joinAndPartCommands ){
+    const std::string join1_{"-join"};
+    const std::string join2_{"-join lobby"};
+    const std::string part1_{"-part"};
+    const std::string part2_{"-part ignored/input"};
+
+    EXPECT_EQ( MessageType::CmdJoin, command_from_string(join1_).msg_type() );
+    EXPECT_EQ( MessageType::CmdJoin, command_from_string(join2_).msg_type() );
+    EXPECT_EQ( 0u, command_from_string(join1_).body_length() );
+    EXPECT_EQ( "lobby", command_from_string(join2_).body_to_string() );
+
+    EXPECT_EQ( MessageType::CmdPart, command_from_string(part1_).msg_type() );
+    EXPECT_EQ( MessageType::CmdPart, command_from_string(part2_).msg_type() );
+    EXPECT_EQ( 0u, command_from_string(part2_).body_length() );
+}
+
+TEST( command_from_string_Test, cancelCommand ){
+    MessageType cancel_file_command{ MessageType::CmdCancelCurrent };
+    const std::string cancel1_{"-cancel"};
+    const std::string cancel2_{"-cancel "};
+    const std::string cancel3_{"-cancel ignored/input"};
+
+    EXPECT_EQ( cancel_file_command, command_from_string(cancel1_).msg_type() );
+    EXPECT_EQ( cancel_file_command, command_from_string(cancel2_).msg_type() );
+    EXPECT_EQ( cancel_file_command, command_from_string(cancel3_).msg_type() );
+}
+
+TEST( command_from_string_Test, cancelAllCommand ){
+    MessageType cancel_all_command{ MessageType::CmdCancelAll };
+    const std::string cancelall1_{"-cancel-all"};
+    const std::string cancelall2_{"-cancel-all "};
+    const std::string cancelall3_{"-cancel-all ignored/input"};
+
+    EXPECT_EQ( cancel_all_command, command_from_string(cancelall1_).msg_type() );
+    EXPECT_EQ( cancel_all_command, command_from_string(cancelall2_).msg_type() );
+    EXPECT_EQ( cancel_all_command, command_from_string(cancelall3_).msg_type() );
+}
+
+
+TEST( message_from_string_Test, emptyLineTest ){
+    MessageType empty_msg_type{ MessageType::EmptyMsg };
+    uint16_t expected_msg_size{ 0 };
+    const std::string empty_line{""};
+    
+    Message test_msg = message_from_string(empty_line);
+
+    EXPECT_EQ( empty_msg_type, test_msg.msg_type() );
+    EXPECT_EQ( expected_msg_size, test_msg.body_length() );
+    EXPECT_EQ( MessageHeader::HeaderLength, test_msg.total_length() );
+}
+
+TEST( message_from_string_Test, chatMsgTest ){
+    MessageType chat_msg_type{ MessageType::ChatMsg };
+    const std::string line{"test line"};
+    uint16_t expected_msg_size = static_cast<uint16_t>(line.size());
+
+    Message test_msg = message_from_string( line );
+
+    EXPECT_EQ( chat_msg_type, test_msg.msg_type() );
+    EXPECT_EQ( expected_msg_size, test_msg.body_length() );
+    EXPECT_EQ( line, std::string( test_msg.msg_body(), test_msg.msg_body() 
+                                  + test_msg.body_length()) );
+}
+
+TEST( message_from_string_Test, sendMsgTest ){
+    MessageType send_file_type{ MessageType::CmdStartFile };
+    const std::string file_dir{"/some/file/directory/"};
+    const std::string command{"-send"};
+    const std::string line("-send /some/file/directory/");
+    uint16_t expected_msg_size{ file_dir.size() };
+
+    Message test_msg = message_from_string( line );
+    EXPECT_EQ( send_file_type, test_msg.msg_type() );
+    EXPECT_EQ( expected_msg_size, test_msg.body_length() );
+    EXPECT_EQ( file_dir, std::string( test_msg.msg_body(), test_msg.msg_body() 
+                                      + test_msg.body_length() ) );
+}
+
+TEST( message_from_string_Test, cmdTest ){
+    const std::string cmd_quit{ "-quit" };
+    const std::string cmd_cancel{ "-cancel" };
+    const std::string cmd_cancelall{ "-cancel-all" };
+    uint16_t expected_msg_size( 0 );
+
+    Message msg_quit = message_from_string( cmd_quit );
+    Message msg_cancel = message_from_string( cmd_cancel );
+    Message msg_cancelall = message_from_string( cmd_cancelall );
+
+
+    EXPECT_EQ( MessageType::CmdQuit, msg_quit.msg_type() );
+    EXPECT_EQ( QUIT_MSG.size(), msg_quit.body_length() );
+    
+    EXPECT_EQ( MessageType::CmdCancelCurrent, msg_cancel.msg_type() );
+    EXPECT_EQ( expected_msg_size, msg_cancel.body_length() );
+
+    EXPECT_EQ( MessageType::CmdCancelAll, msg_cancelall.msg_type() );
+    EXPECT_EQ( expected_msg_size, msg_cancelall.body_length() );
+}
+
+TEST( message_from_string_Test, unknownCmdTest ){
+    MessageType unknown_msg_type{ MessageType::Unknown };
+    const std::string un1_{"-"};
+    const std::string un2_{"- "};
+    const std::string un3_{"-abc"};
+    const std::string un4_{"-quitabc"};
+    const std::string un5_{"-sendabc/def"};
+
+    EXPECT_EQ( unknown_msg_type, message_from_string(un1_).msg_type() );
+    EXPECT_EQ( unknown_msg_type, message_from_string(un2_).msg_type() );
+    EXPECT_EQ( unknown_msg_type, message_from_string(un3_).msg_type() );
+    EXPECT_EQ( unknown_msg_type, message_from_string(un4_).msg_type() );
+    EXPECT_EQ( unknown_msg_type, message_from_string(un5_).msg_type() );
+}
+
+
+TEST( make_file_message_Test, ConstructorTest ){
+    uint32_t test_size{12345};
+    const std::string cmd( "-send" );
+    const std::string input_msg_body( "/some/file/dir" );
+    Message input_msg = message_from_string( cmd + " " + input_msg_body );
+    
+    ASSERT_EQ( MessageType::CmdStartFile, input_msg.msg_type() );
+    ASSERT_EQ( input_msg_body, input_msg.body_to_string() );
+    ASSERT_EQ( input_msg_body.size(), input_msg.body_length() );
+
+    Message test_msg = make_file_message( test_size, input_msg );
+    EXPECT_EQ( MessageType::FileStart, test_msg.msg_type() );
+    EXPECT_EQ( input_msg_body, test_msg.body_to_string() );
+    EXPECT_EQ( test_size, test_msg.file_size() );
+}
+
+TEST( make_file_message_Test, SizesPast4GB ){
+    const uint64_t test_size{ 200ull << 30 | 0x12345678 };
+    Message test_msg = make_file_message( test_size, "/some/dataset" );
+    EXPECT_EQ( test_size, test_msg.file_size() );
+    EXPECT_EQ( "/some/dataset", test_msg.body_to_string() );
+
+    const MessageView view( test_msg.data(), test_msg.total_length() );
+    EXPECT_EQ( test_size, view.file_size() );
+    EXPECT_EQ( "/some/dataset", view.body_to_string() );
+}
+
+TEST( make_file_message_Test, CarriesTheTransferId ){
+    const uint64_t test_id{ 0x0123456789abcdefull };
+    Message test_msg = make_file_message( 42, "/some/file", test_id );
+    EXPECT_EQ( 42u, test_msg.file_size() );
+    EXPECT_EQ( test_id, test_msg.transfer_id() );
+    EXPECT_EQ( "/some/file", test_msg.body_to_string() );
+
+    const MessageView view( test_msg.data(), test_msg.total_length() );
+    EXPECT_EQ( test_id, view.transfer_id() );
+    EXPECT_EQ( "/some/file", view.body_to_string() );
+}
+
+TEST( make_file_accept_Test, RoundTrip ){
+    const FileResume resume( 0xfeedull << 40, 5ull << 32 | 7, 0xE3069283 );
+    Message accept = make_file_accept( resume );
+    EXPECT_EQ( MessageType::FileAccept, accept.msg_type() );
+    ASSERT_EQ( static_cast<uint32_t>( FileResume::BodyLength ), accept.body_length() );
+    EXPECT_EQ( resume, file_resume( accept.msg_body(), accept.body_length() ) );
+}
+
+TEST( make_file_accept_Test, EmptyBodyStartsOver ){
+    Message accept( MessageType::FileAccept, MessageSize::Empty );
+    EXPECT_EQ( FileResume(), file_resume( accept.msg_body(), accept.body_length() ) );
+}
+
+TEST( make_file_control_Test, RoundTrip ){
+    const uint64_t test_id{ 0x0123456789abcdefull };
+    Message cancel = make_file_control( MessageType::FileCancel, test_id, "gone" );
+    EXPECT_EQ( MessageType::FileCancel, cancel.msg_type() );
+    EXPECT_EQ( test_id, file_control_id( cancel.msg_body(), cancel.body_length() ) );
+    EXPECT_EQ( "gone", file_control_reason( cancel.msg_body(), cancel.body_length() ) );
+
+    Message done = make_file_control( MessageType::FileDone, 3 );
+    EXPECT_EQ( static_cast<uint32_t>( FileControlLength ), done.body_length() );
+    EXPECT_EQ( 3u, file_control_id( done.msg_body(), done.body_length() ) );
+    EXPECT_EQ( "", file_control_reason( done.msg_body(), done.body_length() ) );
+
+    // too short to name a transfer
+    EXPECT_EQ( 0u, file_control_id( done.msg_body(), 4 ) );
+}
+
+TEST( file_chunk_header_Test, RoundTrip ){
+    uint8_t data[FileChunkHeader::Length];
+    put_file_chunk_header( data, FileChunkHeader( 5ull << 40 | 9, 0x10203 ) );
+    const FileChunkHeader header( file_chunk_header( data ) );
+    EXPECT_EQ( 5ull << 40 | 9, header.transfer_id );
+    EXPECT_EQ( 0x10203u, header.length );
+}
+
+TEST( FileTrailerTest, Length ){
+    EXPECT_EQ( 4u, FileTrailer::length( 0 ) );
+    EXPECT_EQ( 8u, FileTrailer::length( 1 ) );
+    EXPECT_EQ( 8u, FileTrailer::length( FileTrailer::BlockLength ) );
+    EXPECT_EQ( 12u, FileTrailer::length( FileTrailer::BlockLength + 1 ) );
+}
+
+TEST( make_file_resend_Test, RoundTrip ){
+    const std::vector< FileRange > ranges{ FileRange( 5ull << 32, 262144 )
+                                         , FileRange( 0, 17 ) };
+    Message msg( make_file_resend( 42, ranges ) );
+    EXPECT_EQ( MessageType::FileResend, msg.msg_type() );
+    // the server fills in the reader
+    put_uint64( msg.msg_body() + ResendRequest::ReaderOffset, 7 );
+
+    const ResendRequest resend( file_resend( msg.msg_body(), msg.body_length() ) );
+    EXPECT_EQ( 42u, resend.transfer_id );
+    EXPECT_EQ( 7u, resend.reader );
+    ASSERT_EQ( 2u, resend.ranges.size() );
+    EXPECT_EQ( 5ull << 32, resend.ranges[0].offset );
+    EXPECT_EQ( 262144u, resend.ranges[0].length );
+    EXPECT_EQ( 0u, resend.ranges[1].offset );
+    EXPECT_EQ( 17u, resend.ranges[1].length );
+}
+
+TEST( make_file_repair_Test, RoundTrip ){
+    // past the compact header limit
+    const std::string data( 70000, 'r' );
+    Message msg( make_file_repair( 42, 7, 3ull << 32, data.data(), data.size() ) );
+    EXPECT_EQ( MessageType::FileRepair, msg.msg_type() );
+
+    const RepairChunk repair( file_repair( msg.msg_body(), msg.body_length() ) );
+    EXPECT_EQ( 42u, repair.transfer_id );
+    EXPECT_EQ( 7u, repair.reader );
+    EXPECT_EQ( 3ull << 32, repair.offset );
+    ASSERT_EQ( data.size(), repair.length );
+    EXPECT_EQ( data, std::string( repair.data, repair.data + repair.length ) );
+}
+
+
+} // namespace
@@ -0,0 +1,179 @@
+#include "jamim/OutboundQueue.hpp"
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+
+namespace
+{
+
+typedef OutboundQueue< std::vector<char> >  ChunkQueue;
+typedef OutboundQueue< ptr_Message >        FrameQueue;
+
+std::vector<char> chunk( std::size_t size, char fill )
+{
+    return std::vector<char>( size, fill );
+}
+
+TEST( OutboundQueueTest, DropOldestKeepsTheFrameInFlight ){
+    OverflowStats stats;
+    ChunkQueue queue;
+    queue.configure( QueueLimits( 3, 1024, QueueLimits::DropOldest ), nullptr, &stats );
+    EXPECT_EQ( ChunkQueue::Queued, queue.push( chunk( 1, 'a' ), 0 ) );
+    EXPECT_EQ( ChunkQueue::Queued, queue.push( chunk( 1, 'b' ), 1 ) );
+    EXPECT_EQ( ChunkQueue::Queued, queue.push( chunk( 1, 'c' ), 1 ) );
+    EXPECT_EQ( ChunkQueue::Queued, queue.push( chunk( 1, 'd' ), 1 ) );
+
+    ASSERT_EQ( 3u, queue.size() );
+    std::string order;
+    for( const auto& c : queue ){
+        order += c.front();
+    }
+    EXPECT_EQ( "acd", order );
+    EXPECT_EQ( 1u, stats.dropped( QueueLimits::DropOldest ) );
+}
+
+TEST( OutboundQueueTest, DropNewCapsBytes ){
+    OverflowStats stats;
+    ChunkQueue queue;
+    queue.configure( QueueLimits( 100, 10, QueueLimits::DropNew ), nullptr, &stats );
+    EXPECT_EQ( ChunkQueue::Queued, queue.push( chunk( 8, 'a' ), 0 ) );
+    EXPECT_EQ( ChunkQueue::Dropped, queue.push( chunk( 4, 'b' ), 1 ) );
+    EXPECT_EQ( ChunkQueue::Queued, queue.push( chunk( 2, 'c' ), 1 ) );
+    EXPECT_EQ( 10u, queue.bytes() );
+    EXPECT_EQ( 1u, stats.dropped( QueueLimits::DropNew ) );
+
+    queue.pop_front();
+    EXPECT_EQ( 2u, queue.bytes() );
+}
+
+TEST( OutboundQueueTest, CoalesceJoinsChatLines ){
+    OverflowStats stats;
+    FrameQueue queue;
+    queue.configure( QueueLimits( 2, 1024, QueueLimits::Coalesce ), nullptr, &stats );
+    queue.push( make_shared_message( message_from_string( "one" ) ), 0 );
+    queue.push( make_shared_message( message_from_string( "two" ) ), 1 );
+    EXPECT_EQ( FrameQueue::Queued
+             , queue.push( make_shared_message( message_from_string( "three" ) ), 1 ) );
+
+    ASSERT_EQ( 2u, queue.size() );
+    EXPECT_EQ( "one", queue.front()->body_to_string() );
+    EXPECT_EQ( "two\nthree", ( *( queue.begin() + 1 ) )->body_to_string() );
+    EXPECT_EQ( 1u, stats.coalesced() );
+
+    // the frame in flight is never merged into
+    FrameQueue single;
+    single.configure( QueueLimits( 1, 1024, QueueLimits::Coalesce ), nullptr, &stats );
+    single.push( make_shared_message( message_from_string( "one" ) ), 0 );
+    EXPECT_EQ( FrameQueue::Dropped
+             , single.push( make_shared_message( message_from_string( "two" ) ), 1 ) );
+    EXPECT_EQ( 1u, stats.dropped( QueueLimits::Coalesce ) );
+}
+
+TEST( OutboundQueueTest, DisconnectAfterGrace ){
+    OverflowStats stats;
+    ChunkQueue queue;
+    queue.configure( QueueLimits( 1, 1024, QueueLimits::Disconnect
+                                , std::chrono::milliseconds( 100 ) )
+                   , nullptr, &stats );
+    const ChunkQueue::clock::time_point start = ChunkQueue::clock::now();
+    queue.push( chunk( 1, 'a' ), 0, start );
+    EXPECT_EQ( ChunkQueue::Dropped, queue.push( chunk( 1, 'b' ), 1, start ) );
+    EXPECT_EQ( ChunkQueue::Dropped
+             , queue.push( chunk( 1, 'c' ), 1, start + std::chrono::milliseconds( 50 ) ) );
+    EXPECT_EQ( ChunkQueue::Disconnect
+             , queue.push( chunk( 1, 'd' ), 1, start + std::chrono::milliseconds( 100 ) ) );
+    EXPECT_EQ( 3u, stats.dropped( QueueLimits::Disconnect ) );
+    EXPECT_EQ( 1u, stats.disconnects() );
+
+    // draining restarts the grace period
+    queue.pop_front();
+    const ChunkQueue::clock::time_point later = start + std::chrono::seconds( 1 );
+    EXPECT_EQ( ChunkQueue::Queued, queue.push( chunk( 1, 'e' ), 0, later ) );
+    EXPECT_EQ( ChunkQueue::Dropped, queue.push( chunk( 1, 'f' ), 1, later ) );
+}
+
+TEST( OutboundQueueTest, SharedBudgetAcrossQueues ){
+    MemoryBudget budget( 10 );
+    {
+        ChunkQueue first, second;
+        first.configure( QueueLimits( 100, 100, QueueLimits::DropNew ), &budget );
+        second.configure( QueueLimits( 100, 100, QueueLimits::DropNew ), &budget );
+        EXPECT_EQ( ChunkQueue::Queued, first.push( chunk( 6, 'a' ), 0 ) );
+        EXPECT_EQ( ChunkQueue::Dropped, second.push( chunk( 6, 'b' ), 0 ) );
+        EXPECT_EQ( ChunkQueue::Queued, second.push( chunk( 4, 'c' ), 0 ) );
+        EXPECT_EQ( 10u, budget.used() );
+    }
+    EXPECT_EQ( 0u, budget.used() );
+}
+
+/* DropOldest makes room within its own caps only; a budget used up by
+ * another queue drops the new frame, not this queue's frames */
+TEST( OutboundQueueTest, DropOldestLeavesTheBudgetToOthers ){
+    MemoryBudget budget( 10 );
+    {
+        ChunkQueue mine, other;
+        mine.configure( QueueLimits( 3, 100, QueueLimits::DropOldest ), &budget );
+        other.configure( QueueLimits( 100, 100, QueueLimits::DropNew ), &budget );
+        EXPECT_EQ( ChunkQueue::Queued, mine.push( chunk( 1, 'a' ), 0 ) );
+        EXPECT_EQ( ChunkQueue::Queued, mine.push( chunk( 1, 'b' ), 0 ) );
+        EXPECT_EQ( ChunkQueue::Queued, other.push( chunk( 8, 'x' ), 0 ) );
+
+        EXPECT_EQ( ChunkQueue::Dropped, mine.push( chunk( 4, 'c' ), 0 ) );
+        EXPECT_EQ( 2u, mine.size() );
+        // at its cap it drops its oldest, as much as its own caps need
+        EXPECT_EQ( ChunkQueue::Queued, mine.push( chunk( 0, 'd' ), 0 ) );
+        EXPECT_EQ( ChunkQueue::Queued, mine.push( chunk( 1, 'e' ), 0 ) );
+        ASSERT_EQ( 3u, mine.size() );
+        EXPECT_EQ( 'b', mine.front().front() );
+        EXPECT_EQ( 10u, budget.used() );
+    }
+    EXPECT_EQ( 0u, budget.used() );
+}
+
+/* file control frames are queued past the caps and outlive DropOldest */
+TEST( OutboundQueueTest, FileControlIsPinned ){
+    MemoryBudget budget;
+    {
+        FrameQueue queue;
+        queue.configure( QueueLimits( 2, 1024, QueueLimits::DropOldest ), &budget );
+        EXPECT_EQ( FrameQueue::Queued, queue.push( make_shared_message(
+            make_file_control( MessageType::FileCancel, 1, "" ) ), 0 ) );
+        EXPECT_EQ( FrameQueue::Queued, queue.push( make_shared_message(
+            message_from_string( "a" ) ), 0 ) );
+        EXPECT_EQ( FrameQueue::Queued, queue.push( make_shared_message(
+            make_file_control( MessageType::FileDone, 2, "" ) ), 0 ) );
+        EXPECT_EQ( FrameQueue::Dropped, queue.push( make_shared_message(
+            message_from_string( "b" ) ), 0 ) );
+
+        std::vector<MessageType> types;
+        for( const auto& msg : queue ){
+            types.push_back( msg->msg_type() );
+        }
+        EXPECT_EQ( ( std::vector<MessageType>{ MessageType::FileCancel
+                                             , MessageType::FileDone } ), types );
+        EXPECT_EQ( queue.bytes(), budget.used() );
+    }
+    EXPECT_EQ( 0u, budget.used() );
+}
+
+/* offer() refuses what does not fit and leaves the queued frames alone */
+TEST( OutboundQueueTest, OfferNeverDrops ){
+    OverflowStats stats;
+    ChunkQueue queue;
+    queue.configure( QueueLimits( 100, 10, QueueLimits::DropOldest ), nullptr, &stats );
+    EXPECT_EQ( ChunkQueue::Queued, queue.offer( chunk( 6, 'a' ), 0 ) );
+    EXPECT_EQ( ChunkQueue::Dropped, queue.offer( chunk( 6, 'b' ), 0 ) );
+    EXPECT_EQ( ChunkQueue::Queued, queue.offer( chunk( 4, 'c' ), 0 ) );
+    ASSERT_EQ( 2u, queue.size() );
+    EXPECT_EQ( 'a', queue.front().front() );
+    EXPECT_EQ( 1u, stats.dropped( QueueLimits::DropOldest ) );
+
+    queue.clear();
+    queue.configure( QueueLimits( 100, 10, QueueLimits::Disconnect ), nullptr, &stats );
+    EXPECT_EQ( ChunkQueue::Queued, queue.offer( chunk( 6, 'a' ), 0 ) );
+    EXPECT_EQ( ChunkQueue::Disconnect, queue.offer( chunk( 6, 'b' ), 0 ) );
+    EXPECT_EQ( 1u, stats.disconnects() );
+}
+
+} // namespace
@@ -0,0 +1,86 @@
+#include "jamim/ParticipantRegistry.hpp"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+#include <boost/thread.hpp>
+
+
+namespace
+{
+
+TEST( ParticipantRegistryTest, InsertAndEraseAreIdempotent ){
+    ParticipantRegistry< int > registry;
+    EXPECT_TRUE( registry.insert( 1, 1 ) );
+    EXPECT_TRUE( registry.insert( 2, 2 ) );
+    EXPECT_FALSE( registry.insert( 1, 1 ) );
+    EXPECT_EQ( 2u, registry.size() );
+
+    EXPECT_TRUE( registry.erase( 1 ) );
+    EXPECT_FALSE( registry.erase( 1 ) );
+    ASSERT_EQ( 1u, registry.size() );
+    EXPECT_EQ( 2, *registry.snapshot()->begin() );
+}
+
+TEST( ParticipantRegistryTest, SnapshotIsUnaffectedByLaterWrites ){
+    ParticipantRegistry< int > registry;
+    registry.insert( 1, 1 );
+    registry.insert( 2, 2 );
+
+    const ParticipantRegistry< int >::snapshot_type before( registry.snapshot() );
+    registry.erase( 1 );
+    registry.insert( 3, 3 );
+
+    EXPECT_EQ( ( std::vector<int>{ 1, 2 } )
+             , std::vector<int>( before->begin(), before->end() ) );
+    EXPECT_EQ( ( std::vector<int>{ 2, 3 } )
+             , std::vector<int>( registry.snapshot()->begin(), registry.snapshot()->end() ) );
+    ASSERT_NE( nullptr, before->find( 1 ) );
+    EXPECT_EQ( nullptr, registry.snapshot()->find( 1 ) );
+}
+
+/* Readers walk snapshots while writers churn the set. Id 0 is never
+ * removed and every snapshot must be internally consistent. */
+TEST( ParticipantRegistryTest, ConcurrentReadersSeeConsistentSnapshots ){
+    ParticipantRegistry< int > registry;
+    registry.insert( 0, 0 );
+    std::atomic<bool> stop( false );
+    std::atomic<std::size_t> bad( 0 );
+
+    boost::thread_group readers;
+    for( int r = 0; r < 2; ++r ){
+        readers.create_thread( [&](){
+            while( !stop ){
+                auto snapshot = registry.snapshot();
+                if( !snapshot->contains( 0 ) || snapshot->size() != snapshot->ids().size() ){
+                    ++bad;
+                }
+                std::vector<int> sorted( snapshot->begin(), snapshot->end() );
+                std::sort( sorted.begin(), sorted.end() );
+                if( std::adjacent_find( sorted.begin(), sorted.end() ) != sorted.end() ){
+                    ++bad;
+                }
+            }
+        } );
+    }
+
+    boost::thread_group writers;
+    for( int w = 0; w < 2; ++w ){
+        writers.create_thread( [&registry,w](){
+            for( int i = 0; i < 2000; ++i ){
+                const int value = 1 + w * 10 + i % 10;
+                registry.insert( value, value );
+                registry.erase( value );
+            }
+        } );
+    }
+    writers.join_all();
+    stop = true;
+    readers.join_all();
+
+    EXPECT_EQ( 0u, bad.load() );
+    EXPECT_EQ( ( std::vector<int>{ 0 } )
+             , std::vector<int>( registry.snapshot()->begin(), registry.snapshot()->end() ) );
+}
+
+} // namespace
@@ -0,0 +1,105 @@
+#include "jamim/ParticipantTable.hpp"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <vector>
+
+
+namespace
+{
+
+TEST( ParticipantTableTest, InsertFindErase ){
+    ParticipantTable< int > table;
+    EXPECT_TRUE( table.insert( 10, 1 ) );
+    EXPECT_TRUE( table.insert( 20, 2 ) );
+    EXPECT_FALSE( table.insert( 10, 3 ) );
+    ASSERT_EQ( 2u, table.size() );
+
+    ASSERT_NE( nullptr, table.find( 10 ) );
+    EXPECT_EQ( 1, *table.find( 10 ) );
+    EXPECT_EQ( nullptr, table.find( 30 ) );
+
+    EXPECT_TRUE( table.erase( 10 ) );
+    EXPECT_FALSE( table.erase( 10 ) );
+    EXPECT_FALSE( table.contains( 10 ) );
+    EXPECT_EQ( 1u, table.size() );
+}
+
+/* erase fills the hole with the last value, ids and values stay paired */
+TEST( ParticipantTableTest, EraseKeepsValuesPacked ){
+    ParticipantTable< int > table;
+    for( int i=0; i<5; ++i ){
+        table.insert( 100 + i, i );
+    }
+    table.erase( 101 );
+    table.erase( 100 );
+
+    ASSERT_EQ( 3u, table.size() );
+    std::vector<int> values( table.begin(), table.end() );
+    std::sort( values.begin(), values.end() );
+    EXPECT_EQ( ( std::vector<int>{ 2, 3, 4 } ), values );
+    for( std::size_t i=0; i<table.size(); ++i ){
+        const ParticipantId id = table.ids()[i];
+        ASSERT_NE( nullptr, table.find( id ) );
+        EXPECT_EQ( static_cast<int>( id - 100 ), *table.find( id ) );
+    }
+}
+
+TEST( ParticipantTableTest, IdsAreSixtyFourBit ){
+    ParticipantTable< int > table;
+    const ParticipantId big = 0x100000001ull;
+    table.insert( big, 1 );
+    table.insert( 1, 2 );
+    EXPECT_EQ( 1, *table.find( big ) );
+    EXPECT_EQ( 2, *table.find( 1 ) );
+}
+
+/* erase across block and page boundaries, down to an empty table */
+TEST( ParticipantTableTest, EraseAcrossBlocksAndPages ){
+    typedef ParticipantTable< int > Table;
+    const int count = Table::BlockSize * 3 + 7;
+    Table table;
+    for( int i=0; i<count; ++i ){
+        table.insert( ParticipantId( i ) * ( Table::PageSize / 2 + 1 ), i );
+    }
+    for( int i=0; i<count; i+=2 ){
+        EXPECT_TRUE( table.erase( ParticipantId( i ) * ( Table::PageSize / 2 + 1 ) ) );
+    }
+    ASSERT_EQ( std::size_t( count / 2 ), table.size() );
+    for( int i=1; i<count; i+=2 ){
+        const int* value = table.find( ParticipantId( i ) * ( Table::PageSize / 2 + 1 ) );
+        ASSERT_NE( nullptr, value );
+        EXPECT_EQ( i, *value );
+    }
+    for( int i=1; i<count; i+=2 ){
+        table.erase( ParticipantId( i ) * ( Table::PageSize / 2 + 1 ) );
+    }
+    EXPECT_TRUE( table.empty() );
+    EXPECT_EQ( table.begin(), table.end() );
+}
+
+/* copies share storage, but a write to one never shows in the other */
+TEST( ParticipantTableTest, CopiesAreIndependent ){
+    ParticipantTable< int > table;
+    for( int i=0; i<300; ++i ){
+        table.insert( i, i );
+    }
+    const ParticipantTable< int > before( table );
+    table.erase( 5 );
+    table.insert( 1000, 1000 );
+    *table.find( 7 ) = -7;
+
+    ASSERT_EQ( 300u, before.size() );
+    EXPECT_EQ( 5, *before.find( 5 ) );
+    EXPECT_EQ( 7, *before.find( 7 ) );
+    EXPECT_FALSE( before.contains( 1000 ) );
+    int expected = 0;
+    for( int value : before ){
+        EXPECT_EQ( expected++, value );
+    }
+
+    EXPECT_FALSE( table.contains( 5 ) );
+    EXPECT_EQ( -7, *table.find( 7 ) );
+    EXPECT_EQ( 1000, *table.find( 1000 ) );
+}
+
+} // namespace
@@ -0,0 +1,109 @@
+#include "jamim/Server.hpp"
+#include <benchmark/benchmark.h>
+#include <vector>
+
+
+namespace
+{
+
+/* Participant with an unbounded queue that is drained by the benchmark,
+ * so only the room's fan-out is measured */
+class BenchParticipant : public ChatParticipant
+{
+public:
+    BenchParticipant( ParticipantId id )
+        : ChatParticipant( id )
+        { }
+
+    void deliver( ptr_Message msg ) override
+        { queue_.push_back( std::move( msg ) ); }
+    void file_accepted( const Message&, ptr_ChatParticipant ) override { }
+    void file_refused( const Message&, ptr_ChatParticipant ) override { }
+    bool file_deliver( const std::vector<char>& data
+                     , const ptr_TransferWindow& ) override
+        { file_bytes_ += data.size(); return true; }
+    void file_msg_deliver( ptr_Message msg ) override
+        { queue_.push_back( std::move( msg ) ); }
+    void file_responses_remaining( uint64_t, std::size_t ) override { }
+
+    std::vector<ptr_Message>    queue_;
+    std::size_t                 file_bytes_ = 0;
+};
+
+typedef std::shared_ptr< BenchParticipant >     ptr_BenchParticipant;
+
+std::vector<ptr_BenchParticipant> fill_room( ChatRoom& room, std::size_t count )
+{
+    std::vector<ptr_BenchParticipant> participants;
+    for( std::size_t i=0; i<count; ++i ){
+        participants.push_back( std::make_shared<BenchParticipant>( i ) );
+        room.join( participants.back() );
+    }
+    return participants;
+}
+
+
+/* range(0): participants, range(1): chat line length */
+void BM_RoomDeliver( benchmark::State& state )
+{
+    boost::asio::io_service io_service;
+    ChatRoom room( io_service, io_service );
+    std::vector<ptr_BenchParticipant> participants = fill_room( room, state.range(0) );
+    const Message msg = message_from_string( std::string( state.range(1), 'x' ) );
+
+    for( auto _ : state ){
+        room.deliver( msg, participants.front() );
+        state.PauseTiming();
+        for( auto& p : participants ){
+            p->queue_.clear();
+        }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed( state.iterations() * ( state.range(0) - 1 ) );
+}
+BENCHMARK( BM_RoomDeliver )
+    ->Args( {2, 64} )->Args( {8, 64} )->Args( {64, 64} )->Args( {256, 64} )
+    ->Args( {16384, 64} )
+    ->Args( {64, 4096} );
+
+/* range(0): readers, range(1): chunk size */
+void BM_RoomFileDeliver( benchmark::State& state )
+{
+    boost::asio::io_service io_service;
+    ChatRoom room( io_service, io_service );
+    std::vector<ptr_BenchParticipant> participants = fill_room( room, state.range(0) + 1 );
+    const ptr_BenchParticipant sender = participants.front();
+    room.file_awaiting( make_file_message( 1 << 30, "/some/file", 1 ), sender );
+    for( auto& p : participants ){
+        p->queue_.clear();
+    }
+    std::vector<char> chunk( FileChunkHeader::Length + state.range(1), 'x' );
+    put_file_chunk_header( reinterpret_cast<uint8_t*>( chunk.data() )
+                         , FileChunkHeader( 1, state.range(1) ) );
+
+    for( auto _ : state ){
+        room.file_deliver( 1, chunk );
+    }
+    state.SetBytesProcessed( state.iterations() * state.range(0) * state.range(1) );
+}
+BENCHMARK( BM_RoomFileDeliver )
+    ->Args( {1, 4096} )->Args( {8, 4096} )->Args( {8, 65536} );
+
+/* range(0): participants already in the room */
+void BM_RoomJoinLeave( benchmark::State& state )
+{
+    boost::asio::io_service io_service;
+    ChatRoom room( io_service, io_service );
+    std::vector<ptr_BenchParticipant> participants = fill_room( room, state.range(0) );
+    const auto visitor = std::make_shared<BenchParticipant>( state.range(0) );
+
+    for( auto _ : state ){
+        room.join( visitor );
+        room.leave( visitor );
+    }
+    state.SetItemsProcessed( state.iterations() * 2 );
+}
+BENCHMARK( BM_RoomJoinLeave )
+    ->Arg( 64 )->Arg( 16384 )->Arg( 65536 );
+
+} // namespace
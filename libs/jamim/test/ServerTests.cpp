@@ -1,12 +1,632 @@
-#include "jamim/Server.hpp"
-#include <gtest/gtest.h>
-
-
-namespace
-{
-
-TEST(ServerTest, Constructor){
-    SUCCEED();
-}
-
-} // namespace
+#include "jamim/Server.hpp"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <sys/socket.h>
+#include <unistd.h>
+#endif /* __linux__ */
+
+
+namespace
+{
+
+class MockParticipant : public ChatParticipant
+{
+public:
+    MockParticipant( ParticipantId id )
+        : ChatParticipant( id )
+        { }
+
+    void deliver( ptr_Message msg ) override
+        { delivered_.push_back( msg ); }
+    void file_accepted( const Message&, ptr_ChatParticipant ) override { }
+    void file_refused( const Message& msg, ptr_ChatParticipant ) override
+        { refused_.push_back( file_control_id( msg.msg_body(), msg.body_length() ) ); }
+    bool file_deliver( const std::vector<char>& frame
+                     , const ptr_TransferWindow& ) override
+        {
+            if( frames_.size() == frame_room_ ){
+                return false;
+            }
+            frames_.push_back( frame );
+            return true;
+        }
+    void file_msg_deliver( ptr_Message msg ) override
+        { delivered_.push_back( msg ); }
+    void file_responses_remaining( uint64_t, std::size_t ) override { }
+    void file_reader_left( uint64_t transfer_id, ParticipantId reader ) override
+        {
+            left_.push_back( std::make_pair( transfer_id, reader ) );
+            if( window_ ){
+                window_->remove_reader( reader );
+            }
+        }
+    void file_cancelled( uint64_t transfer_id ) override
+        { cancelled_.push_back( transfer_id ); }
+
+    std::vector<ptr_Message>    delivered_;
+    std::vector< std::vector<char> >    frames_;
+    std::vector< std::pair<uint64_t, ParticipantId> >   left_;
+    std::vector<uint64_t>       refused_;
+    std::vector<uint64_t>       cancelled_;
+    // frames taken before refusing any more
+    std::size_t                 frame_room_ = std::size_t( -1 );
+    // the window of the file this one sends, as a sending session has it
+    ptr_TransferWindow          window_;
+};
+
+std::vector<char> chunk_frame( uint64_t transfer_id, const std::string& bytes )
+{
+    std::vector<char> frame( FileChunkHeader::Length + bytes.size() );
+    put_file_chunk_header( reinterpret_cast<uint8_t*>( frame.data() )
+                         , FileChunkHeader( transfer_id, bytes.size() ) );
+    std::copy( bytes.begin(), bytes.end(), frame.begin() + FileChunkHeader::Length );
+    return frame;
+}
+
+/* `accepted` becomes the other end of `client` */
+void connect_pair( boost::asio::io_service& io_service
+                 , boost::asio::ip::tcp::socket& client
+                 , boost::asio::ip::tcp::socket& accepted )
+{
+    using boost::asio::ip::tcp;
+    tcp::acceptor acceptor( io_service
+                          , tcp::endpoint( boost::asio::ip::address_v4::loopback(), 0 ) );
+    client.connect( acceptor.local_endpoint() );
+    acceptor.accept( accepted );
+}
+
+/* the types of the frames waiting on `socket` */
+std::vector<MessageType> frame_types( boost::asio::ip::tcp::socket& socket )
+{
+    std::vector<uint8_t> bytes( socket.available() );
+    boost::asio::read( socket, boost::asio::buffer( bytes ) );
+    std::vector<MessageType> types;
+    for( std::size_t at = 0; at < bytes.size(); ){
+        const MessageHeader header( MessageHeader::from_bytes( &bytes[at] ) );
+        types.push_back( header.msg_type() );
+        at += header.length() + header.msg_length()
+            + ( header.msg_type() == MessageType::FileStart ? MessageView::FileInfoLength
+                                                            : 0 );
+    }
+    return types;
+}
+
+TEST(ServerTest, Constructor){
+    SUCCEED();
+}
+
+TEST( ChatRoomTest, DeliverSharesOneFrame ){
+    boost::asio::io_service io_service;
+    ChatRoom room( io_service, io_service );
+    std::vector< std::shared_ptr<MockParticipant> > participants;
+    for( uint8_t i=0; i<8; ++i ){
+        participants.push_back( std::make_shared<MockParticipant>( i ) );
+        room.join( participants.back() );
+    }
+
+    const std::string line( 4096, 'x' );
+    room.deliver( message_from_string( line ), participants.front() );
+
+    EXPECT_TRUE( participants.front()->delivered_.empty() );
+    const ptr_Message frame = participants[1]->delivered_.at(0);
+    EXPECT_EQ( line, frame->body_to_string() );
+    for( std::size_t i=1; i<participants.size(); ++i ){
+        ASSERT_EQ( 1u, participants[i]->delivered_.size() );
+        EXPECT_EQ( frame.get(), participants[i]->delivered_[0].get() );
+    }
+}
+
+TEST( ChatRoomTest, PostDeliverRunsOnTheRoomStrand ){
+    boost::asio::io_service io_service;
+    auto room = std::make_shared<ChatRoom>( io_service, io_service, "room" );
+    auto sender = std::make_shared<MockParticipant>( 0 );
+    auto reader = std::make_shared<MockParticipant>( 1 );
+    room->join( sender );
+    room->join( reader );
+
+    room->post_deliver( make_shared_message( message_from_string( "hi" ) ), sender );
+    EXPECT_TRUE( reader->delivered_.empty() );
+    io_service.run();
+    ASSERT_EQ( 1u, reader->delivered_.size() );
+    EXPECT_TRUE( sender->delivered_.empty() );
+}
+
+TEST( ChatRoomTest, ParticipantsAreKeyedById ){
+    boost::asio::io_service io_service;
+    ChatRoom room( io_service, io_service );
+    const ParticipantId wide = 0x100000000ull + 7;
+    auto a = std::make_shared<MockParticipant>( 7 );
+    auto b = std::make_shared<MockParticipant>( wide );
+    room.join( a );
+    room.join( b );
+    room.join( b );
+    EXPECT_EQ( 2u, room.participant_count() );
+
+    room.leave( a );
+    room.deliver( message_from_string( "hi" ) );
+    EXPECT_TRUE( a->delivered_.empty() );
+    EXPECT_EQ( 1u, b->delivered_.size() );
+    EXPECT_EQ( "4294967303", b->string_id() );
+}
+
+TEST( ChatRoomTest, DroppedReaderGetsNoMoreChunks ){
+    boost::asio::io_service io_service;
+    ChatRoom room( io_service, io_service );
+    auto sender = std::make_shared<MockParticipant>( 1 );
+    auto slow = std::make_shared<MockParticipant>( 2 );
+    auto fast = std::make_shared<MockParticipant>( 3 );
+    room.join( sender );
+    room.join( slow );
+    room.join( fast );
+    room.file_awaiting( make_file_message( 10, "/some/file", 5 ), sender );
+    EXPECT_EQ( 2u, room.file_reader_count( 5 ) );
+
+    room.file_drop_reader( 5, slow->id() );
+    EXPECT_EQ( 1u, room.file_reader_count( 5 ) );
+    ASSERT_FALSE( slow->delivered_.empty() );
+    const ptr_Message cancel = slow->delivered_.back();
+    EXPECT_EQ( MessageType::FileCancel, cancel->msg_type() );
+    EXPECT_EQ( 5u, file_control_id( cancel->msg_body(), cancel->body_length() ) );
+
+    room.file_deliver( 5, chunk_frame( 5, "data" ) );
+    EXPECT_TRUE( slow->frames_.empty() );
+    EXPECT_EQ( 1u, fast->frames_.size() );
+}
+
+/* readers share the room's snapshot; answers only clear their bit */
+TEST( FileReadersTest, RemoveClearsOnlyThatReader ){
+    ParticipantRegistry< ptr_ChatParticipant > members;
+    for( ParticipantId id=1; id<=130; ++id ){
+        members.insert( id, std::make_shared<MockParticipant>( id ) );
+    }
+    const auto snapshot = members.snapshot();
+    FileReaders readers( snapshot, 1 );
+    EXPECT_EQ( 129u, readers.size() );
+    EXPECT_FALSE( readers.contains( 1 ) );
+
+    EXPECT_TRUE( readers.remove( 65 ) );
+    EXPECT_FALSE( readers.remove( 65 ) );
+    EXPECT_FALSE( readers.remove( 1000 ) );
+    EXPECT_EQ( nullptr, readers.find( 65 ) );
+    ASSERT_NE( nullptr, readers.find( 130 ) );
+    EXPECT_EQ( 130u, (*readers.find( 130 ))->id() );
+    EXPECT_EQ( 130u, snapshot->size() );
+
+    std::vector< ParticipantId > visited;
+    readers.for_each( [&visited]( const ptr_ChatParticipant& reader )
+        { visited.push_back( reader->id() ); } );
+    std::sort( visited.begin(), visited.end() );
+    EXPECT_EQ( 128u, visited.size() );
+    std::vector< ParticipantId > ids = readers.ids();
+    std::sort( ids.begin(), ids.end() );
+    EXPECT_EQ( visited, ids );
+    EXPECT_FALSE( std::binary_search( visited.begin(), visited.end(), 65u ) );
+}
+
+/* a reader that can not take a chunk leaves the window and is cancelled,
+ * it never sees a later chunk */
+TEST( ChatRoomTest, ReaderRefusingAChunkIsCancelled ){
+    boost::asio::io_service io_service;
+    ChatRoom room( io_service, io_service );
+    auto sender = std::make_shared<MockParticipant>( 1 );
+    auto full = std::make_shared<MockParticipant>( 2 );
+    auto fast = std::make_shared<MockParticipant>( 3 );
+    full->frame_room_ = 1;
+    room.join( sender );
+    room.join( full );
+    room.join( fast );
+    room.file_awaiting( make_file_message( 10, "/some/file", 5 ), sender );
+    auto window = std::make_shared<TransferWindow>( FlowLimits(), [](){} );
+    window->add_reader( full->id() );
+    window->add_reader( fast->id() );
+
+    room.file_deliver( 5, chunk_frame( 5, "one" ), window );
+    room.file_deliver( 5, chunk_frame( 5, "two" ), window );
+    room.file_deliver( 5, chunk_frame( 5, "three" ), window );
+
+    EXPECT_EQ( 1u, full->frames_.size() );
+    EXPECT_EQ( 3u, fast->frames_.size() );
+    EXPECT_EQ( 1u, room.file_reader_count( 5 ) );
+    EXPECT_EQ( 1u, window->reader_count() );
+    ASSERT_FALSE( full->delivered_.empty() );
+    const ptr_Message cancel = full->delivered_.back();
+    EXPECT_EQ( MessageType::FileCancel, cancel->msg_type() );
+    EXPECT_EQ( 5u, file_control_id( cancel->msg_body(), cancel->body_length() ) );
+}
+
+/* a relayed chunk that overflows the reader's file queue cancels that
+ * transfer for it and takes back its queued chunks; its file socket only
+ * ever gets whole chunks and no transfer with a gap */
+TEST( ChatSessionTest, FileQueueOverflowCancelsTheReader ){
+    using boost::asio::ip::tcp;
+    boost::asio::io_service io_service;
+    IoServicePool pool( IoServicePool::Shared, 1 );
+    RoomRegistry rooms( pool, pool );
+    tcp::socket chat( io_service ), chat_end( io_service );
+    tcp::socket file( io_service ), file_end( io_service );
+    connect_pair( io_service, chat, chat_end );
+    connect_pair( io_service, file, file_end );
+    auto reader = std::make_shared<ChatSession>( io_service, io_service
+                                               , std::move( chat_end )
+                                               , std::move( file_end )
+                                               , rooms, 2 );
+    MemoryBudget budget;
+    OverflowStats stats;
+    reader->outbound_limits( QueueLimits(), QueueLimits( 100, 200 ), budget, stats );
+
+    ChatRoom room( io_service, io_service );
+    auto sender = std::make_shared<MockParticipant>( 1 );
+    auto other = std::make_shared<MockParticipant>( 3 );
+    room.join( sender );
+    room.join( reader );
+    room.join( other );
+    room.file_awaiting( make_file_message( 1000, "/some/file", 5 ), sender );
+    room.file_awaiting( make_file_message( 1000, "/other/file", 6 ), other );
+    auto window = std::make_shared<TransferWindow>( FlowLimits(), [](){} );
+    window->add_reader( reader->id() );
+
+    // 52 byte frames: the first is being written, the fourth does not fit
+    const auto chunk = []( uint64_t id, char fill )
+        { return chunk_frame( id, std::string( 40, fill ) ); };
+    room.file_deliver( 5, chunk( 5, 'a' ), window );
+    room.file_deliver( 5, chunk( 5, 'b' ), window );
+    room.file_deliver( 6, chunk( 6, 'c' ) );
+    room.file_deliver( 5, chunk( 5, 'd' ), window );
+    room.file_deliver( 5, chunk( 5, 'e' ), window );
+    // the mocks read on
+    EXPECT_EQ( 1u, room.file_reader_count( 5 ) );
+    EXPECT_EQ( 4u, other->frames_.size() );
+    EXPECT_EQ( 0u, window->reader_count() );
+    EXPECT_EQ( 2u, room.file_reader_count( 6 ) );
+    EXPECT_EQ( 1u, stats.dropped( QueueLimits::DropOldest ) );
+
+    io_service.run();
+    std::vector<char> received( file.available() );
+    boost::asio::read( file, boost::asio::buffer( received ) );
+    std::vector<char> expected( chunk( 5, 'a' ) );
+    const std::vector<char> c( chunk( 6, 'c' ) );
+    expected.insert( expected.end(), c.begin(), c.end() );
+    EXPECT_EQ( expected, received );
+    EXPECT_EQ( ( std::vector<MessageType>{ MessageType::FileStart
+                                         , MessageType::FileStart
+                                         , MessageType::FileCancel } )
+             , frame_types( chat ) );
+    room.leave( reader );
+}
+
+/* a reader whose file socket fails while the sender waits on it gives
+ * back the credit of the chunk it was writing and leaves the window */
+TEST( ChatSessionTest, FailedReaderReleasesAParkedSender ){
+    using boost::asio::ip::tcp;
+    boost::asio::io_service io_service;
+    IoServicePool pool( IoServicePool::Shared, 1 );
+    RoomRegistry rooms( pool, pool );
+    tcp::socket chat( io_service ), chat_end( io_service );
+    tcp::socket file( io_service ), file_end( io_service );
+    connect_pair( io_service, chat, chat_end );
+    connect_pair( io_service, file, file_end );
+    // the chunk can not be written whole before the socket fails
+    file.set_option( tcp::socket::receive_buffer_size( 4096 ) );
+    file_end.set_option( tcp::socket::send_buffer_size( 4096 ) );
+    auto reader = std::make_shared<ChatSession>( io_service, io_service
+                                               , std::move( chat_end )
+                                               , std::move( file_end )
+                                               , rooms, 2 );
+    reader->start();
+
+    auto sender = std::make_shared<MockParticipant>( 1 );
+    const ptr_ChatRoom room = rooms.join( RoomRegistry::DefaultRoom, sender );
+    room->file_awaiting( make_file_message( 1 << 20, "/some/file", 5 ), sender );
+    std::atomic<bool> resumed( false );
+    const std::size_t chunk = 1 << 20;
+    auto window = std::make_shared<TransferWindow>( FlowLimits( chunk )
+                                                  , [&resumed](){ resumed = true; } );
+    window->add_reader( reader->id() );
+    sender->window_ = window;
+
+    ASSERT_TRUE( window->acquire() );
+    window->sent( chunk );
+    room->file_deliver( 5, chunk_frame( 5, std::string( chunk, 'x' ) ), window );
+    io_service.poll();
+    EXPECT_FALSE( window->acquire() );
+
+    // the reader's end goes away with the chunk half read; its chat socket
+    // stays, so only the file error can let the sender go
+    file.close();
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds( 5 );
+    while( !resumed && std::chrono::steady_clock::now() < deadline ){
+        io_service.poll();
+        std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+    }
+    EXPECT_TRUE( resumed );
+    EXPECT_EQ( 0u, window->reader_count() );
+    ASSERT_EQ( 1u, sender->left_.size() );
+    EXPECT_EQ( reader->id(), sender->left_[0].second );
+    EXPECT_EQ( 0u, room->file_reader_count( 5 ) );
+
+    chat.close();
+    io_service.run();
+    rooms.leave( room, sender );
+}
+
+#ifdef __linux__
+/* a reader's pipe counts buffers, not bytes: a tee that takes only part of
+ * a chunk leaves the rest to be copied after it, and the stream stays
+ * whole */
+TEST( ChatSessionTest, ShortTeeCopiesTheRest ){
+    using boost::asio::ip::tcp;
+    boost::asio::io_service io_service;
+    IoServicePool pool( IoServicePool::Shared, 1 );
+    RoomRegistry rooms( pool, pool );
+    tcp::socket chat( io_service ), chat_end( io_service );
+    tcp::socket file( io_service ), file_end( io_service );
+    connect_pair( io_service, chat, chat_end );
+    connect_pair( io_service, file, file_end );
+    auto reader = std::make_shared<ChatSession>( io_service, io_service
+                                               , std::move( chat_end )
+                                               , std::move( file_end )
+                                               , rooms, 2 );
+    reader->relay_mode( ChatSession::SpliceRelay );
+    ASSERT_NE( 0u, reader->file_splice_capacity() );
+
+    ChatRoom room( io_service, io_service );
+    auto sender = std::make_shared<MockParticipant>( 1 );
+    room.join( sender );
+    room.join( reader );
+    room.file_awaiting( make_file_message( 1 << 20, "/some/file", 5 ), sender );
+    auto window = std::make_shared<TransferWindow>( FlowLimits(), [](){} );
+    window->add_reader( reader->id() );
+
+    int in[2];
+    ASSERT_EQ( 0, ::socketpair( AF_UNIX, SOCK_STREAM, 0, in ) );
+    SplicePipe source;
+    ASSERT_TRUE( source.open( reader->file_splice_capacity() ) );
+    // every write is a buffer of its own: the first chunk leaves the
+    // reader's pipe 20 buffers, the second one needs 40
+    const std::size_t slots = reader->file_splice_capacity()
+                            / static_cast<std::size_t>( ::sysconf( _SC_PAGESIZE ) );
+    ASSERT_LT( 40u, slots );
+    std::string sent;
+    for( std::size_t buffers : { slots - 20, std::size_t( 40 ) } ){
+        for( std::size_t i = 0; i < buffers; ++i ){
+            const std::string piece( 10, static_cast<char>( 'a' + i % 26 ) );
+            ASSERT_EQ( 10, ::write( in[1], piece.data(), piece.size() ) );
+            sent += piece;
+        }
+        boost::system::error_code ec;
+        ASSERT_EQ( 10 * buffers, source.splice_from( in[0], 10 * buffers, ec ) );
+        ASSERT_TRUE( window->acquire() );
+        window->sent( 10 * buffers );
+        room.file_deliver( 5, source, 10 * buffers, window );
+    }
+
+    io_service.run();
+    std::vector<char> received( file.available() );
+    boost::asio::read( file, boost::asio::buffer( received ) );
+    std::vector<std::size_t> lengths;
+    std::string stream;
+    for( std::size_t at = 0; at + FileChunkHeader::Length <= received.size(); ){
+        const FileChunkHeader header( file_chunk_header(
+            reinterpret_cast<const uint8_t*>( received.data() ) + at ) );
+        EXPECT_EQ( 5u, header.transfer_id );
+        at += FileChunkHeader::Length;
+        stream.append( received.data() + at, header.length );
+        at += header.length;
+        lengths.push_back( header.length );
+    }
+    EXPECT_EQ( sent, stream );
+    EXPECT_EQ( ( std::vector<std::size_t>{ 10 * ( slots - 20 ), 200, 200 } ), lengths );
+    EXPECT_EQ( 0u, window->behind( reader->id() ) );
+    EXPECT_EQ( 1u, room.file_reader_count( 5 ) );
+    EXPECT_EQ( std::vector<MessageType>{ MessageType::FileStart }, frame_types( chat ) );
+    room.leave( reader );
+    for( int fd : in ){
+        ::close( fd );
+    }
+}
+#endif /* __linux__ */
+
+/* at a quorum below all readers a stalled one is cancelled once it is
+ * too far behind, as the sender's relay loop does it */
+TEST( ChatRoomTest, StalledReaderOutsideTheQuorumIsCancelled ){
+    boost::asio::io_service io_service;
+    ChatRoom room( io_service, io_service );
+    auto sender = std::make_shared<MockParticipant>( 1 );
+    auto fast = std::make_shared<MockParticipant>( 2 );
+    auto stalled = std::make_shared<MockParticipant>( 3 );
+    room.join( sender );
+    room.join( fast );
+    room.join( stalled );
+    room.file_awaiting( make_file_message( 1 << 20, "/some/file", 5 ), sender );
+    auto window = std::make_shared<TransferWindow>( FlowLimits( 8, 1 ), [](){} );
+    window->add_reader( fast->id() );
+    window->add_reader( stalled->id() );
+
+    for( int i=0; i<10; ++i ){
+        ASSERT_TRUE( window->acquire() );
+        for( ParticipantId slow : window->sent( 4 ) ){
+            room.file_drop_reader( 5, slow );
+        }
+        room.file_deliver( 5, chunk_frame( 5, "data" ), window );
+        window->written( fast->id(), 4 );
+    }
+
+    EXPECT_EQ( 10u, fast->frames_.size() );
+    EXPECT_EQ( 4u, stalled->frames_.size() );
+    EXPECT_EQ( 1u, window->reader_count() );
+    EXPECT_EQ( 1u, room.file_reader_count( 5 ) );
+    EXPECT_EQ( std::vector<uint64_t>{ 5 }, stalled->cancelled_ );
+    ASSERT_FALSE( stalled->delivered_.empty() );
+    EXPECT_EQ( MessageType::FileCancel, stalled->delivered_.back()->msg_type() );
+}
+
+TEST( ChatRoomTest, ConcurrentTransfersAreKeyedById ){
+    boost::asio::io_service io_service;
+    ChatRoom room( io_service, io_service );
+    auto a = std::make_shared<MockParticipant>( 1 );
+    auto b = std::make_shared<MockParticipant>( 2 );
+    auto c = std::make_shared<MockParticipant>( 3 );
+    room.join( a );
+    room.join( b );
+    room.join( c );
+    // two of a's files and one of b's at once
+    EXPECT_TRUE( room.file_awaiting( make_file_message( 10, "/one", 1 ), a ) );
+    EXPECT_TRUE( room.file_awaiting( make_file_message( 10, "/two", 2 ), a ) );
+    EXPECT_TRUE( room.file_awaiting( make_file_message( 10, "/three", 3 ), b ) );
+    EXPECT_EQ( 2u, room.file_reader_count( 1 ) );
+    EXPECT_EQ( 2u, room.file_reader_count( 3 ) );
+
+    // c is done with the first file only
+    room.file_done( make_file_control( MessageType::FileDone, 1 ), c );
+    EXPECT_EQ( 1u, room.file_reader_count( 1 ) );
+    EXPECT_EQ( 2u, room.file_reader_count( 2 ) );
+    ASSERT_EQ( 1u, a->left_.size() );
+    EXPECT_EQ( 1u, a->left_[0].first );
+    EXPECT_EQ( c->id(), a->left_[0].second );
+
+    room.file_deliver( 2, chunk_frame( 2, "two" ) );
+    room.file_deliver( 3, chunk_frame( 3, "three" ) );
+    EXPECT_EQ( 1u, b->frames_.size() );
+    EXPECT_EQ( 2u, c->frames_.size() );
+    EXPECT_EQ( 1u, a->frames_.size() );
+    EXPECT_EQ( 3u, file_chunk_header( reinterpret_cast<const uint8_t*>(
+                                        a->frames_[0].data() ) ).transfer_id );
+
+    // the sender cancelling one transfer leaves the others alone
+    room.file_cancel( make_file_control( MessageType::FileCancel, 2 ), a );
+    EXPECT_EQ( 0u, room.file_reader_count( 2 ) );
+    EXPECT_EQ( 2u, room.file_reader_count( 3 ) );
+}
+
+TEST( ChatRoomTest, ReaderLeavingTheRoomLeavesItsTransfers ){
+    boost::asio::io_service io_service;
+    ChatRoom room( io_service, io_service );
+    auto a = std::make_shared<MockParticipant>( 1 );
+    auto b = std::make_shared<MockParticipant>( 2 );
+    auto c = std::make_shared<MockParticipant>( 3 );
+    room.join( a );
+    room.join( b );
+    room.join( c );
+    room.file_awaiting( make_file_message( 10, "/one", 1 ), a );
+    room.file_awaiting( make_file_message( 10, "/two", 2 ), b );
+    room.file_awaiting_complete( 2 );
+
+    room.file_leave( c );
+    room.leave( c );
+    EXPECT_EQ( 1u, room.file_reader_count( 1 ) );
+    EXPECT_EQ( 1u, room.file_reader_count( 2 ) );
+    // still answering the first file: a refusal; the second one had started
+    ASSERT_EQ( 1u, a->refused_.size() );
+    EXPECT_EQ( 1u, a->refused_[0] );
+    EXPECT_TRUE( b->refused_.empty() );
+    ASSERT_EQ( 1u, b->left_.size() );
+    EXPECT_EQ( c->id(), b->left_[0].second );
+    // and c hears both are off
+    std::size_t cancels = 0;
+    for( const ptr_Message& msg : c->delivered_ ){
+        cancels += ( msg->msg_type() == MessageType::FileCancel ) ? 1 : 0;
+    }
+    EXPECT_EQ( 2u, cancels );
+
+    room.file_deliver( 2, chunk_frame( 2, "two" ) );
+    EXPECT_TRUE( c->frames_.empty() );
+}
+
+TEST( ChatRoomTest, TransferIdInUseIsRefused ){
+    boost::asio::io_service io_service;
+    ChatRoom room( io_service, io_service );
+    auto a = std::make_shared<MockParticipant>( 1 );
+    auto b = std::make_shared<MockParticipant>( 2 );
+    room.join( a );
+    room.join( b );
+    EXPECT_TRUE( room.file_awaiting( make_file_message( 10, "/one", 7 ), a ) );
+    EXPECT_FALSE( room.file_awaiting( make_file_message( 10, "/two", 7 ), b ) );
+    EXPECT_FALSE( room.file_awaiting( make_file_message( 10, "/three", 0 ), b ) );
+    EXPECT_EQ( 1u, room.file_reader_count( 7 ) );
+    EXPECT_EQ( 1u, b->delivered_.size() );
+}
+
+/* resends go to the transfer's sender alone, after its stream is relayed
+ * too, until the reader is done with it */
+TEST( ChatRoomTest, ResendGoesToTheSenderUntilTheReaderIsDone ){
+    boost::asio::io_service io_service;
+    ChatRoom room( io_service, io_service );
+    auto a = std::make_shared<MockParticipant>( 1 );
+    auto b = std::make_shared<MockParticipant>( 2 );
+    auto c = std::make_shared<MockParticipant>( 3 );
+    room.join( a );
+    room.join( b );
+    room.join( c );
+    room.file_awaiting( make_file_message( 10, "/one", 7 ), a );
+    room.file_refuse( make_file_control( MessageType::FileRefuse, 7 ), c );
+    room.file_awaiting_complete( 7 );
+    room.file_finished( 7 );
+    a->delivered_.clear();
+    c->delivered_.clear();
+
+    const ptr_Message resend( make_shared_message(
+        make_file_resend( 7, std::vector< FileRange >( 1, FileRange( 0, 10 ) ) ) ) );
+    room.file_resend( resend, c->id() );
+    EXPECT_TRUE( a->delivered_.empty() );
+    room.file_resend( resend, b->id() );
+    ASSERT_EQ( 1u, a->delivered_.size() );
+    EXPECT_EQ( resend, a->delivered_[0] );
+    EXPECT_TRUE( c->delivered_.empty() );
+
+    room.file_done( make_file_control( MessageType::FileDone, 7 ), b );
+    room.file_resend( resend, b->id() );
+    EXPECT_EQ( 1u, a->delivered_.size() );
+    // the id is free again
+    EXPECT_TRUE( room.file_awaiting( make_file_message( 10, "/one", 7 ), a ) );
+}
+
+TEST( FileCreditTest, DroppedFrameCreditsTheWindow ){
+    auto window = std::make_shared<TransferWindow>( FlowLimits( 100 ), [](){} );
+    window->add_reader( 1 );
+    window->sent( 80 );
+    {   FileFrame frame;
+        frame.credits.push_back( std::make_shared<FileCredit>( window, 1, 80 ) );
+        FileFrame copy( frame );
+        EXPECT_EQ( 80u, window->behind( 1 ) );
+    }
+    // the last frame holding the bytes is gone
+    EXPECT_EQ( 0u, window->behind( 1 ) );
+}
+
+TEST( RoomRegistryTest, JoinCreatesAndReusesRooms ){
+    IoServicePool pool( IoServicePool::PerCore, 2 );
+    RoomRegistry rooms( pool, pool );
+    auto a = std::make_shared<MockParticipant>( 0 );
+    auto b = std::make_shared<MockParticipant>( 1 );
+
+    const ptr_ChatRoom first = rooms.join( "first", a );
+    EXPECT_EQ( "first", first->name() );
+    EXPECT_EQ( first, rooms.join( "first", b ) );
+    EXPECT_EQ( 2u, first->participant_count() );
+    EXPECT_NE( first, rooms.join( "second", b ) );
+    EXPECT_EQ( 2u, rooms.size() );
+    EXPECT_FALSE( rooms.find( "third" ) );
+}
+
+TEST( RoomRegistryTest, LastLeaveDropsAllButTheDefaultRoom ){
+    IoServicePool pool( IoServicePool::Shared, 1 );
+    RoomRegistry rooms( pool, pool );
+    auto a = std::make_shared<MockParticipant>( 0 );
+
+    const ptr_ChatRoom lobby = rooms.join( RoomRegistry::DefaultRoom, a );
+    rooms.leave( lobby, a );
+    EXPECT_EQ( lobby, rooms.find( RoomRegistry::DefaultRoom ) );
+
+    const ptr_ChatRoom other = rooms.join( "other", a );
+    rooms.leave( other, a );
+    EXPECT_FALSE( rooms.find( "other" ) );
+    EXPECT_EQ( 1u, rooms.size() );
+}
+
+} // namespace
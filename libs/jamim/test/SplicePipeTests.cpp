@@ -0,0 +1,88 @@
+#include "jamim/SplicePipe.hpp"
+#include <gtest/gtest.h>
+#include <string>
+#include <boost/asio/error.hpp>
+#ifdef __linux__
+#include <sys/socket.h>
+#include <unistd.h>
+#endif /* __linux__ */
+
+
+namespace
+{
+
+#ifdef __linux__
+
+/* socket -> pipe, teed to two readers' pipes, each spliced to a socket */
+TEST( SplicePipeTest, TeesSocketBytesToEveryReader ){
+    int in[2], out_a[2], out_b[2];
+    ASSERT_EQ( 0, ::socketpair( AF_UNIX, SOCK_STREAM, 0, in ) );
+    ASSERT_EQ( 0, ::socketpair( AF_UNIX, SOCK_STREAM, 0, out_a ) );
+    ASSERT_EQ( 0, ::socketpair( AF_UNIX, SOCK_STREAM, 0, out_b ) );
+
+    SplicePipe source, reader_a, reader_b;
+    ASSERT_TRUE( source.open( 1 << 16 ) );
+    ASSERT_TRUE( reader_a.open( 1 << 16 ) );
+    ASSERT_TRUE( reader_b.open( 1 << 16 ) );
+    EXPECT_GE( source.capacity(), 4096u );
+
+    const std::string data( "file bytes" );
+    ASSERT_EQ( static_cast<ssize_t>( data.size() ), ::write( in[1], data.data(), data.size() ) );
+
+    boost::system::error_code ec;
+    EXPECT_EQ( data.size(), source.splice_from( in[0], 4096, ec ) );
+    EXPECT_FALSE( ec );
+    EXPECT_EQ( data.size(), source.tee_to( reader_a, data.size(), ec ) );
+    EXPECT_EQ( data.size(), source.tee_to( reader_b, data.size(), ec ) );
+    EXPECT_EQ( data.size(), source.discard( data.size(), ec ) );
+
+    EXPECT_EQ( data.size(), reader_a.splice_to( out_a[1], data.size(), ec ) );
+    EXPECT_EQ( data.size(), reader_b.splice_to( out_b[1], data.size(), ec ) );
+    char buf[32];
+    ASSERT_EQ( static_cast<ssize_t>( data.size() ), ::read( out_a[0], buf, sizeof(buf) ) );
+    EXPECT_EQ( data, std::string( buf, data.size() ) );
+    ASSERT_EQ( static_cast<ssize_t>( data.size() ), ::read( out_b[0], buf, sizeof(buf) ) );
+    EXPECT_EQ( data, std::string( buf, data.size() ) );
+
+    // nothing left anywhere
+    EXPECT_EQ( 0u, source.tee_to( reader_a, 1, ec ) );
+    EXPECT_EQ( boost::asio::error::would_block, ec );
+
+    for( int fd : { in[0], in[1], out_a[0], out_a[1], out_b[0], out_b[1] } ){
+        ::close( fd );
+    }
+}
+
+/* a reader whose pipe is full gets the bytes copied out instead */
+TEST( SplicePipeTest, ReadCopiesBytesOut ){
+    int in[2];
+    ASSERT_EQ( 0, ::socketpair( AF_UNIX, SOCK_STREAM, 0, in ) );
+    SplicePipe source;
+    ASSERT_TRUE( source.open( 1 << 16 ) );
+
+    const std::string data( "file bytes" );
+    ASSERT_EQ( static_cast<ssize_t>( data.size() ), ::write( in[1], data.data(), data.size() ) );
+    boost::system::error_code ec;
+    EXPECT_EQ( data.size(), source.splice_from( in[0], 4096, ec ) );
+
+    char buf[32];
+    EXPECT_EQ( 4u, source.read( buf, 4, ec ) );
+    EXPECT_FALSE( ec );
+    EXPECT_EQ( "file", std::string( buf, 4 ) );
+    EXPECT_EQ( data.size() - 4, source.read( buf, sizeof(buf), ec ) );
+    EXPECT_EQ( " bytes", std::string( buf, data.size() - 4 ) );
+
+    for( int fd : { in[0], in[1] } ){
+        ::close( fd );
+    }
+}
+
+#endif /* __linux__ */
+
+TEST( SplicePipeTest, ClosedPipeHasNoCapacity ){
+    SplicePipe pipe;
+    EXPECT_FALSE( pipe.is_open() );
+    EXPECT_EQ( 0u, pipe.capacity() );
+}
+
+} // namespace
@@ -0,0 +1,119 @@
+#include "jamim/TransferWindow.hpp"
+#include <gtest/gtest.h>
+
+
+namespace
+{
+
+TEST( TransferWindowTest, SlowestReaderHoldsTheSender ){
+    int resumed = 0;
+    TransferWindow window( FlowLimits( 100 ), [&resumed](){ ++resumed; } );
+    window.add_reader( 1 );
+    window.add_reader( 2 );
+
+    EXPECT_TRUE( window.sent( 60 ).empty() );
+    EXPECT_TRUE( window.acquire() );
+    window.sent( 60 );
+    window.written( 1, 120 );
+    EXPECT_EQ( 0u, window.behind( 1 ) );
+    EXPECT_EQ( 120u, window.behind( 2 ) );
+    EXPECT_FALSE( window.acquire() );
+    EXPECT_EQ( 0, resumed );
+
+    // the credit that reopens the window resumes the sender once
+    window.written( 2, 30 );
+    EXPECT_EQ( 1, resumed );
+    window.written( 2, 30 );
+    EXPECT_EQ( 1, resumed );
+    EXPECT_TRUE( window.acquire() );
+}
+
+TEST( TransferWindowTest, QuorumLetsTheSenderRunAhead ){
+    int resumed = 0;
+    TransferWindow window( FlowLimits( 100, 2 ), [&resumed](){ ++resumed; } );
+    window.add_reader( 1 );
+    window.add_reader( 2 );
+    window.add_reader( 3 );
+
+    window.sent( 150 );
+    window.written( 1, 150 );
+    EXPECT_FALSE( window.acquire() );
+    window.written( 2, 150 );
+    EXPECT_EQ( 1, resumed );
+    EXPECT_EQ( 150u, window.behind( 3 ) );
+    EXPECT_TRUE( window.acquire() );
+}
+
+TEST( TransferWindowTest, ReadersPastTheLimitAreDropped ){
+    int resumed = 0;
+    TransferWindow window( FlowLimits( 100, 1, 250 ), [&resumed](){ ++resumed; } );
+    window.add_reader( 1 );
+    window.add_reader( 2 );
+
+    window.sent( 200 );
+    window.written( 1, 200 );
+    const std::vector<ParticipantId> dropped = window.sent( 100 );
+    ASSERT_EQ( 1u, dropped.size() );
+    EXPECT_EQ( 2u, dropped.front() );
+    EXPECT_EQ( 1u, window.reader_count() );
+
+    // a reader that leaves reopens the window as well
+    EXPECT_FALSE( window.acquire() );
+    window.remove_reader( 1 );
+    EXPECT_EQ( 1, resumed );
+    EXPECT_TRUE( window.acquire() );
+}
+
+/* with a quorum nothing holds the sender back for a stalled reader, so it
+ * is dropped even without drop_behind */
+TEST( TransferWindowTest, QuorumDropsAStalledReader ){
+    TransferWindow window( FlowLimits( 100, 1 ), [](){} );
+    window.add_reader( 1 );
+    window.add_reader( 2 );
+
+    for( int i=0; i<FlowLimits::DefaultDropWindows; ++i ){
+        EXPECT_TRUE( window.sent( 100 ).empty() );
+        window.written( 1, 100 );
+    }
+    const std::vector<ParticipantId> dropped = window.sent( 1 );
+    ASSERT_EQ( 1u, dropped.size() );
+    EXPECT_EQ( 2u, dropped.front() );
+    EXPECT_EQ( 1u, window.reader_count() );
+
+    TransferWindow all( FlowLimits( 100 ), [](){} );
+    all.add_reader( 1 );
+    EXPECT_TRUE( all.sent( 1000 ).empty() );
+}
+
+/* the readers within the window are counted as they come and go, in and
+ * out of it, not recounted on every acquire */
+TEST( TransferWindowTest, ReadersWithinTheWindowAreCounted ){
+    TransferWindow window( FlowLimits( 100, 2 ), [](){} );
+    window.add_reader( 1 );
+    window.add_reader( 1 );
+    window.add_reader( 2 );
+    window.add_reader( 3 );
+
+    window.sent( 100 );
+    EXPECT_FALSE( window.acquire() );
+    window.written( 1, 10 );
+    window.written( 1, 10 );
+    EXPECT_FALSE( window.acquire() );
+    // one behind and one within leave, the one within is still missing
+    window.remove_reader( 2 );
+    window.remove_reader( 1 );
+    window.remove_reader( 1 );
+    EXPECT_FALSE( window.acquire() );
+    // a quorum of two with two readers: both must be within
+    window.add_reader( 4 );
+    EXPECT_FALSE( window.acquire() );
+    window.written( 3, 1 );
+    EXPECT_TRUE( window.acquire() );
+    window.sent( 100 );
+    window.written( 4, 1 );
+    EXPECT_FALSE( window.acquire() );
+    window.written( 3, 100 );
+    EXPECT_TRUE( window.acquire() );
+}
+
+} // namespace
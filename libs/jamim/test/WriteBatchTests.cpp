@@ -0,0 +1,48 @@
+#include "jamim/WriteBatch.hpp"
+#include <gtest/gtest.h>
+#include <deque>
+#include <string>
+
+
+namespace
+{
+
+TEST( WriteBatchTest, GathersWholeQueue ){
+    std::deque<ptr_Message> queue;
+    for( int i=0; i<10; ++i ){
+        queue.push_back( make_shared_message( message_from_string( "line" ) ) );
+    }
+    WriteBatch batch;
+    const WriteBatch::buffers_type& buffers = batch.gather( queue );
+
+    EXPECT_EQ( 10u, buffers.size() );
+    EXPECT_EQ( 10u, batch.count() );
+    EXPECT_EQ( 10 * queue.front()->total_length()
+             , boost::asio::buffer_size( buffers ) );
+
+    batch.complete( queue );
+    EXPECT_TRUE( queue.empty() );
+    EXPECT_EQ( 0u, batch.count() );
+}
+
+TEST( WriteBatchTest, CappedByBufferCount ){
+    std::deque<Message> queue( WriteBatch::MaxBuffers + 5
+                             , message_from_string( "x" ) );
+    WriteBatch batch;
+    EXPECT_EQ( static_cast<std::size_t>( WriteBatch::MaxBuffers )
+             , batch.gather( queue ).size() );
+    batch.complete( queue );
+    EXPECT_EQ( 5u, queue.size() );
+}
+
+TEST( WriteBatchTest, CappedByBytes ){
+    const std::string line( 60000, 'x' );
+    std::deque<Message> queue( 8, message_from_string( line ) );
+    WriteBatch batch;
+    const std::size_t expected = WriteBatch::MaxBytes / queue.front().total_length();
+    EXPECT_EQ( expected, batch.gather( queue ).size() );
+    EXPECT_GE( static_cast<std::size_t>( WriteBatch::MaxBytes )
+             , boost::asio::buffer_size( batch.gather( queue ) ) );
+}
+
+} // namespace
@@ -0,0 +1,932 @@
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <future>
+#include <iomanip>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "jamim/Message.hpp"
+#include "jamim/FrameReader.hpp"
+#include "jamim/WriteBatch.hpp"
+
+
+/* jamim-loadgen -- headless load generator.
+ * Opens N chat + file socket pairs against a local Server, sends chat at a
+ * fixed aggregate rate with uniformly distributed body sizes, periodically
+ * starts file transfers, up to --file-streams at a time, which every other
+ * simulated client accepts, and reports throughput and end-to-end delivery
+ * latency. */
+
+using boost::asio::ip::tcp;
+typedef std::chrono::steady_clock   Clock;
+
+namespace
+{
+
+/* Chat bodies start with a send timestamp so receivers can measure the
+ * delivery latency: "LG" + 16 hex digits of steady_clock nanoseconds */
+/* ------------------------------------------------------------------------- */
+const char STAMP_TAG[] = "LG";
+enum { StampTagLength = sizeof(STAMP_TAG) - 1, StampDigits = 16 };
+
+constexpr std::size_t StampLength()
+{
+    return StampTagLength + StampDigits;
+}
+
+uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                Clock::now().time_since_epoch() ).count();
+}
+
+void write_stamp( uint8_t* body, uint64_t ns )
+{
+    static const char digits[] = "0123456789abcdef";
+    std::copy( STAMP_TAG, STAMP_TAG + StampTagLength, body );
+    for( int i=0; i<StampDigits; ++i ){
+        body[StampTagLength + i] = digits[ (ns >> (60 - 4*i)) & 0xF ];
+    }
+}
+
+bool read_stamp( const MessageView& msg, uint64_t& ns )
+{
+    if( msg.body_length() < StampLength()
+        || std::memcmp( msg.msg_body(), STAMP_TAG, StampTagLength ) != 0 ){
+        return false;       // server notices and other chat
+    }
+    ns = 0;
+    for( int i=0; i<StampDigits; ++i ){
+        const uint8_t c = msg.msg_body()[StampTagLength + i];
+        ns = (ns << 4) | ( (c <= '9') ? (c - '0') : (c - 'a' + 10) );
+    }
+    return true;
+}
+/* ------------------------------------------------------------------------- */
+
+
+/* Config */
+/* ------------------------------------------------------------------------- */
+struct Config
+{
+    std::string     host            = "127.0.0.1";
+    std::string     port            = "";
+    std::string     file_port       = "";
+    std::size_t     clients         = 100;
+    std::size_t     threads         = 2;
+    double          rate            = 1000.0;   // chat messages/s, all clients
+    std::size_t     min_size        = 32;       // chat body bytes
+    std::size_t     max_size        = 256;
+    double          duration        = 10.0;     // seconds
+    double          file_interval   = 0.0;      // seconds, 0 disables files
+    std::uint64_t   file_size       = 1 << 20;
+    std::size_t     file_streams    = 1;        // transfers in flight
+};
+
+void usage()
+{
+    std::cerr << "Usage: jamim-loadgen <port1> <port2> [--host=127.0.0.1]\n"
+                 "           [--clients=100] [--threads=2] [--rate=1000]\n"
+                 "           [--min-size=32] [--max-size=256] [--duration=10]\n"
+                 "           [--file-interval=0] [--file-size=1048576]\n"
+                 "           [--file-streams=1]\n"
+                 "  --rate          chat messages per second over all clients\n"
+                 "  --min/max-size  chat body size range, uniformly distributed\n"
+                 "  --file-interval seconds between file transfers, 0 disables\n"
+                 "  --file-streams  file transfers in flight at most"
+              << std::endl;
+}
+
+bool parse_args( int argc, char* argv[], Config& config )
+{
+    if( argc < 3 ){
+        return false;
+    }
+    config.port = argv[1];
+    config.file_port = argv[2];
+    for( int i=3; i<argc; ++i ){
+        const std::string arg( argv[i] );
+        const std::string::size_type eq = arg.find( '=' );
+        if( arg.compare( 0, 2, "--" ) != 0 || eq == std::string::npos ){
+            return false;
+        }
+        const std::string key = arg.substr( 2, eq-2 );
+        const char* value = arg.c_str() + eq + 1;
+        if( key == "host" )                 config.host = value;
+        else if( key == "clients" )         config.clients = std::atol( value );
+        else if( key == "threads" )         config.threads = std::atol( value );
+        else if( key == "rate" )            config.rate = std::atof( value );
+        else if( key == "min-size" )        config.min_size = std::atol( value );
+        else if( key == "max-size" )        config.max_size = std::atol( value );
+        else if( key == "duration" )        config.duration = std::atof( value );
+        else if( key == "file-interval" )   config.file_interval = std::atof( value );
+        else if( key == "file-size" )       config.file_size = std::strtoull( value, nullptr, 10 );
+        else if( key == "file-streams" )    config.file_streams = std::atol( value );
+        else return false;
+    }
+    config.clients = std::max<std::size_t>( config.clients, 2 );
+    config.threads = std::max<std::size_t>( config.threads, 1 );
+    config.file_streams = std::max<std::size_t>( config.file_streams, 1 );
+    config.min_size = std::max<std::size_t>( config.min_size, StampLength() );
+    config.max_size = std::max( config.max_size, config.min_size );
+    return true;
+}
+/* ------------------------------------------------------------------------- */
+
+
+/* LatencyHistogram -- log-linear buckets over microseconds, 16 linear
+ * sub-buckets per power of two (about 6% resolution) */
+/* ------------------------------------------------------------------------- */
+class LatencyHistogram
+{
+public:
+    enum { SubBuckets = 16, Powers = 40 };
+
+    LatencyHistogram()
+        : counts_( SubBuckets * Powers, 0 )
+        , total_( 0 )
+        , max_( 0 )
+        { }
+
+    void record( uint64_t us )
+        {
+            ++counts_[ bucket( us ) ];
+            ++total_;
+            max_ = std::max( max_, us );
+        }
+
+    void merge( const LatencyHistogram& other )
+        {
+            for( std::size_t i=0; i<counts_.size(); ++i ){
+                counts_[i] += other.counts_[i];
+            }
+            total_ += other.total_;
+            max_ = std::max( max_, other.max_ );
+        }
+
+    /* upper bound of the bucket holding the q-quantile */
+    uint64_t quantile( double q ) const
+        {
+            if( total_ == 0 ){
+                return 0;
+            }
+            const uint64_t rank = std::max<uint64_t>( 1, std::ceil( q * total_ ) );
+            uint64_t seen = 0;
+            for( std::size_t i=0; i<counts_.size(); ++i ){
+                seen += counts_[i];
+                if( seen >= rank ){
+                    return std::min( upper( i ), max_ );
+                }
+            }
+            return max_;
+        }
+
+    uint64_t count() const
+        { return total_; }
+    uint64_t max() const
+        { return max_; }
+
+private:
+    static std::size_t bucket( uint64_t us )
+        {
+            if( us < SubBuckets ){
+                return us;
+            }
+            int power = 63 - __builtin_clzll( us );         // >= 4
+            const uint64_t sub = (us >> (power - 4)) & (SubBuckets - 1);
+            const std::size_t index = (power - 3) * SubBuckets + sub;
+            return std::min<std::size_t>( index, SubBuckets * Powers - 1 );
+        }
+
+    static uint64_t upper( std::size_t index )
+        {
+            if( index < SubBuckets ){
+                return index;
+            }
+            const int power = index / SubBuckets + 3;
+            const uint64_t sub = index % SubBuckets;
+            return ( (SubBuckets + sub + 1) << (power - 4) ) - 1;
+        }
+
+private:
+    std::vector<uint64_t>   counts_;
+    uint64_t                total_;
+    uint64_t                max_;
+};
+/* ------------------------------------------------------------------------- */
+
+
+/* Totals shared by all simulated clients */
+/* ------------------------------------------------------------------------- */
+struct Totals
+{
+    std::atomic<uint64_t>   sent{0};
+    std::atomic<uint64_t>   sent_bytes{0};
+    std::atomic<uint64_t>   received{0};
+    std::atomic<uint64_t>   received_bytes{0};
+    std::atomic<uint64_t>   file_bytes{0};
+    std::atomic<uint64_t>   files_started{0};
+    std::atomic<uint64_t>   files_done{0};
+    std::atomic<uint64_t>   errors{0};
+};
+
+
+class SimClient;
+typedef std::shared_ptr< SimClient >    ptr_SimClient;
+
+/* FileScheduler -- starts a transfer each interval while fewer than
+ * --file-streams are in flight, round robin over the clients. Transfer
+ * ids are unique within the room, so one counter names them all. */
+/* ------------------------------------------------------------------------- */
+class FileScheduler
+{
+public:
+    FileScheduler( boost::asio::io_service& io_service, const Config& config
+                 , Totals& totals )
+        : timer_( io_service )
+        , config_( config )
+        , totals_( totals )
+        , next_sender_( 0 )
+        , next_id_( 1 )
+        { }
+
+    void start( const std::vector<ptr_SimClient>& clients );
+    void stop()
+        { timer_.cancel(); }
+
+    /* a reader got the whole of transfer `id`, or it was cancelled */
+    void reader_done( uint64_t id, bool complete );
+    /* the readers refused transfer `id` */
+    void refused( uint64_t id );
+
+private:
+    struct Transfer
+    {
+        std::size_t         pending_readers;
+        Clock::time_point   started;
+        bool                failed;
+    };
+
+    void schedule();
+    void handle_timer( const boost::system::error_code& ec );
+
+private:
+    boost::asio::steady_timer       timer_;
+    const Config&                   config_;
+    Totals&                         totals_;
+    std::vector<ptr_SimClient>      clients_;
+    std::size_t                     next_sender_;
+    boost::mutex                    mutex_;
+    uint64_t                        next_id_;
+    std::unordered_map< uint64_t, Transfer >  active_;
+    LatencyHistogram                durations_;
+
+    friend void report( const Config&, const Totals&, const LatencyHistogram&
+                      , const FileScheduler&, double );
+};
+/* ------------------------------------------------------------------------- */
+
+
+/* SimClient -- one simulated user with a chat and a file connection */
+/* ------------------------------------------------------------------------- */
+class SimClient
+    : public std::enable_shared_from_this< SimClient >
+{
+public:
+    enum { FileChunk = 1 << 16 };
+
+    SimClient( boost::asio::io_service& io_service, const Config& config
+             , Totals& totals, FileScheduler& files, std::size_t id )
+        : strand_( io_service )
+        , socket_( io_service )
+        , file_socket_( io_service )
+        , timer_( io_service )
+        , config_( config )
+        , totals_( totals )
+        , files_( files )
+        , random_( id )
+        , size_dist_( config.min_size, config.max_size )
+        , running_( false )
+        , read_header_filled_( 0 )
+        , read_chunk_id_( 0 )
+        , read_chunk_left_( 0 )
+        , file_writing_( false )
+        { }
+
+    /* connect the chat socket, then the file socket; the server pairs
+     * them in accept order */
+    template< typename Handler >
+    void connect( const tcp::endpoint& chat, const tcp::endpoint& file
+                , Handler handler );
+
+    void start( Clock::duration interval );
+    void stop();
+    void send_file( uint64_t id, uint64_t size );
+
+    const LatencyHistogram& latency() const
+        { return latency_; }
+
+private:
+    void do_read();
+    void handle_read( const boost::system::error_code& ec
+                    , std::size_t bytes_transferred );
+    void handle_chat( const MessageView& msg );
+    void handle_file_start( const MessageView& msg );
+    void handle_file_accept( const MessageView& msg );
+    void handle_file_refuse( const MessageView& msg );
+    void handle_file_cancel( const MessageView& msg );
+
+    void schedule_send();
+    void handle_timer( const boost::system::error_code& ec );
+    void write( Message&& msg );
+    void do_write();
+    void handle_write( const boost::system::error_code& ec, std::size_t );
+
+    void do_file_read();
+    void handle_file_read( const boost::system::error_code& ec
+                         , std::size_t bytes_transferred );
+    void read_file_chunk( std::size_t bytes );
+    void do_file_write();
+    void handle_file_write( const boost::system::error_code& ec
+                          , std::size_t bytes_transferred );
+
+    void handle_error( const boost::system::error_code& ec );
+
+private:
+    boost::asio::io_service::strand     strand_;
+    tcp::socket                         socket_;
+    tcp::socket                         file_socket_;
+    boost::asio::steady_timer           timer_;
+    const Config&                       config_;
+    Totals&                             totals_;
+    FileScheduler&                      files_;
+    std::mt19937                        random_;
+    std::uniform_int_distribution<std::size_t>  size_dist_;
+    Clock::duration                     interval_;
+    Clock::time_point                   next_send_;
+    bool                                running_;
+
+    FrameReader                         reader_;
+    MessageView                         read_msg_;
+    std::deque<Message>                 write_queue_;
+    WriteBatch                          write_batch_;
+    LatencyHistogram                    latency_;
+
+    // receiving: stream bytes left per transfer, and the chunk being read
+    std::unordered_map< uint64_t, uint64_t >    file_reads_;
+    std::vector<uint8_t>                file_buf_;
+    std::array< uint8_t, FileChunkHeader::Length >  read_header_;
+    std::size_t                         read_header_filled_;
+    uint64_t                            read_chunk_id_;
+    std::size_t                         read_chunk_left_;
+
+    // sending: offers awaiting an answer, and streams taking turns a
+    // chunk at a time
+    struct FileOut
+    {
+        uint64_t    id;
+        uint64_t    remaining;
+        bool        started;
+    };
+    std::unordered_map< uint64_t, uint64_t >    file_offers_;
+    std::deque< FileOut >               file_outs_;
+    std::vector<uint8_t>                file_out_buf_;
+    bool                                file_writing_;
+};
+
+template< typename Handler >
+void SimClient::connect( const tcp::endpoint& chat, const tcp::endpoint& file
+                       , Handler handler )
+{
+    auto self( shared_from_this() );
+    socket_.async_connect( chat,
+        [this,self,file,handler]( const boost::system::error_code& ec )
+        {
+            if( ec ){
+                handler( ec );
+                return;
+            }
+            socket_.set_option( tcp::no_delay( true ) );
+            file_socket_.async_connect( file,
+                [this,self,handler]( const boost::system::error_code& ec )
+                {
+                    if( !ec ){
+                        strand_.dispatch( boost::bind( &SimClient::do_read, self ) );
+                        strand_.dispatch( boost::bind( &SimClient::do_file_read, self ) );
+                    }
+                    handler( ec );
+                });
+        });
+}
+
+void SimClient::start( Clock::duration interval )
+{
+    auto self( shared_from_this() );
+    strand_.dispatch(
+        [this,self,interval]()
+        {
+            running_ = true;
+            interval_ = interval;
+            // spread the first sends over one interval
+            std::uniform_int_distribution<Clock::rep> offset( 0, interval.count() );
+            next_send_ = Clock::now() + Clock::duration( offset( random_ ) );
+            schedule_send();
+        });
+}
+
+void SimClient::stop()
+{
+    auto self( shared_from_this() );
+    strand_.dispatch(
+        [this,self]()
+        {
+            running_ = false;
+            timer_.cancel();
+        });
+}
+
+void SimClient::send_file( uint64_t id, uint64_t size )
+{
+    auto self( shared_from_this() );
+    strand_.dispatch(
+        [this,self,id,size]()
+        {
+            // the server answers FileAccept/FileRefuse on the chat socket
+            file_offers_[id] = size;
+            write( make_file_message( size, "loadgen.bin", id ) );
+        });
+}
+
+/* chat */
+void SimClient::do_read()
+{
+    socket_.async_read_some( reader_.prepare()
+        , strand_.wrap(
+            boost::bind( &SimClient::handle_read, shared_from_this()
+                       , boost::asio::placeholders::error
+                       , boost::asio::placeholders::bytes_transferred ) ) );
+}
+
+void SimClient::handle_read( const boost::system::error_code& ec
+                           , std::size_t bytes_transferred )
+{
+    if( ec ){
+        handle_error( ec );
+        return;
+    }
+    reader_.commit( bytes_transferred );
+    boost::system::error_code frame_ec;
+    while( reader_.next( read_msg_, frame_ec ) ){
+        switch( read_msg_.msg_type() ){
+            case MessageType::ChatMsg :
+                handle_chat( read_msg_ ); break;
+            case MessageType::FileStart :
+                handle_file_start( read_msg_ ); break;
+            case MessageType::FileAccept :
+                handle_file_accept( read_msg_ ); break;
+            case MessageType::FileRefuse :
+                handle_file_refuse( read_msg_ ); break;
+            case MessageType::FileCancel :
+                handle_file_cancel( read_msg_ ); break;
+            default:
+                break;
+        }
+    }
+    if( frame_ec ){
+        handle_error( frame_ec );
+    }
+    else{
+        do_read();
+    }
+}
+
+void SimClient::handle_chat( const MessageView& msg )
+{
+    uint64_t sent_ns = 0;
+    if( read_stamp( msg, sent_ns ) ){
+        latency_.record( ( now_ns() - sent_ns ) / 1000 );
+        ++totals_.received;
+        totals_.received_bytes += msg.total_length();
+    }
+}
+
+void SimClient::schedule_send()
+{
+    timer_.expires_at( next_send_ );
+    timer_.async_wait( strand_.wrap(
+        boost::bind( &SimClient::handle_timer, shared_from_this()
+                   , boost::asio::placeholders::error ) ) );
+}
+
+void SimClient::handle_timer( const boost::system::error_code& ec )
+{
+    if( ec || !running_ ){
+        return;
+    }
+    // catch up on missed sends so the aggregate rate holds under load
+    const Clock::time_point now = Clock::now();
+    while( next_send_ <= now ){
+        Message msg( MessageType::ChatMsg, size_dist_( random_ ) );
+        std::fill( msg.msg_body(), msg.msg_body() + msg.body_length(), 'x' );
+        write_stamp( msg.msg_body(), now_ns() );
+        ++totals_.sent;
+        totals_.sent_bytes += msg.total_length();
+        write( std::move( msg ) );
+        next_send_ += interval_;
+    }
+    schedule_send();
+}
+
+void SimClient::write( Message&& msg )
+{
+    const bool write_in_progress = !write_queue_.empty();
+    write_queue_.push_back( std::move( msg ) );
+    if( !write_in_progress ){
+        do_write();
+    }
+}
+
+void SimClient::do_write()
+{
+    boost::asio::async_write( socket_
+        , write_batch_.gather( write_queue_ )
+        , strand_.wrap(
+            boost::bind( &SimClient::handle_write, shared_from_this()
+                       , boost::asio::placeholders::error
+                       , boost::asio::placeholders::bytes_transferred ) ) );
+}
+
+void SimClient::handle_write( const boost::system::error_code& ec, std::size_t )
+{
+    if( ec ){
+        handle_error( ec );
+        return;
+    }
+    write_batch_.complete( write_queue_ );
+    if( !write_queue_.empty() ){
+        do_write();
+    }
+}
+
+/* file receiving: accept every offer, never resuming; each stream is the
+ * sender's start offset, the data and its checksums, which are counted
+ * but not checked */
+void SimClient::handle_file_start( const MessageView& msg )
+{
+    const uint64_t id = msg.transfer_id();
+    file_reads_[id] = FileResume::PreambleLength + msg.file_size()
+                    + FileTrailer::length( msg.file_size() );
+    write( make_file_accept( FileResume( id ) ) );
+}
+
+void SimClient::handle_file_cancel( const MessageView& msg )
+{
+    const uint64_t id = file_control_id( msg.msg_body(), msg.body_length() );
+    if( file_reads_.erase( id ) ){
+        files_.reader_done( id, false );
+    }
+    // or the server gave up on one of ours
+    if( file_offers_.erase( id ) ){
+        files_.refused( id );
+    }
+    file_outs_.erase( std::remove_if( file_outs_.begin(), file_outs_.end()
+                                    , [id]( const FileOut& out ){ return out.id == id; } )
+                    , file_outs_.end() );
+}
+
+void SimClient::do_file_read()
+{
+    file_buf_.resize( FileChunk );
+    file_socket_.async_read_some( boost::asio::buffer( file_buf_ )
+        , strand_.wrap(
+            boost::bind( &SimClient::handle_file_read, shared_from_this()
+                       , boost::asio::placeholders::error
+                       , boost::asio::placeholders::bytes_transferred ) ) );
+}
+
+void SimClient::handle_file_read( const boost::system::error_code& ec
+                                , std::size_t bytes_transferred )
+{
+    if( ec ){
+        handle_error( ec );
+        return;
+    }
+    totals_.file_bytes += bytes_transferred;
+    read_file_chunk( bytes_transferred );
+    do_file_read();
+}
+
+/* split what was read into the chunks of the transfers */
+void SimClient::read_file_chunk( std::size_t bytes )
+{
+    const uint8_t* p = file_buf_.data();
+    while( bytes > 0 ){
+        if( read_chunk_left_ == 0 ){
+            const std::size_t take = std::min( bytes
+                                             , read_header_.size() - read_header_filled_ );
+            std::copy( p, p + take, read_header_.begin() + read_header_filled_ );
+            read_header_filled_ += take;
+            p += take;
+            bytes -= take;
+            if( read_header_filled_ == read_header_.size() ){
+                const FileChunkHeader header( file_chunk_header( read_header_.data() ) );
+                read_header_filled_ = 0;
+                read_chunk_id_ = header.transfer_id;
+                read_chunk_left_ = header.length;
+            }
+            continue;
+        }
+        const std::size_t take = std::min( bytes, read_chunk_left_ );
+        read_chunk_left_ -= take;
+        p += take;
+        bytes -= take;
+        auto it = file_reads_.find( read_chunk_id_ );
+        if( it == file_reads_.end() ){
+            continue;       // cancelled
+        }
+        it->second -= std::min<uint64_t>( it->second, take );
+        if( it->second == 0 ){
+            file_reads_.erase( it );
+            write( make_file_control( MessageType::FileDone, read_chunk_id_ ) );
+            files_.reader_done( read_chunk_id_, true );
+        }
+    }
+}
+
+/* file sending */
+void SimClient::handle_file_accept( const MessageView& msg )
+{
+    // no reader offers to resume, so the stream starts at 0
+    const uint64_t id = file_resume( msg.msg_body(), msg.body_length() ).transfer_id;
+    auto it = file_offers_.find( id );
+    if( it == file_offers_.end() ){
+        return;
+    }
+    const uint64_t size = it->second;
+    file_offers_.erase( it );
+    FileOut out;
+    out.id = id;
+    out.remaining = size + FileTrailer::length( size );
+    out.started = false;
+    file_outs_.push_back( out );
+    if( !file_writing_ ){
+        do_file_write();
+    }
+}
+
+void SimClient::handle_file_refuse( const MessageView& msg )
+{
+    const uint64_t id = file_control_id( msg.msg_body(), msg.body_length() );
+    if( file_offers_.erase( id ) ){
+        files_.refused( id );
+    }
+}
+
+/* one chunk of the stream at the front, which then goes to the back: the
+ * zero start offset in a chunk of its own first, then filler for the data
+ * and its checksums */
+void SimClient::do_file_write()
+{
+    if( file_outs_.empty() ){
+        file_writing_ = false;
+        return;
+    }
+    FileOut& out = file_outs_.front();
+    const std::size_t length = out.started
+        ? static_cast<std::size_t>( std::min<uint64_t>( FileChunk, out.remaining ) )
+        : static_cast<std::size_t>( FileResume::PreambleLength );
+    file_out_buf_.assign( FileChunkHeader::Length + length, 0 );
+    put_file_chunk_header( file_out_buf_.data(), FileChunkHeader( out.id, length ) );
+    if( out.started ){
+        out.remaining -= length;
+    }
+    out.started = true;
+    if( out.remaining > 0 ){
+        file_outs_.push_back( out );
+    }
+    file_outs_.pop_front();
+    file_writing_ = true;
+    boost::asio::async_write( file_socket_
+        , boost::asio::buffer( file_out_buf_ )
+        , strand_.wrap(
+            boost::bind( &SimClient::handle_file_write, shared_from_this()
+                       , boost::asio::placeholders::error
+                       , boost::asio::placeholders::bytes_transferred ) ) );
+}
+
+void SimClient::handle_file_write( const boost::system::error_code& ec
+                                 , std::size_t /* bytes_transferred */ )
+{
+    if( ec ){
+        file_writing_ = false;
+        handle_error( ec );
+        return;
+    }
+    do_file_write();
+}
+
+void SimClient::handle_error( const boost::system::error_code& ec )
+{
+    if( running_ && ec != boost::asio::error::operation_aborted ){
+        ++totals_.errors;
+    }
+    running_ = false;
+    boost::system::error_code ignored;
+    timer_.cancel( ignored );
+    socket_.close( ignored );
+    file_socket_.close( ignored );
+}
+/* ------------------------------------------------------------------------- */
+
+
+/* FileScheduler */
+/* ------------------------------------------------------------------------- */
+void FileScheduler::start( const std::vector<ptr_SimClient>& clients )
+{
+    clients_ = clients;
+    if( config_.file_interval > 0 ){
+        schedule();
+    }
+}
+
+void FileScheduler::schedule()
+{
+    timer_.expires_from_now( std::chrono::duration_cast<Clock::duration>(
+                                std::chrono::duration<double>( config_.file_interval ) ) );
+    timer_.async_wait( boost::bind( &FileScheduler::handle_timer, this
+                                  , boost::asio::placeholders::error ) );
+}
+
+void FileScheduler::handle_timer( const boost::system::error_code& ec )
+{
+    if( ec ){
+        return;
+    }
+    ptr_SimClient sender;
+    uint64_t id = 0;
+    {   boost::mutex::scoped_lock lk( mutex_ );
+        if( active_.size() < config_.file_streams ){
+            id = next_id_++;
+            Transfer& transfer = active_[id];
+            transfer.pending_readers = clients_.size() - 1;
+            transfer.started = Clock::now();
+            transfer.failed = false;
+            sender = clients_[ next_sender_++ % clients_.size() ];
+        }
+    }
+    if( sender ){
+        ++totals_.files_started;
+        sender->send_file( id, config_.file_size );
+    }
+    schedule();
+}
+
+void FileScheduler::reader_done( uint64_t id, bool complete )
+{
+    boost::mutex::scoped_lock lk( mutex_ );
+    auto it = active_.find( id );
+    if( it == active_.end() ){
+        return;
+    }
+    Transfer& transfer = it->second;
+    transfer.failed = transfer.failed || !complete;
+    if( --transfer.pending_readers == 0 ){
+        if( !transfer.failed ){
+            ++totals_.files_done;
+            durations_.record( std::chrono::duration_cast<std::chrono::microseconds>(
+                                    Clock::now() - transfer.started ).count() );
+        }
+        active_.erase( it );
+    }
+}
+
+void FileScheduler::refused( uint64_t id )
+{
+    boost::mutex::scoped_lock lk( mutex_ );
+    active_.erase( id );
+}
+/* ------------------------------------------------------------------------- */
+
+
+void report( const Config& config, const Totals& totals
+           , const LatencyHistogram& latency, const FileScheduler& files
+           , double seconds )
+{
+    const double mb = 1024.0 * 1024.0;
+    std::cout << std::fixed << std::setprecision(1)
+        << "clients:          " << config.clients << "\n"
+        << "duration:         " << seconds << " s\n"
+        << "chat sent:        " << totals.sent << " msgs, "
+                                << totals.sent / seconds << " msgs/s, "
+                                << totals.sent_bytes / mb / seconds << " MB/s\n"
+        << "chat delivered:   " << totals.received << " msgs, "
+                                << totals.received / seconds << " msgs/s, "
+                                << totals.received_bytes / mb / seconds << " MB/s\n"
+        << "latency (us):     p50 " << latency.quantile( 0.5 )
+                                << "  p99 " << latency.quantile( 0.99 )
+                                << "  p999 " << latency.quantile( 0.999 )
+                                << "  max " << latency.max() << "\n";
+    if( config.file_interval > 0 ){
+        std::cout
+        << "files:            " << totals.files_done << "/" << totals.files_started
+                                << " completed, "
+                                << totals.file_bytes / mb / seconds << " MB/s received\n"
+        << "file time (ms):   p50 " << files.durations_.quantile( 0.5 ) / 1000
+                                << "  max " << files.durations_.max() / 1000 << "\n";
+    }
+    std::cout << "errors:           " << totals.errors << std::endl;
+}
+
+} // namespace
+
+
+int main( int argc, char* argv[] )
+{
+    Config config;
+    if( !parse_args( argc, argv, config ) ){
+        usage();
+        return 1;
+    }
+
+    try{
+        boost::asio::io_service io_service;
+        std::unique_ptr<boost::asio::io_service::work> work(
+            new boost::asio::io_service::work( io_service ) );
+        boost::thread_group thread_group;
+        for( std::size_t i=0; i<config.threads; ++i ){
+            thread_group.create_thread( [&io_service](){ io_service.run(); } );
+        }
+
+        tcp::resolver resolver( io_service );
+        const tcp::endpoint chat_endpoint = *resolver.resolve( {config.host, config.port} );
+        const tcp::endpoint file_endpoint = *resolver.resolve( {config.host, config.file_port} );
+
+        Totals totals;
+        FileScheduler files( io_service, config, totals );
+        std::vector<ptr_SimClient> clients;
+
+        // connect one client at a time so the server pairs the sockets right
+        for( std::size_t i=0; i<config.clients; ++i ){
+            auto client = std::make_shared<SimClient>( io_service, config, totals, files, i );
+            std::promise<boost::system::error_code> connected;
+            client->connect( chat_endpoint, file_endpoint
+                , [&connected]( const boost::system::error_code& ec )
+                  { connected.set_value( ec ); } );
+            const boost::system::error_code ec = connected.get_future().get();
+            if( ec ){
+                std::cerr << "Connect failed after " << i << " clients: "
+                          << ec.message() << std::endl;
+                return 1;
+            }
+            clients.push_back( client );
+        }
+        // let the server finish joining the last sessions
+        boost::this_thread::sleep( boost::posix_time::milliseconds( 200 ) );
+
+        const auto interval = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>( config.clients / config.rate ) );
+        const Clock::time_point start = Clock::now();
+        for( auto& client : clients ){
+            client->start( interval );
+        }
+        files.start( clients );
+
+        boost::this_thread::sleep( boost::posix_time::milliseconds(
+                                        static_cast<long>( config.duration * 1000 ) ) );
+        for( auto& client : clients ){
+            client->stop();
+        }
+        files.stop();
+        const double seconds = std::chrono::duration<double>( Clock::now() - start ).count();
+        // drain messages still in flight
+        boost::this_thread::sleep( boost::posix_time::milliseconds( 500 ) );
+
+        work.reset();
+        io_service.stop();
+        thread_group.join_all();
+
+        LatencyHistogram latency;
+        for( auto& client : clients ){
+            latency.merge( client->latency() );
+        }
+        report( config, totals, latency, files, seconds );
+    }
+    catch( std::exception& e ){
+        std::cerr << "Exception: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -1,27 +1,70 @@
-#include <cstdlib>
-#include "jamim/Server.hpp"
-#include <boost/asio.hpp>
-#include <boost/date_time/posix_time/posix_time.hpp>
-#include <boost/thread.hpp>
-
-
-using boost::asio::ip::tcp;
-
-int main( int argc, char* argv[] )
-{
-    if( argc < 3 ){
-        std::cerr << "Usage: Server <port1> <port2> " << std::endl;
-        return 1;
-    }
-
-    try{
-    tcp::endpoint endpoint( tcp::v4(), std::atoi(argv[1]) );
-    tcp::endpoint file_endpoint( tcp::v4(), std::atoi(argv[2]) );
-    Server chat_server( endpoint, file_endpoint );
-    boost::this_thread::sleep(boost::posix_time::milliseconds(1000));
-    chat_server.run();
-    }
-    catch( std::exception& e ){
-        std::cerr << "Exception: " << e.what() << std::endl;
-    }
-}
+#include <cstdlib>
+#include <algorithm>
+#include <string>
+#include "jamim/Server.hpp"
+#include <boost/asio.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+
+
+using boost::asio::ip::tcp;
+
+int main( int argc, char* argv[] )
+{
+    if( argc < 3 || argc > 7 ){
+        std::cerr << "Usage: Server <port1> <port2> [threads] [shared|per-core] [file-threads] [copy|splice]\n"
+                  << "  threads       worker threads, defaults to the number of cores\n"
+                  << "  shared        one io_service run by all threads (default)\n"
+                  << "  per-core      one io_service per thread, sessions are spread\n"
+                  << "                over them by load\n"
+                  << "  file-threads  threads relaying file transfers, default 1\n"
+                  << "  copy          relay file data through user space buffers (default)\n"
+                  << "  splice        relay file data socket to socket with splice()/tee()\n"
+                  << "                where supported"
+                  << std::endl;
+        return 1;
+    }
+
+    std::size_t threads = std::max( 1u, boost::thread::hardware_concurrency() );
+    if( argc > 3 ){
+        threads = std::max( 1, std::atoi(argv[3]) );
+    }
+    IoServicePool::Mode mode = IoServicePool::Shared;
+    if( argc > 4 ){
+        if( std::string( argv[4] ) == "per-core" ){
+            mode = IoServicePool::PerCore;
+        }
+        else if( std::string( argv[4] ) != "shared" ){
+            std::cerr << "Unknown execution model " << argv[4] << std::endl;
+            return 1;
+        }
+    }
+
+    std::size_t file_threads = 1;
+    if( argc > 5 ){
+        file_threads = std::max( 1, std::atoi(argv[5]) );
+    }
+
+    ChatSession::RelayMode relay = ChatSession::CopyRelay;
+    if( argc > 6 ){
+        if( std::string( argv[6] ) == "splice" ){
+            relay = ChatSession::SpliceRelay;
+        }
+        else if( std::string( argv[6] ) != "copy" ){
+            std::cerr << "Unknown relay mode " << argv[6] << std::endl;
+            return 1;
+        }
+    }
+
+    try{
+    tcp::endpoint endpoint( tcp::v4(), std::atoi(argv[1]) );
+    tcp::endpoint file_endpoint( tcp::v4(), std::atoi(argv[2]) );
+    Server chat_server( endpoint, file_endpoint, mode, threads, file_threads );
+    chat_server.file_relay( relay );
+    boost::this_thread::sleep(boost::posix_time::milliseconds(1000));
+    chat_server.run();
+    }
+    catch( std::exception& e ){
+        std::cerr << "Exception: " << e.what() << std::endl;
+    }
+}
@@ -1,8 +1,8 @@
-#include <gtest/gtest.h>
-
-
-TEST( ListLibraryTests, Default )
-{
-    EXPECT_EQ( 2, 2 );
-    EXPECT_EQ( 2, 1 );
-}
+#include <gtest/gtest.h>
+
+
+TEST( ListLibraryTests, Default )
+{
+    EXPECT_EQ( 2, 2 );
+    EXPECT_EQ( 2, 1 );
+}